@@ -0,0 +1,80 @@
+
+#ifndef Bench_hpp
+#define Bench_hpp
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+namespace eeng::bench
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    /// @brief Time a function a number of times
+    /// @return Median time in milliseconds
+    template <class F>
+    double timeMs(F &&func, int repetitions = 5)
+    {
+        std::vector<double> times;
+        for (int i = 0; i < repetitions; i++)
+        {
+            const auto start = Clock::now();
+            func();
+            times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+    /// @brief Print a result row
+    inline void report(const std::string &name,
+                       double ms,
+                       const std::string &note = "")
+    {
+        std::printf("  %-48s %12.3f ms  %s\n", name.c_str(), ms, note.c_str());
+    }
+
+    /// @brief Benchmarks, each in its own translation unit
+    void vectorTree();
+    void names();
+    void hierarchy();
+    void bvh();
+    void quadtree();
+    void raycast();
+    void logging();
+    /// Also checks that boxes behind a known occluder are culled and boxes beside it kept, and throws if not
+    void occlusion();
+    /// Also checks that the measured error of each LOD level is within its bound, and throws if not
+    void lods();
+
+    /// @brief Render a scene description headless and write per-phase timings as JSON
+    /// Usage: eeng_bench scene FILE [--json FILE] [--label TEXT] [--frames N]
+    /// @return Exit code
+    int scene(int argc, char *argv[]);
+
+    /// @brief Load models with serial and parallel conversion and print the load phases
+    /// Usage: eeng_bench load FILE [FILE ...] [--repetitions N]
+    /// @return Exit code
+    int load(int argc, char *argv[]);
+
+    /// @brief Load one model and print its load phases and the peak resident memory
+    /// Usage: eeng_bench import FILE [--streaming] [--weld off|exact|quantized]. Run once per mode, since peak memory only grows.
+    /// @return Exit code
+    int importPeak(int argc, char *argv[]);
+
+    /// @brief Skin a character with each CPU backend and with transform feedback
+    /// Usage: eeng_bench skinning [FILE] [--animation FILE] [--repetitions N].
+    /// Defaults to the Amy character. Reports time per vertex and the largest error against scalar.
+    /// @return Exit code
+    int skinning(int argc, char *argv[]);
+
+    /// @brief Create the shader programs of the renderer without a program cache, and with it cold and warm
+    /// Usage: eeng_bench shaders [--repetitions N] [--cache DIR]
+    /// @return Exit code
+    int shaders(int argc, char *argv[]);
+
+} // namespace eeng::bench
+
+#endif /* Bench_hpp */
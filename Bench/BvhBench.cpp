@@ -0,0 +1,282 @@
+
+#include <random>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "DynamicBvh.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        const int NbrInstances = 100000;
+        const float WorldSize = 2000.0f;
+
+        AABB makeBox(const glm::vec3 &center, const glm::vec3 &halfSize)
+        {
+            AABB aabb;
+            aabb.min = center - halfSize;
+            aabb.max = center + halfSize;
+            return aabb;
+        }
+
+        /// Same test as the BVH, so that results can be compared exactly
+        bool isOutsideFrustum(const AABB &aabb, const glm::mat4 &M)
+        {
+            const glm::vec4 row0(M[0][0], M[1][0], M[2][0], M[3][0]);
+            const glm::vec4 row1(M[0][1], M[1][1], M[2][1], M[3][1]);
+            const glm::vec4 row2(M[0][2], M[1][2], M[2][2], M[3][2]);
+            const glm::vec4 row3(M[0][3], M[1][3], M[2][3], M[3][3]);
+            const glm::vec4 planes[6] = {row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2};
+            for (const auto &p : planes)
+            {
+                const float d = p.x * (p.x > 0.0f ? aabb.max.x : aabb.min.x) +
+                                p.y * (p.y > 0.0f ? aabb.max.y : aabb.min.y) +
+                                p.z * (p.z > 0.0f ? aabb.max.z : aabb.min.z) + p.w;
+                if (d < 0.0f)
+                    return true;
+            }
+            return false;
+        }
+
+        float intersectRay(const AABB &aabb, const glm::vec3 &origin, const glm::vec3 &invDirection, float tmax)
+        {
+            float tnear = 0.0f, tfar = tmax;
+            for (int i = 0; i < 3; i++)
+            {
+                float t0 = (aabb.min[i] - origin[i]) * invDirection[i];
+                float t1 = (aabb.max[i] - origin[i]) * invDirection[i];
+                if (t0 > t1)
+                    std::swap(t0, t1);
+                tnear = std::max(tnear, t0);
+                tfar = std::min(tfar, t1);
+            }
+            return tnear <= tfar ? tnear : -1.0f;
+        }
+
+        /// Instances spread over a terrain-like slab, as in a large outdoor scene
+        struct Instances
+        {
+            std::vector<glm::vec3> positions, halfSizes, velocities;
+
+            explicit Instances(std::mt19937 &rng)
+            {
+                std::uniform_real_distribution<float> xz(-0.5f * WorldSize, 0.5f * WorldSize), y(0.0f, 20.0f);
+                std::uniform_real_distribution<float> size(0.5f, 3.0f), speed(-2.0f, 2.0f);
+                for (int i = 0; i < NbrInstances; i++)
+                {
+                    positions.emplace_back(xz(rng), y(rng), xz(rng));
+                    halfSizes.emplace_back(size(rng), size(rng), size(rng));
+                    velocities.emplace_back(speed(rng), 0.0f, speed(rng));
+                }
+            }
+
+            AABB bounds(int i) const
+            {
+                return makeBox(positions[i], halfSizes[i]);
+            }
+
+            /// Move a fraction of the instances one frame
+            void step(float movingFraction, float dt)
+            {
+                const int nbrMoving = (int)(movingFraction * NbrInstances);
+                for (int i = 0; i < nbrMoving; i++)
+                    positions[i] += velocities[i] * dt;
+            }
+        };
+
+        template <class T>
+        std::vector<T> sorted(std::vector<T> v)
+        {
+            std::sort(v.begin(), v.end());
+            return v;
+        }
+    }
+
+    void bvh()
+    {
+        std::mt19937 rng(1234);
+        Instances instances(rng);
+
+        DynamicBvh tree;
+        std::vector<int> proxies;
+        for (int i = 0; i < NbrInstances; i++)
+            proxies.push_back(tree.insert(instances.bounds(i), (uint32_t)i));
+
+        std::printf("  %d instances\n", NbrInstances);
+        const double buildMs = timeMs([&]()
+                                      { tree.build(); });
+        const auto &stats = tree.getStats();
+        report("SAH build", buildMs,
+               std::to_string(stats.nodes) + " nodes, depth " + std::to_string(stats.depth) +
+                   ", SAH cost " + std::to_string(stats.sahCost));
+
+        // Frustum queries from cameras looking over the field
+        {
+            std::vector<glm::mat4> cameras;
+            for (int i = 0; i < 16; i++)
+            {
+                const float angle = i * glm::radians(360.0f / 16);
+                const glm::vec3 eye(0.0f, 30.0f, 0.0f);
+                const glm::vec3 target = eye + glm::vec3(std::cos(angle), -0.2f, std::sin(angle));
+                cameras.push_back(glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 1.0f, 500.0f) *
+                                  glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f)));
+            }
+
+            std::vector<int> result;
+            size_t visible = 0;
+            const double bruteMs = timeMs([&]()
+                                          {
+                visible = 0;
+                for (const auto &ProjView : cameras)
+                    for (int i = 0; i < NbrInstances; i++)
+                        visible += !isOutsideFrustum(instances.bounds(i), ProjView); });
+            const double bvhMs = timeMs([&]()
+                                        {
+                for (const auto &ProjView : cameras)
+                {
+                    result.clear();
+                    tree.queryFrustum(ProjView, result);
+                } });
+
+            for (const auto &ProjView : cameras)
+            {
+                std::vector<int> expected;
+                for (int i = 0; i < NbrInstances; i++)
+                    if (!isOutsideFrustum(instances.bounds(i), ProjView))
+                        expected.push_back(proxies[i]);
+                result.clear();
+                tree.queryFrustum(ProjView, result);
+                if (sorted(result) != sorted(expected))
+                    throw std::runtime_error("Frustum query mismatch");
+            }
+
+            const std::string note = std::to_string(visible / cameras.size()) + " visible per frustum";
+            report("Frustum query, brute force (per frustum)", bruteMs / cameras.size(), note);
+            report("Frustum query, BVH (per frustum)", bvhMs / cameras.size(), "x" + std::to_string(bruteMs / bvhMs));
+        }
+
+        // Proximity queries
+        {
+            std::uniform_real_distribution<float> xz(-0.5f * WorldSize, 0.5f * WorldSize);
+            std::vector<AABB> boxes;
+            for (int i = 0; i < 1000; i++)
+                boxes.push_back(makeBox(glm::vec3(xz(rng), 10.0f, xz(rng)), glm::vec3(20.0f)));
+
+            auto overlaps = [](const AABB &a, const AABB &b)
+            {
+                return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+                       a.min.y <= b.max.y && a.max.y >= b.min.y &&
+                       a.min.z <= b.max.z && a.max.z >= b.min.z;
+            };
+
+            std::vector<int> result;
+            const double bruteMs = timeMs([&]()
+                                          {
+                result.clear();
+                for (const auto &box : boxes)
+                    for (int i = 0; i < NbrInstances; i++)
+                        if (overlaps(box, instances.bounds(i)))
+                            result.push_back(proxies[i]); },
+                                          3);
+            const auto expected = sorted(result);
+            const double bvhMs = timeMs([&]()
+                                        {
+                result.clear();
+                for (const auto &box : boxes)
+                    tree.queryAabb(box, result); });
+            if (sorted(result) != expected)
+                throw std::runtime_error("AABB query mismatch");
+
+            report("AABB query, brute force (per query)", bruteMs / boxes.size());
+            report("AABB query, BVH (per query)", bvhMs / boxes.size(), "x" + std::to_string(bruteMs / bvhMs));
+        }
+
+        // Rays along the field, closest hit against instance boxes
+        {
+            // Brute force is slow, so it only runs the first rays
+            const int nbrRays = 10000, nbrBruteRays = 1000;
+            std::uniform_real_distribution<float> xz(-0.5f * WorldSize, 0.5f * WorldSize), unit(-1.0f, 1.0f);
+            std::vector<glm::vec3> origins, directions;
+            for (int i = 0; i < nbrRays; i++)
+            {
+                origins.emplace_back(xz(rng), 10.0f, xz(rng));
+                directions.push_back(glm::normalize(glm::vec3(unit(rng), 0.1f * unit(rng), unit(rng))));
+            }
+
+            const float tmax = WorldSize;
+            std::vector<float> bruteHits(nbrBruteRays), bvhHits(nbrRays);
+            const double bruteMs = timeMs([&]()
+                                          {
+                for (int r = 0; r < nbrBruteRays; r++)
+                {
+                    const glm::vec3 invDirection = 1.0f / directions[r];
+                    float t = tmax;
+                    for (int i = 0; i < NbrInstances; i++)
+                    {
+                        const float ti = intersectRay(instances.bounds(i), origins[r], invDirection, t);
+                        if (ti >= 0.0f && ti < t)
+                            t = ti;
+                    }
+                    bruteHits[r] = t;
+                } },
+                                          1);
+            const double bvhMs = timeMs([&]()
+                                        {
+                for (int r = 0; r < nbrRays; r++)
+                {
+                    const glm::vec3 invDirection = 1.0f / directions[r];
+                    float t = tmax;
+                    tree.raycast(origins[r], directions[r], t, [&](int proxy, float tcur)
+                                 {
+                        const float ti = intersectRay(tree.getBounds(proxy), origins[r], invDirection, tcur);
+                        return ti >= 0.0f ? ti : tcur; });
+                    bvhHits[r] = t;
+                } });
+            for (int r = 0; r < nbrBruteRays; r++)
+                if (std::abs(bruteHits[r] - bvhHits[r]) > 1e-3f)
+                    throw std::runtime_error("Raycast mismatch");
+
+            report("Raycast, brute force", bruteMs, std::to_string(int(nbrBruteRays / (bruteMs * 1e-3))) + " rays/s");
+            report("Raycast, BVH", bvhMs, std::to_string(int(nbrRays / (bvhMs * 1e-3))) + " rays/s");
+        }
+
+        // Animated instances: refit per frame, and how the tree degrades
+        for (float movingFraction : {0.1f, 1.0f})
+        {
+            Instances moving = instances;
+            DynamicBvh animated;
+            for (int i = 0; i < NbrInstances; i++)
+                animated.insert(moving.bounds(i), (uint32_t)i);
+            animated.build();
+            const float builtCost = animated.getStats().sahCost;
+
+            const int nbrFrames = 600;
+            double refitMs = 0.0;
+            for (int frame = 0; frame < nbrFrames; frame++)
+            {
+                moving.step(movingFraction, 1.0f / 60);
+                const int nbrMoving = (int)(movingFraction * NbrInstances);
+                refitMs += timeMs([&]()
+                                  {
+                    for (int i = 0; i < nbrMoving; i++)
+                        animated.move(i, moving.bounds(i));
+                    animated.refit(); },
+                                  1);
+            }
+            const float refitCost = animated.getStats().sahCost;
+            const double rebuildMs = timeMs([&]()
+                                            { animated.build(); },
+                                            3);
+
+            const std::string name = std::to_string(int(movingFraction * 100)) + "% moving";
+            report("Refit per frame, " + name, refitMs / nbrFrames,
+                   "SAH cost " + std::to_string(builtCost) + " -> " + std::to_string(refitCost) + " after " + std::to_string(nbrFrames) + " frames");
+            report("Rebuild, " + name, rebuildMs, "SAH cost " + std::to_string(animated.getStats().sahCost));
+        }
+    }
+
+} // namespace eeng::bench
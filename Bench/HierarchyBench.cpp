@@ -0,0 +1,136 @@
+
+#include <random>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "VectorTree.h"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        /// Same transform data as the nodes of RenderableMesh
+        struct Node : public TreeNode
+        {
+            std::string name;
+            glm::mat4 pose_tfm{1.0f};
+            glm::mat4 global_tfm{1.0f};
+            bool dirty = true;
+
+            Node() = default;
+            Node(const std::string &name, const glm::mat4 &pose_tfm) : name(name), pose_tfm(pose_tfm) {}
+        };
+
+        void updateNode(VectorTree<Node> &tree, size_t node_index)
+        {
+            auto &node = tree.nodes[node_index];
+            node.global_tfm = node.pose_tfm;
+            if (node.m_parent_ofs)
+                node.global_tfm = tree.nodes[node_index - node.m_parent_ofs].global_tfm * node.global_tfm;
+            node.dirty = false;
+        }
+
+        /// Scene graph where a fraction of the nodes are animated
+        struct SceneGraph
+        {
+            VectorTree<Node> tree;
+            std::vector<size_t> animated;
+
+            SceneGraph(size_t nbrNodes, float animatedFraction, std::mt19937 &rng)
+            {
+                std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+                std::vector<Node> nodes;
+                std::vector<size_t> parents;
+                for (size_t i = 0; i < nbrNodes; i++)
+                {
+                    // Shallow, wide hierarchy, as in a level with many objects
+                    const size_t parent = i ? std::uniform_int_distribution<size_t>(0, (i - 1) / 4)(rng) : EENG_NULL_INDEX;
+                    nodes.emplace_back("node" + std::to_string(i),
+                                       glm::translate(glm::mat4{1.0f}, glm::vec3(offset(rng), offset(rng), offset(rng))));
+                    parents.push_back(parent);
+                }
+                if (!tree.build(std::move(nodes), parents))
+                    throw std::runtime_error("Build failed");
+
+                // The root is kept static, or everything would move
+                for (size_t i = 1; i < nbrNodes; i++)
+                    if (std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) < animatedFraction)
+                        animated.push_back(i);
+            }
+
+            /// Set the pose of a frame
+            void pose(int frame)
+            {
+                for (size_t i : animated)
+                {
+                    auto &node = tree.nodes[i];
+                    node.pose_tfm = glm::rotate(node.pose_tfm, 0.01f * (frame % 7 + 1), glm::vec3(0.0f, 1.0f, 0.0f));
+                    node.dirty = true;
+                }
+            }
+
+            size_t updateAll()
+            {
+                for (size_t i = 0; i < tree.nodes.size(); i++)
+                    updateNode(tree, i);
+                return tree.nodes.size();
+            }
+
+            size_t updateDirty()
+            {
+                return tree.traverse_dirty_branches([](const Node &node)
+                                                    { return node.dirty; },
+                                                    [&](size_t i)
+                                                    { updateNode(tree, i); });
+            }
+        };
+    }
+
+    void hierarchy()
+    {
+        const size_t nbrNodes = 10000;
+        const int nbrFrames = 100;
+
+        for (float fraction : {0.0f, 0.01f, 0.1f, 1.0f})
+        {
+            std::mt19937 rng(1234);
+            SceneGraph full(nbrNodes, fraction, rng);
+            rng.seed(1234);
+            SceneGraph incremental(nbrNodes, fraction, rng);
+            std::printf(" %zu nodes, %zu animated\n", nbrNodes, full.animated.size());
+
+            // First evaluation
+            full.updateAll();
+            incremental.updateDirty();
+
+            size_t fullUpdated = 0, incrementalUpdated = 0;
+            const double fullMs = timeMs([&]()
+                                         {
+                for (int frame = 0; frame < nbrFrames; frame++)
+                {
+                    full.pose(frame);
+                    fullUpdated += full.updateAll();
+                } }, 1);
+            const double incrementalMs = timeMs([&]()
+                                                {
+                for (int frame = 0; frame < nbrFrames; frame++)
+                {
+                    incremental.pose(frame);
+                    incrementalUpdated += incremental.updateDirty();
+                } }, 1);
+
+            for (size_t i = 0; i < nbrNodes; i++)
+                if (full.tree.nodes[i].global_tfm != incremental.tree.nodes[i].global_tfm)
+                    throw std::runtime_error("Incremental update differs from full update");
+
+            report("full update x" + std::to_string(nbrFrames), fullMs,
+                   std::to_string(fullUpdated / nbrFrames) + " nodes/frame");
+            report("incremental update x" + std::to_string(nbrFrames), incrementalMs,
+                   std::to_string(incrementalUpdated / nbrFrames) + " nodes/frame");
+        }
+    }
+
+} // namespace eeng::bench
@@ -0,0 +1,209 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "glcommon.h"
+#include "HeadlessContext.hpp"
+#include "ThreadPool.hpp"
+#include "RenderableMesh.hpp"
+#include "ProcessMemory.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        struct Options
+        {
+            std::vector<std::string> files;
+            int repetitions = 5;
+            bool streaming = false;
+            VertexWelding welding = VertexWelding::Exact;
+        };
+
+        Options parseOptions(int argc, char *argv[])
+        {
+            Options options;
+            for (int i = 0; i < argc; i++)
+            {
+                if (!std::strcmp(argv[i], "--repetitions"))
+                {
+                    if (i + 1 >= argc)
+                        throw std::runtime_error("Missing value for --repetitions");
+                    options.repetitions = std::max(1, std::atoi(argv[++i]));
+                }
+                else if (!std::strcmp(argv[i], "--streaming"))
+                    options.streaming = true;
+                else if (!std::strcmp(argv[i], "--weld"))
+                {
+                    if (i + 1 >= argc)
+                        throw std::runtime_error("Missing value for --weld");
+                    const std::string mode = argv[++i];
+                    if (mode == "off")
+                        options.welding = VertexWelding::Off;
+                    else if (mode == "exact")
+                        options.welding = VertexWelding::Exact;
+                    else if (mode == "quantized")
+                        options.welding = VertexWelding::Quantized;
+                    else
+                        throw std::runtime_error("Unknown --weld mode " + mode);
+                }
+                else if (argv[i][0] != '-')
+                    options.files.push_back(argv[i]);
+                else
+                    throw std::runtime_error(std::string("Unknown argument ") + argv[i]);
+            }
+            if (options.files.empty())
+                throw std::runtime_error("No model files given");
+            return options;
+        }
+
+        double median(std::vector<double> samples)
+        {
+            std::sort(samples.begin(), samples.end());
+            return samples[samples.size() / 2];
+        }
+
+        /// Phase times of repeated loads
+        struct LoadTimes
+        {
+            std::vector<double> total, convert, bounds;
+
+            void add(const RenderableMesh::LoadStats &stats)
+            {
+                total.push_back(stats.total_ms);
+                convert.push_back(stats.convert_ms);
+                bounds.push_back(stats.bounds_ms);
+            }
+        };
+
+        std::string speedup(const std::vector<double> &serialMs, const std::vector<double> &parallelMs)
+        {
+            char text[32];
+            std::snprintf(text, sizeof(text), "%.2fx", median(serialMs) / std::max(median(parallelMs), 1e-6));
+            return text;
+        }
+
+        double toMB(size_t bytes)
+        {
+            return bytes / (1024.0 * 1024.0);
+        }
+
+        bool sameAabb(const AABB &a, const AABB &b)
+        {
+            return a.min == b.min && a.max == b.max;
+        }
+
+        /// Serial and parallel loads must give the same bones, skin data and bounds
+        void checkSame(const RenderableMesh &serial, const RenderableMesh &parallel)
+        {
+            bool same = serial.m_bones.size() == parallel.m_bones.size() &&
+                        serial.m_bonehash == parallel.m_bonehash &&
+                        serial.m_bind_positions == parallel.m_bind_positions &&
+                        serial.m_indices == parallel.m_indices &&
+                        serial.m_bind_skindata.size() == parallel.m_bind_skindata.size();
+            for (size_t i = 0; same && i < serial.m_bind_skindata.size(); i++)
+                same = !std::memcmp(&serial.m_bind_skindata[i], &parallel.m_bind_skindata[i], sizeof(RenderableMesh::SkinData));
+            for (size_t i = 0; same && i < serial.m_bone_aabbs_bind.size(); i++)
+                same = sameAabb(serial.m_bone_aabbs_bind[i], parallel.m_bone_aabbs_bind[i]);
+            for (size_t i = 0; same && i < serial.m_mesh_aabbs_bind.size(); i++)
+                same = sameAabb(serial.m_mesh_aabbs_bind[i], parallel.m_mesh_aabbs_bind[i]);
+            if (!same)
+                throw std::runtime_error("Serial and parallel loads differ");
+        }
+    }
+
+    int load(int argc, char *argv[])
+    {
+        const Options options = parseOptions(argc, argv);
+
+        // Textures and buffers are created while loading, so a context is needed
+        HeadlessContext context(64, 64);
+
+        // Threads are created once, so that their creation is not timed
+        auto threadPool = std::make_shared<ThreadPool>();
+        std::printf("Loading with 1 and %u threads, median of %i loads\n",
+                    threadPool->getNbrThreads() + 1,
+                    options.repetitions);
+
+        for (const auto &file : options.files)
+        {
+            std::printf("[%s]\n", file.c_str());
+
+            LoadTimes serialTimes, parallelTimes;
+            RenderableMesh::LoadStats stats;
+            for (int i = 0; i < options.repetitions; i++)
+            {
+                // Interleaved, so that caches and clocks affect both alike
+                RenderableMesh serial;
+                serial.setParallelLoading(false);
+                serial.load(file, false);
+                serialTimes.add(serial.getLoadStats());
+
+                RenderableMesh parallel;
+                parallel.setLoadThreadPool(threadPool);
+                parallel.load(file, false);
+                parallelTimes.add(parallel.getLoadStats());
+                stats = parallel.getLoadStats();
+
+                if (!i)
+                    checkSame(serial, parallel);
+            }
+
+            const std::string note = std::to_string(stats.nbr_meshes) + " meshes, " +
+                                     std::to_string(stats.nbr_vertices) + " vertices, " +
+                                     std::to_string(stats.nbr_triangles) + " triangles";
+            report("import (assimp)", stats.import_ms, note);
+            report("convert submeshes, serial", median(serialTimes.convert));
+            report("convert submeshes, parallel", median(parallelTimes.convert), speedup(serialTimes.convert, parallelTimes.convert));
+            report("bind AABBs, serial", median(serialTimes.bounds));
+            report("bind AABBs, parallel", median(parallelTimes.bounds), speedup(serialTimes.bounds, parallelTimes.bounds));
+            report("load in total, serial", median(serialTimes.total));
+            report("load in total, parallel", median(parallelTimes.total), speedup(serialTimes.total, parallelTimes.total));
+        }
+        return 0;
+    }
+
+    int importPeak(int argc, char *argv[])
+    {
+        const Options options = parseOptions(argc, argv);
+        if (options.files.size() != 1)
+            throw std::runtime_error("Give one model file, since peak memory only grows");
+
+        HeadlessContext context(64, 64);
+        const size_t peakBefore = getPeakResidentBytes();
+
+        RenderableMesh mesh;
+        mesh.setStreamingImport(options.streaming);
+        mesh.setVertexWelding(options.welding);
+        mesh.load(options.files.front(), false);
+
+        const auto &stats = mesh.getLoadStats();
+        char note[128];
+        std::snprintf(note, sizeof(note), "%u meshes, %u vertices, %u batches",
+                      stats.nbr_meshes,
+                      stats.nbr_vertices,
+                      stats.nbr_batches);
+        std::printf("[%s, %s import]\n", options.files.front().c_str(), options.streaming ? "streaming" : "in-memory");
+        report("import (assimp)", stats.import_ms);
+        report("convert and stream submeshes", stats.convert_ms, note);
+        report("upload", stats.upload_ms);
+        report("load in total", stats.total_ms);
+        std::printf("  peak resident memory %.1f MB before loading, %.1f MB after (+%.1f MB)\n",
+                    toMB(peakBefore),
+                    toMB(stats.peak_rss),
+                    toMB(stats.peak_rss - std::min(stats.peak_rss, peakBefore)));
+        std::printf("  vertices %u imported, %u kept; vertex buffers %.1f MB imported, %.1f MB uploaded\n",
+                    stats.nbr_imported_vertices,
+                    stats.nbr_vertices,
+                    toMB(stats.imported_vertex_bytes),
+                    toMB(stats.vertex_bytes));
+        return 0;
+    }
+
+} // namespace eeng::bench
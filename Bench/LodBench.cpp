@@ -0,0 +1,127 @@
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include "AABB.h"
+#include "MeshSimplifier.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        /// Indexed triangle list
+        struct Mesh
+        {
+            std::vector<glm::vec3> positions;
+            std::vector<unsigned> indices;
+        };
+
+        /// Rolling heightfield, with an open border
+        Mesh makeTerrain(int resolution, float size)
+        {
+            Mesh mesh;
+            for (int j = 0; j <= resolution; j++)
+                for (int i = 0; i <= resolution; i++)
+                {
+                    const float x = i * size / resolution, z = j * size / resolution;
+                    const float y = 10.0f * std::sin(0.05f * x) * std::cos(0.07f * z) + 2.0f * std::sin(0.3f * x + 0.2f * z);
+                    mesh.positions.push_back({x - 0.5f * size, y, z - 0.5f * size});
+                }
+            auto vertex = [&](int i, int j)
+            { return (unsigned)(j * (resolution + 1) + i); };
+            for (int j = 0; j < resolution; j++)
+                for (int i = 0; i < resolution; i++)
+                    mesh.indices.insert(mesh.indices.end(), {vertex(i, j), vertex(i, j + 1), vertex(i + 1, j + 1),
+                                                             vertex(i, j), vertex(i + 1, j + 1), vertex(i + 1, j)});
+            return mesh;
+        }
+
+        /// Bumpy sphere of unit size, closed except for a seam of duplicated vertices
+        Mesh makeBlob(int rings, int segments)
+        {
+            Mesh mesh;
+            mesh.positions.push_back({0.0f, 1.0f, 0.0f});
+            mesh.positions.push_back({0.0f, -1.0f, 0.0f});
+            for (int ring = 1; ring < rings; ring++)
+                for (int segment = 0; segment <= segments; segment++)
+                {
+                    const float theta = glm::pi<float>() * ring / rings;
+                    const float phi = 2.0f * glm::pi<float>() * segment / segments;
+                    const float r = 1.0f + 0.05f * std::sin(7.0f * theta) * std::sin(5.0f * phi);
+                    mesh.positions.push_back(r * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+                }
+            auto vertex = [&](int ring, int segment)
+            {
+                if (!ring)
+                    return 0u;
+                if (ring == rings)
+                    return 1u;
+                return (unsigned)(2 + (ring - 1) * (segments + 1) + segment);
+            };
+            for (int ring = 0; ring < rings; ring++)
+                for (int segment = 0; segment < segments; segment++)
+                {
+                    if (ring)
+                        mesh.indices.insert(mesh.indices.end(), {vertex(ring, segment), vertex(ring, segment + 1), vertex(ring + 1, segment + 1)});
+                    if (ring < rings - 1)
+                        mesh.indices.insert(mesh.indices.end(), {vertex(ring, segment), vertex(ring + 1, segment + 1), vertex(ring + 1, segment)});
+                }
+            return mesh;
+        }
+
+        /// Simplify as when LODs are generated while loading, and check the
+        /// measured deviation of each level against its error bound
+        void check(const std::string &name, const Mesh &mesh)
+        {
+            AABB aabb;
+            for (const auto &p : mesh.positions)
+                aabb.grow(p);
+            const float size = glm::length(aabb.max - aabb.min);
+            const std::vector<float> maxErrors{0.005f * size, 0.01f * size, 0.02f * size};
+
+            std::vector<MeshSimplifier::Level> levels;
+            const double ms = timeMs([&]()
+                                     { levels = MeshSimplifier::simplifyLevels(mesh.positions.data(),
+                                                                               (unsigned)mesh.positions.size(),
+                                                                               mesh.indices.data(),
+                                                                               (unsigned)mesh.indices.size(),
+                                                                               maxErrors); });
+            if (levels.empty())
+                throw std::runtime_error(name + ": no levels generated");
+
+            std::string note = std::to_string(mesh.indices.size() / 3);
+            for (unsigned i = 0; i < levels.size(); i++)
+            {
+                const auto &level = levels[i];
+                const float deviation = MeshSimplifier::measureDeviation(mesh.positions.data(),
+                                                                         mesh.indices.data(),
+                                                                         (unsigned)mesh.indices.size(),
+                                                                         level.indices.data(),
+                                                                         (unsigned)level.indices.size());
+                // Slack for float rounding only
+                if (deviation > level.error + 1e-5f * size)
+                {
+                    char text[128];
+                    std::snprintf(text, sizeof(text), "%s: LOD %u measured error %g exceeds bound %g", name.c_str(), i + 1, deviation, level.error);
+                    throw std::runtime_error(text);
+                }
+                char text[64];
+                std::snprintf(text, sizeof(text), ", %zu (%.3g <= %.3g)", level.indices.size() / 3, deviation, level.error);
+                note += text;
+            }
+            report("simplify " + name, ms, "triangles " + note);
+        }
+    }
+
+    void lods()
+    {
+        check("terrain", makeTerrain(64, 100.0f));
+        check("blob", makeBlob(48, 64));
+    }
+
+} // namespace eeng::bench
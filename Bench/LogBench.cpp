@@ -0,0 +1,139 @@
+
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include "Log.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        const char *LogFileName = "eeng_bench_log.txt";
+        const int CallsPerThread = 20000;
+        const int BurstCallsPerThread = 500; // 8 threads of records fit the queue
+
+        /// Run a function on a number of threads, started together
+        /// @return Wall time in milliseconds
+        double runThreads(int nbrThreads, const std::function<void(int thread)> &func)
+        {
+            std::atomic<bool> go{false};
+            std::vector<std::thread> threads;
+            for (int i = 0; i < nbrThreads; i++)
+                threads.emplace_back([&, i]()
+                                     {
+                                         while (!go.load(std::memory_order_acquire))
+                                             std::this_thread::yield();
+                                         func(i); });
+            const auto start = Clock::now();
+            go.store(true, std::memory_order_release);
+            for (auto &thread : threads)
+                thread.join();
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        }
+
+        std::string nsPerCall(double ms, int calls)
+        {
+            char note[64];
+            std::snprintf(note, sizeof(note), "%.1f ns/call", ms * 1e6 / calls);
+            return note;
+        }
+    }
+
+    void logging()
+    {
+        const std::string name = "entity_name";
+
+        // Calls below the active priority
+        {
+            const int nbrCalls = 10000000;
+            Log::setPriority(Log::Info);
+            const double ms = timeMs([&]()
+                                     {
+                                         for (int i = 0; i < nbrCalls; i++)
+                                             EENG_LOG(Log::Verbose, "Frame %i, entity %s, time %.3f ms", i, name, i * 0.5); });
+            report("Inactive priority, 1 thread", ms, nsPerCall(ms, nbrCalls));
+            Log::setPriority(Log::Verbose);
+        }
+
+        // Enabled calls in bursts that fit the queue, i.e. the cost on the
+        // calling threads while the log thread keeps up
+        const int nbrThreads[] = {1, 2, 4, 8};
+        for (int threads : nbrThreads)
+        {
+            LogFile file(LogFileName, Log::Verbose);
+            const int channel = file.getChannel();
+            std::vector<double> times;
+            for (int rep = 0; rep < 5; rep++)
+            {
+                Log::flush();
+                times.push_back(runThreads(threads, [&](int thread)
+                                           {
+                                               for (int i = 0; i < BurstCallsPerThread; i++)
+                                                   EENG_LOG_TO(channel, Log::Info, "Frame %i, entity %s, time %.3f ms, thread %i", i, name, i * 0.5, thread); }));
+            }
+            std::sort(times.begin(), times.end());
+            const double ms = times[times.size() / 2];
+            report("Log queue burst, " + std::to_string(threads) + " threads (per thread)",
+                   ms,
+                   nsPerCall(ms, BurstCallsPerThread) + ", wall time");
+        }
+        Log::flush();
+
+        // Sustained calls to a file. Producer times include waits for the log
+        // thread once the queue is full, flush times include formatting.
+        for (int threads : nbrThreads)
+        {
+            double producerMs = 0.0, flushedMs = 0.0;
+            uint64_t fullWaits = 0;
+            {
+                LogFile file(LogFileName, Log::Verbose);
+                const int channel = file.getChannel();
+                Log::flush();
+                const auto before = Log::getStats();
+                const auto start = Clock::now();
+                producerMs = runThreads(threads, [&](int thread)
+                                        {
+                                            for (int i = 0; i < CallsPerThread; i++)
+                                                EENG_LOG_TO(channel, Log::Info, "Frame %i, entity %s, time %.3f ms, thread %i", i, name, i * 0.5, thread); });
+                Log::flush();
+                flushedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                fullWaits = Log::getStats().fullWaits - before.fullWaits;
+            }
+            Log::flush(); // Closed
+            report("Log queue, " + std::to_string(threads) + " threads (per thread)",
+                   producerMs,
+                   nsPerCall(producerMs, CallsPerThread) + ", " + std::to_string(fullWaits) + " full waits");
+            report("  written", flushedMs, nsPerCall(flushedMs, CallsPerThread * threads) + " throughput");
+
+            // Formatting and writing on the calling thread, synchronized, as
+            // logged before the queue
+            std::FILE *file = std::fopen(LogFileName, "w");
+            if (!file)
+                throw std::runtime_error(std::string("Failed to open ") + LogFileName);
+            std::mutex mutex;
+            const double syncMs = runThreads(threads, [&](int thread)
+                                             {
+                                                 char line[256];
+                                                 for (int i = 0; i < CallsPerThread; i++)
+                                                 {
+                                                     const int length = std::snprintf(line, sizeof(line), "Frame %i, entity %s, time %.3f ms, thread %i\n", i, name.c_str(), i * 0.5, thread);
+                                                     std::lock_guard lock(mutex);
+                                                     std::fwrite(line, 1, length, file);
+                                                 } });
+            std::fclose(file);
+            report("Synchronous, " + std::to_string(threads) + " threads (per thread)",
+                   syncMs,
+                   nsPerCall(syncMs, CallsPerThread) + ", x" + std::to_string(syncMs / producerMs));
+        }
+        std::remove(LogFileName);
+    }
+
+} // namespace eeng::bench
@@ -0,0 +1,139 @@
+
+#include <fstream>
+#include <utility>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include "StringId.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        /// Names as met when loading a model
+        struct ModelNames
+        {
+            std::vector<const char *> nodes;    // Hierarchy, in pre-order
+            std::vector<const char *> bones;    // Per mesh, with repetitions
+            std::vector<const char *> channels; // Animation channels
+        };
+
+        void collectNodes(const aiNode *node, ModelNames &names)
+        {
+            names.nodes.push_back(node->mName.C_Str());
+            for (unsigned i = 0; i < node->mNumChildren; i++)
+                collectNodes(node->mChildren[i], names);
+        }
+
+        ModelNames collectNames(const aiScene *scene)
+        {
+            ModelNames names;
+            collectNodes(scene->mRootNode, names);
+            for (unsigned i = 0; i < scene->mNumMeshes; i++)
+                for (unsigned j = 0; j < scene->mMeshes[i]->mNumBones; j++)
+                    names.bones.push_back(scene->mMeshes[i]->mBones[j]->mName.C_Str());
+            for (unsigned i = 0; i < scene->mNumAnimations; i++)
+                for (unsigned j = 0; j < scene->mAnimations[i]->mNumChannels; j++)
+                    names.channels.push_back(scene->mAnimations[i]->mChannels[j]->mNodeName.C_Str());
+            return names;
+        }
+
+        /// Name handling of RenderableMesh loading: node names, node and bone
+        /// hashes, and node lookups per animation channel
+        /// @return Number of unique bones and number of channels matched to nodes
+        template <class Name>
+        std::pair<size_t, size_t> loadNames(const ModelNames &names)
+        {
+            std::vector<Name> nodes;
+            std::unordered_map<Name, unsigned> nodehash, bonehash;
+            for (auto name : names.nodes)
+                nodes.emplace_back(name);
+            for (unsigned i = 0; i < nodes.size(); i++)
+                nodehash[nodes[i]] = i;
+            for (auto name : names.bones)
+            {
+                Name bone(name);
+                if (bonehash.find(bone) == bonehash.end())
+                    bonehash[bone] = (unsigned)bonehash.size();
+            }
+
+            size_t found = 0;
+            for (auto name : names.channels)
+                found += nodehash.count(Name(name));
+            return {bonehash.size(), found};
+        }
+
+        /// Bytes held per name by node names and the two hashes
+        size_t stringBytes(const ModelNames &names)
+        {
+            auto bytes = [](const char *name)
+            {
+                const std::string str(name);
+                // Heap storage for strings that do not fit the small string buffer
+                return sizeof(std::string) + (str.capacity() > std::string().capacity() ? str.capacity() + 1 : 0);
+            };
+            size_t total = 0;
+            for (auto name : names.nodes)
+                total += 2 * bytes(name); // Node + node hash key
+            std::unordered_map<std::string, int> bones;
+            for (auto name : names.bones)
+                bones.emplace(name, 0);
+            for (auto &bone : bones)
+                total += bytes(bone.first.c_str());
+            return total;
+        }
+    }
+
+    void names()
+    {
+        const char *files[] = {
+            "assets/Amy/Ch46_nonPBR.fbx",
+            "assets/Amy/walking.fbx",
+            "assets/tarisland-dragon-high-poly/M_B_44_Qishilong_skin_Skeleton.FBX"};
+
+        for (auto file : files)
+        {
+            if (!std::ifstream(file))
+            {
+                std::printf(" %s: not found, skipped\n", file);
+                continue;
+            }
+
+            Assimp::Importer importer;
+            const aiScene *scene = importer.ReadFile(file, 0);
+            if (!scene)
+                throw std::runtime_error(importer.GetErrorString());
+            const auto names = collectNames(scene);
+            std::printf(" %s: %zu nodes, %zu bone references, %zu channels\n",
+                        file, names.nodes.size(), names.bones.size(), names.channels.size());
+
+            const int repetitions = 100;
+            std::pair<size_t, size_t> stringResult, idResult;
+            const double stringMs = timeMs([&]()
+                                           {
+                for (int i = 0; i < repetitions; i++)
+                    stringResult = loadNames<std::string>(names); });
+            const double idMs = timeMs([&]()
+                                       {
+                for (int i = 0; i < repetitions; i++)
+                    idResult = loadNames<StringId>(names); });
+            if (stringResult != idResult)
+                throw std::runtime_error("Name lookup mismatch");
+
+            const size_t idBytes = (2 * names.nodes.size() + stringResult.first) * sizeof(StringId);
+
+            report("std::string names x" + std::to_string(repetitions), stringMs,
+                   std::to_string(stringBytes(names)) + " bytes");
+            report("StringId names x" + std::to_string(repetitions), idMs,
+                   std::to_string(idBytes) + " bytes + shared table");
+        }
+
+        const auto stats = StringId::getStats();
+        std::printf(" String table: %zu strings, %zu bytes\n", stats.nbrStrings, stats.nbrBytes);
+    }
+
+} // namespace eeng::bench
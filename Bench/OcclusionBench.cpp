@@ -0,0 +1,71 @@
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "OcclusionCuller.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        AABB makeBox(const glm::vec3 &center, const glm::vec3 &halfSize)
+        {
+            AABB aabb;
+            aabb.min = center - halfSize;
+            aabb.max = center + halfSize;
+            return aabb;
+        }
+
+        void expect(bool condition, const std::string &what)
+        {
+            if (!condition)
+                throw std::runtime_error(what);
+        }
+    }
+
+    void occlusion()
+    {
+        // Camera at the origin looking down -z, and a 10 x 10 wall at z = -10
+        const glm::mat4 P = glm::perspective(glm::radians(60.0f), 2.0f, 1.0f, 500.0f);
+        const glm::mat4 ProjViewMatrix = P * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        const glm::vec3 wall[] = {{-5.0f, -5.0f, -10.0f}, {5.0f, -5.0f, -10.0f}, {5.0f, 5.0f, -10.0f}, {-5.0f, 5.0f, -10.0f}};
+        const unsigned wallIndices[] = {0, 1, 2, 0, 2, 3};
+
+        OcclusionCuller culler;
+        const double rasterMs = timeMs([&]()
+                                       {
+            culler.begin(ProjViewMatrix);
+            culler.rasterize(wall, 4, wallIndices, 6, glm::mat4{1.0f});
+            culler.end(); },
+                                       100);
+
+        const glm::mat4 I{1.0f};
+        const glm::vec3 halfSize{1.0f};
+        expect(!culler.isVisible(makeBox({0.0f, 0.0f, -20.0f}, halfSize), I), "Box behind the occluder is not culled");
+        expect(!culler.isVisible(makeBox({1.0f, 0.0f, -30.0f}, {2.0f, 2.0f, 2.0f}), I), "Box behind the occluder is not culled");
+        expect(culler.isVisible(makeBox({15.0f, 0.0f, -20.0f}, halfSize), I), "Box beside the occluder is culled");
+        expect(culler.isVisible(makeBox({0.0f, 0.0f, -5.0f}, halfSize), I), "Box in front of the occluder is culled");
+        expect(culler.isVisible(makeBox({10.0f, 0.0f, -20.0f}, halfSize), I), "Box partly behind the occluder is culled");
+        expect(culler.isVisible(makeBox({0.0f, 0.0f, -10.5f}, halfSize), I), "Box intersecting the occluder is culled");
+        expect(!culler.isVisible(makeBox({100.0f, 0.0f, -20.0f}, halfSize), I), "Box outside the frustum is not culled");
+
+        // Boxes on a line through the wall and beyond its edge
+        std::vector<AABB> boxes;
+        for (int i = 0; i < 1000; i++)
+            boxes.push_back(makeBox({-20.0f + 0.04f * i, 0.0f, -20.0f}, halfSize));
+        int visible = 0;
+        const double testMs = timeMs([&]()
+                                     {
+            visible = 0;
+            for (const auto &box : boxes)
+                visible += culler.isVisible(box, I); },
+                                     100);
+
+        report("rasterize occluder and build Hi-Z", rasterMs, std::to_string(culler.getWidth()) + " x " + std::to_string(culler.getHeight()));
+        report("test 1000 boxes", testMs, std::to_string(visible) + " visible, expected results checked");
+    }
+
+} // namespace eeng::bench
@@ -0,0 +1,250 @@
+
+#include <random>
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "LooseQuadtree.hpp"
+#include "DynamicBvh.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        const int NbrInstances = 200000;
+        const int NbrKeys = 8;
+        const float WorldSize = 4000.0f;
+
+        /// Same test as the quadtree, so that results can be compared exactly
+        bool isOutsideFrustum(const AABB &aabb, const glm::vec4 planes[6])
+        {
+            for (int i = 0; i < 6; i++)
+            {
+                const auto &p = planes[i];
+                const float d = p.x * (p.x > 0.0f ? aabb.max.x : aabb.min.x) +
+                                p.y * (p.y > 0.0f ? aabb.max.y : aabb.min.y) +
+                                p.z * (p.z > 0.0f ? aabb.max.z : aabb.min.z) + p.w;
+                if (d < 0.0f)
+                    return true;
+            }
+            return false;
+        }
+
+        void extractPlanes(const glm::mat4 &M, glm::vec4 planes[6])
+        {
+            const glm::vec4 row0(M[0][0], M[1][0], M[2][0], M[3][0]);
+            const glm::vec4 row1(M[0][1], M[1][1], M[2][1], M[3][1]);
+            const glm::vec4 row2(M[0][2], M[1][2], M[2][2], M[3][2]);
+            const glm::vec4 row3(M[0][3], M[1][3], M[2][3], M[3][3]);
+            planes[0] = row3 + row0;
+            planes[1] = row3 - row0;
+            planes[2] = row3 + row1;
+            planes[3] = row3 - row1;
+            planes[4] = row3 + row2;
+            planes[5] = row3 - row2;
+        }
+
+        bool isWithinRadius(const AABB &aabb, const glm::vec3 &center, float radius)
+        {
+            const glm::vec3 d = glm::clamp(center, aabb.min, aabb.max) - center;
+            return glm::dot(d, d) <= radius * radius;
+        }
+
+        /// Grass tufts, bushes and trees of a few kinds, as the submeshes of a field
+        struct Field
+        {
+            std::vector<AABB> bounds;
+            std::vector<uint32_t> keys;
+
+            explicit Field(std::mt19937 &rng)
+            {
+                std::uniform_real_distribution<float> xz(-0.5f * WorldSize, 0.5f * WorldSize), unit(0.0f, 1.0f);
+                std::uniform_int_distribution<uint32_t> key(0, NbrKeys - 1);
+                for (int i = 0; i < NbrInstances; i++)
+                {
+                    // Mostly small instances, some trees
+                    const float size = unit(rng) < 0.9f ? 0.5f + 2.0f * unit(rng) : 5.0f + 20.0f * unit(rng);
+                    const glm::vec3 base(xz(rng), 0.0f, xz(rng));
+                    AABB aabb;
+                    aabb.min = base - glm::vec3(0.5f * size, 0.0f, 0.5f * size);
+                    aabb.max = base + glm::vec3(0.5f * size, size, 0.5f * size);
+                    bounds.push_back(aabb);
+                    keys.push_back(key(rng));
+                }
+            }
+        };
+
+        template <class T>
+        std::vector<T> sorted(std::vector<T> v)
+        {
+            std::sort(v.begin(), v.end());
+            return v;
+        }
+    }
+
+    void quadtree()
+    {
+        std::mt19937 rng(4321);
+        Field field(rng);
+
+        AABB world;
+        world.min = glm::vec3(-0.5f * WorldSize, 0.0f, -0.5f * WorldSize);
+        world.max = glm::vec3(0.5f * WorldSize, 30.0f, 0.5f * WorldSize);
+
+        std::vector<int> handles(NbrInstances);
+        auto quadtree = std::make_unique<LooseQuadtree>(world);
+        const double insertMs = timeMs([&]()
+                                       {
+            quadtree = std::make_unique<LooseQuadtree>(world);
+            for (int i = 0; i < NbrInstances; i++)
+                handles[i] = quadtree->insert(field.bounds[i], (uint32_t)i, field.keys[i]); });
+
+        DynamicBvh bvh;
+        for (int i = 0; i < NbrInstances; i++)
+            bvh.insert(field.bounds[i], (uint32_t)i);
+        const double bvhBuildMs = timeMs([&]()
+                                         { bvh.build(); },
+                                         3);
+
+        std::printf("  %d instances, %d keys\n", NbrInstances, NbrKeys);
+        report("Quadtree, insert all", insertMs, std::to_string(1e6 * insertMs / NbrInstances) + " ns/insert");
+        report("BVH, build (for comparison)", bvhBuildMs);
+
+        // Streaming: remove and reinsert a tenth of the instances
+        {
+            const int nbrStreamed = NbrInstances / 10;
+            const double streamMs = timeMs([&]()
+                                           {
+                for (int i = 0; i < nbrStreamed; i++)
+                    quadtree->remove(handles[i]);
+                for (int i = 0; i < nbrStreamed; i++)
+                    handles[i] = quadtree->insert(field.bounds[i], (uint32_t)i, field.keys[i]); });
+            report("Quadtree, remove and reinsert 10%", streamMs, std::to_string(1e6 * streamMs / (2 * nbrStreamed)) + " ns/operation");
+            if (quadtree->size() != NbrInstances)
+                throw std::runtime_error("Quadtree size mismatch");
+        }
+
+        // Frustum queries from cameras at ground level, looking over the field
+        {
+            std::vector<glm::mat4> cameras;
+            for (int i = 0; i < 16; i++)
+            {
+                const float angle = i * glm::radians(360.0f / 16);
+                const glm::vec3 eye(0.0f, 5.0f, 0.0f);
+                const glm::vec3 target = eye + glm::vec3(std::cos(angle), -0.1f, std::sin(angle));
+                cameras.push_back(glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 1.0f, 500.0f) *
+                                  glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f)));
+            }
+
+            std::vector<int> result;
+            size_t visible = 0;
+            const double bruteMs = timeMs([&]()
+                                          {
+                visible = 0;
+                for (const auto &ProjView : cameras)
+                {
+                    glm::vec4 planes[6];
+                    extractPlanes(ProjView, planes);
+                    for (const auto &aabb : field.bounds)
+                        visible += !isOutsideFrustum(aabb, planes);
+                } });
+
+            LooseQuadtree::QueryStats stats;
+            const double quadtreeMs = timeMs([&]()
+                                             {
+                stats = {};
+                for (const auto &ProjView : cameras)
+                {
+                    result.clear();
+                    quadtree->queryFrustum(ProjView, result, &stats);
+                } });
+            const double bvhMs = timeMs([&]()
+                                        {
+                for (const auto &ProjView : cameras)
+                {
+                    result.clear();
+                    bvh.queryFrustum(ProjView, result);
+                } });
+
+            // Per cell batches, as for instanced draws
+            std::vector<const LooseQuadtree::Batch *> batches;
+            size_t nbrBatches = 0, nbrBatched = 0;
+            const double batchMs = timeMs([&]()
+                                          {
+                nbrBatches = nbrBatched = 0;
+                for (const auto &ProjView : cameras)
+                {
+                    batches.clear();
+                    quadtree->queryFrustumBatches(ProjView, batches);
+                    nbrBatches += batches.size();
+                    for (auto batch : batches)
+                        nbrBatched += batch->items.size();
+                } });
+
+            for (const auto &ProjView : cameras)
+            {
+                glm::vec4 planes[6];
+                extractPlanes(ProjView, planes);
+                std::vector<uint32_t> expected, found;
+                for (int i = 0; i < NbrInstances; i++)
+                    if (!isOutsideFrustum(field.bounds[i], planes))
+                        expected.push_back(i);
+                result.clear();
+                quadtree->queryFrustum(ProjView, result);
+                for (int item : result)
+                    found.push_back(quadtree->getUserData(item));
+                if (sorted(found) != expected)
+                    throw std::runtime_error("Quadtree frustum query mismatch");
+            }
+
+            const size_t nbrCameras = cameras.size();
+            report("Frustum query, brute force (per frustum)", bruteMs / nbrCameras, std::to_string(visible / nbrCameras) + " visible");
+            report("Frustum query, quadtree (per frustum)", quadtreeMs / nbrCameras,
+                   "x" + std::to_string(bruteMs / quadtreeMs) + ", " + std::to_string(stats.cellsVisited / nbrCameras) + " cells (" +
+                       std::to_string(stats.cellsInside / nbrCameras) + " inside), " + std::to_string(stats.itemsTested / nbrCameras) + " instances tested");
+            report("Frustum query, BVH (per frustum)", bvhMs / nbrCameras, "x" + std::to_string(bruteMs / bvhMs));
+            report("Frustum batches, quadtree (per frustum)", batchMs / nbrCameras,
+                   std::to_string(nbrBatches / nbrCameras) + " batches, " + std::to_string(nbrBatched / nbrCameras) + " instances");
+        }
+
+        // Radius queries, e.g. for gameplay around characters
+        {
+            std::uniform_real_distribution<float> xz(-0.5f * WorldSize, 0.5f * WorldSize);
+            std::vector<glm::vec3> centers;
+            for (int i = 0; i < 1000; i++)
+                centers.emplace_back(xz(rng), 1.0f, xz(rng));
+            const float radius = 30.0f;
+
+            std::vector<uint32_t> expected;
+            const double bruteMs = timeMs([&]()
+                                          {
+                expected.clear();
+                for (const auto &center : centers)
+                    for (int i = 0; i < NbrInstances; i++)
+                        if (isWithinRadius(field.bounds[i], center, radius))
+                            expected.push_back(i); },
+                                          3);
+
+            std::vector<int> result;
+            const double quadtreeMs = timeMs([&]()
+                                             {
+                result.clear();
+                for (const auto &center : centers)
+                    quadtree->queryRadius(center, radius, result); });
+
+            std::vector<uint32_t> found;
+            for (int item : result)
+                found.push_back(quadtree->getUserData(item));
+            if (sorted(found) != sorted(expected))
+                throw std::runtime_error("Quadtree radius query mismatch");
+
+            report("Radius query, brute force (per query)", bruteMs / centers.size());
+            report("Radius query, quadtree (per query)", quadtreeMs / centers.size(), "x" + std::to_string(bruteMs / quadtreeMs));
+        }
+    }
+
+} // namespace eeng::bench
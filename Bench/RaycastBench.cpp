@@ -0,0 +1,288 @@
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "TriangleBvh.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        /// Triangle soup, three vertices per triangle
+        struct Triangles
+        {
+            std::vector<glm::vec3> vertices;
+            std::vector<unsigned> ids;
+
+            void add(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+            {
+                ids.push_back((unsigned)ids.size());
+                vertices.push_back(a);
+                vertices.push_back(b);
+                vertices.push_back(c);
+            }
+        };
+
+        /// Rolling heightfield, as a terrain
+        Triangles makeTerrain(int resolution, float size)
+        {
+            auto height = [&](int i, int j)
+            {
+                const float x = i * size / resolution, z = j * size / resolution;
+                return 10.0f * std::sin(0.05f * x) * std::cos(0.07f * z) + 2.0f * std::sin(0.3f * x + 0.2f * z);
+            };
+            auto vertex = [&](int i, int j)
+            {
+                return glm::vec3(i * size / resolution - 0.5f * size, height(i, j), j * size / resolution - 0.5f * size);
+            };
+            Triangles triangles;
+            for (int j = 0; j < resolution; j++)
+                for (int i = 0; i < resolution; i++)
+                {
+                    triangles.add(vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1));
+                    triangles.add(vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1));
+                }
+            return triangles;
+        }
+
+        /// Bumpy sphere of unit size, as a character-sized mesh
+        /// @param slices Latitude bands, each a separate triangle set
+        std::vector<Triangles> makeBlob(int rings, int segments, int slices)
+        {
+            auto vertex = [&](int ring, int segment)
+            {
+                const float theta = glm::pi<float>() * ring / rings;
+                const float phi = 2.0f * glm::pi<float>() * segment / segments;
+                const float r = 1.0f + 0.05f * std::sin(7.0f * theta) * std::sin(5.0f * phi);
+                return r * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            };
+            std::vector<Triangles> sets(slices);
+            for (int ring = 0; ring < rings; ring++)
+            {
+                auto &set = sets[ring * slices / rings];
+                for (int segment = 0; segment < segments; segment++)
+                {
+                    set.add(vertex(ring, segment), vertex(ring + 1, segment), vertex(ring + 1, segment + 1));
+                    set.add(vertex(ring, segment), vertex(ring + 1, segment + 1), vertex(ring, segment + 1));
+                }
+            }
+            return sets;
+        }
+
+        /// Reference test, one triangle at a time
+        float bruteForce(const Triangles &triangles, const glm::vec3 &o, const glm::vec3 &d, float tmax)
+        {
+            float t = tmax;
+            for (size_t i = 0; i < triangles.ids.size(); i++)
+            {
+                const glm::vec3 &v0 = triangles.vertices[3 * i];
+                const glm::vec3 e1 = triangles.vertices[3 * i + 1] - v0;
+                const glm::vec3 e2 = triangles.vertices[3 * i + 2] - v0;
+                const glm::vec3 p = glm::cross(d, e2);
+                const float det = glm::dot(e1, p);
+                if (det == 0.0f)
+                    continue;
+                const glm::vec3 s = o - v0;
+                const float u = glm::dot(s, p) / det;
+                const glm::vec3 q = glm::cross(s, e1);
+                const float v = glm::dot(d, q) / det;
+                const float ti = glm::dot(e2, q) / det;
+                if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && ti >= 0.0f && ti < t)
+                    t = ti;
+            }
+            return t;
+        }
+
+        struct Rays
+        {
+            std::vector<glm::vec3> origins, directions;
+        };
+
+        /// Rays per second through a BVH, with and without SSE, checked against brute force
+        void measure(const std::string &name,
+                     const Triangles &triangles,
+                     const Rays &rays,
+                     float tmax,
+                     int nbrBruteRays)
+        {
+            TriangleBvh bvh;
+            const double buildMs = timeMs([&]()
+                                          { bvh.build(triangles.vertices, triangles.ids); },
+                                          3);
+            report(name + ", build", buildMs,
+                   std::to_string(bvh.getNbrTriangles()) + " triangles, " + std::to_string(bvh.getNbrNodes()) + " nodes");
+
+            const int nbrRays = (int)rays.origins.size();
+            std::vector<float> bruteHits(nbrBruteRays);
+            const double bruteMs = timeMs([&]()
+                                          {
+                for (int r = 0; r < nbrBruteRays; r++)
+                    bruteHits[r] = bruteForce(triangles, rays.origins[r], rays.directions[r], tmax); },
+                                          1);
+
+            int nbrHits = 0;
+            std::vector<float> hits(nbrRays);
+            auto cast = [&]()
+            {
+                nbrHits = 0;
+                for (int r = 0; r < nbrRays; r++)
+                {
+                    TriangleHit hit{tmax};
+                    nbrHits += bvh.raycast(rays.origins[r], rays.directions[r], hit);
+                    hits[r] = hit.t;
+                }
+            };
+
+            bvh.setSimd(false);
+            const double scalarMs = timeMs(cast);
+            for (int r = 0; r < nbrBruteRays; r++)
+                if (std::abs(bruteHits[r] - hits[r]) > 1e-4f * std::max(1.0f, bruteHits[r]))
+                    throw std::runtime_error("Raycast mismatch, " + name);
+
+            bvh.setSimd(true);
+            const double simdMs = timeMs(cast);
+            for (int r = 0; r < nbrBruteRays; r++)
+                if (std::abs(bruteHits[r] - hits[r]) > 1e-4f * std::max(1.0f, bruteHits[r]))
+                    throw std::runtime_error("SIMD raycast mismatch, " + name);
+
+            report(name + ", brute force", bruteMs, std::to_string(int(nbrBruteRays / (bruteMs * 1e-3))) + " rays/s");
+            report(name + ", BVH scalar", scalarMs, std::to_string(int(nbrRays / (scalarMs * 1e-3))) + " rays/s");
+            report(name + ", BVH SSE", simdMs,
+                   std::to_string(int(nbrRays / (simdMs * 1e-3))) + " rays/s, " + std::to_string(100 * nbrHits / nbrRays) + "% hit" +
+                       (TriangleBvh::isSimdSupported() ? "" : " (SSE not compiled in)"));
+        }
+    }
+
+    void raycast()
+    {
+        std::mt19937 rng(2468);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        const int nbrRays = 100000;
+
+        // Terrain: rays from above at grazing to steep angles, as for placement and line of sight
+        {
+            const float size = 1000.0f;
+            const Triangles terrain = makeTerrain(512, size);
+            Rays rays;
+            for (int i = 0; i < nbrRays; i++)
+            {
+                rays.origins.emplace_back(0.4f * size * unit(rng), 30.0f, 0.4f * size * unit(rng));
+                rays.directions.push_back(glm::normalize(glm::vec3(unit(rng), -0.1f - 0.5f * std::abs(unit(rng)), unit(rng))));
+            }
+            measure("Terrain", terrain, rays, 2.0f * size, 100);
+        }
+
+        // Character-sized mesh: picking rays from around it, aimed close to its center
+        std::vector<Triangles> slices = makeBlob(128, 256, 32);
+        Triangles blob;
+        for (const auto &slice : slices)
+            for (size_t i = 0; i < slice.ids.size(); i++)
+                blob.add(slice.vertices[3 * i], slice.vertices[3 * i + 1], slice.vertices[3 * i + 2]);
+        Rays rays;
+        for (int i = 0; i < nbrRays; i++)
+        {
+            const glm::vec3 origin = 5.0f * glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)));
+            const glm::vec3 target = 0.8f * glm::vec3(unit(rng), unit(rng), unit(rng));
+            rays.origins.push_back(origin);
+            rays.directions.push_back(glm::normalize(target - origin));
+        }
+        measure("Character", blob, rays, 100.0f, 1000);
+
+        // Skinned character: the slices are bones, posed by twisting them
+        // about y. Per-bone BVHs are built once and rays are moved into bone
+        // space, while a single BVH would have to be rebuilt every pose.
+        {
+            const int nbrBones = (int)slices.size();
+            std::vector<TriangleBvh> boneBvhs(nbrBones);
+            std::vector<AABB> bindBounds(nbrBones);
+            for (int b = 0; b < nbrBones; b++)
+            {
+                boneBvhs[b].build(slices[b].vertices, slices[b].ids);
+                bindBounds[b] = boneBvhs[b].getBounds();
+            }
+
+            std::vector<glm::mat4> boneMatrices(nbrBones);
+            std::vector<AABB> poseBounds(nbrBones);
+            for (int b = 0; b < nbrBones; b++)
+            {
+                boneMatrices[b] = glm::rotate(glm::mat4(1.0f), 0.05f * b, glm::vec3(0.0f, 1.0f, 0.0f));
+                const auto &M = boneMatrices[b];
+                poseBounds[b] = bindBounds[b].post_transform(glm::vec3(M[3]), glm::mat3(M));
+            }
+
+            Triangles posed;
+            for (int b = 0; b < nbrBones; b++)
+                for (size_t i = 0; i < slices[b].ids.size(); i++)
+                    posed.add(glm::vec3(boneMatrices[b] * glm::vec4(slices[b].vertices[3 * i], 1.0f)),
+                              glm::vec3(boneMatrices[b] * glm::vec4(slices[b].vertices[3 * i + 1], 1.0f)),
+                              glm::vec3(boneMatrices[b] * glm::vec4(slices[b].vertices[3 * i + 2], 1.0f)));
+            TriangleBvh single;
+            const double rebuildMs = timeMs([&]()
+                                            { single.build(posed.vertices, posed.ids); },
+                                            3);
+
+            // As in RenderableMesh::raycast
+            auto cast = [&](const glm::vec3 &origin, const glm::vec3 &direction, float tmax)
+            {
+                const glm::vec3 invDirection = 1.0f / direction;
+                std::pair<float, int> candidates[64];
+                int nbrCandidates = 0;
+                for (int b = 0; b < nbrBones; b++)
+                {
+                    const glm::vec3 t0 = (poseBounds[b].min - origin) * invDirection;
+                    const glm::vec3 t1 = (poseBounds[b].max - origin) * invDirection;
+                    const glm::vec3 tmin = glm::min(t0, t1), tmaxs = glm::max(t0, t1);
+                    const float tnear = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+                    const float tfar = std::min(std::min(tmaxs.x, tmaxs.y), std::min(tmaxs.z, tmax));
+                    if (tnear <= tfar)
+                        candidates[nbrCandidates++] = {tnear, b};
+                }
+                std::sort(candidates, candidates + nbrCandidates);
+
+                TriangleHit hit{tmax};
+                for (int c = 0; c < nbrCandidates && candidates[c].first < hit.t; c++)
+                {
+                    const glm::mat4 invM = glm::inverse(boneMatrices[candidates[c].second]);
+                    boneBvhs[candidates[c].second].raycast(glm::vec3(invM * glm::vec4(origin, 1.0f)),
+                                                           glm::vec3(invM * glm::vec4(direction, 0.0f)),
+                                                           hit);
+                }
+                return hit.t;
+            };
+
+            std::vector<float> twoLevelHits(nbrRays), singleHits(nbrRays);
+            const double twoLevelMs = timeMs([&]()
+                                             {
+                for (int r = 0; r < nbrRays; r++)
+                    twoLevelHits[r] = cast(rays.origins[r], rays.directions[r], 100.0f); });
+            const double singleMs = timeMs([&]()
+                                           {
+                for (int r = 0; r < nbrRays; r++)
+                {
+                    TriangleHit hit{100.0f};
+                    single.raycast(rays.origins[r], rays.directions[r], hit);
+                    singleHits[r] = hit.t;
+                } });
+            // Rays through edges shared by triangles may miss both in one
+            // space and not in the other, so a few differences are expected
+            int nbrMismatches = 0;
+            for (int r = 0; r < nbrRays; r++)
+                nbrMismatches += std::abs(twoLevelHits[r] - singleHits[r]) > 1e-4f * std::max(1.0f, singleHits[r]);
+            if (nbrMismatches > nbrRays / 1000)
+                throw std::runtime_error("Two-level raycast mismatch");
+
+            report("Skinned, rebuild single BVH per pose", rebuildMs);
+            report("Skinned, single BVH", singleMs, std::to_string(int(nbrRays / (singleMs * 1e-3))) + " rays/s");
+            report("Skinned, per-bone BVHs", twoLevelMs,
+                   std::to_string(int(nbrRays / (twoLevelMs * 1e-3))) + " rays/s, " + std::to_string(nbrBones) + " bones, no rebuild");
+        }
+    }
+
+} // namespace eeng::bench
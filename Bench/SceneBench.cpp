@@ -0,0 +1,410 @@
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <entt/entt.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "glcommon.h"
+#include "HeadlessContext.hpp"
+#include "OffscreenTarget.hpp"
+#include "GLStateCache.hpp"
+#include "ForwardRenderer.hpp"
+#include "RenderableMesh.hpp"
+#include "SceneComponents.hpp"
+#include "SceneSystems.hpp"
+#include "DynamicBvh.hpp"
+#include "SceneScript.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        /// Phases of a frame, in order
+        enum Phase
+        {
+            Update,  ///< Transforms, animator clocks, bounds and BVH
+            Animate, ///< Posing and skinning of animated instances
+            Cull,    ///< Frustum culling, LOD selection and queuing of draws
+            Submit,  ///< Occlusion culling, sorting and drawcalls
+            Frame,   ///< CPU time of the whole frame
+            Gpu,     ///< GPU time of the whole frame
+            PhaseCount
+        };
+
+        const char *phaseNames[PhaseCount] = {"update", "animate", "cull", "submit", "frame", "gpu"};
+
+        /// GPU time of frames from timestamp queries
+        /** Results are read when a query is reused a few frames later, which
+         * also keeps the CPU from running ahead of the GPU by more than that.
+         * Timestamps are used rather than elapsed time queries, since these
+         * cannot be nested in the skinning pass timing of the renderer.
+         */
+        class GpuTimer
+        {
+            static constexpr int Latency = 3;
+            GLuint queries[Latency][2] = {};
+            int pendingFrame[Latency] = {-1, -1, -1};
+            int slot = 0;
+            std::vector<double> &frameMs;
+
+        public:
+            GpuTimer(std::vector<double> &frameMs)
+                : frameMs(frameMs)
+            {
+                glGenQueries(2 * Latency, &queries[0][0]);
+            }
+
+            ~GpuTimer()
+            {
+                glDeleteQueries(2 * Latency, &queries[0][0]);
+            }
+
+            void begin(int frame)
+            {
+                slot = frame % Latency;
+                read(slot);
+                glQueryCounter(queries[slot][0], GL_TIMESTAMP);
+                pendingFrame[slot] = frame;
+            }
+
+            void end()
+            {
+                glQueryCounter(queries[slot][1], GL_TIMESTAMP);
+            }
+
+            void flush()
+            {
+                for (int i = 0; i < Latency; i++)
+                    read(i);
+            }
+
+        private:
+            void read(int i)
+            {
+                if (pendingFrame[i] < 0)
+                    return;
+                GLuint64 start = 0, end = 0;
+                glGetQueryObjectui64v(queries[i][0], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(queries[i][1], GL_QUERY_RESULT, &end);
+                frameMs[pendingFrame[i]] = (end - start) * 1e-6;
+                pendingFrame[i] = -1;
+            }
+        };
+
+        struct Percentiles
+        {
+            double mean = 0.0, min = 0.0, p50 = 0.0, p90 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+        };
+
+        /// Nearest-rank percentiles
+        Percentiles percentiles(std::vector<double> samples)
+        {
+            Percentiles result;
+            if (samples.empty())
+                return result;
+            std::sort(samples.begin(), samples.end());
+            auto rank = [&](double p)
+            {
+                const size_t index = (size_t)std::ceil(p * samples.size());
+                return samples[std::min(samples.size(), std::max<size_t>(index, 1)) - 1];
+            };
+            for (double sample : samples)
+                result.mean += sample;
+            result.mean /= samples.size();
+            result.min = samples.front();
+            result.p50 = rank(0.5);
+            result.p90 = rank(0.9);
+            result.p95 = rank(0.95);
+            result.p99 = rank(0.99);
+            result.max = samples.back();
+            return result;
+        }
+
+        std::string jsonString(const std::string &text)
+        {
+            std::string result = "\"";
+            for (char c : text)
+            {
+                if (c == '"' || c == '\\')
+                    result += '\\';
+                if ((unsigned char)c < 0x20)
+                    continue;
+                result += c;
+            }
+            return result + "\"";
+        }
+
+        /// Set render state and clear the bound framebuffer
+        void beginFrame(int width, int height)
+        {
+            auto &glState = GLStateCache::instance();
+            glState.enable(GL_CULL_FACE);
+            glFrontFace(GL_CCW);
+            glCullFace(GL_BACK);
+            glState.enable(GL_DEPTH_TEST);
+            glState.depthFunc(GL_LESS);
+            glState.depthMask(GL_TRUE);
+            glDepthRange(0, 1);
+            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            glViewport(0, 0, width, height);
+            glClearColor(0.529f, 0.808f, 0.922f, 1.0f);
+            glClearDepth(1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+
+        struct Options
+        {
+            std::string sceneFile;
+            std::string jsonFile; ///< Named after the scene description if not given
+            std::string label;    ///< E.g. a commit hash
+            int frames = -1;      ///< Overrides the description if set
+        };
+
+        Options parseOptions(int argc, char *argv[])
+        {
+            Options options;
+            for (int i = 0; i < argc; i++)
+            {
+                auto value = [&]() -> std::string
+                {
+                    if (i + 1 >= argc)
+                        throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+                    return argv[++i];
+                };
+                if (!std::strcmp(argv[i], "--json"))
+                    options.jsonFile = value();
+                else if (!std::strcmp(argv[i], "--label"))
+                    options.label = value();
+                else if (!std::strcmp(argv[i], "--frames"))
+                    options.frames = std::stoi(value());
+                else if (options.sceneFile.empty() && argv[i][0] != '-')
+                    options.sceneFile = argv[i];
+                else
+                    throw std::runtime_error(std::string("Unknown argument ") + argv[i]);
+            }
+            if (options.sceneFile.empty())
+                throw std::runtime_error("No scene description given");
+            if (options.jsonFile.empty())
+            {
+                // Standard output also receives the log
+                const auto slash = options.sceneFile.find_last_of("/\\");
+                const auto name = options.sceneFile.substr(slash == std::string::npos ? 0 : slash + 1);
+                options.jsonFile = name.substr(0, name.find_last_of('.')) + ".json";
+            }
+            return options;
+        }
+    }
+
+    int scene(int argc, char *argv[])
+    {
+        const Options options = parseOptions(argc, argv);
+        auto script = SceneScript::load(options.sceneFile);
+        if (options.frames > 0)
+            script.frames = options.frames;
+
+        HeadlessContext context(script.width, script.height);
+        OffscreenTarget target(script.width, script.height);
+
+        auto renderer = std::make_shared<ForwardRenderer>();
+        renderer->init("shaders/phong_vert.glsl", "shaders/phong_frag.glsl");
+        renderer->initSkinning("shaders/skinning_vert.glsl");
+        renderer->initDepthPrepass("shaders/depth_vert.glsl", "shaders/depth_frag.glsl", "shaders/overdraw_frag.glsl");
+        renderer->setSkinningMode(script.cpuSkinning ? SkinningMode::CPU : SkinningMode::TransformFeedback);
+        renderer->setDepthPrepass(script.depthPrepass);
+        renderer->setOcclusionCulling(script.occlusionCulling);
+        renderer->setLodSelection(script.lodSelection);
+        renderer->setDrawOrder(script.frontToBack ? DrawOrder::FrontToBack : DrawOrder::Submission);
+        GLStateCache::instance().setCaching(script.glStateCache);
+
+        // Load
+        std::map<std::string, std::shared_ptr<RenderableMesh>> meshes;
+        std::vector<std::pair<std::string, double>> loadMs;
+        double totalLoadMs = 0.0;
+        for (const auto &desc : script.meshes)
+        {
+            const auto start = Clock::now();
+            auto mesh = std::make_shared<RenderableMesh>();
+            mesh->setLodGeneration(script.lodSelection);
+            mesh->load(desc.file, false);
+            for (const auto &file : desc.animationFiles)
+                mesh->load(file, true);
+            for (const auto &node : desc.staticNodes)
+                mesh->removeTranslationKeys(node);
+            meshes[desc.name] = mesh;
+            loadMs.push_back({desc.name, std::chrono::duration<double, std::milli>(Clock::now() - start).count()});
+            totalLoadMs += loadMs.back().second;
+        }
+
+        // Instances
+        entt::registry registry;
+        DynamicBvh bvh;
+        prepareSystems(registry);
+        int nbrInstances = 0, nbrAnimated = 0;
+        for (const auto &desc : script.instances)
+        {
+            const auto &meshDesc = *std::find_if(script.meshes.begin(), script.meshes.end(), [&](const auto &mesh)
+                                                 { return mesh.name == desc.mesh; });
+            const auto &mesh = meshes[desc.mesh];
+            for (const auto &clip : desc.clips)
+                if (clip.index >= (int)mesh->getNbrAnimations())
+                    throw std::runtime_error("Mesh " + desc.mesh + " has no clip " + std::to_string(clip.index));
+
+            for (int i = 0; i < desc.count; i++)
+            {
+                auto entity = registry.create();
+                auto &tfm = registry.emplace<Transform>(entity);
+                tfm.position = SceneScript::positionOf(desc, i);
+                tfm.scale = glm::vec3(meshDesc.scale);
+                registry.emplace<MeshRef>(entity, MeshRef{mesh, desc.occluder});
+                registry.emplace<Bounds>(entity, Bounds{mesh->mSceneAABB ? mesh->mSceneAABB : mesh->m_model_aabb});
+                if (desc.clips.size())
+                {
+                    // Bounds of all poses, since instances are not posed when culled
+                    registry.get<Bounds>(entity).local = mesh->m_animated_aabb;
+                    auto &animator = registry.emplace<Animator>(entity);
+                    animator.clipIndex = SceneScript::clipOf(desc, i);
+                    animator.speed = desc.speed;
+                    animator.time = SceneScript::timeOffsetOf(i);
+                    nbrAnimated++;
+                }
+                nbrInstances++;
+            }
+        }
+        updateTransforms(registry);
+        updateBounds(registry);
+        for (auto entity : registry.view<Bounds>())
+            addToBvh(registry, entity, bvh);
+
+        // Frames
+        const int nbrFrames = script.warmupFrames + script.frames;
+        std::vector<double> phaseMs[PhaseCount];
+        for (auto &samples : phaseMs)
+            samples.resize(nbrFrames, 0.0);
+        std::vector<double> drawcalls, triangles, culled, glIssued, glSkipped;
+        const float aspectRatio = float(script.width) / script.height;
+        const glm::mat4 P = glm::perspective(glm::radians(60.0f), aspectRatio, 1.0f, 500.0f);
+        const glm::vec3 lightPos{1000.0f, 1000.0f, 1000.0f}, lightColor{1.0f, 1.0f, 0.8f};
+        {
+            GpuTimer gpuTimer(phaseMs[Gpu]);
+            for (int frame = 0; frame < nbrFrames; frame++)
+            {
+                glm::vec3 eye, targetPos;
+                script.cameraAt(frame * script.timeStep, eye, targetPos);
+                const glm::mat4 V = glm::lookAt(eye, targetPos, {0.0f, 1.0f, 0.0f});
+
+                gpuTimer.begin(frame);
+                const auto start = Clock::now();
+                target.bind();
+                beginFrame(script.width, script.height);
+
+                updateTransforms(registry);
+                updateAnimators(registry, script.timeStep);
+                updateBounds(registry);
+                updateBvh(registry, bvh);
+                const auto updated = Clock::now();
+
+                renderer->beginSkinningPass();
+                skinEntities(registry, *renderer, P * V);
+                renderer->endSkinningPass();
+                const auto animated = Clock::now();
+
+                renderer->beginPass(P, V, lightPos, lightColor, eye);
+                const auto stats = renderEntities(registry, *renderer, P * V, true, script.bvhCulling ? &bvh : nullptr);
+                const auto queued = Clock::now();
+
+                renderer->endPass();
+                gpuTimer.end();
+                const auto submitted = Clock::now();
+                GLStateCache::instance().endFrame();
+
+                auto ms = [](Clock::time_point a, Clock::time_point b)
+                { return std::chrono::duration<double, std::milli>(b - a).count(); };
+                phaseMs[Update][frame] = ms(start, updated);
+                phaseMs[Animate][frame] = ms(updated, animated);
+                phaseMs[Cull][frame] = ms(animated, queued);
+                phaseMs[Submit][frame] = ms(queued, submitted);
+                phaseMs[Frame][frame] = ms(start, submitted);
+                if (frame >= script.warmupFrames)
+                {
+                    drawcalls.push_back(renderer->getPassStats().drawcalls);
+                    triangles.push_back(renderer->getPassStats().triangles);
+                    culled.push_back(stats.culled);
+                    glIssued.push_back(GLStateCache::instance().getFrameStats().totalIssued());
+                    glSkipped.push_back(GLStateCache::instance().getFrameStats().totalSkipped());
+                }
+            }
+            gpuTimer.flush();
+        }
+        CheckAndThrowGLErrors();
+
+        // Results, without warmup frames
+        Percentiles results[PhaseCount];
+        for (int phase = 0; phase < PhaseCount; phase++)
+        {
+            phaseMs[phase].erase(phaseMs[phase].begin(), phaseMs[phase].begin() + script.warmupFrames);
+            results[phase] = percentiles(phaseMs[phase]);
+        }
+
+        std::printf("[scene] %s, %i instances (%i animated), %i frames of %ix%i\n",
+                    options.sceneFile.c_str(),
+                    nbrInstances,
+                    nbrAnimated,
+                    script.frames,
+                    script.width,
+                    script.height);
+        std::printf("  %s\n", context.getRendererString().c_str());
+        for (const auto &[name, ms] : loadMs)
+            report("load " + name, ms);
+        for (int phase = 0; phase < PhaseCount; phase++)
+        {
+            char note[64];
+            std::snprintf(note, sizeof(note), "p90 %.3f, p99 %.3f, max %.3f", results[phase].p90, results[phase].p99, results[phase].max);
+            report(std::string(phaseNames[phase]) + " (median)", results[phase].p50, note);
+        }
+
+        FILE *json = std::fopen(options.jsonFile.c_str(), "w");
+        if (!json)
+            throw std::runtime_error("Failed to open " + options.jsonFile);
+        std::fprintf(json, "{\n");
+        std::fprintf(json, "  \"scene\": %s,\n", jsonString(options.sceneFile).c_str());
+        std::fprintf(json, "  \"label\": %s,\n", jsonString(options.label).c_str());
+        std::fprintf(json, "  \"renderer\": %s,\n", jsonString(context.getRendererString()).c_str());
+        std::fprintf(json, "  \"videoDriver\": %s,\n", jsonString(context.getVideoDriver()).c_str());
+        std::fprintf(json, "  \"width\": %i,\n  \"height\": %i,\n", script.width, script.height);
+        std::fprintf(json, "  \"frames\": %i,\n  \"warmupFrames\": %i,\n  \"timeStep\": %g,\n", script.frames, script.warmupFrames, script.timeStep);
+        std::fprintf(json, "  \"instances\": %i,\n  \"animatedInstances\": %i,\n", nbrInstances, nbrAnimated);
+        std::fprintf(json, "  \"loadMs\": {\n    \"total\": %.3f", totalLoadMs);
+        for (const auto &[name, ms] : loadMs)
+            std::fprintf(json, ",\n    %s: %.3f", jsonString(name).c_str(), ms);
+        std::fprintf(json, "\n  },\n  \"phasesMs\": {\n");
+        for (int phase = 0; phase < PhaseCount; phase++)
+        {
+            const auto &r = results[phase];
+            std::fprintf(json,
+                         "    \"%s\": {\"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+                         phaseNames[phase], r.mean, r.min, r.p50, r.p90, r.p95, r.p99, r.max,
+                         phase + 1 < PhaseCount ? "," : "");
+        }
+        std::fprintf(json, "  },\n  \"counters\": {\"drawcalls\": %.1f, \"triangles\": %.1f, \"culled\": %.1f, \"glStateCallsIssued\": %.1f, \"glStateCallsSkipped\": %.1f}\n}\n",
+                     percentiles(drawcalls).mean,
+                     percentiles(triangles).mean,
+                     percentiles(culled).mean,
+                     percentiles(glIssued).mean,
+                     percentiles(glSkipped).mean);
+        std::fclose(json);
+        std::printf("  results written to %s\n", options.jsonFile.c_str());
+
+        // Release skinned vertex caches while there is a GL context
+        registry.clear();
+        return 0;
+    }
+
+} // namespace eeng::bench
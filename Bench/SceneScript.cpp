@@ -0,0 +1,235 @@
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "SceneScript.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        /// Fractional part of a multiple of an irrational number, an evenly spread sequence in [0, 1)
+        float sequence(int i, float alpha)
+        {
+            const double x = (i + 0.5) * alpha;
+            return float(x - std::floor(x));
+        }
+
+        SceneScript::Mesh &findMesh(SceneScript &script,
+                                    const std::string &name)
+        {
+            for (auto &mesh : script.meshes)
+                if (mesh.name == name)
+                    return mesh;
+            throw std::runtime_error("Unknown mesh " + name);
+        }
+
+        template <class T>
+        T read(std::istringstream &line, const char *what)
+        {
+            T value;
+            if (!(line >> value))
+                throw std::runtime_error(std::string("Expected ") + what);
+            return value;
+        }
+    }
+
+    SceneScript SceneScript::load(const std::string &file)
+    {
+        std::ifstream stream(file);
+        if (!stream)
+            throw std::runtime_error("Failed to open " + file);
+
+        SceneScript script;
+        std::string text;
+        for (int lineNumber = 1; std::getline(stream, text); lineNumber++)
+        {
+            text = text.substr(0, text.find('#'));
+            std::istringstream line(text);
+            std::string command;
+            if (!(line >> command))
+                continue;
+
+            try
+            {
+                if (command == "frames")
+                    script.frames = read<int>(line, "frame count");
+                else if (command == "warmup")
+                    script.warmupFrames = read<int>(line, "frame count");
+                else if (command == "timestep")
+                    script.timeStep = read<float>(line, "time step");
+                else if (command == "size")
+                {
+                    script.width = read<int>(line, "width");
+                    script.height = read<int>(line, "height");
+                }
+                else if (command == "mesh")
+                {
+                    Mesh mesh;
+                    mesh.name = read<std::string>(line, "mesh name");
+                    mesh.file = read<std::string>(line, "file");
+                    line >> mesh.scale;
+                    script.meshes.push_back(mesh);
+                }
+                else if (command == "animations")
+                {
+                    auto &mesh = findMesh(script, read<std::string>(line, "mesh name"));
+                    mesh.animationFiles.push_back(read<std::string>(line, "file"));
+                }
+                else if (command == "static")
+                {
+                    auto &mesh = findMesh(script, read<std::string>(line, "mesh name"));
+                    mesh.staticNodes.push_back(read<std::string>(line, "node name"));
+                }
+                else if (command == "instances")
+                {
+                    Instances instances;
+                    instances.mesh = findMesh(script, read<std::string>(line, "mesh name")).name;
+                    instances.count = read<int>(line, "instance count");
+
+                    std::string key;
+                    while (line >> key)
+                    {
+                        if (key == "spacing")
+                            instances.spacing = read<float>(line, "spacing");
+                        else if (key == "origin")
+                        {
+                            instances.origin.x = read<float>(line, "origin x");
+                            instances.origin.y = read<float>(line, "origin z");
+                        }
+                        else if (key == "speed")
+                            instances.speed = read<float>(line, "speed");
+                        else if (key == "occluder")
+                            instances.occluder = true;
+                        else if (key == "clips")
+                        {
+                            // Clips are read until the next keyword
+                            std::string clip;
+                            while (line >> clip)
+                            {
+                                const auto colon = clip.find(':');
+                                if (colon == std::string::npos)
+                                {
+                                    line.seekg(-(std::streamoff)clip.size(), std::ios::cur);
+                                    break;
+                                }
+                                instances.clips.push_back({std::stoi(clip.substr(0, colon)),
+                                                           std::stof(clip.substr(colon + 1))});
+                            }
+                            line.clear();
+                        }
+                        else
+                            throw std::runtime_error("Unknown instance option " + key);
+                    }
+                    script.instances.push_back(instances);
+                }
+                else if (command == "camera")
+                {
+                    CameraKey key;
+                    key.time = read<float>(line, "time");
+                    for (int i = 0; i < 3; i++)
+                        key.eye[i] = read<float>(line, "eye position");
+                    for (int i = 0; i < 3; i++)
+                        key.target[i] = read<float>(line, "target position");
+                    if (script.camera.size() && key.time < script.camera.back().time)
+                        throw std::runtime_error("Camera keys are out of order");
+                    script.camera.push_back(key);
+                }
+                else if (command == "option")
+                {
+                    const auto option = read<std::string>(line, "option");
+                    if (option == "prepass")
+                        script.depthPrepass = true;
+                    else if (option == "occlusion")
+                        script.occlusionCulling = true;
+                    else if (option == "lod")
+                        script.lodSelection = true;
+                    else if (option == "fronttoback")
+                        script.frontToBack = true;
+                    else if (option == "cpuskinning")
+                        script.cpuSkinning = true;
+                    else if (option == "nobvh")
+                        script.bvhCulling = false;
+                    else if (option == "nostatecache")
+                        script.glStateCache = false;
+                    else
+                        throw std::runtime_error("Unknown option " + option);
+                }
+                else
+                    throw std::runtime_error("Unknown command " + command);
+            }
+            catch (const std::exception &e)
+            {
+                throw std::runtime_error(file + ":" + std::to_string(lineNumber) + ": " + e.what());
+            }
+        }
+
+        if (script.frames <= 0 || script.warmupFrames < 0 || script.timeStep <= 0.0f ||
+            script.width <= 0 || script.height <= 0)
+            throw std::runtime_error(file + ": Invalid frame count, time step or size");
+        return script;
+    }
+
+    void SceneScript::cameraAt(float time,
+                               glm::vec3 &eye,
+                               glm::vec3 &target) const
+    {
+        if (camera.empty())
+        {
+            eye = {0.0f, 20.0f, 40.0f};
+            target = {0.0f, 0.0f, 0.0f};
+            return;
+        }
+
+        auto next = std::upper_bound(camera.begin(), camera.end(), time, [](float time, const CameraKey &key)
+                                     { return time < key.time; });
+        if (next == camera.begin() || next == camera.end())
+        {
+            const auto &key = next == camera.begin() ? camera.front() : camera.back();
+            eye = key.eye;
+            target = key.target;
+            return;
+        }
+        const auto &prev = *(next - 1);
+        const float t = (time - prev.time) / std::max(next->time - prev.time, 1e-6f);
+        eye = glm::mix(prev.eye, next->eye, t);
+        target = glm::mix(prev.target, next->target, t);
+    }
+
+    int SceneScript::clipOf(const Instances &instances,
+                            int instance)
+    {
+        float totalWeight = 0.0f;
+        for (const auto &clip : instances.clips)
+            totalWeight += clip.weight;
+
+        float u = sequence(instance, 0.6180339887f) * totalWeight;
+        for (const auto &clip : instances.clips)
+        {
+            if (u < clip.weight)
+                return clip.index;
+            u -= clip.weight;
+        }
+        return instances.clips.size() ? instances.clips.back().index : -1;
+    }
+
+    glm::vec3 SceneScript::positionOf(const Instances &instances,
+                                      int instance)
+    {
+        const int columns = (int)std::ceil(std::sqrt((float)instances.count));
+        const int rows = (instances.count + columns - 1) / columns;
+        return {
+            instances.origin.x + (instance % columns - 0.5f * (columns - 1)) * instances.spacing,
+            0.0f,
+            instances.origin.y + (instance / columns - 0.5f * (rows - 1)) * instances.spacing};
+    }
+
+    float SceneScript::timeOffsetOf(int instance)
+    {
+        // Clip times wrap, so offsets longer than clips spread over them
+        return 10.0f * sequence(instance, 0.7548776662f);
+    }
+
+} // namespace eeng::bench
@@ -0,0 +1,105 @@
+
+#ifndef SceneScript_hpp
+#define SceneScript_hpp
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace eeng::bench
+{
+    /// @brief Scene of the scene benchmark, read from a text description
+    /** One command per line, and # starts a comment. File paths may not
+     * contain spaces.
+     *
+     *   frames N                        Measured frames (600)
+     *   warmup N                        Frames rendered before measuring (10)
+     *   timestep S                      Seconds per frame (1/60)
+     *   size W H                        Frame size (1280 720)
+     *   mesh NAME FILE [SCALE]          Load a mesh, instanced at a uniform scale (1)
+     *   animations NAME FILE            Add the clips of a file to a mesh
+     *   static NAME NODE                Remove translation keys of a node, e.g. root motion
+     *   instances NAME COUNT [spacing S] [origin X Z] [clips I:W ...] [speed S] [occluder]
+     *                                   Grid of instances in the xz-plane. Clips are
+     *                                   assigned by weight, where clip -1 is the bind pose.
+     *   camera TIME EX EY EZ TX TY TZ   Camera key with eye and target, interpolated linearly
+     *   option OPTION                   prepass, occlusion, lod, fronttoback, cpuskinning, nobvh or nostatecache
+     *
+     * Instances are placed and assigned clips and clip times the same way
+     * on every run, so that runs of the same description are comparable.
+     */
+    struct SceneScript
+    {
+        struct Mesh
+        {
+            std::string name;
+            std::string file;
+            float scale = 1.0f;
+            std::vector<std::string> animationFiles;
+            std::vector<std::string> staticNodes;
+        };
+
+        struct Clip
+        {
+            int index;
+            float weight;
+        };
+
+        struct Instances
+        {
+            std::string mesh;
+            int count = 1;
+            float spacing = 1.0f;
+            glm::vec2 origin{0.0f};   ///< Grid center in the xz-plane
+            std::vector<Clip> clips;  ///< Not animated if empty
+            float speed = 1.0f;
+            bool occluder = false;
+        };
+
+        struct CameraKey
+        {
+            float time;
+            glm::vec3 eye, target;
+        };
+
+        int frames = 600;
+        int warmupFrames = 10;
+        float timeStep = 1.0f / 60;
+        int width = 1280, height = 720;
+        std::vector<Mesh> meshes;
+        std::vector<Instances> instances;
+        std::vector<CameraKey> camera;
+
+        // Renderer options
+        bool depthPrepass = false;
+        bool occlusionCulling = false;
+        bool lodSelection = false;
+        bool frontToBack = false;
+        bool cpuSkinning = false;
+        bool bvhCulling = true;
+        bool glStateCache = true;
+
+        /// @brief Read a description. Throws with the line number on errors.
+        static SceneScript load(const std::string &file);
+
+        /// @brief Camera at a time, clamped to the first and last keys
+        void cameraAt(float time,
+                      glm::vec3 &eye,
+                      glm::vec3 &target) const;
+
+        /// @brief Clip of an instance, picked by the clip weights
+        /// @param instance Index among the instances of a command
+        static int clipOf(const Instances &instances,
+                          int instance);
+
+        /// @brief Position of an instance on the grid of its command
+        static glm::vec3 positionOf(const Instances &instances,
+                                    int instance);
+
+        /// @brief Clip time at the first frame, so that instances are not in step
+        static float timeOffsetOf(int instance);
+    };
+
+} // namespace eeng::bench
+
+#endif /* SceneScript_hpp */
@@ -0,0 +1,115 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "glcommon.h"
+#include "HeadlessContext.hpp"
+#include "ForwardRenderer.hpp"
+#include "ShaderCache.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        struct Options
+        {
+            std::string directory = "shader_cache_bench";
+            int repetitions = 5;
+        };
+
+        Options parseOptions(int argc, char *argv[])
+        {
+            Options options;
+            for (int i = 0; i < argc; i++)
+            {
+                if (!std::strcmp(argv[i], "--repetitions") || !std::strcmp(argv[i], "--cache"))
+                {
+                    if (i + 1 >= argc)
+                        throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+                    if (!std::strcmp(argv[i], "--repetitions"))
+                        options.repetitions = std::max(1, std::atoi(argv[++i]));
+                    else
+                        options.directory = argv[++i];
+                }
+                else
+                    throw std::runtime_error(std::string("Unknown argument ") + argv[i]);
+            }
+            return options;
+        }
+
+        double median(std::vector<double> samples)
+        {
+            std::sort(samples.begin(), samples.end());
+            return samples[samples.size() / 2];
+        }
+
+        /// Create the programs of a renderer, as at startup, and time it
+        double initRenderer(const std::shared_ptr<ShaderCache> &shaderCache)
+        {
+            const auto start = Clock::now();
+            auto renderer = std::make_shared<ForwardRenderer>();
+            renderer->setShaderCache(shaderCache);
+            renderer->init("shaders/phong_vert.glsl", "shaders/phong_frag.glsl");
+            renderer->initSkinning("shaders/skinning_vert.glsl");
+            renderer->initDepthPrepass("shaders/depth_vert.glsl", "shaders/depth_frag.glsl", "shaders/overdraw_frag.glsl");
+            glFinish();
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        }
+
+        std::string describe(const ShaderCacheStats &stats)
+        {
+            char text[96];
+            std::snprintf(text, sizeof(text), "%i from binaries, %i compiled, %i rejected, %i stored",
+                          stats.hits,
+                          stats.misses,
+                          stats.rejected,
+                          stats.stored);
+            return text;
+        }
+    }
+
+    int shaders(int argc, char *argv[])
+    {
+        const Options options = parseOptions(argc, argv);
+
+        HeadlessContext context(64, 64);
+        std::printf("[%s, median of %i starts]\n", context.getRendererString().c_str(), options.repetitions);
+
+        // Interleaved, so that caches and clocks affect all alike. Drivers
+        // may cache compiled shaders themselves (e.g. Mesa's disk cache),
+        // which makes compiling faster after the first start as well.
+        auto noCache = std::make_shared<ShaderCache>(options.directory);
+        noCache->setEnabled(false);
+        auto shaderCache = std::make_shared<ShaderCache>(options.directory);
+        std::vector<double> noCacheMs, coldMs, warmMs;
+        ShaderCacheStats coldStats, warmStats; // Of the last start
+        for (int i = 0; i < options.repetitions; i++)
+        {
+            noCacheMs.push_back(initRenderer(noCache));
+
+            shaderCache->clear();
+            shaderCache->clearStats();
+            coldMs.push_back(initRenderer(shaderCache));
+            coldStats = shaderCache->getStats();
+
+            shaderCache->clearStats();
+            warmMs.push_back(initRenderer(shaderCache));
+            warmStats = shaderCache->getStats();
+        }
+        shaderCache->clear();
+
+        char speedup[48];
+        std::snprintf(speedup, sizeof(speedup), ", %.2fx faster than no cache", median(noCacheMs) / std::max(median(warmMs), 1e-6));
+        report("create programs, no cache", median(noCacheMs));
+        report("create programs, cold cache", median(coldMs), describe(coldStats));
+        report("create programs, warm cache", median(warmMs), describe(warmStats) + speedup);
+        return 0;
+    }
+
+} // namespace eeng::bench
@@ -0,0 +1,182 @@
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "glcommon.h"
+#include "HeadlessContext.hpp"
+#include "ForwardRenderer.hpp"
+#include "CpuSkinner.hpp"
+#include "RenderableMesh.hpp"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        struct Options
+        {
+            std::string file = "assets/Amy/Ch46_nonPBR.fbx";
+            std::string animationFile = "assets/Amy/walking.fbx";
+            int repetitions = 20;
+        };
+
+        Options parseOptions(int argc, char *argv[])
+        {
+            Options options;
+            for (int i = 0; i < argc; i++)
+            {
+                if (!std::strcmp(argv[i], "--repetitions") || !std::strcmp(argv[i], "--animation"))
+                {
+                    if (i + 1 >= argc)
+                        throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+                    if (!std::strcmp(argv[i], "--repetitions"))
+                        options.repetitions = std::max(1, std::atoi(argv[++i]));
+                    else
+                        options.animationFile = argv[++i];
+                }
+                else if (argv[i][0] != '-')
+                    options.file = argv[i];
+                else
+                    throw std::runtime_error(std::string("Unknown argument ") + argv[i]);
+            }
+            return options;
+        }
+
+        /// Largest absolute difference of any component
+        float maxError(const std::vector<glm::vec3> &a,
+                       const std::vector<glm::vec3> &b,
+                       const RenderableMesh &mesh)
+        {
+            float error = 0.0f;
+            for (const auto &submesh : mesh.m_meshes)
+            {
+                if (!submesh.is_skinned)
+                    continue;
+                for (unsigned i = submesh.base_vertex; i < submesh.base_vertex + submesh.nbr_vertices; i++)
+                {
+                    const glm::vec3 d = glm::abs(a[i] - b[i]);
+                    error = std::max(error, std::max(d.x, std::max(d.y, d.z)));
+                }
+            }
+            return error;
+        }
+
+        std::string describe(unsigned nbrVertices, double ms, float error)
+        {
+            char text[96];
+            std::snprintf(text, sizeof(text), "%.2f ns/vertex, max error vs scalar %g", ms * 1e6 / std::max(nbrVertices, 1u), error);
+            return text;
+        }
+    }
+
+    int skinning(int argc, char *argv[])
+    {
+        const Options options = parseOptions(argc, argv);
+
+        // Meshes are uploaded when loaded, so a context is needed
+        HeadlessContext context(64, 64);
+        auto mesh = std::make_shared<RenderableMesh>();
+        mesh->load(options.file, false);
+        if (!options.animationFile.empty())
+            mesh->load(options.animationFile, true);
+        if (!mesh->boneMatrices.size() || !mesh->m_bind_positions.size())
+            throw std::runtime_error(options.file + " is not skinned");
+
+        // Mid-clip pose, so that all bones contribute
+        const int clip = mesh->getNbrAnimations() ? 0 : -1;
+        mesh->animate(clip, 0.5f);
+
+        unsigned nbrVertices = 0;
+        for (const auto &submesh : mesh->m_meshes)
+            if (submesh.is_skinned)
+                nbrVertices += submesh.nbr_vertices;
+        std::printf("[%s, %u skinned vertices, %zu bones, median of %i]\n",
+                    options.file.c_str(),
+                    nbrVertices,
+                    mesh->boneMatrices.size(),
+                    options.repetitions);
+
+        const size_t size = mesh->m_bind_positions.size();
+        std::vector<glm::vec3> positions(size), normals(size), tangents(size), binormals(size);
+        const CpuSkinner::Input in{
+            mesh->m_bind_positions.data(),
+            mesh->m_bind_normals.data(),
+            mesh->m_bind_tangents.data(),
+            mesh->m_bind_binormals.data(),
+            mesh->m_bind_skindata.data()};
+        const CpuSkinner::Output out{positions.data(), normals.data(), tangents.data(), binormals.data()};
+
+        CpuSkinner skinner;
+        auto skinAll = [&](CpuSkinner::Backend backend)
+        {
+            for (const auto &submesh : mesh->m_meshes)
+                if (submesh.is_skinned)
+                    skinner.skin(backend, mesh->boneMatrices, in, out, submesh.base_vertex, submesh.base_vertex + submesh.nbr_vertices);
+        };
+
+        // Scalar reference. Errors are of positions.
+        std::vector<glm::vec3> reference;
+        const double scalarMs = timeMs([&]()
+                                       { skinAll(CpuSkinner::Backend::Scalar); },
+                                       options.repetitions);
+        reference = positions;
+        report("CPU scalar", scalarMs, describe(nbrVertices, scalarMs, 0.0f));
+
+        for (auto backend : {CpuSkinner::Backend::SSE, CpuSkinner::Backend::AVX2})
+        {
+            const std::string name = std::string("CPU ") + CpuSkinner::getBackendName(backend);
+            if (!CpuSkinner::isSupported(backend))
+            {
+                report(name, 0.0, "not supported");
+                continue;
+            }
+            const double ms = timeMs([&]()
+                                     { skinAll(backend); },
+                                     options.repetitions);
+            report(name, ms, describe(nbrVertices, ms, maxError(positions, reference, *mesh)));
+        }
+
+        // Transform feedback, timed to completion, with a new pose each time
+        // so that the cache is not skipped
+        if (!std::ifstream("shaders/skinning_vert.glsl"))
+        {
+            report("transform feedback", 0.0, "not available, shaders/ not found");
+            return 0;
+        }
+        ForwardRenderer renderer;
+        renderer.init("shaders/phong_vert.glsl", "shaders/phong_frag.glsl");
+        renderer.initSkinning("shaders/skinning_vert.glsl");
+        renderer.setSkinningMode(SkinningMode::TransformFeedback);
+        SkinnedVertexCache cache;
+        std::vector<double> times;
+        for (int i = 0; i < options.repetitions; i++)
+        {
+            // Posing on the CPU is not timed
+            mesh->animate(clip, 0.5f + 1e-3f * (i + 1));
+            glFinish();
+            const auto start = Clock::now();
+            renderer.beginSkinningPass();
+            renderer.skinMesh(mesh, cache);
+            renderer.endSkinningPass();
+            glFinish();
+            times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        const double tfMs = times[times.size() / 2];
+
+        // Compared against the last pose
+        skinAll(CpuSkinner::Backend::Scalar);
+        std::vector<glm::vec3> captured;
+        cache.readPositions(captured);
+        report("transform feedback", tfMs, describe(nbrVertices, tfMs, maxError(captured, positions, *mesh)));
+        return 0;
+    }
+
+} // namespace eeng::bench
@@ -0,0 +1,158 @@
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include "VectorTree.h"
+#include "Bench.hpp"
+
+namespace eeng::bench
+{
+    namespace
+    {
+        struct Node : public TreeNode
+        {
+            std::string name;
+
+            Node() = default;
+            Node(const std::string &name) : name(name) {}
+        };
+
+        /// Hierarchy with parents listed before their children
+        struct Hierarchy
+        {
+            const char *shape;
+            std::vector<Node> nodes;
+            std::vector<size_t> parents;
+        };
+
+        Hierarchy makeHierarchy(const char *shape,
+                                size_t nbrNodes,
+                                std::mt19937 &rng)
+        {
+            Hierarchy h{shape};
+            for (size_t i = 0; i < nbrNodes; i++)
+            {
+                size_t parent = EENG_NULL_INDEX;
+                if (i > 0)
+                {
+                    if (!std::strcmp(shape, "chain"))
+                        parent = i - 1;
+                    else if (!std::strcmp(shape, "wide"))
+                        parent = 0;
+                    else
+                        parent = std::uniform_int_distribution<size_t>(0, i - 1)(rng);
+                }
+                h.nodes.emplace_back("node" + std::to_string(i));
+                h.parents.push_back(parent);
+            }
+            return h;
+        }
+
+        VectorTree<Node> buildByInsertion(const Hierarchy &h)
+        {
+            VectorTree<Node> tree;
+            for (size_t i = 0; i < h.nodes.size(); i++)
+            {
+                const auto &parent_name = h.parents[i] == (size_t)EENG_NULL_INDEX ? std::string() : h.nodes[h.parents[i]].name;
+                if (!tree.insert(h.nodes[i], parent_name))
+                    throw std::runtime_error("Insertion failed");
+            }
+            return tree;
+        }
+
+        VectorTree<Node> buildInBulk(const Hierarchy &h)
+        {
+            VectorTree<Node> tree;
+            if (!tree.build(h.nodes, h.parents))
+                throw std::runtime_error("Build failed");
+            return tree;
+        }
+
+        /// Both trees have the same parent, child count and branch size for every node
+        bool sameStructure(const VectorTree<Node> &a,
+                           const VectorTree<Node> &b)
+        {
+            if (a.nodes.size() != b.nodes.size())
+                return false;
+            for (size_t i = 0; i < a.nodes.size(); i++)
+            {
+                const auto &na = a.nodes[i];
+                const size_t j = b.find_node_index(na.name);
+                if (j == (size_t)EENG_NULL_INDEX)
+                    return false;
+                const auto &nb = b.nodes[j];
+                if (na.m_nbr_children != nb.m_nbr_children ||
+                    na.m_branch_stride != nb.m_branch_stride ||
+                    (na.m_parent_ofs == 0) != (nb.m_parent_ofs == 0))
+                    return false;
+                if (na.m_parent_ofs &&
+                    a.nodes[i - na.m_parent_ofs].name != b.nodes[j - nb.m_parent_ofs].name)
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    void vectorTree()
+    {
+        const size_t nbrNodes = 10000;
+        std::mt19937 rng(1234);
+
+        for (const char *shape : {"chain", "wide", "random"})
+        {
+            const Hierarchy h = makeHierarchy(shape, nbrNodes, rng);
+            std::printf(" %s, %zu nodes\n", shape, nbrNodes);
+
+            VectorTree<Node> inserted, built;
+            report("insert() per node", timeMs([&]()
+                                               { inserted = buildByInsertion(h); }, 3));
+            report("build()", timeMs([&]()
+                                     { built = buildInBulk(h); }));
+
+            // Same nodes in shuffled order
+            Hierarchy shuffled{shape};
+            {
+                std::vector<size_t> order(nbrNodes), position(nbrNodes);
+                for (size_t i = 0; i < nbrNodes; i++)
+                    order[i] = i;
+                std::shuffle(order.begin(), order.end(), rng);
+                for (size_t i = 0; i < nbrNodes; i++)
+                    position[order[i]] = i;
+                for (size_t i : order)
+                {
+                    shuffled.nodes.push_back(h.nodes[i]);
+                    shuffled.parents.push_back(h.parents[i] == (size_t)EENG_NULL_INDEX ? EENG_NULL_INDEX : position[h.parents[i]]);
+                }
+            }
+            VectorTree<Node> builtShuffled;
+            report("build(), shuffled input", timeMs([&]()
+                                                     { builtShuffled = buildInBulk(shuffled); }));
+
+            if (!sameStructure(inserted, built) || !sameStructure(inserted, builtShuffled))
+                throw std::runtime_error(std::string("Tree structure mismatch for ") + shape);
+
+            // Look up every node by name, and by linear search as a reference
+            size_t hashedSum = 0, linearSum = 0;
+            const double hashedMs = timeMs([&]()
+                                           {
+                for (const auto& node : h.nodes)
+                    hashedSum += built.find_node_index(node.name); });
+            const double linearMs = timeMs([&]()
+                                           {
+                for (const auto& node : h.nodes)
+                {
+                    auto it = std::find_if(built.nodes.begin(), built.nodes.end(), [&](const Node& n)
+                                           { return n.name == node.name; });
+                    linearSum += std::distance(built.nodes.begin(), it);
+                } }, 1);
+            if (hashedSum / 5 != linearSum)
+                throw std::runtime_error(std::string("Lookup mismatch for ") + shape);
+            report("find_node_index() x" + std::to_string(nbrNodes), hashedMs);
+            report("linear search x" + std::to_string(nbrNodes), linearMs);
+        }
+    }
+
+} // namespace eeng::bench
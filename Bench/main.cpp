@@ -0,0 +1,108 @@
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include "Bench.hpp"
+
+namespace
+{
+    struct Benchmark
+    {
+        const char *name;
+        std::function<void()> run;
+    };
+
+    const Benchmark benchmarks[] = {
+        {"vectortree", eeng::bench::vectorTree},
+        {"names", eeng::bench::names},
+        {"hierarchy", eeng::bench::hierarchy},
+        {"bvh", eeng::bench::bvh},
+        {"quadtree", eeng::bench::quadtree},
+        {"raycast", eeng::bench::raycast},
+        {"log", eeng::bench::logging},
+        {"occlusion", eeng::bench::occlusion},
+        {"lods", eeng::bench::lods},
+    };
+
+    /// Subcommands that take arguments of their own and return an exit code
+    struct Command
+    {
+        const char *name;
+        const char *usage;
+        int (*run)(int argc, char *argv[]);
+    };
+
+    const Command commands[] = {
+        {"scene", "FILE [--json FILE] [--label TEXT] [--frames N]", eeng::bench::scene},
+        {"load", "FILE [FILE ...] [--repetitions N]", eeng::bench::load},
+        {"import", "FILE [--streaming] [--weld off|exact|quantized]", eeng::bench::importPeak},
+        {"shaders", "[--repetitions N] [--cache DIR]", eeng::bench::shaders},
+        {"skinning", "[FILE] [--animation FILE] [--repetitions N]", eeng::bench::skinning},
+    };
+
+    /// Run a benchmark or command, reporting exceptions as failures
+    template <class F>
+    int run(F &&func)
+    {
+        try
+        {
+            return func();
+        }
+        catch (const std::exception &e)
+        {
+            std::printf("  failed: %s\n", e.what());
+            return 1;
+        }
+    }
+}
+
+/// Usage: eeng_bench [benchmark ...]
+/// Runs all benchmarks if none are given.
+///        eeng_bench scene FILE [--json FILE] [--label TEXT] [--frames N]
+/// Renders a scene description headless, see SceneScript. Needs a GL driver,
+/// and assets and shaders relative to the working directory.
+///        eeng_bench load FILE [FILE ...] [--repetitions N]
+/// Loads models serially and in parallel and compares the load phases.
+///        eeng_bench import FILE [--streaming] [--weld off|exact|quantized]
+/// Loads a model once and reports peak memory, e.g. with and without streaming.
+///        eeng_bench shaders [--repetitions N] [--cache DIR]
+/// Times creating the renderer's programs without a cache, and with it cold and warm.
+///        eeng_bench skinning [FILE] [--animation FILE] [--repetitions N]
+/// Skins the Amy character, or FILE, with the CPU backends and transform feedback.
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        for (const auto &command : commands)
+            if (!std::strcmp(argv[1], command.name))
+                return run([&]()
+                           { return command.run(argc - 2, argv + 2); });
+
+    bool ran = false;
+    for (const auto &benchmark : benchmarks)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+            selected |= !std::strcmp(argv[i], benchmark.name);
+        if (!selected)
+            continue;
+
+        std::printf("[%s]\n", benchmark.name);
+        if (run([&]()
+                { benchmark.run(); return 0; }))
+            return 1;
+        ran = true;
+    }
+
+    if (!ran)
+    {
+        std::printf("Usage: %s [benchmark ...]\nBenchmarks:", argv[0]);
+        for (const auto &benchmark : benchmarks)
+            std::printf(" %s", benchmark.name);
+        std::printf("\n");
+        for (const auto &command : commands)
+            std::printf("       %s %s %s\n", argv[0], command.name, command.usage);
+        return 1;
+    }
+    return 0;
+}
@@ -1,28 +1,66 @@
+#include <cmath>
+#include <chrono>
 #include "glmcommon.h"
 #include "imgui.h"
 #include "Scene.hpp"
+#include "Log.hpp"
+#include "MeshSimplifier.hpp"
+#include "Profiler.hpp"
 
-bool Scene::init()
+namespace
 {
-    // Do some entt stuff
-    entt::registry registry;
-    auto ent1 = registry.create();
-    struct Tfm
+    /// Log reported and measured simplification errors of all LOD levels of a mesh
+    void logLodErrors(const eeng::RenderableMesh& mesh)
+    {
+        for (const auto& submesh : mesh.m_meshes)
+        {
+            const auto positions = &mesh.m_bind_positions[submesh.base_vertex];
+            const auto indices = &mesh.m_indices[submesh.base_index];
+            for (unsigned i = 0; i < submesh.lods.size(); i++)
+            {
+                const auto& lod = submesh.lods[i];
+                const float deviation = eeng::MeshSimplifier::measureDeviation(positions,
+                    indices,
+                    submesh.nbr_indices,
+                    &mesh.m_indices[lod.base_index],
+                    lod.nbr_indices);
+                eeng::Log::log("LOD %u: %u triangles, error bound %g, measured %g %s",
+                    i + 1,
+                    lod.nbr_indices / 3,
+                    lod.error,
+                    deviation,
+                    deviation <= lod.error ? "" : "(exceeds bound)");
+            }
+        }
+    }
+
+    eeng::Transform makeTransform(const glm::vec3& position, float angle, const glm::vec3& scale)
     {
-        float x, y, z;
-    };
-    registry.emplace<Tfm>(ent1, Tfm{});
+        eeng::Transform transform;
+        transform.position = position;
+        transform.angle = angle;
+        transform.scale = scale;
+        return transform;
+    }
+}
+
+bool Scene::init()
+{
+    eeng::prepareSystems(registry);
 
     // Grass
     grassMesh = std::make_shared<eeng::RenderableMesh>();
+    grassMesh->setLodGeneration(true);
     grassMesh->load("assets/grass/grass_trees_merged2.fbx", false);
 
     // Horse
     horseMesh = std::make_shared<eeng::RenderableMesh>();
+    horseMesh->setLodGeneration(true);
     horseMesh->load("assets/Animals/Horse.fbx", false);
 
     // Character
     characterMesh = std::make_shared<eeng::RenderableMesh>();
+    characterMesh->setLodGeneration(true);
 #if 0
     // Sponza
     characterMesh->load("/Users/ag1498/Dropbox/MAU/DA307A-CGM/Rendering/eduRend_2022/assets/crytek-sponza/sponza.obj", false);
@@ -66,10 +104,104 @@ bool Scene::init()
     characterMesh->remove_translation_keys("mixamorig:Hips");
 #endif
 
+    // Grass, also the occluder of the scene
+    {
+        auto entity = createMeshEntity(grassMesh, makeTransform({ 0.0f, 0.0f, 0.0f }, 0.0f, { 100.0f, 100.0f, 100.0f }));
+        registry.get<eeng::MeshRef>(entity).isOccluder = true;
+    }
+
+    // Horse
+    {
+        createAnimatedEntity(horseMesh, makeTransform({ 30.0f, 0.0f, -35.0f }, 35.0f, { 0.01f, 0.01f, 0.01f }), 3);
+    }
+
+    // Characters, rotated in update()
+    {
+        auto group = registry.create();
+        registry.emplace<eeng::Transform>(group);
+        const float xs[] = { 0.0f, -3.0f, 3.0f };
+        const int clipIndices[] = { -1, 1, 2 };
+        for (int i = 0; i < 3; i++)
+            characterEntities.push_back(createAnimatedEntity(characterMesh, makeTransform({ xs[i], 0.0f, 0.0f }, 0.0f, { 0.03f, 0.03f, 0.03f }), clipIndices[i], group));
+        characterEntity1 = characterEntities[0];
+    }
+
     return true;
 }
 
+entt::entity Scene::createMeshEntity(
+    const std::shared_ptr<eeng::RenderableMesh>& mesh,
+    const eeng::Transform& transform,
+    entt::entity parent)
+{
+    auto entity = registry.create();
+    registry.emplace<eeng::Transform>(entity, transform);
+    eeng::setParent(registry, entity, parent);
+    registry.emplace<eeng::MeshRef>(entity, eeng::MeshRef{ mesh });
+    // Bind pose bounds
+    registry.emplace<eeng::Bounds>(entity, eeng::Bounds{ mesh->mSceneAABB ? mesh->mSceneAABB : mesh->m_model_aabb });
+    eeng::addToBvh(registry, entity, bvh);
+    return entity;
+}
+
+entt::entity Scene::createAnimatedEntity(
+    const std::shared_ptr<eeng::RenderableMesh>& mesh,
+    const eeng::Transform& transform,
+    int clipIndex,
+    entt::entity parent)
+{
+    auto entity = createMeshEntity(mesh, transform, parent);
+    registry.emplace<eeng::Animator>(entity).clipIndex = clipIndex;
+    // Bounds of all poses, since clips may change
+    registry.get<eeng::Bounds>(entity).local = mesh->m_animated_aabb;
+    return entity;
+}
+
+void Scene::createStressEntities(int count)
+{
+    destroyStressEntities();
+
+    // Herds of 4x4 horses on a grid centered in front of the camera
+    const int herdSize = 16;
+    const int nbrHerds = (count + herdSize - 1) / herdSize;
+    const int gridSize = (int)std::ceil(std::sqrt((float)nbrHerds));
+    const float herdSpacing = 12.0f, horseSpacing = 2.5f;
+    for (int i = 0; i < nbrHerds; i++)
+    {
+        auto herd = registry.create();
+        const glm::vec3 herdPosition{ (i % gridSize - 0.5f * gridSize) * herdSpacing, 0.0f, -(i / gridSize) * herdSpacing - 20.0f };
+        registry.emplace<eeng::Transform>(herd, makeTransform(herdPosition, 0.0f, { 1.0f, 1.0f, 1.0f }));
+        stressHerds.push_back(herd);
+
+        for (int j = 0; j < herdSize && (int)stressEntities.size() < count; j++)
+        {
+            const glm::vec3 position{ (j % 4 - 1.5f) * horseSpacing, 0.0f, (j / 4 - 1.5f) * horseSpacing };
+            stressEntities.push_back(createAnimatedEntity(horseMesh, makeTransform(position, 0.0f, { 0.01f, 0.01f, 0.01f }), 3, herd));
+        }
+    }
+}
+
+void Scene::destroyStressEntities()
+{
+    for (auto entity : stressEntities)
+        eeng::removeFromBvh(registry, entity, bvh);
+    registry.destroy(stressEntities.begin(), stressEntities.end());
+    registry.destroy(stressHerds.begin(), stressHerds.end());
+    stressEntities.clear();
+    stressHerds.clear();
+}
+
 void Scene::update(float time_s, float deltaTime_s)
+{
+    eeng::storePreviousState(registry);
+    updateLogic(time_s);
+    eeng::updateTransforms(registry);
+    eeng::updateAnimators(registry, deltaTime_s);
+    eeng::updateBounds(registry);
+    eeng::updateBvh(registry, bvh);
+}
+
+void Scene::updateLogic(float time_s)
 {
     lightPos = glm::vec3(TRS(
         { 1000.0f, 1000.0f, 1000.0f },
@@ -83,41 +215,162 @@ void Scene::update(float time_s, float deltaTime_s)
         { 1.0f, 0.0f, 0.0f },
         { 1.0f, 1.0f, 1.0f }) * glm::vec4{ 0.0f, 0.0f, 0.0f, 1.0f });
 
-    grassWorldMatrix = TRS(
-        { 0.0f, 0.0f, 0.0f },
-        0.0f,
-        { 0, 1, 0 },
-        { 100.0f, 100.0f, 100.0f });
-
-    horseWorldMatrix = TRS(
-        { 30.0f, 0.0f, -35.0f },
-        35.0f,
-        { 0, 1, 0 },
-        { 0.01f, 0.01f, 0.01f });
-
-    characterWorldMatrix1 = TRS(
-        { 0, 0, 0 },
-        time_s * 50.0f,
-        { 0, 1, 0 },
-        { 0.03f, 0.03f, 0.03f });
-
-    characterWorldMatrix2 = TRS(
-        { -3, 0, 0 },
-        0.0f,
-        { 0, 1, 0 },
-        { 1.0f, 1.0f, 1.0f }) * characterWorldMatrix1;
-
-    characterWorldMatrix3 = TRS(
-        { 6, 0, 0 },
-        0.0f,
-        { 0, 1, 0 },
-        { 1.0f, 1.0f, 1.0f }) * characterWorldMatrix2;
+    // Characters rotate in place
+    for (auto entity : characterEntities)
+    {
+        registry.get<eeng::Transform>(entity).angle = time_s * 50.0f;
+        registry.get<eeng::Animator>(entity).speed = characterAnimSpeed;
+    }
+    registry.get<eeng::Animator>(characterEntity1).clipIndex = characterAnimIndex;
+
+    for (auto entity : stressHerds)
+        registry.get<eeng::Transform>(entity).angle = time_s * 10.0f;
 }
 
 void Scene::renderUI()
 {
     ImGui::Text("Drawcall count %i", drawcallCount);
 
+    // Entities and systems
+    ImGui::Text("Entities %i, with meshes %i, frustum culled %i",
+        (int)registry.view<eeng::Transform>().size(),
+        renderSystemStats.entities,
+        renderSystemStats.culled);
+    ImGui::Checkbox("BVH frustum culling", &bvhCulling);
+    {
+        const auto& stats = bvh.getStats();
+        ImGui::Text("BVH %i proxies, %i nodes, depth %i, SAH cost %.1f",
+            stats.proxies,
+            stats.nodes,
+            stats.depth,
+            stats.sahCost);
+        ImGui::Text("BVH build %.3f ms (%i), refit %.3f ms (%i)",
+            stats.buildMs,
+            stats.builds,
+            stats.refitMs,
+            stats.refits);
+    }
+    ImGui::Checkbox("Mouse picking", &mousePicking);
+    if (mousePicking)
+    {
+        if (pickedEntity != entt::null)
+            ImGui::Text("Picked entity %u, mesh %i, triangle %u, bone %i, distance %.2f, %.3f ms",
+                entt::to_integral(pickedEntity),
+                pickHit.mesh,
+                pickHit.triangle,
+                pickHit.bone,
+                pickDistance,
+                pickMs);
+        else
+            ImGui::Text("Picked nothing, %.3f ms", pickMs);
+    }
+
+    ImGui::SliderInt("Stress test entities", &stressEntityCount, 0, 50000);
+    if (ImGui::Button("Create stress test entities"))
+        createStressEntities(stressEntityCount);
+    ImGui::SameLine();
+    if (ImGui::Button("Remove"))
+        destroyStressEntities();
+
+    ImGui::Checkbox("Depth pre-pass", &depthPrepass);
+    ImGui::Checkbox("Front-to-back", &frontToBack);
+    ImGui::Checkbox("Overdraw visualization", &overdrawVisualization);
+    ImGui::Text("Overdraw %.2f shaded samples/pixel", passStats.overdraw);
+
+    ImGui::Checkbox("LOD selection", &lodSelection);
+    ImGui::SliderInt("Forced LOD", &forcedLod, -1, 3);
+    ImGui::Text("Triangles %u", passStats.triangles);
+    if (ImGui::Button("Check LOD errors"))
+        checkLodErrors = true;
+
+    ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+    if (occlusionCulling)
+    {
+        const int culled = occlusionStats.frustumCulled + occlusionStats.occluded;
+        ImGui::Text("Culled %i of %i (frustum %i, occluded %i), %.0f%%",
+            culled,
+            occlusionStats.tested,
+            occlusionStats.frustumCulled,
+            occlusionStats.occluded,
+            occlusionStats.tested ? 100.0f * culled / occlusionStats.tested : 0.0f);
+        ImGui::Text("Occluders %u triangles, raster %.3f ms, test %.3f ms",
+            occlusionStats.occluderTriangles,
+            occlusionStats.rasterTimeMs,
+            occlusionStats.testTimeMs);
+    }
+
+    ImGui::Checkbox("Skinning pre-pass", &skinningPrepass);
+    if (skinningPrepass)
+    {
+        const char* modeNames[] = { "Transform feedback", "CPU" };
+        int modeIndex = (int)skinningMode;
+        if (ImGui::Combo("Skinning mode", &modeIndex, modeNames, IM_ARRAYSIZE(modeNames)))
+            skinningMode = (eeng::SkinningMode)modeIndex;
+
+        if (skinningMode == eeng::SkinningMode::CPU)
+        {
+            const eeng::CpuSkinner::Backend backends[] = {
+                eeng::CpuSkinner::Backend::Scalar,
+                eeng::CpuSkinner::Backend::SSE,
+                eeng::CpuSkinner::Backend::AVX2 };
+            if (ImGui::BeginCombo("CPU backend", eeng::CpuSkinner::getBackendName(cpuSkinningBackend)))
+            {
+                for (auto backend : backends)
+                {
+                    if (!eeng::CpuSkinner::isSupported(backend))
+                        continue;
+                    const bool isSelected = (backend == cpuSkinningBackend);
+                    if (ImGui::Selectable(eeng::CpuSkinner::getBackendName(backend), isSelected))
+                        cpuSkinningBackend = backend;
+                    if (isSelected)
+                        ImGui::SetItemDefaultFocus();
+                }
+                ImGui::EndCombo();
+            }
+            if (ImGui::Button("Verify against scalar"))
+                verifyCpuSkinning = true;
+        }
+
+        ImGui::Text("Skinned %i instances (%u vertices), skipped %i",
+            skinningStats.instancesSkinned,
+            skinningStats.verticesSkinned,
+            skinningStats.instancesSkipped);
+        ImGui::Text("Skinning CPU %.3f ms, GPU %.3f ms",
+            skinningStats.cpuTimeMs,
+            skinningStats.gpuTimeMs);
+    }
+
+    // Node hierarchy updates
+    {
+        const std::pair<const char*, std::shared_ptr<eeng::RenderableMesh>> meshes[] = {
+            { "Grass", grassMesh }, { "Horse", horseMesh }, { "Character", characterMesh } };
+
+        bool incrementalUpdates = characterMesh ? characterMesh->getIncrementalUpdates() : true;
+        if (ImGui::Checkbox("Incremental hierarchy updates", &incrementalUpdates))
+        {
+            for (const auto& [name, mesh] : meshes)
+            {
+                if (!mesh)
+                    continue;
+                mesh->setIncrementalUpdates(incrementalUpdates);
+                mesh->resetHierarchyStats();
+            }
+        }
+        for (const auto& [name, mesh] : meshes)
+        {
+            if (!mesh)
+                continue;
+            const auto& stats = mesh->getHierarchyStats();
+            ImGui::Text("%s: updated %u of %zu nodes, %u evaluations, %u skipped, %.1f nodes/evaluation",
+                name,
+                stats.nodes_updated,
+                mesh->m_nodetree.nodes.size(),
+                stats.evaluations,
+                stats.skipped,
+                stats.evaluations ? double(stats.total_updated) / stats.evaluations : 0.0);
+        }
+    }
+
     if (ImGui::ColorEdit3("Light color",
         glm::value_ptr(lightColor),
         ImGuiColorEditFlags_NoInputs))
@@ -162,45 +415,272 @@ void Scene::render(
     int screenHeight,
     eeng::ForwardRendererPtr renderer)
 {
-    // int ANIM_INDEX = -1;
-    // float ANIM_SPEED = 1.0f;
-    // glm::vec3 LIGHT_COLOR{ 1.0f, 1.0f, 1.0f };
+    skinningPass(screenWidth, screenHeight, renderer);
+    mainPass(screenWidth, screenHeight, renderer);
+}
+
+void Scene::scheduleStep(
+    eeng::SystemScheduler& scheduler,
+    float time_s,
+    float deltaTime_s)
+{
+    using namespace eeng;
+
+    // Scene state such as camera and options is declared as the resource Scene
+    scheduler.addSystem("previous state",
+        [this]() { storePreviousState(registry); },
+        resources<>(),
+        resources<Transform, Animator>());
+    scheduler.addSystem("logic",
+        [this, time_s]() { updateLogic(time_s); },
+        resources<>(),
+        resources<Scene, Transform, Animator>());
+    scheduler.addSystem("animators",
+        [this, deltaTime_s]() { updateAnimators(registry, deltaTime_s); },
+        resources<>(),
+        resources<Animator>());
+}
+
+void Scene::scheduleFrame(
+    eeng::SystemScheduler& scheduler,
+    float time_s,
+    float alpha,
+    int screenWidth,
+    int screenHeight,
+    eeng::ForwardRendererPtr renderer)
+{
+    using namespace eeng;
+
+    // Rendering uses GL, and the renderer is declared as written by both
+    // passes, so that they run in order on the main thread.
+    scheduleInterpolation(scheduler, alpha);
+    scheduler.addSystem("skinning",
+        [this, screenWidth, screenHeight, renderer]() { skinningPass(screenWidth, screenHeight, renderer); },
+        resources<Scene, MeshRef, Bounds>(),
+        resources<Animator, RenderableMesh, ForwardRenderer>(),
+        true);
+    scheduler.addSystem("render",
+        [this, screenWidth, screenHeight, renderer]() { mainPass(screenWidth, screenHeight, renderer); },
+        resources<Scene, Transform, Bounds, Animator, DynamicBvh>(),
+        resources<MeshRef, RenderableMesh, ForwardRenderer>(),
+        true);
+}
+
+void Scene::scheduleCapture(
+    eeng::SystemScheduler& scheduler,
+    float time_s,
+    float alpha,
+    int screenWidth,
+    int screenHeight,
+    int slot)
+{
+    using namespace eeng;
 
+    // Scheduled on the thread of the UI, so its mouse state is read here
+    const auto& io = ImGui::GetIO();
+    const glm::vec2 mousePos{ io.MousePos.x, io.MousePos.y };
+    const bool mouseOverUI = io.WantCaptureMouse;
+
+    // Meshes are animated to capture their poses, so capturing runs on the
+    // simulation thread, which is the only one posing meshes while pipelined
+    scheduleInterpolation(scheduler, alpha);
+    scheduler.addSystem("capture",
+        [this, slot, screenWidth, screenHeight, mousePos, mouseOverUI]() { capturePass(snapshots[slot], screenWidth, screenHeight, mousePos, mouseOverUI); },
+        resources<Scene, Transform, Bounds, Animator, DynamicBvh>(),
+        resources<MeshRef, RenderableMesh, RenderSnapshot>(),
+        true);
+}
 
+void Scene::renderSnapshot(
+    int slot,
+    int screenWidth,
+    int screenHeight,
+    eeng::ForwardRendererPtr renderer)
+{
+    auto& snapshot = snapshots[slot];
+
+    // The skinning pre-pass poses meshes, so it is skipped while pipelined
+    beginRenderPass(*renderer, snapshot.ProjMatrix, snapshot.ViewMatrix, snapshot.lightPos, snapshot.lightColor, snapshot.eyePos);
+
+    eeng::renderSnapshot(snapshot, *renderer);
+    renderSystemStats = snapshot.stats;
+
+    endRenderPass(*renderer);
+}
+
+void Scene::scheduleInterpolation(
+    eeng::SystemScheduler& scheduler,
+    float alpha)
+{
+    using namespace eeng;
+
+    // Transforms and poses are interpolated between the two latest steps
+    scheduler.addSystem("transforms",
+        [this, alpha]() { updateTransforms(registry, alpha); },
+        resources<>(),
+        resources<Transform>());
+    scheduler.addSystem("pose interpolation",
+        [this, alpha]() { interpolateAnimators(registry, alpha); },
+        resources<>(),
+        resources<Animator>());
+    scheduler.addSystem("bounds",
+        [this]() { updateBounds(registry); },
+        resources<Transform, MeshRef>(),
+        resources<Bounds>());
+    scheduler.addSystem("bvh",
+        [this]() { updateBvh(registry, bvh); },
+        resources<Transform, MeshRef, Bounds>(),
+        resources<DynamicBvh>());
+}
+
+void Scene::getCamera(
+    int screenWidth,
+    int screenHeight,
+    glm::mat4& P,
+    glm::mat4& V) const
+{
     // Projection matrix
     const float aspectRatio = float(screenWidth) / screenHeight;
-    const glm::mat4 P = glm::perspective(glm::radians(60.0f), aspectRatio, nearPlane, farPlane);
+    P = glm::perspective(glm::radians(60.0f), aspectRatio, nearPlane, farPlane);
 
     // View matrix
-    const glm::mat4 V = glm::inverse(TRS(eyePos, 0.0f, { 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }));
+    V = glm::inverse(TRS(eyePos, 0.0f, { 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }));
+}
+
+void Scene::beginRenderPass(
+    eeng::ForwardRenderer& renderer,
+    const glm::mat4& P,
+    const glm::mat4& V,
+    const glm::vec3& passLightPos,
+    const glm::vec3& passLightColor,
+    const glm::vec3& passEyePos)
+{
+    renderer.setDepthPrepass(depthPrepass);
+    renderer.setDrawOrder(frontToBack ? eeng::DrawOrder::FrontToBack : eeng::DrawOrder::Submission);
+    renderer.setOverdrawVisualization(overdrawVisualization);
+    renderer.setOcclusionCulling(occlusionCulling);
+    renderer.setLodSelection(lodSelection);
+    renderer.setForcedLod(forcedLod);
+    renderer.beginPass(P, V, passLightPos, passLightColor, passEyePos);
+}
 
-    // Begin rendering pass
-    renderer->beginPass(P, V, lightPos, lightColor, eyePos);
+void Scene::endRenderPass(eeng::ForwardRenderer& renderer)
+{
+    drawcallCount = renderer.endPass();
+    passStats = renderer.getPassStats();
+    occlusionStats = renderer.getOcclusionStats();
 
-    // Grass
-    renderer->renderMesh(grassMesh, grassWorldMatrix);
+    if (checkLodErrors)
+    {
+        logLodErrors(*characterMesh);
+        checkLodErrors = false;
+    }
+}
 
-    // Horse
-    horseMesh->animate(3, time_s);
-    renderer->renderMesh(horseMesh, horseWorldMatrix);
+void Scene::skinningPass(
+    int screenWidth,
+    int screenHeight,
+    eeng::ForwardRendererPtr renderer)
+{
+    // Skinning pre-pass
+    // Pose and skin each animated instance once, so that all passes that
+    // follow can draw them as static geometry. Node transforms are cached
+    // with the vertices, for submeshes that are animated by nodes.
+    if (skinningPrepass)
+    {
+        EENG_PROFILE_SCOPE("Skinning");
+        EENG_PROFILE_GPU_SCOPE("Skinning");
+        renderer->setSkinningMode(skinningMode, cpuSkinningBackend);
+        renderer->beginSkinningPass();
 
-    // Character, instance 1
-    characterMesh->animate(characterAnimIndex, time_s * characterAnimSpeed);
-    renderer->renderMesh(characterMesh, characterWorldMatrix1);
+        glm::mat4 P, V;
+        getCamera(screenWidth, screenHeight, P, V);
+        eeng::skinEntities(registry, *renderer, P * V);
+        if (verifyCpuSkinning)
+        {
+            // Verifies the latest pose of the character mesh
+            eeng::Log::log("CPU skinning %s, max error vs scalar %g",
+                eeng::CpuSkinner::getBackendName(cpuSkinningBackend),
+                renderer->verifyCpuSkinning(characterMesh));
+            verifyCpuSkinning = false;
+        }
 
-    // Character, instance 2
-    characterMesh->animate(1, time_s * characterAnimSpeed);
-    renderer->renderMesh(characterMesh, characterWorldMatrix2);
+        skinningStats = renderer->endSkinningPass();
+    }
+}
 
-    // Character, instance 3
-    characterMesh->animate(2, time_s * characterAnimSpeed);
-    renderer->renderMesh(characterMesh, characterWorldMatrix3);
+void Scene::mainPass(
+    int screenWidth,
+    int screenHeight,
+    eeng::ForwardRendererPtr renderer)
+{
+    glm::mat4 P, V;
+    getCamera(screenWidth, screenHeight, P, V);
 
-    // End rendering pass
-    drawcallCount = renderer->endPass();
+    beginRenderPass(*renderer, P, V, lightPos, lightColor, eyePos);
+
+    renderSystemStats = eeng::renderEntities(registry, *renderer, P * V, skinningPrepass, bvhCulling ? &bvh : nullptr);
+    if (mousePicking)
+    {
+        const auto& io = ImGui::GetIO();
+        pickUnderMouse(screenWidth, screenHeight, P * V, { io.MousePos.x, io.MousePos.y }, io.WantCaptureMouse);
+    }
+
+    endRenderPass(*renderer);
 }
 
-void Scene::destroy()
+void Scene::capturePass(
+    eeng::RenderSnapshot& snapshot,
+    int screenWidth,
+    int screenHeight,
+    const glm::vec2& mousePos,
+    bool mouseOverUI)
 {
+    EENG_PROFILE_SCOPE("Capture");
+    glm::mat4 P, V;
+    getCamera(screenWidth, screenHeight, P, V);
+
+    eeng::captureEntities(registry, P * V, bvhCulling ? &bvh : nullptr, snapshot);
+    snapshot.ProjMatrix = P;
+    snapshot.ViewMatrix = V;
+    snapshot.eyePos = eyePos;
+    snapshot.lightPos = lightPos;
+    snapshot.lightColor = lightColor;
+
+    if (mousePicking)
+        pickUnderMouse(screenWidth, screenHeight, P * V, mousePos, mouseOverUI);
+}
 
+void Scene::pickUnderMouse(
+    int screenWidth,
+    int screenHeight,
+    const glm::mat4& ProjViewMatrix,
+    const glm::vec2& mousePos,
+    bool mouseOverUI)
+{
+    if (mouseOverUI)
+        return;
+
+    // Ray from the near to the far plane through the cursor, with ray
+    // parameters in [0, 1]
+    const float x = 2.0f * mousePos.x / screenWidth - 1.0f;
+    const float y = 1.0f - 2.0f * mousePos.y / screenHeight;
+    const glm::mat4 invPV = glm::inverse(ProjViewMatrix);
+    glm::vec4 nearPoint = invPV * glm::vec4(x, y, -1.0f, 1.0f);
+    glm::vec4 farPoint = invPV * glm::vec4(x, y, 1.0f, 1.0f);
+    const glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    const glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    const auto start = std::chrono::high_resolution_clock::now();
+    pickHit = eeng::RenderableMesh::MeshHit{ 1.0f };
+    pickedEntity = eeng::pickEntity(registry, bvh, origin, direction, pickHit);
+    pickMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    pickDistance = pickHit.t * glm::length(direction);
+}
+
+void Scene::destroy()
+{
+    // Release skinned vertex caches while there is a GL context
+    destroyStressEntities();
+    registry.clear();
 }
\ No newline at end of file
@@ -2,9 +2,11 @@
 #define Scene_hpp
 #pragma once
 
+#include <vector>
 #include <entt/entt.hpp> // -> Scene source
 #include "SceneBase.h"
 #include "RenderableMesh.hpp"
+#include "SceneSystems.hpp"
 
 class Scene : public eeng::SceneBase
 {
@@ -13,8 +15,24 @@ protected:
 
     std::shared_ptr<eeng::RenderableMesh> grassMesh, horseMesh, characterMesh;
 
-    glm::mat4 characterWorldMatrix1, characterWorldMatrix2, characterWorldMatrix3;
-    glm::mat4 grassWorldMatrix, horseWorldMatrix;
+    entt::entity characterEntity1 = entt::null;
+    std::vector<entt::entity> characterEntities;
+
+    // Stress test: herds of animated horses, each herd rotating about its center
+    int stressEntityCount = 1000;
+    std::vector<entt::entity> stressHerds, stressEntities;
+
+    eeng::RenderSystemStats renderSystemStats;
+
+    // Entities with meshes, for culling and spatial queries
+    eeng::DynamicBvh bvh;
+    bool bvhCulling = true;
+
+    // Picking of the entity under the mouse cursor
+    bool mousePicking = false;
+    entt::entity pickedEntity = entt::null;
+    eeng::RenderableMesh::MeshHit pickHit{ 0.0f };
+    float pickDistance = 0.0f, pickMs = 0.0f;
 
     glm::vec3 lightPos, eyePos;
     glm::vec3 lightColor{ 1.0f, 1.0f, 0.8f };
@@ -25,6 +43,27 @@ protected:
     float characterAnimSpeed = 1.0f;
     int drawcallCount = 0;
 
+    // Pass options
+    bool depthPrepass = false;
+    bool frontToBack = false;
+    bool overdrawVisualization = false;
+    bool occlusionCulling = false;
+    bool lodSelection = false;
+    int forcedLod = -1;
+    bool checkLodErrors = false;
+    eeng::PassStats passStats;
+    eeng::OcclusionStats occlusionStats;
+
+    // Draw lists captured by the simulation thread when pipelined
+    eeng::RenderSnapshot snapshots[2];
+
+    // Skinning pre-pass: one cache per animated entity
+    bool skinningPrepass = false;
+    eeng::SkinningStats skinningStats;
+    eeng::SkinningMode skinningMode = eeng::SkinningMode::TransformFeedback;
+    eeng::CpuSkinner::Backend cpuSkinningBackend = eeng::CpuSkinner::getBestBackend();
+    bool verifyCpuSkinning = false;
+
 public:
     bool init() override;
 
@@ -38,7 +77,109 @@ public:
         int screenHeight,
         eeng::ForwardRendererPtr renderer) override;
 
+    void scheduleStep(
+        eeng::SystemScheduler& scheduler,
+        float time_s,
+        float deltaTime_s) override;
+
+    void scheduleFrame(
+        eeng::SystemScheduler& scheduler,
+        float time_s,
+        float alpha,
+        int screenWidth,
+        int screenHeight,
+        eeng::ForwardRendererPtr renderer) override;
+
+    bool supportsPipelining() const override { return true; }
+
+    void scheduleCapture(
+        eeng::SystemScheduler& scheduler,
+        float time_s,
+        float alpha,
+        int screenWidth,
+        int screenHeight,
+        int slot) override;
+
+    void renderSnapshot(
+        int slot,
+        int screenWidth,
+        int screenHeight,
+        eeng::ForwardRendererPtr renderer) override;
+
     void destroy() override;
+
+private:
+    /// @brief Animate the camera, light and entity transforms of the scene
+    void updateLogic(float time_s);
+
+    /// @brief Interpolate between the two latest steps, and update bounds and the BVH
+    void scheduleInterpolation(
+        eeng::SystemScheduler& scheduler,
+        float alpha);
+
+    /// @brief Camera projection and view
+    void getCamera(
+        int screenWidth,
+        int screenHeight,
+        glm::mat4& P,
+        glm::mat4& V) const;
+
+    /// @brief Pose and skin animated entities, if the skinning pre-pass is enabled
+    void skinningPass(
+        int screenWidth,
+        int screenHeight,
+        eeng::ForwardRendererPtr renderer);
+
+    /// @brief Apply the pass options to the renderer and begin a pass
+    void beginRenderPass(
+        eeng::ForwardRenderer& renderer,
+        const glm::mat4& P,
+        const glm::mat4& V,
+        const glm::vec3& passLightPos,
+        const glm::vec3& passLightColor,
+        const glm::vec3& passEyePos);
+
+    /// @brief End a pass and collect its statistics
+    void endRenderPass(eeng::ForwardRenderer& renderer);
+
+    /// @brief Render all entities
+    void mainPass(
+        int screenWidth,
+        int screenHeight,
+        eeng::ForwardRendererPtr renderer);
+
+    /// @brief Capture visible entities, camera and light into a snapshot
+    void capturePass(
+        eeng::RenderSnapshot& snapshot,
+        int screenWidth,
+        int screenHeight,
+        const glm::vec2& mousePos,
+        bool mouseOverUI);
+
+    /// @brief Pick the entity under the mouse cursor
+    /// @param mouseOverUI The mouse is captured by the UI, so nothing is picked
+    void pickUnderMouse(
+        int screenWidth,
+        int screenHeight,
+        const glm::mat4& ProjViewMatrix,
+        const glm::vec2& mousePos,
+        bool mouseOverUI);
+
+    entt::entity createMeshEntity(
+        const std::shared_ptr<eeng::RenderableMesh>& mesh,
+        const eeng::Transform& transform,
+        entt::entity parent = entt::null);
+
+    /// @brief Create a mesh entity with an Animator, bounded by all poses of the mesh
+    entt::entity createAnimatedEntity(
+        const std::shared_ptr<eeng::RenderableMesh>& mesh,
+        const eeng::Transform& transform,
+        int clipIndex,
+        entt::entity parent = entt::null);
+
+    void createStressEntities(int count);
+
+    void destroyStressEntities();
 };
 
 #endif
\ No newline at end of file
@@ -1,5 +1,12 @@
 
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
+#include <cstdio>
 #include "config.h"
 #include "glcommon.h"
 #ifdef EENG_GLVERSION_43
@@ -17,13 +24,22 @@
 
 #include "Log.hpp"
 #include "ForwardRenderer.hpp"
+#include "SystemScheduler.hpp"
+#include "HeadlessContext.hpp"
+#include "OffscreenTarget.hpp"
+#include "GLStateCache.hpp"
+#include "Profiler.hpp"
+#include "FramePacer.hpp"
+#include "FramePipeline.hpp"
 #include "Scene.hpp"
 
 const int WINDOW_WIDTH = 1600;
 const int WINDOW_HEIGHT = 900;
-float FRAMETIME_MIN_MS = 1000.0f / 60;
 bool WIREFRAME = false;
 bool SOUND_PLAY = false;
+#ifdef EENG_PROFILER
+bool showProfiler = false;
+#endif
 SDL_GameController* controller1;
 
 namespace
@@ -42,10 +58,243 @@ namespace
 
         return nullptr;
     }
+
+    /// Command line options
+    struct Options
+    {
+        bool headless = false;
+        int frames = 600;           ///< Frames to render headless
+        int width = WINDOW_WIDTH;
+        int height = WINDOW_HEIGHT;
+        std::string dumpDir;        ///< Headless frames are written here as PNG images, if given
+        std::string rawFile;        ///< Headless frames are appended here as raw RGBA, if given
+        bool help = false;
+    };
+
+    void printUsage()
+    {
+        std::cout << "Usage: Module1 [options]\n"
+            << "  --headless        Render offscreen without a window, as fast as possible\n"
+            << "  --frames N        Number of frames to render headless (default 600)\n"
+            << "  --size WxH        Headless frame size (default " << WINDOW_WIDTH << "x" << WINDOW_HEIGHT << ")\n"
+            << "  --dump DIR        Write headless frames to DIR as PNG images\n"
+            << "  --raw FILE        Append headless frames to FILE as raw RGBA, e.g. a pipe to ffmpeg\n"
+            << "  --help            Show this message\n";
+    }
+
+    Options parseOptions(int argc, char* argv[])
+    {
+        Options options;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            auto value = [&]() -> std::string
+            {
+                if (i + 1 >= argc)
+                    throw std::runtime_error("Missing value for " + arg);
+                return argv[++i];
+            };
+
+            if (arg == "--headless")
+                options.headless = true;
+            else if (arg == "--frames")
+                options.frames = std::stoi(value());
+            else if (arg == "--size")
+            {
+                const std::string size = value();
+                const auto x = size.find('x');
+                if (x == std::string::npos)
+                    throw std::runtime_error("Invalid size " + size);
+                options.width = std::stoi(size.substr(0, x));
+                options.height = std::stoi(size.substr(x + 1));
+            }
+            else if (arg == "--dump")
+                options.dumpDir = value();
+            else if (arg == "--raw")
+                options.rawFile = value();
+            else if (arg == "--help")
+                options.help = true;
+            else
+                throw std::runtime_error("Unknown option " + arg);
+        }
+        if (options.frames < 0 || options.width <= 0 || options.height <= 0)
+            throw std::runtime_error("Invalid frame count or size");
+        return options;
+    }
+
+    std::shared_ptr<eeng::ForwardRenderer> createRenderer()
+    {
+        // Programs are compiled on the first start and loaded as binaries after that
+        auto shaderCache = std::make_shared<eeng::ShaderCache>("shader_cache");
+        auto renderer = std::make_shared<eeng::ForwardRenderer>();
+        renderer->setShaderCache(shaderCache);
+        renderer->init("shaders/phong_vert.glsl", "shaders/phong_frag.glsl");
+        renderer->initSkinning("shaders/skinning_vert.glsl");
+        renderer->initDepthPrepass("shaders/depth_vert.glsl", "shaders/depth_frag.glsl", "shaders/overdraw_frag.glsl");
+
+        const auto &stats = shaderCache->getStats();
+        eeng::Log::log("Shader programs created in %.1f ms: %i from binaries, %i compiled (%i binaries rejected)",
+                       stats.ms,
+                       stats.hits,
+                       stats.misses + stats.rejected,
+                       stats.rejected);
+        return renderer;
+    }
+
+    /// Set render state and clear the bound framebuffer
+    void beginFrame(int width, int height)
+    {
+        auto& glState = eeng::GLStateCache::instance();
+
+        // Face culling - takes place before rasterization
+        glState.enable(GL_CULL_FACE); // Perform face culling
+        glFrontFace(GL_CCW);          // Define winding for a front-facing face
+        glCullFace(GL_BACK);          // Cull back-facing faces
+        // Rasterization stuff
+        glState.enable(GL_DEPTH_TEST); // Perform depth test when rasterizing
+        glState.depthFunc(GL_LESS);    // Depth test pass if z < existing z (closer than existing z)
+        glState.depthMask(GL_TRUE);    // If depth test passes, write z to z-buffer
+        glDepthRange(0, 1);            // Z-buffer range is [0,1], where 0 is at z-near and 1 is at z-far
+
+        // Define viewport transform = Clip -> Screen space (applied before rasterization)
+        glViewport(0, 0, width, height);
+
+        // Clear depth and color attachments of frame buffer
+        // glClearColor(0.45f, 0.55f, 0.60f, 1.00f);
+        glClearColor(0.529f, 0.808f, 0.922f, 1.0f);
+        glClearDepth(1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        if (WIREFRAME)
+        {
+            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            glState.disable(GL_CULL_FACE);
+        }
+        else
+        {
+            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            glState.enable(GL_CULL_FACE);
+        }
+    }
+
+    /// Render a fixed number of frames offscreen, without a window or UI
+    /** Frames advance by a fixed time step, so that dumped frames are the
+     * same from run to run, and are not capped, so that the frame rate
+     * measures throughput.
+     */
+    int runHeadless(const Options& options)
+    {
+        using Clock = std::chrono::high_resolution_clock;
+
+        eeng::HeadlessContext context(options.width, options.height);
+        eeng::Log::log("Headless rendering with video driver %s, %s",
+            context.getVideoDriver().c_str(),
+            context.getRendererString().c_str());
+
+        auto renderer = createRenderer();
+        auto scene = std::make_shared<Scene>();
+        scene->init();
+        eeng::SystemScheduler scheduler;
+        eeng::OffscreenTarget target(options.width, options.height);
+
+        if (options.dumpDir.size())
+            std::filesystem::create_directories(options.dumpDir);
+        std::ofstream raw;
+        if (options.rawFile.size())
+        {
+            raw.open(options.rawFile, std::ios::binary);
+            if (!raw)
+                throw std::runtime_error("Failed to open " + options.rawFile);
+        }
+        const bool dumping = options.dumpDir.size() || raw.is_open();
+
+        // Frames are read back one frame late, see OffscreenTarget
+        std::vector<uint8_t> pixels;
+        int nbrWritten = 0;
+        double writeMs = 0.0;
+        auto write = [&]()
+        {
+            const auto start = Clock::now();
+            if (options.dumpDir.size())
+            {
+                char name[32];
+                std::snprintf(name, sizeof(name), "frame%05d.png", nbrWritten);
+                eeng::OffscreenTarget::writePng((std::filesystem::path(options.dumpDir) / name).string(),
+                    pixels,
+                    options.width,
+                    options.height);
+            }
+            if (raw.is_open())
+                raw.write((const char*)pixels.data(), pixels.size());
+            nbrWritten++;
+            writeMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        };
+
+        const float deltaTime_s = 1.0f / 60;
+        const auto start = Clock::now();
+        for (int frame = 0; frame < options.frames; frame++)
+        {
+            target.bind();
+            beginFrame(options.width, options.height);
+
+            scene->schedule(scheduler, frame * deltaTime_s, deltaTime_s, options.width, options.height, renderer);
+            scheduler.run();
+
+            if (dumping && target.readback(pixels))
+                write();
+            eeng::GLStateCache::instance().endFrame();
+        }
+        if (dumping && target.finish(pixels))
+            write();
+        glFinish();
+        const double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        const double renderMs = totalMs - writeMs;
+        eeng::Log::log("Rendered %i frames of %ix%i in %.3f s: %.1f frames/s, %.3f ms/frame",
+            options.frames,
+            options.width,
+            options.height,
+            totalMs * 1e-3,
+            options.frames / (renderMs * 1e-3),
+            renderMs / std::max(1, options.frames));
+        if (nbrWritten)
+            eeng::Log::log("Wrote %i frames in %.3f s (not included above)", nbrWritten, writeMs * 1e-3);
+
+        scene->destroy();
+        return 0;
+    }
 }
 
 int main(int argc, char* argv[])
 {
+    Options options;
+    try
+    {
+        options = parseOptions(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+    if (options.help)
+    {
+        printUsage();
+        return 0;
+    }
+    if (options.headless)
+    {
+        try
+        {
+            return runHeadless(options);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Headless rendering failed: " << e.what() << std::endl;
+            return 1;
+        }
+    }
 
     // Hello standard output
     std::cout << "Hello SDL2 + Assimp + Dear ImGui" << std::endl;
@@ -224,25 +473,43 @@ int main(int argc, char* argv[])
     }
 #endif
 
-    auto renderer = std::make_shared<eeng::ForwardRenderer>();
-    renderer->init("shaders/phong_vert.glsl", "shaders/phong_frag.glsl");
+    auto renderer = createRenderer();
 
     auto scene = std::make_shared<Scene>();
     scene->init();
 
+    // Runs the systems of the scene each frame
+    eeng::SystemScheduler scheduler;
+
+    // Frames are paced on the high-resolution counter, and the scene is
+    // simulated in fixed steps, with rendered frames interpolated between them
+    eeng::FramePacer pacer;
+    pacer.setTargetFrameTime(1.0 / 60);
+    eeng::FixedTimestep simulationClock(1.0 / 60);
+    bool interpolation = true;
+
+    // Optionally, steps are simulated and the next frame is captured on a
+    // thread of its own, while the latest captured frame is rendered
+    eeng::FramePipeline pipeline;
+    bool pipelined = false;
+
+    // Initial state, rendered until the first step is due
+    scene->scheduleStep(scheduler, 0.0f, 0.0f);
+    scheduler.run();
+
     // Main loop
-    float time_s = 0.0f, time_ms, deltaTime_s = 0.016f;
     bool quit = false;
     SDL_Event event;
     eeng::Log::log("Entering main loop...");
 
     while (!quit)
     {
-        const auto now_ms = SDL_GetTicks();
-        const auto now_s = now_ms * 0.001f;
-        deltaTime_s = now_s - time_s;
-        time_ms = now_ms;
-        time_s = now_s;;
+        simulationClock.advance(pacer.beginFrame());
+        EENG_PROFILE_FRAME();
+
+        // Take back the scene from the simulation thread, along with the
+        // snapshot it captured
+        int slot = pipeline.wait();
 
         while (SDL_PollEvent(&event))
         {
@@ -281,6 +548,7 @@ int main(int argc, char* argv[])
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplSDL2_NewFrame(window);
         ImGui::NewFrame();
+        eeng::Log::setFrame(ImGui::GetFrameCount());
 
         ImGui::ShowDemoWindow();
 
@@ -310,19 +578,117 @@ int main(int argc, char* argv[])
                 }
                 ImGui::EndCombo();
             }
-            if (currentItem == 0)
-                FRAMETIME_MIN_MS = 1000.0f / 10;
-            else if (currentItem == 1)
-                FRAMETIME_MIN_MS = 1000.0f / 30;
-            else if (currentItem == 2)
-                FRAMETIME_MIN_MS = 1000.0f / 60;
-            else if (currentItem == 3)
-                FRAMETIME_MIN_MS = 1000.0f / 120;
-            else if (currentItem == 4)
-                FRAMETIME_MIN_MS = 0.0f;
+            static const double frameTimes[] = { 1.0 / 10, 1.0 / 30, 1.0 / 60, 1.0 / 120, 0.0 };
+            pacer.setTargetFrameTime(frameTimes[currentItem]);
+
+            static const char* rates[] = { "30 Hz", "60 Hz", "120 Hz", "240 Hz" };
+            static const double steps[] = { 1.0 / 30, 1.0 / 60, 1.0 / 120, 1.0 / 240 };
+            static int currentRate = 1;
+            ImGui::Combo("Simulation rate", &currentRate, rates, IM_ARRAYSIZE(rates));
+            simulationClock.setStep(steps[currentRate]);
+            ImGui::Checkbox("Interpolate frames between steps", &interpolation);
+            ImGui::Text("%i steps this frame, %.3f s dropped",
+                simulationClock.getFrameSteps(),
+                simulationClock.getDroppedTime());
+
+            if (scene->supportsPipelining())
+            {
+                ImGui::Checkbox("Pipelined simulation", &pipelined);
+                if (pipelined)
+                {
+                    ImGui::SameLine();
+                    ImGui::TextDisabled("(skinning pre-pass off)");
+                    ImGui::Text("Simulation %.3f ms, waited %.3f ms, overlapped %.3f ms",
+                        pipeline.getSimulationMs(),
+                        pipeline.getWaitMs(),
+                        pipeline.getOverlapMs());
+                    if (ImGui::TreeNode("Pipeline times"))
+                    {
+                        if (ImGui::Button("Clear##pipeline"))
+                            pipeline.clearStats();
+                        pipeline.getSimulationTimes().drawUI("Simulation thread");
+                        pipeline.getWaitTimes().drawUI("Wait for simulation");
+                        ImGui::TreePop();
+                    }
+                }
+            }
+
+            if (ImGui::TreeNode("Frame pacing"))
+            {
+                pacer.drawUI();
+                ImGui::TreePop();
+            }
 
             ImGui::Checkbox("Wireframe rendering", &WIREFRAME);
 
+            auto& glState = eeng::GLStateCache::instance();
+            if (ImGui::TreeNode("GL state cache"))
+            {
+                bool caching = glState.getCaching();
+                if (ImGui::Checkbox("Skip redundant calls", &caching))
+                    glState.setCaching(caching);
+                const auto& stats = glState.getFrameStats();
+                if (ImGui::BeginTable("GL state calls table", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+                {
+                    ImGui::TableSetupColumn("Call");
+                    ImGui::TableSetupColumn("Issued");
+                    ImGui::TableSetupColumn("Skipped");
+                    ImGui::TableHeadersRow();
+                    for (int call = 0; call < eeng::GLStateCache::CallCount; call++)
+                    {
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::TextUnformatted(eeng::GLStateCache::getCallName((eeng::GLStateCache::Call)call));
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%u", stats.issued[call]);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%u", stats.skipped[call]);
+                    }
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted("Total");
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%u", stats.totalIssued());
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%u", stats.totalSkipped());
+                    ImGui::EndTable();
+                }
+                ImGui::TreePop();
+            }
+#ifdef EENG_PROFILER
+            ImGui::Checkbox("Profiler", &showProfiler);
+#endif
+
+            bool deterministic = scheduler.getDeterministic();
+            if (ImGui::Checkbox("Deterministic systems", &deterministic))
+                scheduler.setDeterministic(deterministic);
+            if (ImGui::TreeNode("System trace"))
+            {
+                ImGui::Text("%u worker threads, thread 0 is the main thread", scheduler.getNbrThreads());
+                if (ImGui::BeginTable("System trace table", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+                {
+                    ImGui::TableSetupColumn("System");
+                    ImGui::TableSetupColumn("Thread");
+                    ImGui::TableSetupColumn("Start (ms)");
+                    ImGui::TableSetupColumn("Duration (ms)");
+                    ImGui::TableHeadersRow();
+                    for (const auto& system : scheduler.getTrace())
+                    {
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::TextUnformatted(system.name.c_str());
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%i", system.thread);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.3f", system.startMs);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.3f", system.durationMs);
+                    }
+                    ImGui::EndTable();
+                }
+                ImGui::TreePop();
+            }
+
             if (SOUND_PLAY)
             {
                 if (ImGui::Button("Pause sound"))
@@ -375,51 +741,85 @@ int main(int argc, char* argv[])
         ImGui::End(); // end config window
 
         eeng::Log::draw();
-
-        // Face culling - takes place before rasterization
-        glEnable(GL_CULL_FACE); // Perform face culling
-        glFrontFace(GL_CCW);    // Define winding for a front-facing face
-        glCullFace(GL_BACK);    // Cull back-facing faces
-        // Rasterization stuff
-        glEnable(GL_DEPTH_TEST); // Perform depth test when rasterizing
-        glDepthFunc(GL_LESS);    // Depth test pass if z < existing z (closer than existing z)
-        glDepthMask(GL_TRUE);    // If depth test passes, write z to z-buffer
-        glDepthRange(0, 1);      // Z-buffer range is [0,1], where 0 is at z-near and 1 is at z-far
-
-        // Define viewport transform = Clip -> Screen space (applied before rasterization)
-        glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
+#ifdef EENG_PROFILER
+        if (showProfiler)
+            eeng::Profiler::instance().drawUI(&showProfiler);
+#endif
 
         // Bind the default framebuffer (only needed when using multiple render targets)
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        // Clear depth and color attachments of frame buffer
-        // glClearColor(0.45f, 0.55f, 0.60f, 1.00f);
-        glClearColor(0.529f, 0.808f, 0.922f, 1.0f);
-        glClearDepth(1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        const int screenWidth = (int)io.DisplaySize.x, screenHeight = (int)io.DisplaySize.y;
+        beginFrame(screenWidth, screenHeight);
 
-        if (WIREFRAME)
+        // Interpolation between the two latest steps is read once the due
+        // steps are consumed, since the clock holds whole steps until then
+        auto getAlpha = [&]() { return interpolation ? simulationClock.getAlpha() : 1.0f; };
+        if (pipelined && scene->supportsPipelining())
         {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-            glDisable(GL_CULL_FACE);
+            // Hand the scene over to the simulation thread, which simulates
+            // the steps that are due and captures the next frame, and render
+            // the frame captured previously meanwhile. Frames are thus
+            // rendered one frame late.
+            auto kick = [&]()
+            {
+                while (simulationClock.step())
+                    scene->scheduleStep(scheduler, (float)simulationClock.getTime(), (float)simulationClock.getStep());
+                const float alpha = getAlpha();
+                const double frameTime_s = simulationClock.getTime() - (1.0f - alpha) * simulationClock.getStep();
+                scene->scheduleCapture(scheduler, (float)frameTime_s, alpha, screenWidth, screenHeight, pipeline.getNextSlot());
+                pipeline.kick([&]() { scheduler.run(); });
+            };
+            kick();
+            if (slot < 0)
+            {
+                // Nothing captured yet, so capture once without overlap
+                slot = pipeline.wait();
+                kick();
+            }
+
+            EENG_PROFILE_SCOPE("Scene");
+            EENG_PROFILE_GPU_SCOPE("Scene");
+            scene->renderSnapshot(slot, screenWidth, screenHeight, renderer);
         }
         else
         {
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            glEnable(GL_CULL_FACE);
+            // Simulate the steps that are due, then render the scene, with
+            // independent systems running concurrently
+            {
+                EENG_PROFILE_SCOPE("Simulation");
+                while (simulationClock.step())
+                {
+                    scene->scheduleStep(scheduler, (float)simulationClock.getTime(), (float)simulationClock.getStep());
+                    scheduler.run();
+                }
+            }
+            {
+                EENG_PROFILE_SCOPE("Scene");
+                EENG_PROFILE_GPU_SCOPE("Scene");
+                const float alpha = getAlpha();
+                const double frameTime_s = simulationClock.getTime() - (1.0f - alpha) * simulationClock.getStep();
+                scene->scheduleFrame(scheduler, (float)frameTime_s, alpha, screenWidth, screenHeight, renderer);
+                scheduler.run();
+            }
         }
 
-        scene->update(time_s, deltaTime_s);
-        scene->render(time_s, WINDOW_WIDTH, WINDOW_HEIGHT, renderer);
-
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            EENG_PROFILE_SCOPE("ImGui");
+            EENG_PROFILE_GPU_SCOPE("ImGui");
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            // The ImGui backend sets GL state directly
+            eeng::GLStateCache::instance().invalidate();
+        }
 
-        SDL_GL_SwapWindow(window);
+        {
+            EENG_PROFILE_SCOPE("Swap");
+            SDL_GL_SwapWindow(window);
+        }
+        eeng::GLStateCache::instance().endFrame();
 
-        // Add a delay if frame time was faster than the target frame time
-        const Uint32 elapsed_ms = SDL_GetTicks() - time_ms;
-        if (elapsed_ms < FRAMETIME_MIN_MS)
-            SDL_Delay(FRAMETIME_MIN_MS - elapsed_ms);
+        // Wait until the target frame time has passed
+        pacer.waitForNextFrame();
 
         // Example: Play the sound again after 5 seconds
         //        SDL_Delay(5000);
@@ -430,6 +830,7 @@ int main(int argc, char* argv[])
     }
 
     eeng::Log::log("Exiting...");
+    pipeline.wait();
 
     // Cleanup
     ImGui_ImplOpenGL3_Shutdown();
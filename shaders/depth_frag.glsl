@@ -0,0 +1,15 @@
+#version 410 core
+
+uniform sampler2D opacityTexture;
+uniform int has_opacityTexture;
+
+in vec2 texcoord;
+
+void main()
+{
+   if (has_opacityTexture > 0)
+   {
+       if (texture(opacityTexture, texcoord).x < 0.5)
+           discard;
+   }
+}
@@ -0,0 +1,21 @@
+#version 410 core
+
+uniform sampler2D opacityTexture;
+uniform int has_opacityTexture;
+
+in vec2 texcoord;
+out vec4 fragcolor;
+
+/* Drawn with additive blending, so each shaded fragment adds one step */
+const vec3 OverdrawStep = vec3(0.1, 0.04, 0.01);
+
+void main()
+{
+   if (has_opacityTexture > 0)
+   {
+       if (texture(opacityTexture, texcoord).x < 0.5)
+           discard;
+   }
+
+   fragcolor = vec4(OverdrawStep, 1.0);
+}
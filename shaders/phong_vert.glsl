@@ -21,6 +21,9 @@ out vec3 tangent;
 out vec3 binormal;
 out vec3 color;
 
+/* Depth must match the depth pre-pass exactly */
+invariant gl_Position;
+
 void main()
 {
    mat4 BoneMatrix = mat4(1.0);
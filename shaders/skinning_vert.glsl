@@ -0,0 +1,37 @@
+#version 410 core
+const int MaxBones = 128;
+
+layout (location = 0) in vec3 attr_Position;
+layout (location = 2) in vec3 attr_Normal;
+layout (location = 3) in vec3 attr_Tangent;
+layout (location = 4) in vec3 attr_Binormal;
+layout (location = 5) in ivec4 BoneIDs;
+layout (location = 6) in vec4 BoneWeights;
+
+uniform mat4 BoneMatrices[MaxBones];
+
+// Captured with transform feedback, one buffer each
+out vec3 skinned_Position;
+out vec3 skinned_Normal;
+out vec3 skinned_Tangent;
+out vec3 skinned_Binormal;
+
+void main()
+{
+   mat4 BoneMatrix =    BoneMatrices[BoneIDs.x] * BoneWeights.x +
+                        BoneMatrices[BoneIDs.y] * BoneWeights.y +
+                        BoneMatrices[BoneIDs.z] * BoneWeights.z +
+                        BoneMatrices[BoneIDs.w] * BoneWeights.w;
+   /* Fallback when bone weights are zero */
+   if (BoneWeights.x+BoneWeights.y+BoneWeights.z+BoneWeights.w < 0.01)
+   {
+       BoneMatrix = BoneMatrices[0];
+   }
+
+   // Output is in model space and left unnormalized,
+   // phong_vert.glsl normalizes after the world transform
+   skinned_Position = (BoneMatrix * vec4(attr_Position, 1)).xyz;
+   skinned_Normal = (BoneMatrix * vec4(attr_Normal, 0)).xyz;
+   skinned_Tangent = (BoneMatrix * vec4(attr_Tangent, 0)).xyz;
+   skinned_Binormal = (BoneMatrix * vec4(attr_Binormal, 0)).xyz;
+}
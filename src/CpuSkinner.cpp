@@ -0,0 +1,337 @@
+
+#include <cmath>
+#include <algorithm>
+#include "CpuSkinner.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EENG_SKINNING_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define EENG_TARGET_AVX2
+#else
+#define EENG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace eeng
+{
+    namespace
+    {
+        // Vertices per task, small enough to balance but large enough to
+        // amortize the scheduling overhead
+        const unsigned SkinningGrainSize = 2048;
+
+        /// Bones and weights used for a vertex. Vertices with (near) zero
+        /// weights fall back to the first bone, like the skinning shaders do.
+        inline void resolveWeights(const RenderableMesh::SkinData &skindata,
+                                   unsigned indices[NUM_BONES_PER_VERTEX],
+                                   float weights[NUM_BONES_PER_VERTEX])
+        {
+            float weightSum = 0.0f;
+            for (int k = 0; k < NUM_BONES_PER_VERTEX; k++)
+                weightSum += skindata.bone_weights[k];
+
+            if (weightSum < 0.01f)
+            {
+                for (int k = 0; k < NUM_BONES_PER_VERTEX; k++)
+                {
+                    indices[k] = 0;
+                    weights[k] = (k == 0 ? 1.0f : 0.0f);
+                }
+                return;
+            }
+            for (int k = 0; k < NUM_BONES_PER_VERTEX; k++)
+            {
+                indices[k] = skindata.bone_indices[k];
+                weights[k] = skindata.bone_weights[k];
+            }
+        }
+
+        void skinScalar(const glm::mat4 *bones,
+                        const CpuSkinner::Input &in,
+                        const CpuSkinner::Output &out,
+                        unsigned begin,
+                        unsigned end)
+        {
+            unsigned indices[NUM_BONES_PER_VERTEX];
+            float weights[NUM_BONES_PER_VERTEX];
+
+            for (unsigned v = begin; v < end; v++)
+            {
+                resolveWeights(in.skindata[v], indices, weights);
+
+                const glm::mat4 M =
+                    bones[indices[0]] * weights[0] +
+                    bones[indices[1]] * weights[1] +
+                    bones[indices[2]] * weights[2] +
+                    bones[indices[3]] * weights[3];
+
+                out.positions[v] = glm::vec3(M * glm::vec4(in.positions[v], 1.0f));
+                out.normals[v] = glm::vec3(M * glm::vec4(in.normals[v], 0.0f));
+                out.tangents[v] = glm::vec3(M * glm::vec4(in.tangents[v], 0.0f));
+                out.binormals[v] = glm::vec3(M * glm::vec4(in.binormals[v], 0.0f));
+            }
+        }
+
+#ifdef EENG_SKINNING_X86
+        // Matrices are column-major, so each column is one 128-bit register.
+        // Operations are ordered as in the scalar path (glm evaluates sums left to right).
+
+        inline __m128 loadColumn(const glm::mat4 &M, int column)
+        {
+            return _mm_loadu_ps(&M[column][0]);
+        }
+
+        inline void storeVec3(glm::vec3 &dst, __m128 v)
+        {
+            alignas(16) float tmp[4];
+            _mm_store_ps(tmp, v);
+            dst = glm::vec3(tmp[0], tmp[1], tmp[2]);
+        }
+
+        /// Blend the columns of four bone matrices
+        inline void blendColumns(const glm::mat4 *bones,
+                                 const unsigned indices[NUM_BONES_PER_VERTEX],
+                                 const float weights[NUM_BONES_PER_VERTEX],
+                                 __m128 columns[4])
+        {
+            const __m128 w0 = _mm_set1_ps(weights[0]);
+            const __m128 w1 = _mm_set1_ps(weights[1]);
+            const __m128 w2 = _mm_set1_ps(weights[2]);
+            const __m128 w3 = _mm_set1_ps(weights[3]);
+            for (int j = 0; j < 4; j++)
+            {
+                __m128 c = _mm_mul_ps(loadColumn(bones[indices[0]], j), w0);
+                c = _mm_add_ps(c, _mm_mul_ps(loadColumn(bones[indices[1]], j), w1));
+                c = _mm_add_ps(c, _mm_mul_ps(loadColumn(bones[indices[2]], j), w2));
+                c = _mm_add_ps(c, _mm_mul_ps(loadColumn(bones[indices[3]], j), w3));
+                columns[j] = c;
+            }
+        }
+
+        inline __m128 transform(const __m128 columns[4], const glm::vec3 &v, float w)
+        {
+            __m128 r = _mm_mul_ps(columns[0], _mm_set1_ps(v.x));
+            r = _mm_add_ps(r, _mm_mul_ps(columns[1], _mm_set1_ps(v.y)));
+            r = _mm_add_ps(r, _mm_mul_ps(columns[2], _mm_set1_ps(v.z)));
+            return _mm_add_ps(r, _mm_mul_ps(columns[3], _mm_set1_ps(w)));
+        }
+
+        void skinSSE(const glm::mat4 *bones,
+                     const CpuSkinner::Input &in,
+                     const CpuSkinner::Output &out,
+                     unsigned begin,
+                     unsigned end)
+        {
+            unsigned indices[NUM_BONES_PER_VERTEX];
+            float weights[NUM_BONES_PER_VERTEX];
+            __m128 columns[4];
+
+            for (unsigned v = begin; v < end; v++)
+            {
+                resolveWeights(in.skindata[v], indices, weights);
+                blendColumns(bones, indices, weights, columns);
+
+                storeVec3(out.positions[v], transform(columns, in.positions[v], 1.0f));
+                storeVec3(out.normals[v], transform(columns, in.normals[v], 0.0f));
+                storeVec3(out.tangents[v], transform(columns, in.tangents[v], 0.0f));
+                storeVec3(out.binormals[v], transform(columns, in.binormals[v], 0.0f));
+            }
+        }
+
+        // AVX2 backend: two vertices per iteration, one in each 128-bit lane
+
+        EENG_TARGET_AVX2 inline __m256 loadColumnPair(const glm::mat4 &A, const glm::mat4 &B, int column)
+        {
+            return _mm256_insertf128_ps(_mm256_castps128_ps256(loadColumn(A, column)), loadColumn(B, column), 1);
+        }
+
+        EENG_TARGET_AVX2 inline __m256 broadcastPair(float a, float b)
+        {
+            return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(a)), _mm_set1_ps(b), 1);
+        }
+
+        EENG_TARGET_AVX2 inline __m256 transformPair(const __m256 columns[4],
+                                                     const glm::vec3 &a,
+                                                     const glm::vec3 &b,
+                                                     float w)
+        {
+            __m256 r = _mm256_mul_ps(columns[0], broadcastPair(a.x, b.x));
+            r = _mm256_add_ps(r, _mm256_mul_ps(columns[1], broadcastPair(a.y, b.y)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(columns[2], broadcastPair(a.z, b.z)));
+            return _mm256_add_ps(r, _mm256_mul_ps(columns[3], _mm256_set1_ps(w)));
+        }
+
+        EENG_TARGET_AVX2 inline void storePair(glm::vec3 &a, glm::vec3 &b, __m256 v)
+        {
+            storeVec3(a, _mm256_castps256_ps128(v));
+            storeVec3(b, _mm256_extractf128_ps(v, 1));
+        }
+
+        EENG_TARGET_AVX2 void skinAVX2(const glm::mat4 *bones,
+                                       const CpuSkinner::Input &in,
+                                       const CpuSkinner::Output &out,
+                                       unsigned begin,
+                                       unsigned end)
+        {
+            unsigned indicesA[NUM_BONES_PER_VERTEX], indicesB[NUM_BONES_PER_VERTEX];
+            float weightsA[NUM_BONES_PER_VERTEX], weightsB[NUM_BONES_PER_VERTEX];
+            __m256 columns[4];
+
+            unsigned v = begin;
+            for (; v + 1 < end; v += 2)
+            {
+                const unsigned a = v, b = v + 1;
+                resolveWeights(in.skindata[a], indicesA, weightsA);
+                resolveWeights(in.skindata[b], indicesB, weightsB);
+
+                for (int j = 0; j < 4; j++)
+                {
+                    __m256 c = _mm256_mul_ps(loadColumnPair(bones[indicesA[0]], bones[indicesB[0]], j),
+                                             broadcastPair(weightsA[0], weightsB[0]));
+                    for (int k = 1; k < NUM_BONES_PER_VERTEX; k++)
+                        c = _mm256_add_ps(c, _mm256_mul_ps(loadColumnPair(bones[indicesA[k]], bones[indicesB[k]], j),
+                                                           broadcastPair(weightsA[k], weightsB[k])));
+                    columns[j] = c;
+                }
+
+                storePair(out.positions[a], out.positions[b], transformPair(columns, in.positions[a], in.positions[b], 1.0f));
+                storePair(out.normals[a], out.normals[b], transformPair(columns, in.normals[a], in.normals[b], 0.0f));
+                storePair(out.tangents[a], out.tangents[b], transformPair(columns, in.tangents[a], in.tangents[b], 0.0f));
+                storePair(out.binormals[a], out.binormals[b], transformPair(columns, in.binormals[a], in.binormals[b], 0.0f));
+            }
+
+            // Odd vertex out
+            if (v < end)
+                skinSSE(bones, in, out, v, end);
+        }
+
+        bool cpuSupportsAVX2()
+        {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+            __cpuid(info, 1);
+            const bool osxsave = (info[2] & (1 << 27)) != 0;
+            const bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+                return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+#endif
+    }
+
+    CpuSkinner::CpuSkinner(std::shared_ptr<ThreadPool> threadPool)
+        : threadPool(threadPool ? threadPool : std::make_shared<ThreadPool>())
+    {
+    }
+
+    bool CpuSkinner::isSupported(Backend backend)
+    {
+        switch (backend)
+        {
+        case Backend::Scalar:
+            return true;
+#ifdef EENG_SKINNING_X86
+        case Backend::SSE:
+            return true;
+        case Backend::AVX2:
+        {
+            static const bool supported = cpuSupportsAVX2();
+            return supported;
+        }
+#endif
+        default:
+            return false;
+        }
+    }
+
+    CpuSkinner::Backend CpuSkinner::getBestBackend()
+    {
+        if (isSupported(Backend::AVX2))
+            return Backend::AVX2;
+        if (isSupported(Backend::SSE))
+            return Backend::SSE;
+        return Backend::Scalar;
+    }
+
+    const char *CpuSkinner::getBackendName(Backend backend)
+    {
+        switch (backend)
+        {
+        case Backend::Scalar:
+            return "Scalar";
+        case Backend::SSE:
+            return "SSE";
+        case Backend::AVX2:
+            return "AVX2";
+        }
+        return "";
+    }
+
+    void CpuSkinner::skin(Backend backend,
+                          const std::vector<glm::mat4> &boneMatrices,
+                          const Input &in,
+                          const Output &out,
+                          unsigned begin,
+                          unsigned end)
+    {
+        if (!boneMatrices.size() || end <= begin)
+            return;
+        if (!isSupported(backend))
+            backend = Backend::Scalar;
+
+        void (*skinFunc)(const glm::mat4 *, const Input &, const Output &, unsigned, unsigned) = skinScalar;
+#ifdef EENG_SKINNING_X86
+        if (backend == Backend::SSE)
+            skinFunc = skinSSE;
+        else if (backend == Backend::AVX2)
+            skinFunc = skinAVX2;
+#endif
+
+        const glm::mat4 *bones = boneMatrices.data();
+        threadPool->parallelFor(begin,
+                                end,
+                                SkinningGrainSize,
+                                [&](size_t chunkBegin, size_t chunkEnd)
+                                { skinFunc(bones, in, out, (unsigned)chunkBegin, (unsigned)chunkEnd); });
+    }
+
+    float CpuSkinner::verify(Backend backend,
+                             const std::vector<glm::mat4> &boneMatrices,
+                             const Input &in,
+                             unsigned begin,
+                             unsigned end)
+    {
+        if (end <= begin)
+            return 0.0f;
+
+        // Outputs are indexed like the input, so allocate up to the end vertex
+        std::vector<glm::vec3> reference[4], result[4];
+        for (int i = 0; i < 4; i++)
+        {
+            reference[i].resize(end);
+            result[i].resize(end);
+        }
+        const Output referenceOut{reference[0].data(), reference[1].data(), reference[2].data(), reference[3].data()};
+        const Output resultOut{result[0].data(), result[1].data(), result[2].data(), result[3].data()};
+
+        skinScalar(boneMatrices.data(), in, referenceOut, begin, end);
+        skin(backend, boneMatrices, in, resultOut, begin, end);
+
+        float maxError = 0.0f;
+        for (int i = 0; i < 4; i++)
+            for (unsigned v = begin; v < end; v++)
+                for (int c = 0; c < 3; c++)
+                    maxError = std::max(maxError, std::fabs(reference[i][v][c] - result[i][v][c]));
+        return maxError;
+    }
+
+} // namespace eeng
@@ -0,0 +1,90 @@
+
+#ifndef CpuSkinner_hpp
+#define CpuSkinner_hpp
+
+#include <vector>
+#include <memory>
+#include <glm/glm.hpp>
+
+#include "RenderableMesh.hpp"
+#include "ThreadPool.hpp"
+
+namespace eeng
+{
+    /// @brief Linear blend skinning on the CPU
+    /** Intended for setups where vertex shader skinning is slow, such as
+     * software GL implementations. The scalar backend is the reference that
+     * the SIMD backends are verified against. Each backend computes the blended
+     * matrix and the transforms in the same order, so results are expected to
+     * be close to bit-identical.
+     */
+    class CpuSkinner
+    {
+    public:
+        enum class Backend
+        {
+            Scalar,
+            SSE,
+            AVX2
+        };
+
+        /// Bind pose vertex streams
+        struct Input
+        {
+            const glm::vec3 *positions = nullptr;
+            const glm::vec3 *normals = nullptr;
+            const glm::vec3 *tangents = nullptr;
+            const glm::vec3 *binormals = nullptr;
+            const RenderableMesh::SkinData *skindata = nullptr;
+        };
+
+        /// Skinned vertex streams, indexed the same way as the input
+        struct Output
+        {
+            glm::vec3 *positions = nullptr;
+            glm::vec3 *normals = nullptr;
+            glm::vec3 *tangents = nullptr;
+            glm::vec3 *binormals = nullptr;
+        };
+
+        /// @brief Create skinner
+        /// @param threadPool Pool to distribute vertex ranges over. A pool is created if none is given.
+        explicit CpuSkinner(std::shared_ptr<ThreadPool> threadPool = nullptr);
+
+        /// @brief Check if a backend is compiled in and supported by this CPU
+        static bool isSupported(Backend backend);
+
+        /// @brief Fastest supported backend
+        static Backend getBestBackend();
+
+        static const char *getBackendName(Backend backend);
+
+        /// @brief Skin a range of vertices, distributed over the thread pool
+        /// @param backend Backend to use. Falls back to scalar if not supported.
+        /// @param boneMatrices Bone palette
+        /// @param in Bind pose vertices
+        /// @param out Skinned vertices
+        /// @param begin First vertex
+        /// @param end One past the last vertex
+        void skin(Backend backend,
+                  const std::vector<glm::mat4> &boneMatrices,
+                  const Input &in,
+                  const Output &out,
+                  unsigned begin,
+                  unsigned end);
+
+        /// @brief Compare a backend against the scalar reference
+        /// @return Largest absolute difference of any output component
+        float verify(Backend backend,
+                     const std::vector<glm::mat4> &boneMatrices,
+                     const Input &in,
+                     unsigned begin,
+                     unsigned end);
+
+    private:
+        std::shared_ptr<ThreadPool> threadPool;
+    };
+
+} // namespace eeng
+
+#endif /* CpuSkinner_hpp */
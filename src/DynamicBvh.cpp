@@ -0,0 +1,675 @@
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include "config.h"
+#include "DynamicBvh.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EENG_BVH_SSE
+#include <emmintrin.h>
+#endif
+
+namespace eeng
+{
+    namespace
+    {
+        using Clock = std::chrono::high_resolution_clock;
+
+        float elapsedMs(const Clock::time_point &start)
+        {
+            return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+        }
+
+        // Deeper nodes become leaves, which bounds the traversal stacks
+        const int MaxDepth = 48;
+        const int StackSize = 3 * MaxDepth + 4;
+
+        const int NbrBins = 16;
+
+        /// Grow a box to include another. Unlike AABB::grow, empty boxes are left out.
+        void unite(AABB &aabb, const AABB &other)
+        {
+            aabb.min = glm::min(aabb.min, other.min);
+            aabb.max = glm::max(aabb.max, other.max);
+        }
+
+        float surfaceArea(const AABB &aabb)
+        {
+            // Flat boxes, such as those of planes, are allowed
+            const glm::vec3 d = glm::max(aabb.max - aabb.min, glm::vec3(0.0f));
+            return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+
+        glm::vec3 centroid(const AABB &aabb)
+        {
+            return (aabb.min + aabb.max) * 0.5f;
+        }
+
+        /// Frustum planes with inward normals, from a projection-view matrix
+        /// (Gribb & Hartmann)
+        void extractPlanes(const glm::mat4 &M, glm::vec4 planes[6])
+        {
+            const glm::vec4 row0(M[0][0], M[1][0], M[2][0], M[3][0]);
+            const glm::vec4 row1(M[0][1], M[1][1], M[2][1], M[3][1]);
+            const glm::vec4 row2(M[0][2], M[1][2], M[2][2], M[3][2]);
+            const glm::vec4 row3(M[0][3], M[1][3], M[2][3], M[3][3]);
+            planes[0] = row3 + row0;
+            planes[1] = row3 - row0;
+            planes[2] = row3 + row1;
+            planes[3] = row3 - row1;
+            planes[4] = row3 + row2;
+            planes[5] = row3 - row2;
+        }
+
+        bool isOutsidePlanes(const AABB &aabb, const glm::vec4 planes[6])
+        {
+            for (int i = 0; i < 6; i++)
+            {
+                const auto &p = planes[i];
+                // Corner farthest along the normal
+                const float d = p.x * (p.x > 0.0f ? aabb.max.x : aabb.min.x) +
+                                p.y * (p.y > 0.0f ? aabb.max.y : aabb.min.y) +
+                                p.z * (p.z > 0.0f ? aabb.max.z : aabb.min.z) + p.w;
+                if (d < 0.0f)
+                    return true;
+            }
+            return false;
+        }
+
+        struct RayData
+        {
+            glm::vec3 origin, invDirection;
+        };
+
+        /// Ray parameter where the ray enters a box, or a negative value if it misses
+        float intersectRay(const AABB &aabb, const RayData &ray, float tmax)
+        {
+            float tnear = 0.0f, tfar = tmax;
+            for (int i = 0; i < 3; i++)
+            {
+                float t0 = (aabb.min[i] - ray.origin[i]) * ray.invDirection[i];
+                float t1 = (aabb.max[i] - ray.origin[i]) * ray.invDirection[i];
+                if (t0 > t1)
+                    std::swap(t0, t1);
+                tnear = std::max(tnear, t0);
+                tfar = std::min(tfar, t1);
+            }
+            return tnear <= tfar ? tnear : -1.0f;
+        }
+
+        // Node tests, each returning a mask of the child slots that pass
+
+        template <class Node>
+        int overlapMask(const Node &node, const AABB &aabb)
+        {
+            int mask;
+#ifdef EENG_BVH_SSE
+            __m128 hit = _mm_and_ps(_mm_cmple_ps(_mm_set1_ps(aabb.min.x), _mm_loadu_ps(node.maxX)),
+                                    _mm_cmpge_ps(_mm_set1_ps(aabb.max.x), _mm_loadu_ps(node.minX)));
+            hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmple_ps(_mm_set1_ps(aabb.min.y), _mm_loadu_ps(node.maxY)),
+                                             _mm_cmpge_ps(_mm_set1_ps(aabb.max.y), _mm_loadu_ps(node.minY))));
+            hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmple_ps(_mm_set1_ps(aabb.min.z), _mm_loadu_ps(node.maxZ)),
+                                             _mm_cmpge_ps(_mm_set1_ps(aabb.max.z), _mm_loadu_ps(node.minZ))));
+            mask = _mm_movemask_ps(hit);
+#else
+            mask = 0;
+            for (int i = 0; i < 4; i++)
+                if (aabb.min.x <= node.maxX[i] && aabb.max.x >= node.minX[i] &&
+                    aabb.min.y <= node.maxY[i] && aabb.max.y >= node.minY[i] &&
+                    aabb.min.z <= node.maxZ[i] && aabb.max.z >= node.minZ[i])
+                    mask |= 1 << i;
+#endif
+            return mask & ((1 << node.nbrChildren) - 1);
+        }
+
+        template <class Node>
+        int frustumMask(const Node &node, const glm::vec4 planes[6])
+        {
+            int outside = 0;
+            for (int p = 0; p < 6; p++)
+            {
+                const auto &plane = planes[p];
+                // All four boxes share the sign of the normal, so the corner
+                // farthest along it is picked per plane rather than per box
+                const float *x = plane.x > 0.0f ? node.maxX : node.minX;
+                const float *y = plane.y > 0.0f ? node.maxY : node.minY;
+                const float *z = plane.z > 0.0f ? node.maxZ : node.minZ;
+#ifdef EENG_BVH_SSE
+                const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), _mm_loadu_ps(x)),
+                                                       _mm_mul_ps(_mm_set1_ps(plane.y), _mm_loadu_ps(y))),
+                                            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), _mm_loadu_ps(z)),
+                                                       _mm_set1_ps(plane.w)));
+                outside |= _mm_movemask_ps(_mm_cmplt_ps(d, _mm_setzero_ps()));
+#else
+                for (int i = 0; i < 4; i++)
+                    if (plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w < 0.0f)
+                        outside |= 1 << i;
+#endif
+            }
+            return ~outside & ((1 << node.nbrChildren) - 1);
+        }
+
+        template <class Node>
+        int rayMask(const Node &node, const RayData &ray, float tmax, float tnear[4])
+        {
+            int mask;
+#ifdef EENG_BVH_SSE
+            const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+            const __m128 ix = _mm_set1_ps(ray.invDirection.x), iy = _mm_set1_ps(ray.invDirection.y), iz = _mm_set1_ps(ray.invDirection.z);
+            const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+            const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+            const __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+            const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+            const __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+            const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+            const __m128 t0 = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+                                         _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+            const __m128 t1 = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+                                         _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(tmax)));
+            _mm_storeu_ps(tnear, t0);
+            mask = _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+            mask = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                AABB aabb;
+                aabb.min = {node.minX[i], node.minY[i], node.minZ[i]};
+                aabb.max = {node.maxX[i], node.maxY[i], node.maxZ[i]};
+                tnear[i] = intersectRay(aabb, ray, tmax);
+                if (tnear[i] >= 0.0f)
+                    mask |= 1 << i;
+            }
+#endif
+            return mask & ((1 << node.nbrChildren) - 1);
+        }
+
+        RayData makeRay(const glm::vec3 &origin, const glm::vec3 &direction)
+        {
+            // Zero components give infinities, which the slab tests handle
+            return {origin, 1.0f / direction};
+        }
+    }
+
+    DynamicBvh::DynamicBvh(int maxLeafSize)
+        : maxLeafSize(std::max(1, maxLeafSize))
+    {
+    }
+
+    int DynamicBvh::insert(const AABB &aabb, uint32_t userData)
+    {
+        int proxy;
+        if (freeProxies.size())
+        {
+            proxy = freeProxies.back();
+            freeProxies.pop_back();
+        }
+        else
+        {
+            proxy = (int)proxies.size();
+            proxies.emplace_back();
+        }
+        proxies[proxy] = {aabb, userData, true};
+        stats.proxies++;
+        needsBuild = true;
+        return proxy;
+    }
+
+    void DynamicBvh::remove(int proxy)
+    {
+        if (proxy < 0 || proxy >= (int)proxies.size() || !proxies[proxy].alive)
+            throw std::runtime_error("Invalid BVH proxy");
+        proxies[proxy].alive = false;
+        freeProxies.push_back(proxy);
+        stats.proxies--;
+        needsRefit = true;
+    }
+
+    void DynamicBvh::move(int proxy, const AABB &aabb)
+    {
+        proxies[proxy].aabb = aabb;
+        needsRefit = true;
+    }
+
+    const AABB &DynamicBvh::getBounds(int proxy) const
+    {
+        return proxies[proxy].aabb;
+    }
+
+    uint32_t DynamicBvh::getUserData(int proxy) const
+    {
+        return proxies[proxy].userData;
+    }
+
+    void DynamicBvh::update()
+    {
+        if (needsBuild)
+            build();
+        else if (needsRefit)
+        {
+            refit();
+            if (stats.sahCost > builtSahCost * rebuildThreshold)
+                needsBuild = true;
+        }
+    }
+
+    void DynamicBvh::setRebuildThreshold(float threshold)
+    {
+        rebuildThreshold = threshold;
+    }
+
+    const BvhStats &DynamicBvh::getStats() const
+    {
+        return stats;
+    }
+
+    AABB DynamicBvh::rangeBounds(int first, int count) const
+    {
+        AABB aabb;
+        for (int i = first; i < first + count; i++)
+            unite(aabb, buildItems[i].aabb);
+        return aabb;
+    }
+
+    int DynamicBvh::split(int first, int count)
+    {
+        AABB centroidBounds;
+        for (int i = first; i < first + count; i++)
+        {
+            centroidBounds.min = glm::min(centroidBounds.min, buildItems[i].centroid);
+            centroidBounds.max = glm::max(centroidBounds.max, buildItems[i].centroid);
+        }
+
+        // Binned SAH over all three axes. Small ranges use fewer bins,
+        // since the fixed cost of the bins would dominate.
+        const int nbrBins = std::min(NbrBins, count);
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if (extent <= 0.0f)
+                continue;
+            const float scale = nbrBins / extent;
+
+            AABB binBounds[NbrBins];
+            int binCounts[NbrBins] = {0};
+            for (int i = first; i < first + count; i++)
+            {
+                const auto &item = buildItems[i];
+                const int bin = std::min(nbrBins - 1, (int)((item.centroid[axis] - centroidBounds.min[axis]) * scale));
+                unite(binBounds[bin], item.aabb);
+                binCounts[bin]++;
+            }
+
+            // Sweep from the right, then from the left
+            float rightAreas[NbrBins];
+            int rightCounts[NbrBins];
+            AABB right;
+            int rightCount = 0;
+            for (int b = nbrBins - 1; b > 0; b--)
+            {
+                unite(right, binBounds[b]);
+                rightCount += binCounts[b];
+                rightAreas[b] = surfaceArea(right);
+                rightCounts[b] = rightCount;
+            }
+            AABB left;
+            int leftCount = 0;
+            for (int b = 0; b < nbrBins - 1; b++)
+            {
+                unite(left, binBounds[b]);
+                leftCount += binCounts[b];
+                if (!leftCount || !rightCounts[b + 1])
+                    continue;
+                const float cost = surfaceArea(left) * leftCount + rightAreas[b + 1] * rightCounts[b + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        // Coincident centroids: split in the middle
+        if (bestAxis < 0)
+            return count / 2;
+
+        const float scale = nbrBins / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+        const float offset = centroidBounds.min[bestAxis];
+        const auto middle = std::partition(buildItems.begin() + first,
+                                           buildItems.begin() + first + count,
+                                           [&](const BuildItem &item)
+                                           { return std::min(nbrBins - 1, (int)((item.centroid[bestAxis] - offset) * scale)) <= bestBin; });
+        return (int)(middle - (buildItems.begin() + first));
+    }
+
+    int DynamicBvh::buildNode(int first, int count, int depth)
+    {
+        stats.depth = std::max(stats.depth, depth);
+
+        // Split the range twice, largest part first, for up to four children
+        struct Range
+        {
+            int first, count;
+        };
+        Range ranges[4] = {{first, count}};
+        int nbrRanges = 1;
+        while (nbrRanges < 4)
+        {
+            int largest = -1;
+            for (int i = 0; i < nbrRanges; i++)
+                if (ranges[i].count > maxLeafSize && (largest < 0 || ranges[i].count > ranges[largest].count))
+                    largest = i;
+            if (largest < 0)
+                break;
+
+            const Range range = ranges[largest];
+            const int leftCount = split(range.first, range.count);
+            ranges[largest] = {range.first, leftCount};
+            ranges[nbrRanges++] = {range.first + leftCount, range.count - leftCount};
+        }
+
+        const int index = (int)nodes.size();
+        nodes.emplace_back();
+        nodes[index].nbrChildren = nbrRanges;
+        for (int i = 0; i < 4; i++)
+        {
+            auto &node = nodes[index];
+            node.minX[i] = node.minY[i] = node.minZ[i] = std::numeric_limits<float>::max();
+            node.maxX[i] = node.maxY[i] = node.maxZ[i] = std::numeric_limits<float>::lowest();
+            node.child[i] = EENG_NULL_INDEX;
+            node.count[i] = 0;
+        }
+
+        for (int i = 0; i < nbrRanges; i++)
+        {
+            const auto &range = ranges[i];
+            int child = range.first;
+            unsigned childCount = range.count;
+            if (range.count > maxLeafSize && depth < MaxDepth)
+            {
+                child = buildNode(range.first, range.count, depth + 1);
+                childCount = 0;
+            }
+            else
+                stats.leaves++;
+
+            // Nodes may have been reallocated by the recursion
+            auto &node = nodes[index];
+            const AABB aabb = rangeBounds(range.first, range.count);
+            node.minX[i] = aabb.min.x;
+            node.minY[i] = aabb.min.y;
+            node.minZ[i] = aabb.min.z;
+            node.maxX[i] = aabb.max.x;
+            node.maxY[i] = aabb.max.y;
+            node.maxZ[i] = aabb.max.z;
+            node.child[i] = child;
+            node.count[i] = childCount;
+        }
+        return index;
+    }
+
+    void DynamicBvh::build()
+    {
+        const auto start = Clock::now();
+
+        nodes.clear();
+        buildItems.clear();
+        for (int i = 0; i < (int)proxies.size(); i++)
+            if (proxies[i].alive)
+                buildItems.push_back({proxies[i].aabb, centroid(proxies[i].aabb), i});
+
+        stats.leaves = 0;
+        stats.depth = 0;
+        if (buildItems.size())
+            buildNode(0, (int)buildItems.size(), 1);
+
+        items.resize(buildItems.size());
+        for (size_t i = 0; i < buildItems.size(); i++)
+            items[i] = buildItems[i].proxy;
+
+        stats.nodes = (int)nodes.size();
+        stats.sahCost = builtSahCost = computeSahCost();
+        stats.buildMs = elapsedMs(start);
+        stats.builds++;
+        needsBuild = needsRefit = false;
+    }
+
+    void DynamicBvh::refit()
+    {
+        const auto start = Clock::now();
+
+        // Children are stored after their parents
+        for (int n = (int)nodes.size() - 1; n >= 0; n--)
+        {
+            auto &node = nodes[n];
+            for (int i = 0; i < node.nbrChildren; i++)
+            {
+                AABB aabb;
+                if (node.count[i])
+                {
+                    for (unsigned j = 0; j < node.count[i]; j++)
+                    {
+                        const auto &proxy = proxies[items[node.child[i] + j]];
+                        if (proxy.alive)
+                            unite(aabb, proxy.aabb);
+                    }
+                }
+                else
+                {
+                    const auto &child = nodes[node.child[i]];
+                    for (int j = 0; j < child.nbrChildren; j++)
+                    {
+                        aabb.min = glm::min(aabb.min, glm::vec3(child.minX[j], child.minY[j], child.minZ[j]));
+                        aabb.max = glm::max(aabb.max, glm::vec3(child.maxX[j], child.maxY[j], child.maxZ[j]));
+                    }
+                }
+                node.minX[i] = aabb.min.x;
+                node.minY[i] = aabb.min.y;
+                node.minZ[i] = aabb.min.z;
+                node.maxX[i] = aabb.max.x;
+                node.maxY[i] = aabb.max.y;
+                node.maxZ[i] = aabb.max.z;
+            }
+        }
+
+        stats.sahCost = computeSahCost();
+        stats.refitMs = elapsedMs(start);
+        stats.refits++;
+        needsRefit = false;
+    }
+
+    float DynamicBvh::computeSahCost() const
+    {
+        if (nodes.empty())
+            return 0.0f;
+
+        // Expected number of node visits for a random ray, relative to the root
+        float cost = 0.0f;
+        AABB root;
+        for (const auto &node : nodes)
+            for (int i = 0; i < node.nbrChildren; i++)
+            {
+                AABB aabb;
+                aabb.min = {node.minX[i], node.minY[i], node.minZ[i]};
+                aabb.max = {node.maxX[i], node.maxY[i], node.maxZ[i]};
+                cost += surfaceArea(aabb) * (node.count[i] ? node.count[i] : 1);
+                if (&node == &nodes[0])
+                    unite(root, aabb);
+            }
+        const float rootArea = surfaceArea(root);
+        return rootArea > 0.0f ? cost / rootArea : 0.0f;
+    }
+
+    void DynamicBvh::queryFrustum(const glm::mat4 &ProjViewMatrix,
+                                  std::vector<int> &result) const
+    {
+        if (nodes.empty())
+            return;
+
+        glm::vec4 planes[6];
+        extractPlanes(ProjViewMatrix, planes);
+
+        int stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            const auto &node = nodes[stack[--top]];
+            int mask = frustumMask(node, planes);
+            for (int i = 0; mask; i++, mask >>= 1)
+            {
+                if (!(mask & 1))
+                    continue;
+                if (!node.count[i])
+                {
+                    stack[top++] = node.child[i];
+                    continue;
+                }
+                for (unsigned j = 0; j < node.count[i]; j++)
+                {
+                    const int proxy = items[node.child[i] + j];
+                    if (proxies[proxy].alive && !isOutsidePlanes(proxies[proxy].aabb, planes))
+                        result.push_back(proxy);
+                }
+            }
+        }
+    }
+
+    void DynamicBvh::queryAabb(const AABB &aabb,
+                               std::vector<int> &result) const
+    {
+        if (nodes.empty())
+            return;
+
+        int stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            const auto &node = nodes[stack[--top]];
+            int mask = overlapMask(node, aabb);
+            for (int i = 0; mask; i++, mask >>= 1)
+            {
+                if (!(mask & 1))
+                    continue;
+                if (!node.count[i])
+                {
+                    stack[top++] = node.child[i];
+                    continue;
+                }
+                for (unsigned j = 0; j < node.count[i]; j++)
+                {
+                    const int proxy = items[node.child[i] + j];
+                    const auto &bounds = proxies[proxy].aabb;
+                    if (proxies[proxy].alive &&
+                        aabb.min.x <= bounds.max.x && aabb.max.x >= bounds.min.x &&
+                        aabb.min.y <= bounds.max.y && aabb.max.y >= bounds.min.y &&
+                        aabb.min.z <= bounds.max.z && aabb.max.z >= bounds.min.z)
+                        result.push_back(proxy);
+                }
+            }
+        }
+    }
+
+    void DynamicBvh::queryRay(const glm::vec3 &origin,
+                              const glm::vec3 &direction,
+                              float tmax,
+                              std::vector<int> &result) const
+    {
+        if (nodes.empty())
+            return;
+
+        const RayData ray = makeRay(origin, direction);
+        float tnear[4];
+        int stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top)
+        {
+            const auto &node = nodes[stack[--top]];
+            int mask = rayMask(node, ray, tmax, tnear);
+            for (int i = 0; mask; i++, mask >>= 1)
+            {
+                if (!(mask & 1))
+                    continue;
+                if (!node.count[i])
+                {
+                    stack[top++] = node.child[i];
+                    continue;
+                }
+                for (unsigned j = 0; j < node.count[i]; j++)
+                {
+                    const int proxy = items[node.child[i] + j];
+                    if (proxies[proxy].alive && intersectRay(proxies[proxy].aabb, ray, tmax) >= 0.0f)
+                        result.push_back(proxy);
+                }
+            }
+        }
+    }
+
+    int DynamicBvh::raycast(const glm::vec3 &origin,
+                            const glm::vec3 &direction,
+                            float &t,
+                            const std::function<float(int proxy, float tmax)> &intersect) const
+    {
+        int hit = EENG_NULL_INDEX;
+        if (nodes.empty())
+            return hit;
+
+        struct Entry
+        {
+            int node;
+            float tnear;
+        };
+        const RayData ray = makeRay(origin, direction);
+        float tnear[4];
+        Entry stack[StackSize];
+        int top = 0;
+        stack[top++] = {0, 0.0f};
+        while (top)
+        {
+            const auto entry = stack[--top];
+            if (entry.tnear > t)
+                continue;
+            const auto &node = nodes[entry.node];
+            const int mask = rayMask(node, ray, t, tnear);
+
+            // Hit children ordered far to near, so that the nearest is popped first
+            Entry children[4];
+            int nbrChildren = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+                if (node.count[i])
+                {
+                    for (unsigned j = 0; j < node.count[i]; j++)
+                    {
+                        const int proxy = items[node.child[i] + j];
+                        if (!proxies[proxy].alive || intersectRay(proxies[proxy].aabb, ray, t) < 0.0f)
+                            continue;
+                        const float tproxy = intersect(proxy, t);
+                        if (tproxy < t)
+                        {
+                            t = tproxy;
+                            hit = proxy;
+                        }
+                    }
+                    continue;
+                }
+                int k = nbrChildren++;
+                for (; k > 0 && children[k - 1].tnear < tnear[i]; k--)
+                    children[k] = children[k - 1];
+                children[k] = {node.child[i], tnear[i]};
+            }
+            for (int i = 0; i < nbrChildren; i++)
+                stack[top++] = children[i];
+        }
+        return hit;
+    }
+
+} // namespace eeng
@@ -0,0 +1,164 @@
+
+#ifndef DynamicBvh_hpp
+#define DynamicBvh_hpp
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+
+namespace eeng
+{
+    /// @brief Counters of a DynamicBvh
+    struct BvhStats
+    {
+        int proxies = 0;       ///< Live proxies
+        int nodes = 0;         ///< Four-wide nodes
+        int leaves = 0;        ///< Leaf slots
+        int depth = 0;         ///< Deepest node, the root being 1
+        float sahCost = 0.0f;  ///< Surface area cost relative to the root, after the latest build or refit
+        float buildMs = 0.0f;  ///< Duration of the latest build
+        float refitMs = 0.0f;  ///< Duration of the latest refit
+        int builds = 0;
+        int refits = 0;
+    };
+
+    /// @brief Bounding volume hierarchy over the bounding boxes of scene instances
+    /** Proxies are boxes with user data, e.g. an entity. The tree is built
+     * with a binned surface area heuristic (SAH) into nodes of four children,
+     * stored as arrays so that all four are tested at once with SSE.
+     *
+     * Moving proxies only refits the boxes of the tree, which is cheap but
+     * degrades it as instances drift apart. Inserting proxies, or a refit
+     * that has grown the SAH cost past a threshold, triggers a rebuild on
+     * the next update(). Queries reflect the tree as of the latest update().
+     *
+     * Queries are const and may run concurrently with each other.
+     */
+    class DynamicBvh
+    {
+        struct Proxy
+        {
+            AABB aabb;
+            uint32_t userData = 0;
+            bool alive = false;
+        };
+
+        /// Four child slots, as arrays of each box component
+        struct Node
+        {
+            float minX[4], minY[4], minZ[4];
+            float maxX[4], maxY[4], maxZ[4];
+            int child[4];      ///< Node index, or first item of a leaf slot
+            unsigned count[4]; ///< Items of a leaf slot, or 0 for a node
+            int nbrChildren;
+        };
+
+        std::vector<Proxy> proxies;
+        std::vector<int> freeProxies;
+        std::vector<int> items; ///< Proxies ordered by leaf
+        std::vector<Node> nodes;
+
+        /// Proxy bounds, partitioned in place while building
+        struct BuildItem
+        {
+            AABB aabb;
+            glm::vec3 centroid;
+            int proxy;
+        };
+        std::vector<BuildItem> buildItems;
+
+        int maxLeafSize;
+        float rebuildThreshold = 1.5f;
+        float builtSahCost = 0.0f;
+        bool needsBuild = false;
+        bool needsRefit = false;
+        BvhStats stats;
+
+    public:
+        /// @brief Create BVH
+        /// @param maxLeafSize Most proxies per leaf
+        explicit DynamicBvh(int maxLeafSize = 4);
+
+        /// @brief Add a proxy
+        /// @param aabb World space bounds
+        /// @param userData Returned by getUserData(), e.g. an entity
+        /// @return Proxy index
+        int insert(const AABB &aabb, uint32_t userData);
+
+        /// @brief Remove a proxy. Its index may be reused by later insertions.
+        void remove(int proxy);
+
+        /// @brief Set the bounds of a proxy
+        void move(int proxy, const AABB &aabb);
+
+        const AABB &getBounds(int proxy) const;
+
+        uint32_t getUserData(int proxy) const;
+
+        /// @brief Bring the tree up to date
+        /// Builds if proxies were inserted or refits have degraded the tree,
+        /// otherwise refits if proxies were moved or removed.
+        void update();
+
+        /// @brief Build the tree from all proxies
+        void build();
+
+        /// @brief Recompute node bounds bottom-up, keeping the structure
+        void refit();
+
+        /// @brief Rebuild when a refit raises the SAH cost past this factor of the built cost
+        void setRebuildThreshold(float threshold);
+
+        /// @brief Proxies whose bounds are not entirely outside a view frustum
+        /// @param ProjViewMatrix Camera projection and view
+        /// @param result Proxies are appended here
+        void queryFrustum(const glm::mat4 &ProjViewMatrix,
+                          std::vector<int> &result) const;
+
+        /// @brief Proxies whose bounds overlap a box
+        void queryAabb(const AABB &aabb,
+                       std::vector<int> &result) const;
+
+        /// @brief Proxies whose bounds are hit by a ray
+        /// @param origin Ray origin
+        /// @param direction Ray direction, need not be normalized
+        /// @param tmax Largest ray parameter
+        void queryRay(const glm::vec3 &origin,
+                      const glm::vec3 &direction,
+                      float tmax,
+                      std::vector<int> &result) const;
+
+        /// @brief Closest hit along a ray
+        /// Nodes are visited front to back and skipped once they are farther
+        /// than the closest hit so far.
+        /// @param intersect Called for proxies whose bounds are hit, with the
+        /// proxy and the closest hit so far. Returns the ray parameter of its
+        /// hit, or a value not less than the given one if there is none.
+        /// @param t Largest ray parameter on input, ray parameter of the hit on output
+        /// @return Hit proxy, or EENG_NULL_INDEX
+        int raycast(const glm::vec3 &origin,
+                    const glm::vec3 &direction,
+                    float &t,
+                    const std::function<float(int proxy, float tmax)> &intersect) const;
+
+        const BvhStats &getStats() const;
+
+    private:
+        /// @brief Build a node for a range of items
+        int buildNode(int first, int count, int depth);
+
+        /// @brief Split a range of items by SAH
+        /// @return Number of items in the left part
+        int split(int first, int count);
+
+        AABB rangeBounds(int first, int count) const;
+
+        float computeSahCost() const;
+    };
+
+} // namespace eeng
+
+#endif /* DynamicBvh_hpp */
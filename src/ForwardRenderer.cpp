@@ -1,5 +1,6 @@
 
 #include <fstream>
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <glm/gtc/type_ptr.hpp>
@@ -7,6 +8,8 @@
 #include "ForwardRenderer.hpp"
 #include "glcommon.h"
 #include "ShaderLoader.h"
+#include "GLStateCache.hpp"
+#include "Profiler.hpp"
 #include "Log.hpp"
 
 namespace
@@ -21,10 +24,82 @@ namespace
         buffer << file.rdbuf();
         return buffer.str();
     }
+
+    // Vertex attribute locations, as set up by RenderableMesh::loadScene
+    const GLuint PositionLocation = 0;
+    const GLuint TexcoordLocation = 1;
+    const GLuint NormalLocation = 2;
+    const GLuint TangentLocation = 3;
+    const GLuint BinormalLocation = 4;
+
+    // Projected radius, relative to half the viewport height, below which
+    // level i+1 is used. Levels are entered and left at this size -/+ the hysteresis.
+    const float LodScreenSizes[] = {0.5f, 0.25f, 0.125f};
+    const float LodHysteresis = 0.1f;
+
+    /// Distance from a point to the closest point of an AABB
+    float distanceToAABB(const eeng::AABB &aabb, const glm::vec3 &p)
+    {
+        const glm::vec3 closest = glm::clamp(p, aabb.min, aabb.max);
+        return glm::length(p - closest);
+    }
 }
 
 namespace eeng
 {
+    SkinnedVertexCache::~SkinnedVertexCache()
+    {
+        free();
+    }
+
+    bool SkinnedVertexCache::isValidFor(const RenderableMesh &mesh) const
+    {
+        return m_is_valid && m_mesh == &mesh;
+    }
+
+    void SkinnedVertexCache::invalidate()
+    {
+        m_is_valid = false;
+    }
+
+    const std::vector<glm::mat4> &SkinnedVertexCache::getNodeMatrices() const
+    {
+        return m_node_matrices;
+    }
+
+    void SkinnedVertexCache::free()
+    {
+        if (m_Buffers[0] != 0)
+        {
+            glDeleteBuffers(BufferCount, m_Buffers);
+            for (auto &buffer : m_Buffers)
+                buffer = 0;
+        }
+
+        if (m_VAO != 0)
+        {
+            GLStateCache::instance().forgetVertexArray(m_VAO);
+            glDeleteVertexArrays(1, &m_VAO);
+            m_VAO = 0;
+        }
+
+        m_nbr_vertices = 0;
+        m_node_matrices.clear();
+        m_mesh = nullptr;
+        m_is_valid = false;
+    }
+
+    void SkinnedVertexCache::readPositions(std::vector<glm::vec3> &positions) const
+    {
+        positions.resize(m_nbr_vertices);
+        if (!m_nbr_vertices)
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[PositionBuffer]);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * m_nbr_vertices, positions.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        CheckAndThrowGLErrors();
+    }
+
     ForwardRenderer::ForwardRenderer()
     {
     }
@@ -33,7 +108,40 @@ namespace eeng
     {
         EENG_ASSERT(phongShader, "Destrying uninitialized shader program");
         if (phongShader)
+        {
+            GLStateCache::instance().forgetProgram(phongShader);
             glDeleteProgram(phongShader);
+        }
+
+        if (skinningShader)
+        {
+            GLStateCache::instance().forgetProgram(skinningShader);
+            glDeleteProgram(skinningShader);
+            glDeleteTransformFeedbacks(1, &skinningFeedback);
+            glDeleteQueries(2, skinningQueries);
+        }
+
+        if (depthShader)
+        {
+            GLStateCache::instance().forgetProgram(depthShader);
+            glDeleteProgram(depthShader);
+            GLStateCache::instance().forgetProgram(overdrawShader);
+            glDeleteProgram(overdrawShader);
+            glDeleteQueries(2, overdrawQueries);
+        }
+    }
+
+    void ForwardRenderer::setShaderCache(std::shared_ptr<ShaderCache> shaderCache)
+    {
+        this->shaderCache = shaderCache;
+    }
+
+    GLuint ForwardRenderer::createProgram(const std::string &vertSource,
+                                          const std::string &fragSource)
+    {
+        if (shaderCache)
+            return shaderCache->createProgram(vertSource, fragSource);
+        return createShaderProgram(vertSource.c_str(), fragSource.c_str());
     }
 
     void ForwardRenderer::init(const std::string &vertShaderPath,
@@ -44,20 +152,406 @@ namespace eeng
                  fragShaderPath.c_str());
         auto vertSource = file_to_string(vertShaderPath);
         auto fragSource = file_to_string(fragShaderPath);
-        phongShader = createShaderProgram(vertSource.c_str(), fragSource.c_str());
+        phongShader = createProgram(vertSource, fragSource);
 
         // Bind shader samplers to texture units
-        glUseProgram(phongShader);
+        GLStateCache::instance().useProgram(phongShader);
         for (auto &textureDesc : texturesDescs)
         {
             glUniform1i(glGetUniformLocation(phongShader, textureDesc.samplerName), textureDesc.textureUnit);
         }
-        glUseProgram(0);
+        GLStateCache::instance().useProgram(0);
         CheckAndThrowGLErrors();
 
         // placeholder_texture = create_checker_texture();
     }
 
+    void ForwardRenderer::initDepthPrepass(const std::string &depthVertShaderPath,
+                                           const std::string &depthFragShaderPath,
+                                           const std::string &overdrawFragShaderPath)
+    {
+        Log::log("Compiling depth shaders %s, %s, %s",
+                 depthVertShaderPath.c_str(),
+                 depthFragShaderPath.c_str(),
+                 overdrawFragShaderPath.c_str());
+        auto vertSource = file_to_string(depthVertShaderPath);
+        auto depthFragSource = file_to_string(depthFragShaderPath);
+        auto overdrawFragSource = file_to_string(overdrawFragShaderPath);
+        depthShader = createProgram(vertSource, depthFragSource);
+        overdrawShader = createProgram(vertSource, overdrawFragSource);
+
+        // Both only sample opacity
+        const auto &opacityDesc = texturesDescs[PhongMaterial::TextureTypeIndex::Opacity];
+        for (auto shader : {depthShader, overdrawShader})
+        {
+            GLStateCache::instance().useProgram(shader);
+            glUniform1i(glGetUniformLocation(shader, opacityDesc.samplerName), opacityDesc.textureUnit);
+        }
+        GLStateCache::instance().useProgram(0);
+
+        glGenQueries(2, overdrawQueries);
+        CheckAndThrowGLErrors();
+    }
+
+    void ForwardRenderer::setDepthPrepass(bool enabled)
+    {
+        EENG_ASSERT(!enabled || depthShader, "Depth pre-pass not initialized");
+        depthPrepass = enabled && depthShader;
+    }
+
+    bool ForwardRenderer::getDepthPrepass() const
+    {
+        return depthPrepass;
+    }
+
+    void ForwardRenderer::setDrawOrder(DrawOrder order)
+    {
+        drawOrder = order;
+    }
+
+    DrawOrder ForwardRenderer::getDrawOrder() const
+    {
+        return drawOrder;
+    }
+
+    void ForwardRenderer::setOcclusionCulling(bool enabled)
+    {
+        occlusionCulling = enabled;
+    }
+
+    bool ForwardRenderer::getOcclusionCulling() const
+    {
+        return occlusionCulling;
+    }
+
+    const OcclusionStats &ForwardRenderer::getOcclusionStats() const
+    {
+        return occlusionStats;
+    }
+
+    void ForwardRenderer::setLodSelection(bool enabled)
+    {
+        lodSelection = enabled;
+    }
+
+    bool ForwardRenderer::getLodSelection() const
+    {
+        return lodSelection;
+    }
+
+    void ForwardRenderer::setForcedLod(int level)
+    {
+        forcedLod = level;
+    }
+
+    int ForwardRenderer::getForcedLod() const
+    {
+        return forcedLod;
+    }
+
+    void ForwardRenderer::setOverdrawVisualization(bool enabled)
+    {
+        EENG_ASSERT(!enabled || overdrawShader, "Overdraw visualization not initialized");
+        overdrawVisualization = enabled && overdrawShader;
+    }
+
+    bool ForwardRenderer::getOverdrawVisualization() const
+    {
+        return overdrawVisualization;
+    }
+
+    void ForwardRenderer::initSkinning(const std::string &skinningShaderPath)
+    {
+        Log::log("Compiling skinning shader %s", skinningShaderPath.c_str());
+        auto skinningSource = file_to_string(skinningShaderPath);
+        const char *varyings[] = {
+            "skinned_Position",
+            "skinned_Normal",
+            "skinned_Tangent",
+            "skinned_Binormal"};
+        skinningShader = shaderCache ? shaderCache->createTransformFeedbackProgram(skinningSource,
+                                                                                   varyings,
+                                                                                   (int)numelem(varyings))
+                                     : createTransformFeedbackProgram(skinningSource.c_str(),
+                                                                      varyings,
+                                                                      (int)numelem(varyings));
+
+        glGenTransformFeedbacks(1, &skinningFeedback);
+        glGenQueries(2, skinningQueries);
+        CheckAndThrowGLErrors();
+    }
+
+    void ForwardRenderer::setSkinningMode(SkinningMode mode,
+                                          CpuSkinner::Backend backend)
+    {
+        if (mode == SkinningMode::CPU && !cpuSkinner)
+            cpuSkinner = std::make_unique<CpuSkinner>();
+
+        skinningMode = mode;
+        cpuSkinningBackend = CpuSkinner::isSupported(backend) ? backend : CpuSkinner::Backend::Scalar;
+    }
+
+    SkinningMode ForwardRenderer::getSkinningMode() const
+    {
+        return skinningMode;
+    }
+
+    CpuSkinner::Backend ForwardRenderer::getCpuSkinningBackend() const
+    {
+        return cpuSkinningBackend;
+    }
+
+    float ForwardRenderer::verifyCpuSkinning(const std::shared_ptr<RenderableMesh> mesh)
+    {
+        if (!mesh->boneMatrices.size() || !mesh->m_bind_positions.size())
+            return 0.0f;
+        if (!cpuSkinner)
+            cpuSkinner = std::make_unique<CpuSkinner>();
+
+        const CpuSkinner::Input in{
+            mesh->m_bind_positions.data(),
+            mesh->m_bind_normals.data(),
+            mesh->m_bind_tangents.data(),
+            mesh->m_bind_binormals.data(),
+            mesh->m_bind_skindata.data()};
+
+        float maxError = 0.0f;
+        for (const auto &submesh : mesh->m_meshes)
+        {
+            if (!submesh.is_skinned)
+                continue;
+            maxError = std::max(maxError,
+                                cpuSkinner->verify(cpuSkinningBackend,
+                                                   mesh->boneMatrices,
+                                                   in,
+                                                   submesh.base_vertex,
+                                                   submesh.base_vertex + submesh.nbr_vertices));
+        }
+        return maxError;
+    }
+
+    void ForwardRenderer::beginSkinningPass()
+    {
+        EENG_ASSERT(skinningShader, "Skinning not initialized");
+
+        // Reset counters but keep the last known GPU time
+        const float gpuTimeMs = skinningStats.gpuTimeMs;
+        skinningStats = SkinningStats{};
+        skinningStats.gpuTimeMs = gpuTimeMs;
+        skinningStartTime = std::chrono::high_resolution_clock::now();
+
+        glBeginQuery(GL_TIME_ELAPSED, skinningQueries[skinningQueryIndex]);
+
+        if (skinningMode == SkinningMode::TransformFeedback)
+        {
+            // Vertices are only captured, not rasterized
+            GLStateCache::instance().enable(GL_RASTERIZER_DISCARD);
+            GLStateCache::instance().useProgram(skinningShader);
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, skinningFeedback);
+        }
+    }
+
+    void ForwardRenderer::skinMesh(const std::shared_ptr<RenderableMesh> mesh,
+                                   SkinnedVertexCache &cache)
+    {
+        if (!mesh->boneMatrices.size())
+            return;
+
+        // Skip instances whose pose did not change since they were last skinned
+        if (cache.isValidFor(*mesh) && cache.m_pose == mesh->m_pose)
+        {
+            skinningStats.instancesSkipped++;
+            return;
+        }
+
+        if (cache.m_mesh != mesh.get())
+            initSkinnedVertexCache(*mesh, cache);
+
+        if (skinningMode == SkinningMode::CPU)
+            skinMeshCPU(*mesh, cache);
+        else
+            skinMeshTransformFeedback(*mesh, cache);
+
+        cache.m_pose = mesh->m_pose;
+        cache.m_aabb = mesh->m_model_aabb;
+        cache.m_node_matrices.resize(mesh->m_meshes.size());
+        for (unsigned i = 0; i < mesh->m_meshes.size(); i++)
+        {
+            const auto node_index = mesh->m_meshes[i].node_index;
+            cache.m_node_matrices[i] = node_index != EENG_NULL_INDEX
+                                           ? mesh->m_nodetree.nodes[node_index].global_tfm
+                                           : glm::mat4{1.0f};
+        }
+        cache.m_is_valid = true;
+        skinningStats.instancesSkinned++;
+    }
+
+    void ForwardRenderer::skinMeshTransformFeedback(const RenderableMesh &mesh,
+                                                    SkinnedVertexCache &cache)
+    {
+        glUniformMatrix4fv(glGetUniformLocation(skinningShader, "BoneMatrices"),
+                           (GLsizei)mesh.boneMatrices.size(),
+                           0,
+                           glm::value_ptr(mesh.boneMatrices[0]));
+
+        GLStateCache::instance().bindVertexArray(mesh.m_VAO);
+
+        for (const auto &submesh : mesh.m_meshes)
+        {
+            if (!submesh.is_skinned || !submesh.nbr_vertices)
+                continue;
+
+            // Capture vertices of this submesh to the same range in the cache
+            for (GLuint i = 0; i < SkinnedVertexCache::BufferCount; i++)
+                glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER,
+                                  i,
+                                  cache.m_Buffers[i],
+                                  sizeof(glm::vec3) * submesh.base_vertex,
+                                  sizeof(glm::vec3) * submesh.nbr_vertices);
+
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, submesh.base_vertex, submesh.nbr_vertices);
+            glEndTransformFeedback();
+
+            skinningStats.verticesSkinned += submesh.nbr_vertices;
+        }
+
+        GLStateCache::instance().bindVertexArray(0);
+        CheckAndThrowGLErrors();
+    }
+
+    void ForwardRenderer::skinMeshCPU(const RenderableMesh &mesh,
+                                      SkinnedVertexCache &cache)
+    {
+        EENG_ASSERT(mesh.m_bind_positions.size() >= cache.m_nbr_vertices, "Bind pose vertices not retained");
+
+        for (auto &vertices : cpuSkinnedVertices)
+            if (vertices.size() < cache.m_nbr_vertices)
+                vertices.resize(cache.m_nbr_vertices);
+
+        const CpuSkinner::Input in{
+            mesh.m_bind_positions.data(),
+            mesh.m_bind_normals.data(),
+            mesh.m_bind_tangents.data(),
+            mesh.m_bind_binormals.data(),
+            mesh.m_bind_skindata.data()};
+        const CpuSkinner::Output out{
+            cpuSkinnedVertices[SkinnedVertexCache::PositionBuffer].data(),
+            cpuSkinnedVertices[SkinnedVertexCache::NormalBuffer].data(),
+            cpuSkinnedVertices[SkinnedVertexCache::TangentBuffer].data(),
+            cpuSkinnedVertices[SkinnedVertexCache::BinormalBuffer].data()};
+
+        for (const auto &submesh : mesh.m_meshes)
+        {
+            if (!submesh.is_skinned || !submesh.nbr_vertices)
+                continue;
+
+            cpuSkinner->skin(cpuSkinningBackend,
+                             mesh.boneMatrices,
+                             in,
+                             out,
+                             submesh.base_vertex,
+                             submesh.base_vertex + submesh.nbr_vertices);
+
+            // Upload to the same range in the cache
+            for (int i = 0; i < SkinnedVertexCache::BufferCount; i++)
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, cache.m_Buffers[i]);
+                glBufferSubData(GL_ARRAY_BUFFER,
+                                sizeof(glm::vec3) * submesh.base_vertex,
+                                sizeof(glm::vec3) * submesh.nbr_vertices,
+                                &cpuSkinnedVertices[i][submesh.base_vertex]);
+            }
+
+            skinningStats.verticesSkinned += submesh.nbr_vertices;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        CheckAndThrowGLErrors();
+    }
+
+    const SkinningStats &ForwardRenderer::endSkinningPass()
+    {
+        if (skinningMode == SkinningMode::TransformFeedback)
+        {
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+            GLStateCache::instance().useProgram(0);
+            GLStateCache::instance().disable(GL_RASTERIZER_DISCARD);
+        }
+
+        glEndQuery(GL_TIME_ELAPSED);
+        skinningQueryPending[skinningQueryIndex] = true;
+
+        // Read the query issued the previous frame, if it is available,
+        // so that the CPU never waits for the GPU
+        skinningQueryIndex = 1 - skinningQueryIndex;
+        if (skinningQueryPending[skinningQueryIndex])
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(skinningQueries[skinningQueryIndex], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 elapsed_ns = 0;
+                glGetQueryObjectui64v(skinningQueries[skinningQueryIndex], GL_QUERY_RESULT, &elapsed_ns);
+                skinningStats.gpuTimeMs = elapsed_ns * 1e-6f;
+                skinningQueryPending[skinningQueryIndex] = false;
+            }
+        }
+        CheckAndThrowGLErrors();
+
+        const auto now = std::chrono::high_resolution_clock::now();
+        skinningStats.cpuTimeMs = std::chrono::duration<float, std::milli>(now - skinningStartTime).count();
+
+        return skinningStats;
+    }
+
+    void ForwardRenderer::initSkinnedVertexCache(const RenderableMesh &mesh,
+                                                 SkinnedVertexCache &cache)
+    {
+        cache.free();
+
+        // Buffers mirror the vertex layout of the mesh, so that submeshes
+        // can be drawn using the same base vertex and indices
+        unsigned nbr_vertices = 0;
+        for (const auto &submesh : mesh.m_meshes)
+            nbr_vertices = std::max(nbr_vertices, submesh.base_vertex + submesh.nbr_vertices);
+
+        glGenVertexArrays(1, &cache.m_VAO);
+        GLStateCache::instance().bindVertexArray(cache.m_VAO);
+        glGenBuffers(SkinnedVertexCache::BufferCount, cache.m_Buffers);
+
+        const GLuint locations[SkinnedVertexCache::BufferCount] = {
+            PositionLocation,
+            NormalLocation,
+            TangentLocation,
+            BinormalLocation};
+        for (int i = 0; i < SkinnedVertexCache::BufferCount; i++)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, cache.m_Buffers[i]);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * nbr_vertices, nullptr, GL_DYNAMIC_COPY);
+            glEnableVertexAttribArray(locations[i]);
+            glVertexAttribPointer(locations[i], 3, GL_FLOAT, GL_FALSE, 0, 0);
+        }
+
+        // Texture coordinates and indices are shared with the mesh, which
+        // has no texture coordinate buffer if no material uses them
+        if (mesh.m_Buffers[RenderableMesh::TexturecoordBuffer])
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, mesh.m_Buffers[RenderableMesh::TexturecoordBuffer]);
+            glEnableVertexAttribArray(TexcoordLocation);
+            glVertexAttribPointer(TexcoordLocation, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        }
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.m_Buffers[RenderableMesh::IndexBuffer]);
+
+        GLStateCache::instance().bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        CheckAndThrowGLErrors();
+
+        cache.m_nbr_vertices = nbr_vertices;
+        cache.m_mesh = &mesh;
+        cache.m_is_valid = false;
+    }
+
     void ForwardRenderer::beginPass(const glm::mat4 &ProjMatrix,
                                     const glm::mat4 &ViewMatrix,
                                     const glm::vec3 &lightPos,
@@ -68,15 +562,18 @@ namespace eeng
 
         // GL state
 
+        // Cached state is only set if it changed since the last pass
+        auto &glState = GLStateCache::instance();
+
         // Face culling - takes place before rasterization
-        glEnable(GL_CULL_FACE); // Perform face culling
-        glFrontFace(GL_CCW);    // Define winding for a front-facing face
-        glCullFace(GL_BACK);    // Cull back-facing faces
+        glState.enable(GL_CULL_FACE); // Perform face culling
+        glFrontFace(GL_CCW);          // Define winding for a front-facing face
+        glCullFace(GL_BACK);          // Cull back-facing faces
         // Rasterization stuff
-        glEnable(GL_DEPTH_TEST); // Perform depth test when rasterizing
-        glDepthFunc(GL_LESS);    // Depth test pass if z < existing z (closer than existing z)
-        glDepthMask(GL_TRUE);    // If depth test passes, write z to z-buffer
-        glDepthRange(0, 1);      // Z-buffer range is [0,1], where 0 is at z-near and 1 is at z-far
+        glState.enable(GL_DEPTH_TEST); // Perform depth test when rasterizing
+        glState.depthFunc(GL_LESS);    // Depth test pass if z < existing z (closer than existing z)
+        glState.depthMask(GL_TRUE);    // If depth test passes, write z to z-buffer
+        glDepthRange(0, 1);            // Z-buffer range is [0,1], where 0 is at z-near and 1 is at z-far
 
         // Define viewport transform = Clip -> Screen space (applied before rasterization)
         // TODO glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
@@ -100,10 +597,12 @@ namespace eeng
         //     glEnable(GL_CULL_FACE);
         // }
 
-        glUseProgram(phongShader);
+        glState.useProgram(phongShader);
 
         // Bind matrices
-        const auto ProjViewMatrix = ProjMatrix * ViewMatrix;
+        this->ProjMatrix = ProjMatrix;
+        this->ProjViewMatrix = ProjMatrix * ViewMatrix;
+        this->eyePos = eyePos;
         glUniformMatrix4fv(glGetUniformLocation(phongShader, "ProjViewMatrix"), 1, 0, glm::value_ptr(ProjViewMatrix));
 
         // Bind light & eye position
@@ -116,103 +615,390 @@ namespace eeng
         if (cubemapTextureHandle)
         {
             // const auto &cubemapTextureDesc = texturesDescs[TextureTypeIndex::Cubemap];
-            glActiveTexture(GL_TEXTURE0 + cubemapTextureDesc.textureUnit);
-            glBindTexture(GL_TEXTURE_2D, cubemapTextureHandle);
+            glState.bindTexture(GL_TEXTURE0 + cubemapTextureDesc.textureUnit, GL_TEXTURE_2D, cubemapTextureHandle);
 
             glUniform1i(glGetUniformLocation(phongShader, cubemapTextureDesc.flagName), 1);
         }
 
         CheckAndThrowGLErrors();
         drawcallCounter = 0;
+
+        drawItems.clear();
+        bonePalettes.clear();
+        occluderItems.clear();
     }
 
     int ForwardRenderer::endPass()
     {
-        glUseProgram(0);
-        glBindVertexArray(0);
+        EENG_PROFILE_SCOPE("Render pass");
+        EENG_PROFILE_GPU_SCOPE("Render pass");
+        auto &glState = GLStateCache::instance();
+
+        // Draw order
+        drawItemOrder.resize(drawItems.size());
+        for (unsigned i = 0; i < drawItemOrder.size(); i++)
+            drawItemOrder[i] = i;
+        if (drawOrder == DrawOrder::FrontToBack)
+        {
+            EENG_PROFILE_SCOPE("Sort draws");
+            std::stable_sort(drawItemOrder.begin(),
+                             drawItemOrder.end(),
+                             [&](unsigned a, unsigned b)
+                             { return drawItems[a].distance < drawItems[b].distance; });
+        }
+
+        if (occlusionCulling)
+            cullDrawItems();
+        else
+            occlusionStats = OcclusionStats{};
+
+        passStats.drawcalls = passStats.prepassDrawcalls = 0;
+        passStats.triangles = 0;
+
+        // Depth pre-pass
+        if (depthPrepass)
+        {
+            EENG_PROFILE_SCOPE("Depth pre-pass");
+            EENG_PROFILE_GPU_SCOPE("Depth pre-pass");
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glState.useProgram(depthShader);
+            glUniformMatrix4fv(glGetUniformLocation(depthShader, "ProjViewMatrix"), 1, 0, glm::value_ptr(ProjViewMatrix));
+            passStats.prepassDrawcalls = submitDrawItems(depthShader, false);
+
+            // Only shade fragments that are visible
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glState.depthFunc(GL_EQUAL);
+            glState.depthMask(GL_FALSE);
+        }
+
+        // Shading pass
+        GLuint shader = phongShader;
+        if (overdrawVisualization)
+        {
+            shader = overdrawShader;
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glState.enable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glState.useProgram(overdrawShader);
+            glUniformMatrix4fv(glGetUniformLocation(overdrawShader, "ProjViewMatrix"), 1, 0, glm::value_ptr(ProjViewMatrix));
+        }
+        else
+            glState.useProgram(phongShader);
+
+        if (overdrawQueries[0])
+            glBeginQuery(GL_SAMPLES_PASSED, overdrawQueries[overdrawQueryIndex]);
+        passStats.drawcalls = submitDrawItems(shader, !overdrawVisualization);
+        for (auto index : drawItemOrder)
+            passStats.triangles += drawItems[index].nbr_indices / 3;
+        if (overdrawQueries[0])
+            endOverdrawQuery();
+
+        drawcallCounter = passStats.prepassDrawcalls + passStats.drawcalls;
+
+        // Restore GL state
+        glState.disable(GL_BLEND);
+        glState.depthFunc(GL_LESS);
+        glState.depthMask(GL_TRUE);
+        glState.useProgram(0);
+        glState.bindVertexArray(0);
+        CheckAndThrowGLErrors();
 
-        // Possibly restore GL state
+        drawItems.clear();
+        bonePalettes.clear();
+        occluderItems.clear();
 
         return drawcallCounter;
     }
 
+    const PassStats &ForwardRenderer::getPassStats() const
+    {
+        return passStats;
+    }
+
+    void ForwardRenderer::addOccluder(const std::shared_ptr<RenderableMesh> mesh,
+                                      const glm::mat4 &WorldMatrix,
+                                      const glm::mat4 *nodeMatrices)
+    {
+        if (!occlusionCulling)
+            return;
+
+        for (unsigned i = 0; i < mesh->m_meshes.size(); i++)
+        {
+            const auto &submesh = mesh->m_meshes[i];
+            if (submesh.is_skinned || !submesh.nbr_indices)
+                continue;
+
+            // Alpha tested geometry (e.g. foliage) does not occlude where it is discarded
+            const auto &mtl = mesh->m_materials[submesh.mtl_index];
+            if (mtl.textureIndices[PhongMaterial::TextureTypeIndex::Opacity] != NO_TEXTURE)
+                continue;
+
+            // Node transforms are copied, like for draws
+            if (nodeMatrices)
+                occluderItems.push_back({mesh, i, WorldMatrix * nodeMatrices[i]});
+            else if (submesh.node_index != EENG_NULL_INDEX)
+                occluderItems.push_back({mesh, i, WorldMatrix * mesh->m_nodetree.nodes[submesh.node_index].global_tfm});
+            else
+                occluderItems.push_back({mesh, i, WorldMatrix});
+        }
+    }
+
+    void ForwardRenderer::cullDrawItems()
+    {
+        EENG_PROFILE_SCOPE("Occlusion culling");
+        occlusionCuller.begin(ProjViewMatrix);
+        for (const auto &occluder : occluderItems)
+        {
+            const auto &mesh = *occluder.mesh;
+            const auto &submesh = mesh.m_meshes[occluder.submeshIndex];
+            if (mesh.m_bind_positions.size() < submesh.base_vertex + submesh.nbr_vertices ||
+                mesh.m_indices.size() < submesh.base_index + submesh.nbr_indices)
+                continue;
+
+            occlusionCuller.rasterize(&mesh.m_bind_positions[submesh.base_vertex],
+                                      submesh.nbr_vertices,
+                                      &mesh.m_indices[submesh.base_index],
+                                      submesh.nbr_indices,
+                                      occluder.WorldMatrix);
+        }
+        occlusionCuller.end();
+
+        // Keep visible draws, in order
+        auto visibleEnd = std::remove_if(drawItemOrder.begin(),
+                                         drawItemOrder.end(),
+                                         [&](unsigned index)
+                                         {
+                                             const auto &item = drawItems[index];
+                                             return item.aabb && !occlusionCuller.isVisible(item.aabb, item.WorldMatrix);
+                                         });
+        drawItemOrder.erase(visibleEnd, drawItemOrder.end());
+
+        occlusionStats = occlusionCuller.getStats();
+    }
+
+    int ForwardRenderer::selectLod(const AABB &aabb,
+                                   const glm::mat4 &WorldMatrix,
+                                   LodState *lodState) const
+    {
+        if (!aabb)
+            return 0;
+
+        // Projected radius of the world space bounding sphere
+        const glm::vec4 bs = aabb.post_transform(glm::vec3(WorldMatrix[3]), glm::mat3(WorldMatrix)).getBoundingSphere();
+        const float distance = glm::length(glm::vec3(bs) - eyePos);
+        const float screenSize = distance > bs.w ? bs.w * ProjMatrix[1][1] / distance : std::numeric_limits<float>::max();
+
+        const int maxLevel = (int)numelem(LodScreenSizes);
+        int level = lodState ? std::min(lodState->level, maxLevel) : 0;
+        while (level < maxLevel && screenSize < LodScreenSizes[level] * (1.0f - LodHysteresis))
+            level++;
+        while (level > 0 && screenSize > LodScreenSizes[level - 1] * (1.0f + LodHysteresis))
+            level--;
+
+        if (lodState)
+            lodState->level = level;
+        return level;
+    }
+
+    void ForwardRenderer::endOverdrawQuery()
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+
+        // Samples are counted per pixel sample
+        GLint viewport[4] = {0}, samples = 0;
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glGetIntegerv(GL_SAMPLES, &samples);
+        overdrawPixels[overdrawQueryIndex] = viewport[2] * viewport[3] * std::max(1, samples);
+        overdrawQueryPending[overdrawQueryIndex] = true;
+
+        // Read the query issued the previous frame, if it is available
+        overdrawQueryIndex = 1 - overdrawQueryIndex;
+        if (overdrawQueryPending[overdrawQueryIndex])
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(overdrawQueries[overdrawQueryIndex], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 samplesPassed = 0;
+                glGetQueryObjectui64v(overdrawQueries[overdrawQueryIndex], GL_QUERY_RESULT, &samplesPassed);
+                passStats.overdraw = (float)samplesPassed / std::max(1, overdrawPixels[overdrawQueryIndex]);
+                overdrawQueryPending[overdrawQueryIndex] = false;
+            }
+        }
+    }
+
     void ForwardRenderer::renderMesh(const std::shared_ptr<RenderableMesh> mesh,
-                                     const glm::mat4 &WorldMatrix)
+                                     const glm::mat4 &WorldMatrix,
+                                     const SkinnedVertexCache *skinCache,
+                                     LodState *lodState)
     {
-        // Bind bone matrices
-        if (mesh->boneMatrices.size())
-            glUniformMatrix4fv(glGetUniformLocation(phongShader, "BoneMatrices"),
-                               (GLsizei)mesh->boneMatrices.size(),
-                               0,
-                               glm::value_ptr(mesh->boneMatrices[0]));
+        queueMesh(mesh,
+                  WorldMatrix,
+                  skinCache,
+                  lodState,
+                  nullptr,
+                  mesh->boneMatrices.size() ? mesh->boneMatrices.data() : nullptr,
+                  mesh->m_model_aabb ? mesh->m_model_aabb : mesh->mSceneAABB);
+    }
 
-        glBindVertexArray(mesh->m_VAO);
+    void ForwardRenderer::renderMesh(const std::shared_ptr<RenderableMesh> mesh,
+                                     const glm::mat4 &WorldMatrix,
+                                     const glm::mat4 *nodeMatrices,
+                                     const glm::mat4 *boneMatrices,
+                                     const AABB &poseAABB,
+                                     LodState *lodState)
+    {
+        queueMesh(mesh, WorldMatrix, nullptr, lodState, nodeMatrices, boneMatrices, poseAABB);
+    }
+
+    void ForwardRenderer::queueMesh(const std::shared_ptr<RenderableMesh> &mesh,
+                                    const glm::mat4 &WorldMatrix,
+                                    const SkinnedVertexCache *skinCache,
+                                    LodState *lodState,
+                                    const glm::mat4 *nodeMatrices,
+                                    const glm::mat4 *boneMatrices,
+                                    const AABB &poseAABB)
+    {
+        // Skinned submeshes are drawn from the cache if it has been filled
+        // for this mesh, in which case bone matrices are not needed. Other
+        // submeshes then use the node transforms of the cached pose.
+        const bool useSkinCache = skinCache && skinCache->isValidFor(*mesh);
+        if (useSkinCache && !nodeMatrices)
+            nodeMatrices = skinCache->m_node_matrices.data();
+
+        // Level of detail of the instance, from the size of its pose AABB
+        int lodLevel = 0;
+        if (forcedLod >= 0)
+            lodLevel = forcedLod;
+        else if (lodSelection)
+            lodLevel = selectLod(useSkinCache ? skinCache->m_aabb : poseAABB, WorldMatrix, lodState);
+
+        // Copy bone matrices, unless all skinned submeshes use the cache.
+        // The number of bones is fixed once a mesh is loaded.
+        const unsigned paletteOffset = (unsigned)bonePalettes.size();
+        const unsigned paletteSize = boneMatrices && !useSkinCache ? (unsigned)mesh->boneMatrices.size() : 0;
+        bonePalettes.insert(bonePalettes.end(), boneMatrices, boneMatrices + paletteSize);
 
         for (uint i = 0; i < mesh->m_meshes.size(); i++)
         {
             const auto &submesh = mesh->m_meshes[i];
-            const auto &mtl = mesh->m_materials[submesh.mtl_index];
+
+            DrawItem item;
+            item.mesh = mesh;
+            item.submeshIndex = i;
+            item.paletteOffset = paletteOffset;
+            item.paletteSize = paletteSize;
+
+            const bool drawFromSkinCache = useSkinCache && submesh.is_skinned;
+            item.VAO = drawFromSkinCache ? skinCache->m_VAO : mesh->m_VAO;
+            item.isSkinned = submesh.is_skinned && !drawFromSkinCache;
+
+            // Submeshes may have fewer levels than selected
+            const int submeshLod = std::min(lodLevel, (int)submesh.lods.size());
+            item.base_index = submeshLod ? submesh.lods[submeshLod - 1].base_index : submesh.base_index;
+            item.nbr_indices = submeshLod ? submesh.lods[submeshLod - 1].nbr_indices : submesh.nbr_indices;
 
             // Append hierarchical transform non-skinned meshes that are linked to nodes
-            if (submesh.node_index != EENG_NULL_INDEX && !submesh.is_skinned)
+            if (nodeMatrices && !submesh.is_skinned)
+                item.WorldMatrix = WorldMatrix * nodeMatrices[i];
+            else if (submesh.node_index != EENG_NULL_INDEX && !submesh.is_skinned)
+                item.WorldMatrix = WorldMatrix * mesh->m_nodetree.nodes[submesh.node_index].global_tfm;
+            else
+                item.WorldMatrix = WorldMatrix;
+
+            // Model space AABB, in the current pose for skinned submeshes
+            item.aabb = submesh.is_skinned
+                            ? (drawFromSkinCache ? skinCache->m_aabb : poseAABB)
+                            : mesh->m_mesh_aabbs_bind[i];
+            item.distance = item.aabb
+                                ? distanceToAABB(item.aabb.post_transform(glm::vec3(item.WorldMatrix[3]), glm::mat3(item.WorldMatrix)), eyePos)
+                                : 0.0f;
+
+            drawItems.push_back(std::move(item));
+        }
+    }
+
+    int ForwardRenderer::submitDrawItems(GLuint shader,
+                                         bool bindMaterials)
+    {
+        const auto &opacityDesc = texturesDescs[PhongMaterial::TextureTypeIndex::Opacity];
+        const GLint worldMatrixLocation = glGetUniformLocation(shader, "WorldMatrix");
+        const GLint boneMatricesLocation = glGetUniformLocation(shader, "BoneMatrices");
+        const GLint isSkinnedLocation = glGetUniformLocation(shader, "u_is_skinned");
+
+        auto &glState = GLStateCache::instance();
+        unsigned boundPalette = (unsigned)-1;
+        int drawcalls = 0;
+
+        for (auto index : drawItemOrder)
+        {
+            const auto &item = drawItems[index];
+            const auto &mesh = item.mesh;
+            const auto &submesh = mesh->m_meshes[item.submeshIndex];
+            const auto &mtl = mesh->m_materials[submesh.mtl_index];
+
+            glState.bindVertexArray(item.VAO);
+
+            // Bind bone matrices
+            if (item.isSkinned && item.paletteSize && item.paletteOffset != boundPalette)
             {
-                const auto WorldMeshMatrix = WorldMatrix * mesh->m_nodetree.nodes[submesh.node_index].global_tfm;
-                glUniformMatrix4fv(glGetUniformLocation(phongShader, "WorldMatrix"), 1, 0, glm::value_ptr(WorldMeshMatrix));
+                glUniformMatrix4fv(boneMatricesLocation,
+                                   (GLsizei)item.paletteSize,
+                                   0,
+                                   glm::value_ptr(bonePalettes[item.paletteOffset]));
+                boundPalette = item.paletteOffset;
             }
-            else
-                glUniformMatrix4fv(glGetUniformLocation(phongShader, "WorldMatrix"), 1, 0, glm::value_ptr(WorldMatrix));
-
-            // (Could do view frustum culling (VFC) here using the projection matrix)
-            // (Mesh traversal)
-            // if (submesh.is_skinned)
-            //     submesh.aabb = meshres.src_mesh->m_model_aabb;
-            // else
-            //     submesh.aabb = meshres.src_mesh->m_mesh_aabbs_pose[i];
-            // (VFC)
-            // v4f bs = aabb.post_transform(tfm).get_boundingsphere();
-
-            // Color components
-            glUniform3fv(glGetUniformLocation(phongShader, "Ka"), 1, glm::value_ptr(mtl.Ka));
-            glUniform3fv(glGetUniformLocation(phongShader, "Kd"), 1, glm::value_ptr(mtl.Kd));
-            glUniform3fv(glGetUniformLocation(phongShader, "Ks"), 1, glm::value_ptr(mtl.Ks));
-            glUniform1f(glGetUniformLocation(phongShader, "shininess"), mtl.shininess);
-
-            // Bind textures and texture flags
+
+            glUniformMatrix4fv(worldMatrixLocation, 1, 0, glm::value_ptr(item.WorldMatrix));
+
+            if (bindMaterials)
+            {
+                // Color components
+                glUniform3fv(glGetUniformLocation(shader, "Ka"), 1, glm::value_ptr(mtl.Ka));
+                glUniform3fv(glGetUniformLocation(shader, "Kd"), 1, glm::value_ptr(mtl.Kd));
+                glUniform3fv(glGetUniformLocation(shader, "Ks"), 1, glm::value_ptr(mtl.Ks));
+                glUniform1f(glGetUniformLocation(shader, "shininess"), mtl.shininess);
+            }
+
+            // Bind textures and texture flags (only opacity is needed for depth)
             for (auto &textureDesc : texturesDescs)
             {
+                if (!bindMaterials && &textureDesc != &opacityDesc)
+                    continue;
+
                 // if (texture.textureTypeIndex == TextureTypeIndex::Cubemap) continue;
                 const int textureIndex = mtl.textureIndices[textureDesc.textureTypeIndex];
                 const bool hasTexture = (textureIndex != NO_TEXTURE);
                 if (hasTexture)
                 {
-                    glActiveTexture(GL_TEXTURE0 + textureDesc.textureUnit);
-                    glBindTexture(GL_TEXTURE_2D, mesh->m_textures[textureIndex].getHandle());
+                    glState.bindTexture(GL_TEXTURE0 + textureDesc.textureUnit,
+                                        GL_TEXTURE_2D,
+                                        mesh->m_textures[textureIndex].getHandle());
                 }
-                glUniform1i(glGetUniformLocation(phongShader, textureDesc.flagName), hasTexture);
+                glUniform1i(glGetUniformLocation(shader, textureDesc.flagName), hasTexture);
             }
 
-            // Skinned flag
-            glUniform1i(glGetUniformLocation(phongShader, "u_is_skinned"), (int)submesh.is_skinned);
+            // Skinned flag (cached vertices are already skinned)
+            glUniform1i(isSkinnedLocation, (int)item.isSkinned);
 
             // Render
             glDrawElementsBaseVertex(GL_TRIANGLES,
-                                     submesh.nbr_indices,
+                                     item.nbr_indices,
                                      GL_UNSIGNED_INT,
-                                     (GLvoid *)(sizeof(uint) * submesh.base_index),
+                                     (GLvoid *)(sizeof(uint) * item.base_index),
                                      submesh.base_vertex);
-            drawcallCounter++;
-
-            // Unbind textures
-            for (auto &texture : texturesDescs)
-            {
-                glActiveTexture(GL_TEXTURE0 + texture.textureUnit);
-                glBindTexture(GL_TEXTURE_2D, 0);
-            }
+            drawcalls++;
 
             CheckAndThrowGLErrors();
         }
 
-        glBindVertexArray(0);
+        // Textures stay bound between draws, since unused units are flagged
+        // off, so that draws sharing textures do not rebind them
+        for (auto &texture : texturesDescs)
+            glState.bindTexture(GL_TEXTURE0 + texture.textureUnit, GL_TEXTURE_2D, 0);
+        glState.bindVertexArray(0);
+        return drawcalls;
     }
 
 } // namespace eeng
\ No newline at end of file
@@ -9,20 +9,186 @@
 // #include <unordered_map>
 // #include <fstream>
 // #include <string>
+#include <chrono>
 // GL
 #include "glcommon.h"
 #include "RenderableMesh.hpp"
+#include "CpuSkinner.hpp"
+#include "OcclusionCuller.hpp"
+#include "ShaderCache.hpp"
 
 #include <glm/glm.hpp>
 
 namespace eeng
 {
+    /// @brief Skinned vertices of one animated mesh instance
+    /** Written by the skinning pre-pass and then drawn as static geometry by
+     * all subsequent passes. Each animated instance needs its own cache, also
+     * when instances share the same mesh. Node transforms of the submeshes
+     * are cached along with the vertices, so that node-animated submeshes of
+     * the instance are drawn in the same pose as its skinned ones.
+     */
+    class SkinnedVertexCache
+    {
+        friend class ForwardRenderer;
+
+        enum
+        {
+            PositionBuffer,
+            NormalBuffer,
+            TangentBuffer,
+            BinormalBuffer,
+            BufferCount
+        };
+
+        GLuint m_VAO = 0;
+        GLuint m_Buffers[BufferCount] = {0};
+        unsigned m_nbr_vertices = 0;
+
+        const RenderableMesh *m_mesh = nullptr; // Mesh the buffers are laid out for
+        RenderableMesh::PoseKey m_pose;         // Pose of the cached vertices
+        AABB m_aabb;                            // Model space AABB of the cached pose
+        std::vector<glm::mat4> m_node_matrices; // Node transforms of the submeshes in the cached pose
+        bool m_is_valid = false;
+
+    public:
+        SkinnedVertexCache() = default;
+        SkinnedVertexCache(const SkinnedVertexCache &) = delete;
+        SkinnedVertexCache &operator=(const SkinnedVertexCache &) = delete;
+
+        ~SkinnedVertexCache();
+
+        /// @brief Check if cache holds skinned vertices of a mesh in its current pose
+        bool isValidFor(const RenderableMesh &mesh) const;
+
+        /// @brief Release GL buffers
+        void free();
+
+        /// @brief Mark the cached vertices as out of date, e.g. for an instance not skinned this frame
+        void invalidate();
+
+        /// @brief Global node transforms of the submeshes in the cached pose, one per submesh
+        const std::vector<glm::mat4> &getNodeMatrices() const;
+
+        /// @brief Read the cached positions back from the GL buffer, e.g. for verification
+        void readPositions(std::vector<glm::vec3> &positions) const;
+    };
+
+    /// @brief Timings and counters of the skinning pre-pass
+    struct SkinningStats
+    {
+        int instancesSkinned = 0;  ///< Instances re-skinned this frame
+        int instancesSkipped = 0;  ///< Instances with an unchanged pose
+        unsigned verticesSkinned = 0;
+        float cpuTimeMs = 0.0f;    ///< CPU time to issue the pass
+        float gpuTimeMs = 0.0f;    ///< GPU time, lags one or more frames
+    };
+
+    /// @brief Where the skinning pre-pass runs
+    enum class SkinningMode
+    {
+        TransformFeedback, ///< Vertex shader with transform feedback
+        CPU                ///< CpuSkinner, uploaded to the cache buffers
+    };
+
+    /// @brief Order in which the draws of a pass are submitted
+    enum class DrawOrder
+    {
+        Submission, ///< Order of renderMesh calls
+        FrontToBack ///< Nearest first, by eye distance to world space AABBs
+    };
+
+    /// @brief Level of detail of a mesh instance, kept between frames
+    /** Levels change with hysteresis around the screen size thresholds,
+     * so that instances close to a threshold do not switch back and forth.
+     */
+    struct LodState
+    {
+        int level = 0; ///< 0 is full detail
+    };
+
+    /// @brief Counters of the latest rendering pass
+    struct PassStats
+    {
+        int drawcalls = 0;        ///< Drawcalls of the shading pass
+        unsigned triangles = 0;   ///< Triangles drawn by the shading pass
+        int prepassDrawcalls = 0; ///< Drawcalls of the depth pre-pass
+        float overdraw = 0.0f;    ///< Shaded samples per pixel, lags one or more frames
+    };
+
     class ForwardRenderer
     {
         GLuint phongShader = 0;
+        GLuint skinningShader = 0;
+        GLuint depthShader = 0;
+        GLuint overdrawShader = 0;
         GLuint placeholder_texture = 0;
         int drawcallCounter;
 
+        std::shared_ptr<ShaderCache> shaderCache;
+
+        // Draws are queued by renderMesh and submitted by endPass
+        struct DrawItem
+        {
+            std::shared_ptr<RenderableMesh> mesh;
+            unsigned submeshIndex;
+            glm::mat4 WorldMatrix;  // Including node transform
+            GLuint VAO;             // Mesh or skinned vertex cache
+            unsigned base_index;    // Index range of the selected level of detail
+            unsigned nbr_indices;
+            bool isSkinned;         // Skinned in the vertex shader
+            unsigned paletteOffset; // First bone matrix in bonePalettes
+            unsigned paletteSize;
+            AABB aabb;              // Model space AABB
+            float distance;         // Eye distance to world space AABB
+        };
+        std::vector<DrawItem> drawItems;
+        std::vector<unsigned> drawItemOrder;
+        std::vector<glm::mat4> bonePalettes; // Copied, since meshes may be re-animated before the pass ends
+        glm::mat4 ProjMatrix{1.0f};
+        glm::mat4 ProjViewMatrix{1.0f};
+        glm::vec3 eyePos{0.0f};
+
+        // Occlusion culling
+        struct OccluderItem
+        {
+            std::shared_ptr<RenderableMesh> mesh;
+            unsigned submeshIndex;
+            glm::mat4 WorldMatrix; // Including node transform
+        };
+        std::vector<OccluderItem> occluderItems;
+        OcclusionCuller occlusionCuller;
+        OcclusionStats occlusionStats;
+
+        // Pass options
+        bool depthPrepass = false;
+        bool occlusionCulling = false;
+        bool lodSelection = false;
+        int forcedLod = -1;
+        DrawOrder drawOrder = DrawOrder::Submission;
+        bool overdrawVisualization = false;
+
+        // Samples passed by the shading pass
+        GLuint overdrawQueries[2] = {0};
+        int overdrawPixels[2] = {0};
+        int overdrawQueryIndex = 0;
+        bool overdrawQueryPending[2] = {false};
+        PassStats passStats;
+
+        // Skinning pre-pass
+        GLuint skinningFeedback = 0;
+        GLuint skinningQueries[2] = {0};
+        int skinningQueryIndex = 0;
+        bool skinningQueryPending[2] = {false};
+        SkinningStats skinningStats;
+        std::chrono::high_resolution_clock::time_point skinningStartTime;
+        SkinningMode skinningMode = SkinningMode::TransformFeedback;
+
+        // CPU skinning
+        std::unique_ptr<CpuSkinner> cpuSkinner;
+        CpuSkinner::Backend cpuSkinningBackend = CpuSkinner::Backend::Scalar;
+        std::vector<glm::vec3> cpuSkinnedVertices[SkinnedVertexCache::BufferCount];
+
         struct TextureDesc
         {
             PhongMaterial::TextureTypeIndex textureTypeIndex;
@@ -53,12 +219,92 @@ namespace eeng
 
         ~ForwardRenderer();
 
+        /// @brief Store and reuse compiled shader programs
+        /// Set before the init functions. Without a cache, all programs are compiled.
+        void setShaderCache(std::shared_ptr<ShaderCache> shaderCache);
+
         /// @brief Initialize renderer
         /// @param vertShaderPath
         /// @param fragShaderPath
         void init(const std::string &vertShaderPath,
                   const std::string &fragShaderPath);
 
+        /// @brief Initialize the depth pre-pass and overdraw visualization
+        /// @param depthVertShaderPath Position-only vertex shader
+        /// @param depthFragShaderPath Fragment shader performing opacity discard only
+        /// @param overdrawFragShaderPath Fragment shader counting fragments using additive blending
+        void initDepthPrepass(const std::string &depthVertShaderPath,
+                              const std::string &depthFragShaderPath,
+                              const std::string &overdrawFragShaderPath);
+
+        /// @brief Lay down depth before shading, so that each pixel is shaded once
+        /// Shading then uses GL_EQUAL depth testing.
+        void setDepthPrepass(bool enabled);
+
+        bool getDepthPrepass() const;
+
+        void setDrawOrder(DrawOrder order);
+
+        DrawOrder getDrawOrder() const;
+
+        /// @brief Cull draws that are outside the view frustum or hidden behind occluders
+        void setOcclusionCulling(bool enabled);
+
+        bool getOcclusionCulling() const;
+
+        /// @brief Culling counters of the latest pass
+        const OcclusionStats &getOcclusionStats() const;
+
+        /// @brief Select level of detail by the projected screen size of instances
+        /// Only meshes loaded with RenderableMesh::setLodGeneration have levels.
+        void setLodSelection(bool enabled);
+
+        bool getLodSelection() const;
+
+        /// @brief Draw all instances at a given level of detail
+        /// @param level Level, or -1 for automatic selection
+        void setForcedLod(int level);
+
+        int getForcedLod() const;
+
+        /// @brief Replace shading by a count of shaded fragments per pixel
+        void setOverdrawVisualization(bool enabled);
+
+        bool getOverdrawVisualization() const;
+
+        /// @brief Initialize the skinning pre-pass
+        /// @param skinningShaderPath Vertex shader with transform feedback outputs
+        void initSkinning(const std::string &skinningShaderPath);
+
+        /// @brief Select how the skinning pre-pass is performed
+        /// @param mode Transform feedback or CPU skinning
+        /// @param backend Backend used in CPU mode
+        void setSkinningMode(SkinningMode mode,
+                             CpuSkinner::Backend backend = CpuSkinner::getBestBackend());
+
+        SkinningMode getSkinningMode() const;
+
+        CpuSkinner::Backend getCpuSkinningBackend() const;
+
+        /// @brief Compare the CPU skinning backend against the scalar reference
+        /// @param mesh Mesh, posed using animate()
+        /// @return Largest absolute difference of any skinned vertex component
+        float verifyCpuSkinning(const std::shared_ptr<RenderableMesh> mesh);
+
+        /// @brief Start of the skinning pre-pass
+        void beginSkinningPass();
+
+        /// @brief Skin an animated mesh instance into a cache using its current pose
+        /// Does nothing if the cache already holds the current pose.
+        /// @param mesh Mesh, posed using animate()
+        /// @param cache Skinned vertices of this instance
+        void skinMesh(const std::shared_ptr<RenderableMesh> mesh,
+                      SkinnedVertexCache &cache);
+
+        /// @brief End of the skinning pre-pass
+        /// @return Stats for the pass
+        const SkinningStats &endSkinningPass();
+
         /// @brief Start of a rendering pass and set common uniforms
         /// @param ProjMatrix
         /// @param ViewMatrix
@@ -71,15 +317,94 @@ namespace eeng
                        const glm::vec3 &lightColor,
                        const glm::vec3 &eyePos);
 
-        /// @brief Ends pass and resets GL state
-        /// @return Number of drawcalls made during pass
+        /// @brief Submits queued draws, ends pass and resets GL state
+        /// @return Number of drawcalls made during pass, including any pre-pass
         int endPass();
 
-        /// @brief Render an instance of a mesh
+        /// @brief Counters of the latest pass
+        const PassStats &getPassStats() const;
+
+        /// @brief Use an instance of a mesh as occluder in the current pass
+        /// Only non-skinned submeshes without opacity maps occlude. Occluders are not drawn by this
+        /// call, and are ignored unless occlusion culling is enabled.
+        /// @param mesh Occluding mesh
+        /// @param WorldMatrix Instance world transform
+        /// @param nodeMatrices Global node transforms of the submeshes, one per
+        /// submesh, or nullptr to use the current pose of the mesh
+        void addOccluder(const std::shared_ptr<RenderableMesh> mesh,
+                         const glm::mat4 &WorldMatrix,
+                         const glm::mat4 *nodeMatrices = nullptr);
+
+        /// @brief Queue an instance of a mesh for rendering
+        /// The mesh may be re-animated after this call, since its transforms
+        /// and bone matrices are copied.
         /// @param mesh Mesh to render
         /// @param WorldMatrix Instance world transform
+        /// @param skinCache Skinned vertices of this instance. If valid, these
+        /// are used for skinned submeshes instead of skinning in the vertex shader,
+        /// and its node transforms for the other submeshes.
+        /// @param lodState Level of detail of this instance. Without it, levels
+        /// are selected without hysteresis.
+        void renderMesh(const std::shared_ptr<RenderableMesh> mesh,
+                        const glm::mat4 &WorldMatrix,
+                        const SkinnedVertexCache *skinCache = nullptr,
+                        LodState *lodState = nullptr);
+
+        /// @brief Queue an instance of a mesh in a pose captured earlier
+        /// The pose of the mesh is not read, so the mesh may be animated
+        /// concurrently, e.g. by a simulation thread. See RenderSnapshot.
+        /// @param nodeMatrices Global node transforms of the submeshes, one per submesh
+        /// @param boneMatrices Bone matrices, as many as the mesh has, or nullptr
+        /// if the mesh has no bones
+        /// @param poseAABB Model space AABB of the pose
         void renderMesh(const std::shared_ptr<RenderableMesh> mesh,
-                        const glm::mat4 &WorldMatrix);
+                        const glm::mat4 &WorldMatrix,
+                        const glm::mat4 *nodeMatrices,
+                        const glm::mat4 *boneMatrices,
+                        const AABB &poseAABB,
+                        LodState *lodState = nullptr);
+
+    private:
+        /// @brief Create a program through the shader cache, if set
+        GLuint createProgram(const std::string &vertSource,
+                             const std::string &fragSource);
+
+        void queueMesh(const std::shared_ptr<RenderableMesh> &mesh,
+                       const glm::mat4 &WorldMatrix,
+                       const SkinnedVertexCache *skinCache,
+                       LodState *lodState,
+                       const glm::mat4 *nodeMatrices,
+                       const glm::mat4 *boneMatrices,
+                       const AABB &poseAABB);
+
+        void initSkinnedVertexCache(const RenderableMesh &mesh,
+                                    SkinnedVertexCache &cache);
+
+        void skinMeshTransformFeedback(const RenderableMesh &mesh,
+                                       SkinnedVertexCache &cache);
+
+        void skinMeshCPU(const RenderableMesh &mesh,
+                         SkinnedVertexCache &cache);
+
+        /// @brief Draw queued items in the current order
+        /// @param shader Program to draw with
+        /// @param bindMaterials Bind all material data, or only what is needed for opacity discard
+        /// @return Number of drawcalls
+        int submitDrawItems(GLuint shader,
+                            bool bindMaterials);
+
+        void endOverdrawQuery();
+
+        /// @brief Rasterize occluders and remove hidden draws from the draw order
+        void cullDrawItems();
+
+        /// @brief Level of detail of an instance from its projected size
+        /// @param aabb Model space AABB of the instance in its current pose
+        /// @param WorldMatrix Instance world transform
+        /// @param lodState Previous level, updated if given
+        int selectLod(const AABB &aabb,
+                      const glm::mat4 &WorldMatrix,
+                      LodState *lodState) const;
     };
 
 using ForwardRendererPtr = std::shared_ptr<ForwardRenderer>;
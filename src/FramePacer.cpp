@@ -0,0 +1,239 @@
+
+#include <cmath>
+#include <cfloat>
+#include <string>
+#include <algorithm>
+#include <SDL.h>
+#include "imgui.h"
+#include "FramePacer.hpp"
+
+namespace eeng
+{
+    void FrameTimeHistogram::add(float ms)
+    {
+        const int bin = std::min(int(std::max(ms, 0.0f) / BinMs), NbrBins - 1);
+        bins[bin]++;
+        recent[recentOffset] = ms;
+        recentOffset = (recentOffset + 1) % NbrRecent;
+        count++;
+        sumMs += ms;
+        maxMs = std::max(maxMs, ms);
+    }
+
+    void FrameTimeHistogram::clear()
+    {
+        *this = FrameTimeHistogram{};
+    }
+
+    float FrameTimeHistogram::getPercentileMs(float percentile) const
+    {
+        if (!count)
+            return 0.0f;
+        const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(count * (double)percentile / 100.0));
+        uint64_t cumulative = 0;
+        for (int i = 0; i < NbrBins; i++)
+        {
+            cumulative += bins[i];
+            if (cumulative >= rank)
+                return (i + 1) * BinMs;
+        }
+        return NbrBins * BinMs;
+    }
+
+    float FrameTimeHistogram::getMeanMs() const
+    {
+        return count ? float(sumMs / count) : 0.0f;
+    }
+
+    void FrameTimeHistogram::drawUI(const char *label) const
+    {
+        ImGui::PushID(label);
+        ImGui::Text("%s: mean %.2f, p50 %.2f, p95 %.2f, p99 %.2f, max %.2f ms",
+                    label,
+                    getMeanMs(),
+                    getPercentileMs(50.0f),
+                    getPercentileMs(95.0f),
+                    getPercentileMs(99.0f),
+                    maxMs);
+
+        // Bins up to the slowest frame, which are at least those up to 20 ms
+        int nbrShown = int(20.0f / BinMs);
+        for (int i = NbrBins - 1; i >= nbrShown; i--)
+            if (bins[i])
+            {
+                nbrShown = i + 1;
+                break;
+            }
+        float shown[NbrBins];
+        for (int i = 0; i < nbrShown; i++)
+            shown[i] = (float)bins[i];
+
+        const std::string overlay = "0 - " + std::to_string(int(nbrShown * BinMs)) + " ms";
+        ImGui::PlotHistogram("##bins", shown, nbrShown, 0, overlay.c_str(), 0.0f, FLT_MAX, ImVec2(0, 60));
+        ImGui::PlotLines("##recent", recent, NbrRecent, recentOffset, "Recent frames", 0.0f, std::max(2.0f * getMeanMs(), 1.0f), ImVec2(0, 60));
+        ImGui::PopID();
+    }
+
+    FramePacer::FramePacer()
+        : frequency((double)SDL_GetPerformanceFrequency())
+    {
+    }
+
+    double FramePacer::now()
+    {
+        return (double)SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+    }
+
+    void FramePacer::setTargetFrameTime(double frameTime_s)
+    {
+        const uint64_t ticks = uint64_t(std::max(frameTime_s, 0.0) * frequency);
+        if (ticks == targetTicks)
+            return;
+        targetTicks = ticks;
+        deadline = 0;
+    }
+
+    double FramePacer::getTargetFrameTime() const
+    {
+        return targetTicks / frequency;
+    }
+
+    void FramePacer::setSpinning(bool spinning)
+    {
+        this->spinning = spinning;
+    }
+
+    bool FramePacer::getSpinning() const
+    {
+        return spinning;
+    }
+
+    double FramePacer::beginFrame()
+    {
+        const uint64_t now = SDL_GetPerformanceCounter();
+        double frameTime_s = 0.0;
+        if (frameStart)
+        {
+            frameTime_s = (now - frameStart) / frequency;
+            frameTimes.add(float(frameTime_s * 1000.0));
+        }
+        frameStart = now;
+        return frameTime_s;
+    }
+
+    void FramePacer::waitForNextFrame()
+    {
+        const uint64_t now = SDL_GetPerformanceCounter();
+        workTimes.add(float((now - frameStart) / frequency * 1000.0));
+        if (!targetTicks)
+            return;
+
+        if (!deadline)
+            deadline = frameStart;
+        deadline += targetTicks;
+        if (now > deadline)
+        {
+            missedDeadlines++;
+            // Catch up with the next frame, unless too late to do so
+            if (now - deadline > targetTicks)
+                deadline = now;
+            return;
+        }
+        sleepUntil(deadline);
+    }
+
+    void FramePacer::sleepUntil(uint64_t deadline)
+    {
+        if (!spinning)
+        {
+            // Millisecond sleep only, as SDL_Delay would be used alone
+            const uint64_t now = SDL_GetPerformanceCounter();
+            SDL_Delay(Uint32((deadline - now) / frequency * 1000.0));
+            return;
+        }
+
+        for (;;)
+        {
+            const uint64_t before = SDL_GetPerformanceCounter();
+            if (before >= deadline || (deadline - before) / frequency <= getSleepEstimate())
+                break;
+            SDL_Delay(1);
+            updateSleepEstimate((SDL_GetPerformanceCounter() - before) / frequency);
+        }
+        while (SDL_GetPerformanceCounter() < deadline)
+            ;
+    }
+
+    void FramePacer::updateSleepEstimate(double sleep_s)
+    {
+        const double error = sleep_s - sleepMean;
+        sleepMean += 0.1 * error;
+        sleepDeviation += 0.1 * (std::abs(error) - sleepDeviation);
+    }
+
+    void FramePacer::clearStats()
+    {
+        frameTimes.clear();
+        workTimes.clear();
+        missedDeadlines = 0;
+    }
+
+    void FramePacer::drawUI()
+    {
+        ImGui::Checkbox("Spin before deadlines", &spinning);
+        ImGui::SameLine();
+        if (ImGui::Button("Clear##framepacer"))
+            clearStats();
+        ImGui::Text("Missed deadlines %llu of %llu frames, 1 ms sleep estimate %.3f ms",
+                    (unsigned long long)missedDeadlines,
+                    (unsigned long long)workTimes.getCount(),
+                    getSleepEstimate() * 1000.0);
+        frameTimes.drawUI("Frame time");
+        workTimes.drawUI("Work time");
+    }
+
+    FixedTimestep::FixedTimestep(double step_s)
+    {
+        setStep(step_s);
+    }
+
+    void FixedTimestep::setStep(double step_s)
+    {
+        stepTime = std::max(step_s, 1e-4);
+    }
+
+    void FixedTimestep::setMaxStepsPerFrame(int maxSteps)
+    {
+        this->maxSteps = std::max(maxSteps, 1);
+    }
+
+    void FixedTimestep::advance(double frameTime_s)
+    {
+        accumulator += std::max(frameTime_s, 0.0);
+        frameSteps = 0;
+    }
+
+    bool FixedTimestep::step()
+    {
+        if (accumulator < stepTime)
+            return false;
+        if (frameSteps >= maxSteps)
+        {
+            // Drop whole steps, keeping the fraction for interpolation
+            const double dropped = std::floor(accumulator / stepTime) * stepTime;
+            droppedTime += dropped;
+            accumulator -= dropped;
+            return false;
+        }
+        accumulator -= stepTime;
+        time += stepTime;
+        frameSteps++;
+        return true;
+    }
+
+    float FixedTimestep::getAlpha() const
+    {
+        return (float)std::clamp(accumulator / stepTime, 0.0, 1.0);
+    }
+
+} // namespace eeng
@@ -0,0 +1,170 @@
+
+#ifndef FramePacer_hpp
+#define FramePacer_hpp
+
+#include <cstdint>
+
+namespace eeng
+{
+    /// @brief Histogram of frame times, with the latest frames kept for plotting
+    class FrameTimeHistogram
+    {
+    public:
+        static constexpr int NbrBins = 200;
+        static constexpr float BinMs = 0.25f; ///< Times from NbrBins * BinMs ms go in the last bin
+        static constexpr int NbrRecent = 256;
+
+        void add(float ms);
+
+        void clear();
+
+        /// @brief Upper bound of the bin that holds a percentile of the times
+        /// @param percentile In [0, 100]
+        float getPercentileMs(float percentile) const;
+
+        float getMeanMs() const;
+
+        float getMaxMs() const { return maxMs; }
+
+        uint64_t getCount() const { return count; }
+
+        /// @brief Draw the histogram and a plot of recent times in the current ImGui window
+        void drawUI(const char *label) const;
+
+    private:
+        uint64_t bins[NbrBins] = {0};
+        float recent[NbrRecent] = {0.0f};
+        int recentOffset = 0;
+        uint64_t count = 0;
+        double sumMs = 0.0;
+        float maxMs = 0.0f;
+    };
+
+    /// @brief Paces frames to a target frame time using the high-resolution counter
+    /** Frames are scheduled on deadlines spaced by the target frame time,
+     * so that a late frame is made up for by the next one rather than
+     * delaying all frames that follow. Frames later than a whole frame
+     * time drop the schedule and start a new one.
+     *
+     * Waiting sleeps in 1 ms steps for as long as the remaining time exceeds
+     * the estimated duration of such a sleep, which is measured as it goes,
+     * and spins for the rest.
+     */
+    class FramePacer
+    {
+    public:
+        FramePacer();
+
+        /// @brief Seconds on the high-resolution counter
+        static double now();
+
+        /// @param frameTime_s Target frame time, or 0 for uncapped
+        void setTargetFrameTime(double frameTime_s);
+
+        double getTargetFrameTime() const;
+
+        /// @brief Only sleep while waiting, e.g. to compare with sleep and spin
+        void setSpinning(bool spinning);
+
+        bool getSpinning() const;
+
+        /// @brief Start a frame
+        /// @return Seconds since the start of the previous frame, 0 for the first frame
+        double beginFrame();
+
+        /// @brief Wait for the deadline of the next frame
+        void waitForNextFrame();
+
+        /// @brief Times between the starts of frames
+        const FrameTimeHistogram &getFrameTimes() const { return frameTimes; }
+
+        /// @brief Times from the start of frames to waiting
+        const FrameTimeHistogram &getWorkTimes() const { return workTimes; }
+
+        /// @brief Frames that ended after their deadline
+        uint64_t getMissedDeadlines() const { return missedDeadlines; }
+
+        /// @brief Estimated duration of a 1 ms sleep, in seconds, with a margin of two deviations
+        double getSleepEstimate() const { return sleepMean + 2.0 * sleepDeviation; }
+
+        void clearStats();
+
+        /// @brief Draw settings and statistics in the current ImGui window
+        void drawUI();
+
+    private:
+        void sleepUntil(uint64_t deadline);
+
+        void updateSleepEstimate(double sleep_s);
+
+        double frequency;
+        uint64_t targetTicks = 0;
+        uint64_t frameStart = 0;
+        uint64_t deadline = 0;
+        bool spinning = true;
+
+        // Mean and deviation of measured 1 ms sleeps, as exponential moving averages
+        double sleepMean = 1e-3, sleepDeviation = 0.5e-3;
+
+        FrameTimeHistogram frameTimes, workTimes;
+        uint64_t missedDeadlines = 0;
+    };
+
+    /// @brief Fixed-timestep clock for a simulation advanced by frames of varying length
+    /** Frame times are accumulated and consumed in whole steps. The time
+     * left over, as a fraction of a step, interpolates rendered frames
+     * between the two latest steps. Steps beyond a maximum per frame are
+     * dropped, so that a slow frame does not cause even slower frames.
+     *
+     * @code
+     * clock.advance(frameTime_s);
+     * while (clock.step())
+     *     simulate(clock.getTime(), clock.getStep());
+     * render(clock.getAlpha());
+     * @endcode
+     */
+    class FixedTimestep
+    {
+    public:
+        /// @param step_s Simulated time per step
+        explicit FixedTimestep(double step_s = 1.0 / 60);
+
+        void setStep(double step_s);
+
+        double getStep() const { return stepTime; }
+
+        void setMaxStepsPerFrame(int maxSteps);
+
+        int getMaxStepsPerFrame() const { return maxSteps; }
+
+        /// @brief Add the time of a frame
+        void advance(double frameTime_s);
+
+        /// @brief Take a step, if a whole step of time has accumulated
+        /// @return Whether a step was taken
+        bool step();
+
+        /// @brief Simulated time at the end of the latest step
+        double getTime() const { return time; }
+
+        /// @brief Time accumulated towards the next step, as a fraction of a step
+        float getAlpha() const;
+
+        /// @brief Steps taken since the latest call to advance()
+        int getFrameSteps() const { return frameSteps; }
+
+        /// @brief Simulated time dropped because of the maximum steps per frame
+        double getDroppedTime() const { return droppedTime; }
+
+    private:
+        double stepTime;
+        int maxSteps = 8;
+        double accumulator = 0.0;
+        double time = 0.0;
+        double droppedTime = 0.0;
+        int frameSteps = 0;
+    };
+
+} // namespace eeng
+
+#endif /* FramePacer_hpp */
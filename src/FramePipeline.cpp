@@ -0,0 +1,120 @@
+
+#include <chrono>
+#include <stdexcept>
+#include "Profiler.hpp"
+#include "FramePipeline.hpp"
+
+namespace eeng
+{
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        /// Spin briefly, then yield, then sleep in short steps until a condition holds
+        template <class F>
+        void backoffWait(F &&condition)
+        {
+            for (int i = 0; !condition(); i++)
+            {
+                if (i < 64)
+                    continue;
+                if (i < 128)
+                    std::this_thread::yield();
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+
+    FramePipeline::FramePipeline()
+    {
+        thread = std::thread([this]()
+                             { run(); });
+    }
+
+    FramePipeline::~FramePipeline()
+    {
+        stopping.store(true, std::memory_order_release);
+        thread.join();
+    }
+
+    int FramePipeline::getNextSlot() const
+    {
+        return int((waited + 1) % 2);
+    }
+
+    void FramePipeline::kick(std::function<void()> simulate)
+    {
+        if (isPending())
+            throw std::runtime_error("FramePipeline::kick() called before wait()");
+        this->simulate = std::move(simulate);
+        kicked.store(waited + 1, std::memory_order_release);
+    }
+
+    int FramePipeline::wait()
+    {
+        if (!isPending())
+            return -1;
+
+        const auto start = Clock::now();
+        {
+            EENG_PROFILE_SCOPE("Wait for simulation");
+            backoffWait([&]()
+                        { return produced.load(std::memory_order_acquire) == waited + 1; });
+        }
+        waitMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+        waited++;
+
+        simulationTimes.add(simulationMs);
+        waitTimes.add(waitMs);
+
+        if (error)
+        {
+            auto e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+        return int(waited % 2);
+    }
+
+    bool FramePipeline::isPending() const
+    {
+        return kicked.load(std::memory_order_relaxed) != waited;
+    }
+
+    void FramePipeline::clearStats()
+    {
+        simulationTimes.clear();
+        waitTimes.clear();
+    }
+
+    void FramePipeline::run()
+    {
+        uint64_t frame = 0;
+        for (;;)
+        {
+            backoffWait([&]()
+                        { return kicked.load(std::memory_order_acquire) > frame ||
+                                 stopping.load(std::memory_order_acquire); });
+            // Kicked frames are finished before stopping
+            if (kicked.load(std::memory_order_acquire) == frame)
+                return;
+            frame++;
+
+            const auto start = Clock::now();
+            try
+            {
+                EENG_PROFILE_SCOPE("Simulation thread");
+                simulate();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            simulationMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+
+            produced.store(frame, std::memory_order_release);
+        }
+    }
+
+} // namespace eeng
@@ -0,0 +1,91 @@
+
+#ifndef FramePipeline_hpp
+#define FramePipeline_hpp
+
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include "FramePacer.hpp"
+
+namespace eeng
+{
+    /// @brief Simulates the next frame on a thread of its own while the current frame is rendered
+    /** A two-stage pipeline. The simulation thread produces a snapshot of
+     * each frame into one of two slots, while the thread of the GL context
+     * renders the snapshot in the other slot.
+     *
+     * Everything the simulation touches is owned by the simulation thread
+     * from kick() until the following wait() returns, and by the calling
+     * thread otherwise. In between, the calling thread may only read the
+     * slot returned by the latest wait(). Handoffs are atomic frame counters,
+     * waited on by spinning, yielding and then sleeping briefly, so that no
+     * locks are taken.
+     */
+    class FramePipeline
+    {
+    public:
+        FramePipeline();
+
+        /// @brief Finish a pending frame and stop the simulation thread
+        ~FramePipeline();
+
+        /// @brief Slot, 0 or 1, that the next kick() produces into
+        int getNextSlot() const;
+
+        /// @brief Hand over to the simulation thread, which produces the next snapshot
+        /// Throws if the previous frame has not been waited for.
+        /// @param simulate Produces the snapshot into getNextSlot(). Runs on the simulation thread.
+        void kick(std::function<void()> simulate);
+
+        /// @brief Wait for the snapshot of the latest kick() and take back ownership
+        /// Exceptions thrown by the simulation are rethrown here.
+        /// @return Slot of the snapshot, or -1 if nothing was kicked since the previous wait
+        int wait();
+
+        /// @brief A kicked frame has not been waited for
+        bool isPending() const;
+
+        /// @brief Time spent simulating the latest frame, on the simulation thread
+        float getSimulationMs() const { return simulationMs; }
+
+        /// @brief Time the latest wait() blocked
+        float getWaitMs() const { return waitMs; }
+
+        /// @brief Simulation time of the latest frame that overlapped other work of the calling thread
+        float getOverlapMs() const { return simulationMs > waitMs ? simulationMs - waitMs : 0.0f; }
+
+        const FrameTimeHistogram &getSimulationTimes() const { return simulationTimes; }
+
+        const FrameTimeHistogram &getWaitTimes() const { return waitTimes; }
+
+        void clearStats();
+
+        FramePipeline(const FramePipeline &) = delete;
+        FramePipeline &operator=(const FramePipeline &) = delete;
+
+    private:
+        void run();
+
+        // Written by the calling thread before a frame is kicked
+        std::function<void()> simulate;
+
+        // Frames kicked by the calling thread and produced by the simulation thread
+        std::atomic<uint64_t> kicked{0}, produced{0};
+        std::atomic<bool> stopping{false};
+        uint64_t waited = 0;
+
+        // Written by the simulation thread before a frame is published
+        std::exception_ptr error;
+        float simulationMs = 0.0f;
+
+        float waitMs = 0.0f;
+        FrameTimeHistogram simulationTimes, waitTimes;
+
+        std::thread thread;
+    };
+
+} // namespace eeng
+
+#endif /* FramePipeline_hpp */
@@ -0,0 +1,215 @@
+
+#include "GLStateCache.hpp"
+
+namespace eeng
+{
+    unsigned GLStateCache::Stats::totalIssued() const
+    {
+        unsigned total = 0;
+        for (auto count : issued)
+            total += count;
+        return total;
+    }
+
+    unsigned GLStateCache::Stats::totalSkipped() const
+    {
+        unsigned total = 0;
+        for (auto count : skipped)
+            total += count;
+        return total;
+    }
+
+    GLStateCache &GLStateCache::instance()
+    {
+        static GLStateCache cache;
+        return cache;
+    }
+
+    GLStateCache::GLStateCache()
+    {
+        invalidate();
+    }
+
+    const char *GLStateCache::getCallName(Call call)
+    {
+        static const char *names[CallCount] = {
+            "glUseProgram",
+            "glBindVertexArray",
+            "glActiveTexture",
+            "glBindTexture",
+            "glEnable/glDisable",
+            "glDepthFunc",
+            "glDepthMask"};
+        return names[call];
+    }
+
+    int GLStateCache::getTargetIndex(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D:
+            return Target2D;
+        case GL_TEXTURE_CUBE_MAP:
+            return TargetCubeMap;
+        default:
+            return -1;
+        }
+    }
+
+    bool GLStateCache::skip(Call call, bool unchanged)
+    {
+        if (caching && unchanged)
+        {
+            current.skipped[call]++;
+            return true;
+        }
+        current.issued[call]++;
+        return false;
+    }
+
+    void GLStateCache::useProgram(GLuint program)
+    {
+        if (skip(UseProgram, this->program == program))
+            return;
+        glUseProgram(program);
+        this->program = program;
+    }
+
+    void GLStateCache::bindVertexArray(GLuint vao)
+    {
+        if (skip(BindVertexArray, this->vao == vao))
+            return;
+        glBindVertexArray(vao);
+        this->vao = vao;
+    }
+
+    void GLStateCache::activeTexture(GLenum unit)
+    {
+        if (skip(ActiveTexture, activeUnit == unit))
+            return;
+        glActiveTexture(unit);
+        activeUnit = unit;
+    }
+
+    void GLStateCache::bindTexture(GLenum target, GLuint texture)
+    {
+        const int targetIndex = getTargetIndex(target);
+        const GLuint unit = activeUnit - GL_TEXTURE0;
+        const bool tracked = activeUnit != Unknown && unit < MaxTextureUnits && targetIndex >= 0;
+
+        if (skip(BindTexture, tracked && textures[unit][targetIndex] == texture))
+            return;
+        glBindTexture(target, texture);
+        if (tracked)
+            textures[unit][targetIndex] = texture;
+    }
+
+    void GLStateCache::bindTexture(GLenum unit, GLenum target, GLuint texture)
+    {
+        const int targetIndex = getTargetIndex(target);
+        const GLuint unitIndex = unit - GL_TEXTURE0;
+
+        // Bound already, so the unit need not be active
+        if (unitIndex < MaxTextureUnits && targetIndex >= 0 &&
+            skip(BindTexture, textures[unitIndex][targetIndex] == texture))
+            return;
+
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        if (unitIndex < MaxTextureUnits && targetIndex >= 0)
+            textures[unitIndex][targetIndex] = texture;
+        else
+            current.issued[BindTexture]++;
+    }
+
+    void GLStateCache::setEnabled(GLenum cap, bool enabled)
+    {
+        int capIndex = 0;
+        while (capIndex < CapCount && TrackedCaps[capIndex] != cap)
+            capIndex++;
+
+        if (skip(Enable, capIndex < CapCount && caps[capIndex] == (int)enabled))
+            return;
+        if (enabled)
+            glEnable(cap);
+        else
+            glDisable(cap);
+        if (capIndex < CapCount)
+            caps[capIndex] = (int)enabled;
+    }
+
+    void GLStateCache::depthFunc(GLenum func)
+    {
+        if (skip(DepthFunc, depthFuncState == func))
+            return;
+        glDepthFunc(func);
+        depthFuncState = func;
+    }
+
+    void GLStateCache::depthMask(GLboolean mask)
+    {
+        if (skip(DepthMask, depthMaskState == (int)mask))
+            return;
+        glDepthMask(mask);
+        depthMaskState = (int)mask;
+    }
+
+    void GLStateCache::forgetTexture(GLuint texture)
+    {
+        // Deleted textures revert to 0 on all units of the context
+        for (auto &unit : textures)
+            for (auto &bound : unit)
+                if (bound == texture)
+                    bound = 0;
+    }
+
+    void GLStateCache::forgetVertexArray(GLuint vao)
+    {
+        // A deleted vertex array reverts to 0 if bound
+        if (this->vao == vao)
+            this->vao = 0;
+    }
+
+    void GLStateCache::forgetProgram(GLuint program)
+    {
+        // A deleted program stays in use until replaced, while its name may be reused
+        if (this->program == program)
+            this->program = Unknown;
+    }
+
+    void GLStateCache::invalidate()
+    {
+        program = Unknown;
+        vao = Unknown;
+        activeUnit = Unknown;
+        for (auto &unit : textures)
+            for (auto &bound : unit)
+                bound = Unknown;
+        for (auto &cap : caps)
+            cap = -1;
+        depthFuncState = Unknown;
+        depthMaskState = -1;
+    }
+
+    void GLStateCache::setCaching(bool caching)
+    {
+        this->caching = caching;
+    }
+
+    bool GLStateCache::getCaching() const
+    {
+        return caching;
+    }
+
+    void GLStateCache::endFrame()
+    {
+        frame = current;
+        current = Stats{};
+    }
+
+    const GLStateCache::Stats &GLStateCache::getFrameStats() const
+    {
+        return frame;
+    }
+
+} // namespace eeng
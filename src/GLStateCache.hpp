@@ -0,0 +1,132 @@
+
+#ifndef GLStateCache_hpp
+#define GLStateCache_hpp
+
+#include "glcommon.h"
+
+namespace eeng
+{
+    /// @brief Cache of GL bindings and enables that skips calls which would not change state
+    /** Programs, vertex arrays, active texture unit, 2D and cube map textures
+     * per unit, a set of capabilities and depth func/mask are tracked. Calls
+     * that would not change the cached state are skipped and counted.
+     *
+     * Tracked state must only be changed through the cache, on the thread of
+     * the GL context. Call invalidate() after code that changes it directly,
+     * e.g. a new context or third-party rendering, and the forget functions
+     * when objects are deleted, since GL reuses names.
+     */
+    class GLStateCache
+    {
+    public:
+        enum Call
+        {
+            UseProgram,
+            BindVertexArray,
+            ActiveTexture,
+            BindTexture,
+            Enable,
+            DepthFunc,
+            DepthMask,
+            CallCount
+        };
+
+        struct Stats
+        {
+            unsigned issued[CallCount] = {0};
+            unsigned skipped[CallCount] = {0};
+
+            unsigned totalIssued() const;
+            unsigned totalSkipped() const;
+        };
+
+        static GLStateCache &instance();
+
+        static const char *getCallName(Call call);
+
+        void useProgram(GLuint program);
+
+        void bindVertexArray(GLuint vao);
+
+        /// @param unit GL_TEXTURE0 + i
+        void activeTexture(GLenum unit);
+
+        /// @brief Bind to the active unit
+        void bindTexture(GLenum target, GLuint texture);
+
+        /// @brief Bind to a unit, which is only made active if the binding changes
+        void bindTexture(GLenum unit, GLenum target, GLuint texture);
+
+        void setEnabled(GLenum cap, bool enabled);
+
+        void enable(GLenum cap) { setEnabled(cap, true); }
+
+        void disable(GLenum cap) { setEnabled(cap, false); }
+
+        void depthFunc(GLenum func);
+
+        void depthMask(GLboolean mask);
+
+        /// @brief Call before glDeleteTextures
+        void forgetTexture(GLuint texture);
+
+        /// @brief Call before glDeleteVertexArrays
+        void forgetVertexArray(GLuint vao);
+
+        /// @brief Call before glDeleteProgram
+        void forgetProgram(GLuint program);
+
+        /// @brief Mark all state as unknown, so that the next call of each kind is issued
+        void invalidate();
+
+        /// @brief Skip redundant calls. If disabled, all calls are issued, e.g. for comparison.
+        void setCaching(bool caching);
+
+        bool getCaching() const;
+
+        /// @brief Keep the counts of the current frame and reset them
+        void endFrame();
+
+        /// @brief Counts of the last complete frame
+        const Stats &getFrameStats() const;
+
+    private:
+        GLStateCache();
+
+        static constexpr GLuint Unknown = ~0u;
+        static constexpr int MaxTextureUnits = 16;
+        enum TextureTarget
+        {
+            Target2D,
+            TargetCubeMap,
+            TargetCount
+        };
+        static constexpr GLenum TrackedCaps[] = {
+            GL_CULL_FACE,
+            GL_DEPTH_TEST,
+            GL_BLEND,
+            GL_RASTERIZER_DISCARD,
+            GL_SCISSOR_TEST,
+            GL_STENCIL_TEST,
+            GL_TEXTURE_CUBE_MAP_SEAMLESS};
+        static constexpr int CapCount = sizeof(TrackedCaps) / sizeof(TrackedCaps[0]);
+
+        static int getTargetIndex(GLenum target);
+
+        bool skip(Call call, bool unchanged);
+
+        GLuint program;
+        GLuint vao;
+        GLenum activeUnit;
+        GLuint textures[MaxTextureUnits][TargetCount];
+        int caps[CapCount]; // -1 unknown
+        GLenum depthFuncState;
+        int depthMaskState; // -1 unknown
+
+        bool caching = true;
+        Stats current, frame;
+    };
+
+} // namespace eeng
+
+#endif /* GLStateCache_hpp */
@@ -0,0 +1,103 @@
+
+#include <cstdlib>
+#include <stdexcept>
+#include "config.h"
+#include "glcommon.h"
+
+#define SDL_MAIN_HANDLED
+#include <SDL.h>
+
+#include "HeadlessContext.hpp"
+
+namespace eeng
+{
+    HeadlessContext::HeadlessContext(int width, int height)
+    {
+        // Prefer the offscreen driver, unless a driver is given explicitly
+        const bool driverGiven = std::getenv("SDL_VIDEODRIVER") != nullptr;
+        if (!driverGiven)
+        {
+            SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+            if (SDL_Init(SDL_INIT_VIDEO) == 0 && !create(width, height))
+                destroy();
+        }
+        if (!glContext)
+        {
+            SDL_SetHint(SDL_HINT_VIDEODRIVER, "");
+            if (SDL_Init(SDL_INIT_VIDEO) != 0)
+                throw std::runtime_error(std::string("SDL initialization failed: ") + SDL_GetError());
+            if (!create(width, height))
+            {
+                const std::string error = SDL_GetError();
+                destroy();
+                throw std::runtime_error("Failed to create a headless GL context: " + error);
+            }
+        }
+        const char *driver = SDL_GetCurrentVideoDriver();
+        videoDriver = driver ? driver : "unknown";
+
+        // Core profiles need experimental entry points with GLEW, and glewInit
+        // sets GL_INVALID_ENUM on some of them
+        glewExperimental = GL_TRUE;
+        const GLenum err = glewInit();
+        // GLEW reports a missing GLX display when the context is EGL, which
+        // is expected, as long as the GL entry points were loaded
+        if (err != GLEW_OK && !glGenFramebuffers)
+        {
+            destroy();
+            throw std::runtime_error(std::string("GLEW initialization failed: ") + (const char *)glewGetErrorString(err));
+        }
+        FlushGLErrors();
+    }
+
+    HeadlessContext::~HeadlessContext()
+    {
+        destroy();
+    }
+
+    bool HeadlessContext::create(int width, int height)
+    {
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, EENG_GLVERSION_MAJOR);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, EENG_GLVERSION_MINOR);
+
+        window = SDL_CreateWindow("eduEngine (headless)",
+                                  SDL_WINDOWPOS_UNDEFINED,
+                                  SDL_WINDOWPOS_UNDEFINED,
+                                  width,
+                                  height,
+                                  SDL_WINDOW_HIDDEN | SDL_WINDOW_OPENGL);
+        if (!window)
+            return false;
+        glContext = SDL_GL_CreateContext(window);
+        if (!glContext || SDL_GL_MakeCurrent(window, glContext) != 0)
+            return false;
+
+        // Frames are never presented, and must not wait for vsync
+        SDL_GL_SetSwapInterval(0);
+        return true;
+    }
+
+    void HeadlessContext::destroy()
+    {
+        if (glContext)
+            SDL_GL_DeleteContext(glContext);
+        if (window)
+            SDL_DestroyWindow(window);
+        glContext = nullptr;
+        window = nullptr;
+        SDL_Quit();
+    }
+
+    const std::string &HeadlessContext::getVideoDriver() const
+    {
+        return videoDriver;
+    }
+
+    std::string HeadlessContext::getRendererString() const
+    {
+        return std::string((const char *)glGetString(GL_RENDERER)) + ", " + (const char *)glGetString(GL_VERSION);
+    }
+
+} // namespace eeng
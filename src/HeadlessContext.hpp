@@ -0,0 +1,54 @@
+
+#ifndef HeadlessContext_hpp
+#define HeadlessContext_hpp
+
+#include <string>
+
+struct SDL_Window;
+
+namespace eeng
+{
+    /// @brief OpenGL context for rendering without a display
+    /** Uses SDL's offscreen video driver, which creates the context through
+     * EGL, e.g. with Mesa llvmpipe on a machine without a display server.
+     * If the offscreen driver is not available, a hidden window of the
+     * default driver is used instead, e.g. under Xvfb. A driver set with the
+     * SDL_VIDEODRIVER environment variable is used as is.
+     *
+     * The default framebuffer may not be usable, so render into an
+     * OffscreenTarget. SDL and GLEW are initialized and shut down by the
+     * context, so only one may exist at a time.
+     */
+    class HeadlessContext
+    {
+        SDL_Window *window = nullptr;
+        void *glContext = nullptr;
+        std::string videoDriver;
+
+    public:
+        /// @brief Create context. Throws if no context could be created.
+        /// @param width Width of the hidden window, which some drivers need
+        /// @param height Height of the hidden window
+        HeadlessContext(int width, int height);
+
+        ~HeadlessContext();
+
+        HeadlessContext(const HeadlessContext &) = delete;
+        HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+        /// @brief SDL video driver in use
+        const std::string &getVideoDriver() const;
+
+        /// @brief GL renderer and version strings, e.g. "llvmpipe (LLVM 15.0.7, 256 bits), 4.5 (Core Profile) Mesa 23.0.4"
+        std::string getRendererString() const;
+
+    private:
+        /// @brief Try to create a hidden window and a context with the current driver
+        bool create(int width, int height);
+
+        void destroy();
+    };
+
+} // namespace eeng
+
+#endif /* HeadlessContext_hpp */
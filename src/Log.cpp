@@ -1,19 +1,50 @@
 
-#include <iostream>
+#include <cstdio>
 #include <cstdarg>
+#include <cstddef>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include "imgui.h"
 #include "Log.hpp"
 
 namespace eeng {
 
+/// Lines are kept in a ring buffer of text with a fixed budget, oldest lines
+/// are dropped when it is full. Lines passing the filter are cached by index
+/// and only new lines are tested, so both modes can use the clipper.
 struct LogWidget
 {
-    ImGuiTextBuffer Buf;
+    static constexpr size_t MaxTextBytes = 4 << 20;
+    static constexpr size_t MaxLines = 1 << 17;
+    static constexpr size_t MaxLineSize = 4096; // Longer lines are truncated
+
+    struct Line
+    {
+        uint64_t begin; // Position in the ring, counting from the first byte ever added
+        uint32_t size;  // Excluding the newline
+    };
+
+    std::vector<char> Buf;
+    uint64_t Head;        // Position of the next line in the ring
+    std::deque<Line> Lines;
+    uint64_t FirstLine;   // Number of the oldest kept line, counting from the first line ever added
+    std::deque<uint64_t> FilteredLines; // Numbers of kept lines that pass the filter
+    uint64_t FilteredEnd; // Lines before this number have been tested
+    uint64_t Dropped;
+    ImGuiTextBuffer FormatBuf;
     ImGuiTextFilter Filter;
-    ImVector<int> LineOffsets;
     bool AutoScroll;
     bool ScrollToBottom;
 
     LogWidget()
+        : Buf(MaxTextBytes)
     {
         AutoScroll = true;
         ScrollToBottom = false;
@@ -22,23 +53,98 @@ struct LogWidget
 
     void Clear()
     {
-        Buf.clear();
-        LineOffsets.clear();
-        LineOffsets.push_back(0);
+        Head = 0;
+        Lines.clear();
+        FirstLine = 0;
+        FilteredLines.clear();
+        FilteredEnd = 0;
+        Dropped = 0;
+    }
+
+    /// @brief Add text, split into lines
+    void Add(const char *text, const char *text_end)
+    {
+        while (text < text_end)
+        {
+            const char *line_end = (const char *)std::memchr(text, '\n', text_end - text);
+            if (!line_end)
+                line_end = text_end;
+            AddLine(text, line_end);
+            text = line_end + 1;
+        }
+        if (AutoScroll)
+            ScrollToBottom = true;
     }
 
     void AddLog(const char *fmt, ...) IM_FMTARGS(2)
     {
-        int old_size = Buf.size();
+        FormatBuf.clear();
         va_list args;
         va_start(args, fmt);
-        Buf.appendfv(fmt, args);
+        FormatBuf.appendfv(fmt, args);
         va_end(args);
-        for (int new_size = Buf.size(); old_size < new_size; old_size++)
-            if (Buf[old_size] == '\n')
-                LineOffsets.push_back(old_size + 1);
-        if (AutoScroll)
-            ScrollToBottom = true;
+        Add(FormatBuf.begin(), FormatBuf.end());
+    }
+
+    void AddLine(const char *line, const char *line_end)
+    {
+        const size_t size = std::min(size_t(line_end - line), MaxLineSize);
+
+        // Lines are contiguous, so one that would wrap starts over at the
+        // beginning of the buffer. A byte is reserved for the newline, which
+        // also bounds the number of empty lines.
+        uint64_t begin = Head;
+        const size_t offset = begin % MaxTextBytes;
+        if (offset + size + 1 > MaxTextBytes)
+            begin += MaxTextBytes - offset;
+        const uint64_t end = begin + size + 1;
+
+        // Drop lines that are overwritten, and their filter results
+        while (Lines.size() && (Lines.front().begin + MaxTextBytes < end || Lines.size() >= MaxLines))
+        {
+            Lines.pop_front();
+            FirstLine++;
+            Dropped++;
+        }
+        while (FilteredLines.size() && FilteredLines.front() < FirstLine)
+            FilteredLines.pop_front();
+        FilteredEnd = std::max(FilteredEnd, FirstLine);
+
+        char *dst = Buf.data() + begin % MaxTextBytes;
+        std::memcpy(dst, line, size);
+        dst[size] = '\n';
+        Lines.push_back({begin, (uint32_t)size});
+        Head = end;
+    }
+
+    /// @brief Test lines added since the last call against the filter
+    void UpdateFilter()
+    {
+        const uint64_t end = FirstLine + Lines.size();
+        for (uint64_t line_no = FilteredEnd; line_no < end; line_no++)
+        {
+            const char *line_start = GetLineStart(line_no - FirstLine);
+            if (Filter.PassFilter(line_start, line_start + Lines[line_no - FirstLine].size))
+                FilteredLines.push_back(line_no);
+        }
+        FilteredEnd = end;
+    }
+
+    void ResetFilter()
+    {
+        FilteredLines.clear();
+        FilteredEnd = FirstLine;
+    }
+
+    const char *GetLineStart(size_t index) const
+    {
+        return Buf.data() + Lines[index].begin % MaxTextBytes;
+    }
+
+    void DrawLine(size_t index)
+    {
+        const char *line_start = GetLineStart(index);
+        ImGui::TextUnformatted(line_start, line_start + Lines[index].size);
     }
 
     void Draw(const char *title, bool *p_open = NULL)
@@ -76,6 +182,11 @@ struct LogWidget
             if (ImGui::Checkbox("Auto-scroll", &AutoScroll))
                 if (AutoScroll)
                     ScrollToBottom = true;
+            ImGui::Text("%d lines, %.1f/%.1f MB, %llu dropped",
+                        (int)Lines.size(),
+                        (Lines.size() ? Head - Lines.front().begin : 0) / (1024.0f * 1024.0f),
+                        MaxTextBytes / (1024.0f * 1024.0f),
+                        (unsigned long long)Dropped);
             ImGui::EndPopup();
         }
 
@@ -87,7 +198,14 @@ struct LogWidget
         ImGui::SameLine();
         bool copy = ImGui::Button("Copy");
         ImGui::SameLine();
-        Filter.Draw("Filter", -100.0f);
+        if (Filter.Draw("Filter", -100.0f))
+            ResetFilter();
+
+        const bool filtered = Filter.IsActive();
+        if (filtered)
+            UpdateFilter();
+        else
+            ResetFilter();
 
         ImGui::Separator();
         ImGui::BeginChild("scrolling", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
@@ -95,49 +213,27 @@ struct LogWidget
         if (clear)
             Clear();
         if (copy)
-            ImGui::LogToClipboard();
-
-        ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
-        const char *buf = Buf.begin();
-        const char *buf_end = Buf.end();
-        if (Filter.IsActive())
-        {
-            // In this example we don't use the clipper when Filter is enabled.
-            // This is because we don't have a random access on the result on our filter.
-            // A real application processing logs with ten of thousands of entries may want to store the result of search/filter.
-            // especially if the filtering function is not trivial (e.g. reg-exp).
-            for (int line_no = 0; line_no < LineOffsets.Size; line_no++)
-            {
-                const char *line_start = buf + LineOffsets[line_no];
-                const char *line_end = (line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-                if (Filter.PassFilter(line_start, line_end))
-                    ImGui::TextUnformatted(line_start, line_end);
-            }
-        }
-        else
         {
-            // The simplest and easy way to display the entire buffer:
-            //   ImGui::TextUnformatted(buf_begin, buf_end);
-            // And it'll just work. TextUnformatted() has specialization for large blob of text and will fast-forward to skip non-visible lines.
-            // Here we instead demonstrate using the clipper to only process lines that are within the visible area.
-            // If you have tens of thousands of items and their processing cost is non-negligible, coarse clipping them on your side is recommended.
-            // Using ImGuiListClipper requires A) random access into your data, and B) items all being the  same height,
-            // both of which we can handle since we an array pointing to the beginning of each line of text.
-            // When using the filter (in the block of code above) we don't have random access into the data to display anymore, which is why we don't use the clipper.
-            // Storing or skimming through the search result would make it possible (and would be recommended if you want to search through tens of thousands of entries)
-            ImGuiListClipper clipper;
-            clipper.Begin(LineOffsets.Size);
-            while (clipper.Step())
+            // All shown lines, not only the visible ones
+            std::string text;
+            const size_t count = filtered ? FilteredLines.size() : Lines.size();
+            for (size_t i = 0; i < count; i++)
             {
-                for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++)
-                {
-                    const char *line_start = buf + LineOffsets[line_no];
-                    const char *line_end = (line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-                    ImGui::TextUnformatted(line_start, line_end);
-                }
+                const size_t index = filtered ? size_t(FilteredLines[i] - FirstLine) : i;
+                text.append(GetLineStart(index), Lines[index].size + 1);
             }
-            clipper.End();
+            ImGui::SetClipboardText(text.c_str());
         }
+
+        // Lines all have the same height, and are randomly accessible in both
+        // modes, so only those in the visible area are processed
+        ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
+        ImGuiListClipper clipper;
+        clipper.Begin(filtered ? (int)FilteredLines.size() : (int)Lines.size());
+        while (clipper.Step())
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+                DrawLine(filtered ? size_t(FilteredLines[i] - FirstLine) : (size_t)i);
+        clipper.End();
         ImGui::PopStyleVar();
 
         if (ScrollToBottom)
@@ -148,43 +244,528 @@ struct LogWidget
     }
 };
 
-std::unique_ptr<LogWidget> Log::log_widget = std::make_unique<LogWidget>();
+namespace
+{
+    // Records are split over blocks of two cache lines, each with a sequence
+    // number that tells whether it is free or published (Vyukov's bounded queue).
+    // Most records fit one block.
+    constexpr size_t BlockData = 120;
+    struct alignas(64) Block
+    {
+        std::atomic<uint64_t> sequence;
+        char data[BlockData];
+    };
+    constexpr uint64_t NbrBlocks = 1 << 13; // 1 MB
+    constexpr uint64_t BlockMask = NbrBlocks - 1;
+
+    // Pending widget text is dropped beyond this size, e.g. when the log is never drawn
+    constexpr size_t MaxWidgetText = 1 << 20;
+
+    enum Control : uint8_t
+    {
+        OpenFile,
+        AppendFile,
+        CloseFile
+    };
+
+    struct Arg
+    {
+        char tag = 0;
+        long long i = 0;
+        unsigned long long u = 0;
+        double f = 0.0;
+        const char *s = nullptr;
+        const void *p = nullptr;
+    };
+
+    bool readArg(const char *&pos, const char *end, Arg &arg)
+    {
+        if (pos >= end)
+            return false;
+        arg.tag = *pos++;
+        switch (arg.tag)
+        {
+        case 'i':
+            std::memcpy(&arg.i, pos, sizeof(arg.i));
+            pos += sizeof(arg.i);
+            return true;
+        case 'u':
+            std::memcpy(&arg.u, pos, sizeof(arg.u));
+            pos += sizeof(arg.u);
+            return true;
+        case 'f':
+            std::memcpy(&arg.f, pos, sizeof(arg.f));
+            pos += sizeof(arg.f);
+            return true;
+        case 'p':
+            std::memcpy(&arg.p, pos, sizeof(arg.p));
+            pos += sizeof(arg.p);
+            return true;
+        case 's':
+        {
+            uint16_t length;
+            std::memcpy(&length, pos, sizeof(length));
+            arg.s = pos + sizeof(length);
+            pos += sizeof(length) + length + 1;
+            return true;
+        }
+        default:
+            pos = end;
+            return false;
+        }
+    }
+
+    template <class T>
+    void appendf(std::string &out, const char *spec, T value)
+    {
+        char buffer[256];
+        const int length = std::snprintf(buffer, sizeof(buffer), spec, value);
+        if (length < 0)
+            return;
+        if (length < (int)sizeof(buffer))
+        {
+            out.append(buffer, length);
+            return;
+        }
+        const size_t size = out.size();
+        out.resize(size + length + 1);
+        std::snprintf(&out[size], length + 1, spec, value);
+        out.resize(size + length);
+    }
+
+    long long asInt(const Arg &arg)
+    {
+        switch (arg.tag)
+        {
+        case 'u':
+            return (long long)arg.u;
+        case 'f':
+            return (long long)arg.f;
+        case 'p':
+            return (long long)(uintptr_t)arg.p;
+        default:
+            return arg.i;
+        }
+    }
+
+    double asFloat(const Arg &arg)
+    {
+        switch (arg.tag)
+        {
+        case 'i':
+            return (double)arg.i;
+        case 'u':
+            return (double)arg.u;
+        default:
+            return arg.f;
+        }
+    }
+
+    /// Format printf-style using recorded arguments. Each conversion is
+    /// formatted with the length modifier of the recorded type, so that the
+    /// format need not match the width of the logged types.
+    void format(const char *fmt, const char *args, const char *end, std::string &out)
+    {
+        char spec[48];
+        for (const char *c = fmt; *c; c++)
+        {
+            if (*c != '%')
+            {
+                const char *next = std::strchr(c, '%');
+                const size_t length = next ? size_t(next - c) : std::strlen(c);
+                out.append(c, length);
+                c += length - 1;
+                continue;
+            }
+            if (c[1] == '%')
+            {
+                out += '%';
+                c++;
+                continue;
+            }
+
+            // Flags, width and precision are kept, length modifiers replaced
+            size_t n = 0;
+            spec[n++] = *c++;
+            auto copyDigits = [&]()
+            {
+                if (*c == '*')
+                {
+                    Arg arg;
+                    n += std::snprintf(spec + n, 12, "%d", readArg(args, end, arg) ? (int)asInt(arg) : 0);
+                    c++;
+                }
+                else
+                    while (*c >= '0' && *c <= '9' && n < 20)
+                        spec[n++] = *c++;
+            };
+            while (*c && std::strchr("-+ #0", *c) && n < 8)
+                spec[n++] = *c++;
+            copyDigits();
+            if (*c == '.')
+            {
+                spec[n++] = *c++;
+                copyDigits();
+            }
+            while (*c && std::strchr("hlLqjzt", *c))
+                c++;
+            const char conversion = *c;
+            if (!conversion)
+                break;
+
+            Arg arg;
+            if (!readArg(args, end, arg))
+            {
+                out += "<?>";
+                continue;
+            }
+            if (arg.tag == 's' && conversion != 's')
+            {
+                out += arg.s;
+                continue;
+            }
+            switch (conversion)
+            {
+            case 'd':
+            case 'i':
+                std::strcpy(spec + n, "lld");
+                appendf(out, spec, asInt(arg));
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conversion;
+                spec[n] = '\0';
+                appendf(out, spec, (unsigned long long)asInt(arg));
+                break;
+            case 'c':
+                std::strcpy(spec + n, "c");
+                appendf(out, spec, (int)asInt(arg));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                spec[n++] = conversion;
+                spec[n] = '\0';
+                appendf(out, spec, asFloat(arg));
+                break;
+            case 'p':
+                std::strcpy(spec + n, "p");
+                appendf(out, spec, arg.tag == 'p' ? arg.p : (const void *)(uintptr_t)asInt(arg));
+                break;
+            case 's':
+            {
+                std::strcpy(spec + n, "s");
+                if (arg.tag == 's')
+                    appendf(out, spec, arg.s);
+                else
+                {
+                    std::string value;
+                    if (arg.tag == 'f')
+                        appendf(value, "%g", arg.f);
+                    else if (arg.tag == 'p')
+                        appendf(value, "%p", arg.p);
+                    else if (arg.tag == 'u')
+                        appendf(value, "%llu", arg.u);
+                    else
+                        appendf(value, "%lld", arg.i);
+                    appendf(out, spec, value.c_str());
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+
+    /// Queue and log thread
+    struct Backend
+    {
+        std::unique_ptr<Block[]> blocks;
+        alignas(64) std::atomic<uint64_t> tail{0};
+        alignas(64) std::atomic<uint64_t> written{0}; // Records before are written and flushed
+        std::atomic<uint64_t> records{0}, fullWaits{0}, truncated{0};
+        std::atomic<bool> console{true};
+        std::atomic<bool> stop{false};
+
+        std::mutex channelsMutex;
+        bool channelInUse[Log::MaxChannels] = {true};
+
+        // Text formatted by the log thread, moved to the widget when drawn
+        std::mutex widgetMutex;
+        std::string widgetText;
+        std::unique_ptr<LogWidget> widget;
+        std::string drawText;
+
+        // Log thread only
+        uint64_t head = 0;
+        std::FILE *files[Log::MaxChannels] = {};
+        std::vector<char> record;
+        std::string text;
+
+        std::thread thread;
+
+        Backend()
+            : blocks(new Block[NbrBlocks]), widget(std::make_unique<LogWidget>())
+        {
+            for (uint64_t i = 0; i < NbrBlocks; i++)
+                blocks[i].sequence.store(i, std::memory_order_relaxed);
+            thread = std::thread([this]()
+                                 { run(); });
+        }
+
+        ~Backend()
+        {
+            // Remaining records are written before the thread exits
+            stop.store(true, std::memory_order_release);
+            thread.join();
+            for (auto file : files)
+                if (file)
+                    std::fclose(file);
+        }
+
+        void run()
+        {
+            while (true)
+            {
+                if (consume())
+                    continue;
+
+                std::fflush(stdout);
+                for (auto file : files)
+                    if (file)
+                        std::fflush(file);
+                written.store(head, std::memory_order_release);
 
-void Log::log(const char *fmt, ...)
+                if (stop.load(std::memory_order_acquire) &&
+                    tail.load(std::memory_order_acquire) == head)
+                    break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        /// Write available records
+        /// @return True if any
+        bool consume()
+        {
+            bool any = false;
+            while (true)
+            {
+                Block &first = blocks[head & BlockMask];
+                if (first.sequence.load(std::memory_order_acquire) != head + 1)
+                    return any;
+
+                Log::RecordHeader header;
+                std::memcpy(&header, first.data, sizeof(header));
+                const uint64_t nbrBlocks = (header.size + BlockData - 1) / BlockData;
+                record.resize(header.size);
+                for (uint64_t i = 0; i < nbrBlocks; i++)
+                {
+                    // Later blocks of the record may not be published yet
+                    Block &block = blocks[(head + i) & BlockMask];
+                    while (block.sequence.load(std::memory_order_acquire) != head + i + 1)
+                        std::this_thread::yield();
+                    const size_t offset = i * BlockData;
+                    std::memcpy(record.data() + offset, block.data, std::min(BlockData, header.size - offset));
+                    block.sequence.store(head + i + NbrBlocks, std::memory_order_release);
+                }
+                head += nbrBlocks;
+
+                write(header);
+                records.fetch_add(1, std::memory_order_relaxed);
+                any = true;
+            }
+        }
+
+        void write(const Log::RecordHeader &header)
+        {
+            const char *args = record.data() + sizeof(header);
+            const char *end = record.data() + header.size;
+
+            if (!header.fmt)
+            {
+                control(header, args, end);
+                return;
+            }
+
+            text.clear();
+            format(header.fmt, args, end, text);
+            text += '\n';
+
+            if (header.channel != Log::MainChannel)
+            {
+                if (auto file = files[header.channel])
+                    std::fwrite(text.data(), 1, text.size(), file);
+                return;
+            }
+
+            if (console.load(std::memory_order_relaxed))
+                std::fwrite(text.data(), 1, text.size(), stdout);
+
+            std::lock_guard lock(widgetMutex);
+            if (widgetText.size() < MaxWidgetText)
+            {
+                appendf(widgetText, "[frame#%i] ", header.frame);
+                widgetText += text;
+            }
+        }
+
+        void control(const Log::RecordHeader &header, const char *args, const char *end)
+        {
+            auto &file = files[header.channel];
+            if (file)
+            {
+                std::fclose(file);
+                file = nullptr;
+            }
+            if (header.priority == CloseFile)
+                return;
+
+            Arg path;
+            if (!readArg(args, end, path) || path.tag != 's')
+                return;
+            file = std::fopen(path.s, header.priority == AppendFile ? "a" : "w");
+            if (!file)
+                std::fprintf(stderr, "Log: failed to open %s\n", path.s);
+        }
+    };
+
+    Backend &backend()
+    {
+        static Backend backend;
+        return backend;
+    }
+}
+
+// Thresholds are the lowest kept priority plus one, zero for closed channels
+std::atomic<int> Log::channelThresholds[MaxChannels] = {Log::Verbose + 1};
+std::atomic<int> Log::frame{0};
+
+void Log::push(const char *record, size_t size, bool truncated)
+{
+    auto &b = backend();
+    const uint64_t nbrBlocks = (size + BlockData - 1) / BlockData;
+    const uint64_t pos = b.tail.fetch_add(nbrBlocks, std::memory_order_relaxed);
+    for (uint64_t i = 0; i < nbrBlocks; i++)
+    {
+        // Wait for the log thread to free the block if the queue is full
+        Block &block = b.blocks[(pos + i) & BlockMask];
+        if (block.sequence.load(std::memory_order_acquire) != pos + i)
+        {
+            b.fullWaits.fetch_add(1, std::memory_order_relaxed);
+            while (block.sequence.load(std::memory_order_acquire) != pos + i)
+                std::this_thread::yield();
+        }
+        const size_t offset = i * BlockData;
+        std::memcpy(block.data, record + offset, std::min(BlockData, size - offset));
+        block.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    if (truncated)
+        b.truncated.fetch_add(1, std::memory_order_relaxed);
+}
+
+int Log::openFile(const std::string &file, int priority, bool append)
 {
-    va_list args;
-    va_start(args, fmt);
-    std::string formattedString = formatString(fmt, args);
-    std::cout << formattedString << std::endl;
-    va_end(args);
+    auto &b = backend();
+    int channel = MainChannel + 1;
+    {
+        std::lock_guard lock(b.channelsMutex);
+        while (channel < MaxChannels && b.channelInUse[channel])
+            channel++;
+        if (channel == MaxChannels)
+            throw std::runtime_error("Log: no free channel for " + file);
+        b.channelInUse[channel] = true;
+    }
 
-    log_widget->AddLog("[frame#%i] %s\n", ImGui::GetFrameCount(), formattedString.c_str());
+    char record[MaxRecordSize];
+    RecordWriter writer(record, sizeof(record), nullptr, channel, append ? AppendFile : OpenFile, 0);
+    writer.put(file);
+    push(record, writer.finish(), writer.isTruncated());
+    channelThresholds[channel].store(priority + 1, std::memory_order_relaxed);
+    return channel;
 }
 
-void Log::draw(bool *p_open)
+void Log::closeFile(int channel)
 {
-    log_widget->Draw("Log", p_open);
+    if (channel <= MainChannel || channel >= MaxChannels)
+        return;
+    auto &b = backend();
+    channelThresholds[channel].store(0, std::memory_order_relaxed);
+
+    char record[MaxRecordSize];
+    RecordWriter writer(record, sizeof(record), nullptr, channel, CloseFile, 0);
+    push(record, writer.finish(), false);
+
+    // Reopened channels are enqueued after the close
+    std::lock_guard lock(b.channelsMutex);
+    b.channelInUse[channel] = false;
 }
 
-void Log::clear()
+void Log::setPriority(int priority)
+{
+    channelThresholds[MainChannel].store(priority + 1, std::memory_order_relaxed);
+}
+
+int Log::getPriority()
 {
-    log_widget->Clear();
+    return channelThresholds[MainChannel].load(std::memory_order_relaxed) - 1;
 }
 
-std::string Log::formatString(const char* fmt, va_list args) 
+void Log::setConsoleOutput(bool enabled)
 {
-    va_list args_copy;
-    va_copy(args_copy, args);
+    backend().console.store(enabled, std::memory_order_relaxed);
+}
 
-    int length = vsnprintf(NULL, 0, fmt, args_copy);
-    char* buffer = new char[length + 1];
-    vsnprintf(buffer, length + 1, fmt, args);
-    va_end(args_copy);
+void Log::setFrame(int frame)
+{
+    Log::frame.store(frame, std::memory_order_relaxed);
+}
 
-    std::string formattedString(buffer);
-    delete[] buffer;
+void Log::flush()
+{
+    auto &b = backend();
+    const uint64_t target = b.tail.load(std::memory_order_acquire);
+    while (b.written.load(std::memory_order_acquire) < target)
+        std::this_thread::yield();
+}
 
-    return formattedString;
+Log::Stats Log::getStats()
+{
+    auto &b = backend();
+    Stats stats;
+    stats.records = b.records.load(std::memory_order_relaxed);
+    stats.fullWaits = b.fullWaits.load(std::memory_order_relaxed);
+    stats.truncated = b.truncated.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Log::draw(bool *p_open)
+{
+    auto &b = backend();
+    {
+        std::lock_guard lock(b.widgetMutex);
+        b.drawText.swap(b.widgetText);
+    }
+    if (b.drawText.size())
+    {
+        b.widget->Add(b.drawText.data(), b.drawText.data() + b.drawText.size());
+        b.drawText.clear();
+    }
+    b.widget->Draw("Log", p_open);
+}
+
+void Log::clear()
+{
+    backend().widget->Clear();
 }
 
-} // namespace eeng
\ No newline at end of file
+} // namespace eeng
@@ -2,8 +2,29 @@
 #ifndef UILog_hpp
 #define UILog_hpp
 
-#include <memory>
-#include "imgui.h"
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/// Log calls below this priority are compiled out
+#ifndef EENG_LOG_MIN_PRIORITY
+#define EENG_LOG_MIN_PRIORITY 0
+#endif
+
+/// Log to the main channel, see Log::write(). Below the active priority of
+/// the channel, arguments are not evaluated and nothing is enqueued.
+#define EENG_LOG(priority, ...) EENG_LOG_TO(eeng::Log::MainChannel, priority, __VA_ARGS__)
+
+/// Log to a channel, e.g. a file opened with Log::openFile()
+#define EENG_LOG_TO(channel, priority, ...)                                                    \
+    do                                                                                         \
+    {                                                                                          \
+        if ((priority) >= EENG_LOG_MIN_PRIORITY && eeng::Log::isActive(channel, priority)) \
+            eeng::Log::write(channel, priority, __VA_ARGS__);                                  \
+    } while (0)
 
 namespace eeng {
 
@@ -11,26 +32,243 @@ namespace eeng {
 ///  Adapted from imgui_demo.cpp
 struct LogWidget;
 
+/// @brief Asynchronous log
+/** Log calls enqueue a binary record: the format string pointer, which
+ * serves as its id, and the arguments. Records go through a bounded,
+ * lock-free queue with many producers and one consumer, a background
+ * thread that formats them and writes them to their channel. The main
+ * channel goes to the console and the log widget, other channels to files.
+ *
+ * Format strings are printf-style and must have static storage duration,
+ * e.g. literals. Strings are copied, and truncated if a record would
+ * exceed MaxRecordSize. Producers wait if the queue is full.
+ */
 class Log
 {
 public:
-    static std::unique_ptr<LogWidget> log_widget;
+    enum Priority
+    {
+        Verbose = 0,
+        Info,
+        Warning,
+        Error,
+        Off
+    };
 
-    // static void log(const char *str);
+    static constexpr int MainChannel = 0;
+    static constexpr int NoChannel = -1;
+    static constexpr int MaxChannels = 64;
+    static constexpr size_t MaxRecordSize = 1024;
 
-    /// @brief Add a log item
+    /// @brief Add a log item to the main channel, at Info priority
     /// @param fmt Format string
-    static void log(const char *fmt, ...);
+    template <class... Args>
+    static void log(const char *fmt, const Args &...args)
+    {
+        if (isActive(MainChannel, Info))
+            write(MainChannel, Info, fmt, args...);
+    }
+
+    /// @brief Whether records of a priority are kept by a channel. Cheap enough to call for every record.
+    static bool isActive(int channel, int priority)
+    {
+        if ((unsigned)channel >= (unsigned)MaxChannels)
+            return false;
+        // Thresholds are the lowest kept priority plus one, and zero for closed channels
+        const int threshold = channelThresholds[channel].load(std::memory_order_relaxed);
+        return threshold && priority >= threshold - 1;
+    }
+
+    /// @brief Enqueue a record, regardless of priority. Use EENG_LOG or EENG_LOG_TO to skip inactive records.
+    template <class... Args>
+    static void write(int channel, int priority, const char *fmt, const Args &...args);
+
+    /// @brief Open a channel to a file, which is opened by the log thread
+    /// @return Channel. Throws if all channels are in use.
+    static int openFile(const std::string &file, int priority, bool append = false);
+
+    /// @brief Close a channel once the records before it are written
+    static void closeFile(int channel);
+
+    /// @brief Lowest priority kept by the main channel
+    static void setPriority(int priority);
+
+    static int getPriority();
+
+    /// @brief Echo the main channel to stdout
+    static void setConsoleOutput(bool enabled);
+
+    /// @brief Frame number recorded with records, e.g. ImGui::GetFrameCount()
+    static void setFrame(int frame);
+
+    /// @brief Wait until all records enqueued so far are written
+    static void flush();
+
+    struct Stats
+    {
+        uint64_t records = 0;   ///< Records written
+        uint64_t fullWaits = 0; ///< Times a producer waited for a full queue
+        uint64_t truncated = 0; ///< Records whose arguments did not fit
+    };
+
+    static Stats getStats();
 
     /// @brief Draw the log
-    /// @param p_open 
+    /// @param p_open
     static void draw(bool *p_open = nullptr);
 
     /// @brief Clear log
     static void clear();
 
+    /// Record layout, followed by tagged arguments
+    struct RecordHeader
+    {
+        const char *fmt; ///< nullptr for control records
+        int32_t frame;
+        uint16_t size;   ///< Including the header
+        uint8_t channel;
+        uint8_t priority; ///< Or control code
+    };
+
+    /// @brief Encodes a record into a buffer
+    class RecordWriter
+    {
+        char *begin, *pos, *end;
+        bool truncated = false;
+
+        void bytes(const void *data, size_t size)
+        {
+            std::memcpy(pos, data, size);
+            pos += size;
+        }
+
+        template <class T>
+        void tagged(char tag, const T &value)
+        {
+            if (pos + 1 + sizeof(T) > end)
+            {
+                truncated = true;
+                return;
+            }
+            *pos++ = tag;
+            bytes(&value, sizeof(T));
+        }
+
+        void string(const char *str)
+        {
+            if (!str)
+                str = "(null)";
+            // Tag, length and terminator
+            if (pos + 4 > end)
+            {
+                truncated = true;
+                return;
+            }
+            size_t length = std::strlen(str);
+            if (length > size_t(end - pos) - 4)
+            {
+                length = size_t(end - pos) - 4;
+                truncated = true;
+            }
+            const uint16_t length16 = (uint16_t)length;
+            *pos++ = 's';
+            bytes(&length16, sizeof(length16));
+            bytes(str, length);
+            *pos++ = '\0';
+        }
+
+        template <class T>
+        static constexpr bool unsupported = !sizeof(T);
+
+    public:
+        RecordWriter(char *buffer, size_t size, const char *fmt, int channel, int priority, int frame)
+            : begin(buffer), pos(buffer + sizeof(RecordHeader)), end(buffer + size)
+        {
+            RecordHeader header{fmt, frame, 0, (uint8_t)channel, (uint8_t)priority};
+            std::memcpy(begin, &header, sizeof(header));
+        }
+
+        template <class T>
+        void put(const T &value)
+        {
+            if constexpr (std::is_same_v<T, std::string>)
+                string(value.c_str());
+            else if constexpr (std::is_array_v<T>)
+            {
+                static_assert(std::is_same_v<std::remove_cv_t<std::remove_extent_t<T>>, char>, "Unsupported log argument type");
+                string(value);
+            }
+            else if constexpr (std::is_pointer_v<T>)
+            {
+                if constexpr (std::is_same_v<std::remove_cv_t<std::remove_pointer_t<T>>, char>)
+                    string(value);
+                else
+                    tagged('p', (const void *)value);
+            }
+            else if constexpr (std::is_same_v<T, bool>)
+                tagged('u', (unsigned long long)value);
+            else if constexpr (std::is_enum_v<T>)
+                tagged('i', (long long)value);
+            else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+                tagged('i', (long long)value);
+            else if constexpr (std::is_integral_v<T>)
+                tagged('u', (unsigned long long)value);
+            else if constexpr (std::is_floating_point_v<T>)
+                tagged('f', (double)value);
+            else
+                static_assert(unsupported<T>, "Unsupported log argument type");
+        }
+
+        /// @brief Finish the record
+        /// @return Size in bytes
+        size_t finish()
+        {
+            const uint16_t size = (uint16_t)(pos - begin);
+            std::memcpy(begin + offsetof(RecordHeader, size), &size, sizeof(size));
+            return size;
+        }
+
+        bool isTruncated() const { return truncated; }
+    };
+
 private:
-    static std::string formatString(const char* fmt, va_list args);
+    static std::atomic<int> channelThresholds[MaxChannels];
+    static std::atomic<int> frame;
+
+    /// @brief Copy a record to the queue
+    static void push(const char *record, size_t size, bool truncated);
+};
+
+template <class... Args>
+void Log::write(int channel, int priority, const char *fmt, const Args &...args)
+{
+    char record[MaxRecordSize];
+    RecordWriter writer(record, sizeof(record), fmt, channel, priority, frame.load(std::memory_order_relaxed));
+    (writer.put(args), ...);
+    const size_t size = writer.finish();
+    push(record, size, writer.isTruncated());
+}
+
+/// @brief File channel, open from construction to destruction
+class LogFile
+{
+    int channel;
+
+public:
+    LogFile(const std::string &file, int priority, bool append = false)
+        : channel(Log::openFile(file, priority, append))
+    {
+    }
+
+    ~LogFile()
+    {
+        Log::closeFile(channel);
+    }
+
+    int getChannel() const { return channel; }
+
+    LogFile(const LogFile &) = delete;
+    LogFile &operator=(const LogFile &) = delete;
 };
 
 } // namespace eeng
@@ -0,0 +1,355 @@
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "LooseQuadtree.hpp"
+
+namespace eeng
+{
+    namespace
+    {
+        /// Frustum planes with inward normals, from a projection-view matrix
+        /// (Gribb & Hartmann)
+        void extractPlanes(const glm::mat4 &M, glm::vec4 planes[6])
+        {
+            const glm::vec4 row0(M[0][0], M[1][0], M[2][0], M[3][0]);
+            const glm::vec4 row1(M[0][1], M[1][1], M[2][1], M[3][1]);
+            const glm::vec4 row2(M[0][2], M[1][2], M[2][2], M[3][2]);
+            const glm::vec4 row3(M[0][3], M[1][3], M[2][3], M[3][3]);
+            planes[0] = row3 + row0;
+            planes[1] = row3 - row0;
+            planes[2] = row3 + row1;
+            planes[3] = row3 - row1;
+            planes[4] = row3 + row2;
+            planes[5] = row3 - row2;
+        }
+
+        /// 0 if a box is outside the planes, 2 if it is inside all of them, else 1
+        int classifyPlanes(const AABB &aabb, const glm::vec4 planes[6])
+        {
+            int result = 2;
+            for (int i = 0; i < 6; i++)
+            {
+                const auto &p = planes[i];
+                // Corners farthest along and against the normal
+                const float far = p.x * (p.x > 0.0f ? aabb.max.x : aabb.min.x) +
+                                  p.y * (p.y > 0.0f ? aabb.max.y : aabb.min.y) +
+                                  p.z * (p.z > 0.0f ? aabb.max.z : aabb.min.z) + p.w;
+                if (far < 0.0f)
+                    return 0;
+                const float near = p.x * (p.x > 0.0f ? aabb.min.x : aabb.max.x) +
+                                   p.y * (p.y > 0.0f ? aabb.min.y : aabb.max.y) +
+                                   p.z * (p.z > 0.0f ? aabb.min.z : aabb.max.z) + p.w;
+                if (near < 0.0f)
+                    result = 1;
+            }
+            return result;
+        }
+
+        /// 0 if a box is farther than a radius from a point, 2 if it is entirely within it, else 1
+        int classifySphere(const AABB &aabb, const glm::vec3 &center, float radius)
+        {
+            const glm::vec3 nearest = glm::clamp(center, aabb.min, aabb.max);
+            const glm::vec3 d = nearest - center;
+            if (glm::dot(d, d) > radius * radius)
+                return 0;
+            const glm::vec3 farthest = glm::max(glm::abs(aabb.min - center), glm::abs(aabb.max - center));
+            return glm::dot(farthest, farthest) <= radius * radius ? 2 : 1;
+        }
+    }
+
+    LooseQuadtree::LooseQuadtree(const AABB &worldBounds,
+                                 int nbrLevels)
+        : worldBounds(worldBounds),
+          nbrLevels(std::max(1, nbrLevels))
+    {
+        if (!worldBounds)
+            throw std::runtime_error("Quadtree world bounds are empty");
+
+        worldSize = std::max(worldBounds.max.x - worldBounds.min.x, worldBounds.max.z - worldBounds.min.z);
+        this->worldBounds.max.x = worldBounds.min.x + worldSize;
+        this->worldBounds.max.z = worldBounds.min.z + worldSize;
+
+        int nbrCells = 0;
+        for (int level = 0; level < this->nbrLevels; level++)
+        {
+            levelOffsets.push_back(nbrCells);
+            nbrCells += (1 << level) * (1 << level);
+        }
+        cells.resize(nbrCells);
+        for (auto &cell : cells)
+        {
+            cell.minY = std::numeric_limits<float>::max();
+            cell.maxY = std::numeric_limits<float>::lowest();
+        }
+    }
+
+    int LooseQuadtree::cellIndex(int level, int x, int z) const
+    {
+        return levelOffsets[level] + z * (1 << level) + x;
+    }
+
+    void LooseQuadtree::cellCoords(int cell, int &level, int &x, int &z) const
+    {
+        level = (int)(std::upper_bound(levelOffsets.begin(), levelOffsets.end(), cell) - levelOffsets.begin()) - 1;
+        const int index = cell - levelOffsets[level];
+        x = index % (1 << level);
+        z = index / (1 << level);
+    }
+
+    int LooseQuadtree::findCell(const AABB &aabb) const
+    {
+        const glm::vec3 center = (aabb.min + aabb.max) * 0.5f;
+        if (center.x < worldBounds.min.x || center.x >= worldBounds.max.x ||
+            center.z < worldBounds.min.z || center.z >= worldBounds.max.z)
+            return 0;
+
+        // Deepest level with cells at least as large as the instance. Its
+        // center is then inside the cell, and the rest of it within half a
+        // cell, which the loose bounds include.
+        const float size = std::max(aabb.max.x - aabb.min.x, aabb.max.z - aabb.min.z);
+        int level = nbrLevels - 1;
+        if (size > 0.0f)
+            level = std::clamp((int)std::floor(std::log2(worldSize / size)), 0, nbrLevels - 1);
+
+        const int resolution = 1 << level;
+        const float cellSize = worldSize / resolution;
+        const int x = std::min(resolution - 1, (int)((center.x - worldBounds.min.x) / cellSize));
+        const int z = std::min(resolution - 1, (int)((center.z - worldBounds.min.z) / cellSize));
+        return cellIndex(level, x, z);
+    }
+
+    int LooseQuadtree::insert(const AABB &aabb,
+                              uint32_t userData,
+                              uint32_t key)
+    {
+        int index;
+        if (freeItems.size())
+        {
+            index = freeItems.back();
+            freeItems.pop_back();
+        }
+        else
+        {
+            index = (int)items.size();
+            items.emplace_back();
+        }
+
+        const int cellIndex = findCell(aabb);
+        auto &cell = cells[cellIndex];
+
+        // A cell holds few keys, such as the meshes placed in a region
+        auto batch = std::find_if(cell.batches.begin(), cell.batches.end(), [key](const Batch &batch)
+                                  { return batch.key == key; });
+        if (batch == cell.batches.end())
+            batch = cell.batches.insert(cell.batches.end(), Batch{key, {}});
+
+        auto &item = items[index];
+        item.aabb = aabb;
+        item.userData = userData;
+        item.cell = cellIndex;
+        item.batch = (int)(batch - cell.batches.begin());
+        item.slot = (int)batch->items.size();
+        batch->items.push_back(index);
+        cell.nbrItems++;
+
+        // The root also holds instances outside the world or larger than
+        // it, which its loose bounds may not include
+        if (cellIndex == 0)
+        {
+            cell.extraBounds.min = glm::min(cell.extraBounds.min, aabb.min);
+            cell.extraBounds.max = glm::max(cell.extraBounds.max, aabb.max);
+        }
+
+        // Counts and height ranges of the cell and its ancestors
+        int level, x, z;
+        cellCoords(cellIndex, level, x, z);
+        for (; level >= 0; level--, x /= 2, z /= 2)
+        {
+            auto &ancestor = cells[this->cellIndex(level, x, z)];
+            ancestor.nbrSubtree++;
+            ancestor.minY = std::min(ancestor.minY, aabb.min.y);
+            ancestor.maxY = std::max(ancestor.maxY, aabb.max.y);
+        }
+
+        return index;
+    }
+
+    void LooseQuadtree::remove(int index)
+    {
+        if (index < 0 || index >= (int)items.size() || items[index].cell < 0)
+            throw std::runtime_error("Invalid quadtree item");
+
+        auto &item = items[index];
+        auto &cell = cells[item.cell];
+        auto &batch = cell.batches[item.batch];
+
+        // Swap with the last item of the batch. Empty batches are kept,
+        // since cells are expected to get instances with the same keys again.
+        const int last = batch.items.back();
+        batch.items[item.slot] = last;
+        items[last].slot = item.slot;
+        batch.items.pop_back();
+        cell.nbrItems--;
+
+        int level, x, z;
+        cellCoords(item.cell, level, x, z);
+        for (; level >= 0; level--, x /= 2, z /= 2)
+            cells[cellIndex(level, x, z)].nbrSubtree--;
+
+        item.cell = -1;
+        freeItems.push_back(index);
+    }
+
+    const AABB &LooseQuadtree::getBounds(int item) const
+    {
+        return items[item].aabb;
+    }
+
+    uint32_t LooseQuadtree::getUserData(int item) const
+    {
+        return items[item].userData;
+    }
+
+    int LooseQuadtree::size() const
+    {
+        return cells[0].nbrSubtree;
+    }
+
+    AABB LooseQuadtree::looseBounds(int cell, int level, const AABB &bounds) const
+    {
+        const float halfCellSize = 0.5f * worldSize / (1 << level);
+        AABB aabb = bounds;
+        aabb.min.x -= halfCellSize;
+        aabb.min.z -= halfCellSize;
+        aabb.max.x += halfCellSize;
+        aabb.max.z += halfCellSize;
+        aabb.min.y = cells[cell].minY;
+        aabb.max.y = cells[cell].maxY;
+        if (!cell)
+        {
+            aabb.min = glm::min(aabb.min, cells[0].extraBounds.min);
+            aabb.max = glm::max(aabb.max, cells[0].extraBounds.max);
+        }
+        return aabb;
+    }
+
+    template <class Classify, class Visit>
+    void LooseQuadtree::traverse(Classify &&classify, Visit &&visit, QueryStats *stats) const
+    {
+        struct Entry
+        {
+            int level, x, z;
+            AABB bounds;
+            bool inside;
+        };
+        std::vector<Entry> stack{{0, 0, 0, worldBounds, false}};
+        while (stack.size())
+        {
+            Entry entry = stack.back();
+            stack.pop_back();
+
+            const int index = cellIndex(entry.level, entry.x, entry.z);
+            const auto &cell = cells[index];
+            if (!cell.nbrSubtree)
+                continue;
+
+            // Cells inside the volume are not tested, nor are their descendants
+            if (!entry.inside)
+            {
+                const int result = classify(looseBounds(index, entry.level, entry.bounds));
+                if (!result)
+                    continue;
+                entry.inside = result == 2;
+            }
+
+            if (stats)
+            {
+                stats->cellsVisited++;
+                stats->cellsInside += entry.inside;
+            }
+            if (cell.nbrItems)
+                visit(cell, entry.inside);
+
+            if (entry.level + 1 < nbrLevels)
+            {
+                AABB children[4];
+                entry.bounds.split4_xz(children);
+                for (int i = 0; i < 4; i++)
+                    stack.push_back({entry.level + 1, 2 * entry.x + (i >> 1), 2 * entry.z + (i & 1), children[i], entry.inside});
+            }
+        }
+    }
+
+    void LooseQuadtree::queryFrustum(const glm::mat4 &ProjViewMatrix,
+                                     std::vector<int> &result,
+                                     QueryStats *stats) const
+    {
+        glm::vec4 planes[6];
+        extractPlanes(ProjViewMatrix, planes);
+
+        traverse([&](const AABB &aabb)
+                 { return classifyPlanes(aabb, planes); },
+                 [&](const Cell &cell, bool inside)
+                 {
+                     for (const auto &batch : cell.batches)
+                         for (int item : batch.items)
+                         {
+                             if (!inside)
+                             {
+                                 if (stats)
+                                     stats->itemsTested++;
+                                 if (!classifyPlanes(items[item].aabb, planes))
+                                     continue;
+                             }
+                             result.push_back(item);
+                         }
+                 },
+                 stats);
+    }
+
+    void LooseQuadtree::queryFrustumBatches(const glm::mat4 &ProjViewMatrix,
+                                            std::vector<const Batch *> &result,
+                                            QueryStats *stats) const
+    {
+        glm::vec4 planes[6];
+        extractPlanes(ProjViewMatrix, planes);
+
+        traverse([&](const AABB &aabb)
+                 { return classifyPlanes(aabb, planes); },
+                 [&](const Cell &cell, bool inside)
+                 {
+                     for (const auto &batch : cell.batches)
+                         if (batch.items.size())
+                             result.push_back(&batch);
+                 },
+                 stats);
+    }
+
+    void LooseQuadtree::queryRadius(const glm::vec3 &center,
+                                    float radius,
+                                    std::vector<int> &result,
+                                    QueryStats *stats) const
+    {
+        traverse([&](const AABB &aabb)
+                 { return classifySphere(aabb, center, radius); },
+                 [&](const Cell &cell, bool inside)
+                 {
+                     for (const auto &batch : cell.batches)
+                         for (int item : batch.items)
+                         {
+                             if (!inside)
+                             {
+                                 if (stats)
+                                     stats->itemsTested++;
+                                 if (!classifySphere(items[item].aabb, center, radius))
+                                     continue;
+                             }
+                             result.push_back(item);
+                         }
+                 },
+                 stats);
+    }
+
+} // namespace eeng
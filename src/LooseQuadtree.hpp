@@ -0,0 +1,142 @@
+
+#ifndef LooseQuadtree_hpp
+#define LooseQuadtree_hpp
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+
+namespace eeng
+{
+    /// @brief Loose quadtree over the xz-plane, for static instances in large outdoor scenes
+    /** Cells are split with AABB::split4_xz. Each cell has loose bounds of
+     * twice its size, so an instance is placed directly in the cell that
+     * holds its center at the level that matches its size. Insertion and
+     * removal therefore never search the tree and take constant time, apart
+     * from updating the counts and height ranges of the ancestors.
+     *
+     * The levels are stored as grids, the deepest being a uniform grid.
+     * Within a cell, instances are grouped into batches by a key, such as a
+     * mesh and submesh, so that a visible cell gives lists of instances ready
+     * for instanced draws.
+     *
+     * Instances outside the world bounds, or larger than it, are kept in the
+     * root cell, whose bounds then grow to include them.
+     */
+    class LooseQuadtree
+    {
+    public:
+        /// @brief Instances of a cell that share a key
+        struct Batch
+        {
+            uint32_t key;
+            std::vector<int> items;
+        };
+
+        /// @brief Counters of a query
+        struct QueryStats
+        {
+            int cellsVisited = 0;
+            int cellsInside = 0;  ///< Cells accepted without testing their instances
+            int itemsTested = 0;
+        };
+
+    private:
+        struct Item
+        {
+            AABB aabb;
+            uint32_t userData = 0;
+            int cell = -1;        ///< Or -1 if removed
+            int batch = 0;
+            int slot = 0;
+        };
+
+        struct Cell
+        {
+            std::vector<Batch> batches;
+            int nbrItems = 0;    ///< In this cell
+            int nbrSubtree = 0;  ///< In this cell and its descendants
+            float minY, maxY;    ///< Height range of the subtree, only ever grown
+            AABB extraBounds;    ///< Root only: its instances, which may be outside the world
+        };
+
+        AABB worldBounds;
+        float worldSize;
+        int nbrLevels;
+        std::vector<int> levelOffsets; ///< Index of the first cell of each level
+        std::vector<Cell> cells;
+        std::vector<Item> items;
+        std::vector<int> freeItems;
+
+    public:
+        /// @brief Create quadtree
+        /// @param worldBounds Region covered in xz. Made square, anchored at its minimum.
+        /// @param nbrLevels Number of levels, the root being level 0
+        LooseQuadtree(const AABB &worldBounds,
+                      int nbrLevels = 8);
+
+        /// @brief Add an instance
+        /// @param aabb World space bounds
+        /// @param userData Returned by getUserData(), e.g. an entity
+        /// @param key Batch key, e.g. mesh and submesh
+        /// @return Item index
+        int insert(const AABB &aabb,
+                   uint32_t userData,
+                   uint32_t key = 0);
+
+        /// @brief Remove an instance. Its index may be reused by later insertions.
+        void remove(int item);
+
+        const AABB &getBounds(int item) const;
+
+        uint32_t getUserData(int item) const;
+
+        /// @brief Number of instances
+        int size() const;
+
+        /// @brief Instances whose bounds are not entirely outside a view frustum
+        /// @param result Items are appended here
+        /// @param stats Optional counters, added to
+        void queryFrustum(const glm::mat4 &ProjViewMatrix,
+                          std::vector<int> &result,
+                          QueryStats *stats = nullptr) const;
+
+        /// @brief Batches of all cells that are not entirely outside a view frustum
+        /// Culling is per cell, so batches may hold instances outside the frustum.
+        /// Empty batches are left out.
+        /// @param result Batches are appended here. Valid until the quadtree is modified.
+        void queryFrustumBatches(const glm::mat4 &ProjViewMatrix,
+                                 std::vector<const Batch *> &result,
+                                 QueryStats *stats = nullptr) const;
+
+        /// @brief Instances whose bounds are within a distance of a point
+        void queryRadius(const glm::vec3 &center,
+                         float radius,
+                         std::vector<int> &result,
+                         QueryStats *stats = nullptr) const;
+
+    private:
+        /// @brief Cell that an instance belongs to
+        int findCell(const AABB &aabb) const;
+
+        int cellIndex(int level, int x, int z) const;
+
+        /// @brief Level and grid coordinates of a cell
+        void cellCoords(int cell, int &level, int &x, int &z) const;
+
+        /// @brief Loose bounds of a cell, including the height range of its subtree
+        /// @param bounds Bounds of the cell in xz
+        AABB looseBounds(int cell, int level, const AABB &bounds) const;
+
+        /// @brief Visit non-empty cells that pass a test, depth first
+        /// @param classify Returns 0 if a box is outside, 1 if it intersects, 2 if it is inside
+        /// @param visit Called with each cell that passes, and whether it is entirely inside
+        template <class Classify, class Visit>
+        void traverse(Classify &&classify, Visit &&visit, QueryStats *stats) const;
+    };
+
+} // namespace eeng
+
+#endif /* LooseQuadtree_hpp */
@@ -0,0 +1,381 @@
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include "MeshSimplifier.hpp"
+
+namespace eeng
+{
+    namespace
+    {
+        /// Symmetric 4x4 matrix Q such that v^T Q v is the sum of squared
+        /// distances from v = (x, y, z, 1) to a set of planes
+        struct Quadric
+        {
+            double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+            double b0 = 0, b1 = 0, b2 = 0;
+            double c = 0;
+
+            /// Quadric of the plane n.x + d = 0, with n of unit length
+            static Quadric fromPlane(double nx, double ny, double nz, double d)
+            {
+                Quadric q;
+                q.a00 = nx * nx;
+                q.a01 = nx * ny;
+                q.a02 = nx * nz;
+                q.a11 = ny * ny;
+                q.a12 = ny * nz;
+                q.a22 = nz * nz;
+                q.b0 = nx * d;
+                q.b1 = ny * d;
+                q.b2 = nz * d;
+                q.c = d * d;
+                return q;
+            }
+
+            Quadric &operator+=(const Quadric &q)
+            {
+                a00 += q.a00;
+                a01 += q.a01;
+                a02 += q.a02;
+                a11 += q.a11;
+                a12 += q.a12;
+                a22 += q.a22;
+                b0 += q.b0;
+                b1 += q.b1;
+                b2 += q.b2;
+                c += q.c;
+                return *this;
+            }
+
+            double evaluate(const glm::vec3 &p) const
+            {
+                const double x = p.x, y = p.y, z = p.z;
+                const double error =
+                    a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z +
+                    a11 * y * y + 2 * a12 * y * z + a22 * z * z +
+                    2 * (b0 * x + b1 * y + b2 * z) + c;
+                return std::max(error, 0.0);
+            }
+        };
+
+        struct Collapse
+        {
+            unsigned from, to;
+            double cost;
+        };
+
+        struct PositionHash
+        {
+            size_t operator()(const glm::vec3 &p) const
+            {
+                unsigned bits[3];
+                std::memcpy(bits, &p.x, sizeof(float));
+                std::memcpy(bits + 1, &p.y, sizeof(float));
+                std::memcpy(bits + 2, &p.z, sizeof(float));
+                return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+            }
+        };
+
+        struct PositionEqual
+        {
+            bool operator()(const glm::vec3 &a, const glm::vec3 &b) const
+            {
+                return a.x == b.x && a.y == b.y && a.z == b.z;
+            }
+        };
+
+        /// Closest point on triangle abc to p.
+        /// Ericson, Real-time Collision Detection, page 141.
+        glm::vec3 closestPointOnTriangle(const glm::vec3 &p,
+                                         const glm::vec3 &a,
+                                         const glm::vec3 &b,
+                                         const glm::vec3 &c)
+        {
+            const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+            const float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+            if (d1 <= 0.0f && d2 <= 0.0f)
+                return a;
+
+            const glm::vec3 bp = p - b;
+            const float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+            if (d3 >= 0.0f && d4 <= d3)
+                return b;
+
+            const float vc = d1 * d4 - d3 * d2;
+            if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+                return a + ab * (d1 / (d1 - d3));
+
+            const glm::vec3 cp = p - c;
+            const float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+            if (d6 >= 0.0f && d5 <= d6)
+                return c;
+
+            const float vb = d5 * d2 - d1 * d6;
+            if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+                return a + ac * (d2 / (d2 - d6));
+
+            const float va = d3 * d6 - d5 * d4;
+            if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+                return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+            const float denom = 1.0f / (va + vb + vc);
+            return a + ab * (vb * denom) + ac * (vc * denom);
+        }
+    }
+
+    std::vector<unsigned> MeshSimplifier::simplify(const glm::vec3 *positions,
+                                                   unsigned nbrVertices,
+                                                   const unsigned *indices,
+                                                   unsigned nbrIndices,
+                                                   unsigned targetNbrIndices,
+                                                   float maxError,
+                                                   float *resultError)
+    {
+        std::vector<unsigned> result(indices, indices + nbrIndices);
+        if (resultError)
+            *resultError = 0.0f;
+        if (targetNbrIndices >= nbrIndices)
+            return result;
+
+        // Lock vertices on attribute seams, i.e. that share position with another vertex
+        std::vector<char> locked(nbrVertices, 0);
+        std::vector<unsigned> positionIds(nbrVertices);
+        {
+            std::unordered_map<glm::vec3, unsigned, PositionHash, PositionEqual> firstVertex;
+            for (unsigned i = 0; i < nbrVertices; i++)
+            {
+                auto it = firstVertex.emplace(positions[i], i);
+                positionIds[i] = it.first->second;
+                if (!it.second)
+                    locked[i] = locked[it.first->second] = 1;
+            }
+        }
+
+        // Lock vertices on open borders, i.e. edges used by a single triangle
+        {
+            std::unordered_map<unsigned long long, int> edgeCount;
+            auto edgeKey = [&](unsigned a, unsigned b)
+            {
+                a = positionIds[a];
+                b = positionIds[b];
+                return ((unsigned long long)std::min(a, b) << 32) | std::max(a, b);
+            };
+            for (unsigned i = 0; i + 2 < nbrIndices; i += 3)
+                for (int e = 0; e < 3; e++)
+                    edgeCount[edgeKey(indices[i + e], indices[i + (e + 1) % 3])]++;
+            for (unsigned i = 0; i + 2 < nbrIndices; i += 3)
+                for (int e = 0; e < 3; e++)
+                {
+                    const unsigned a = indices[i + e], b = indices[i + (e + 1) % 3];
+                    if (edgeCount[edgeKey(a, b)] == 1)
+                        locked[a] = locked[b] = 1;
+                }
+        }
+
+        // Vertex quadrics from the planes of the original triangles
+        std::vector<Quadric> quadrics(nbrVertices);
+        for (unsigned i = 0; i + 2 < nbrIndices; i += 3)
+        {
+            const glm::vec3 &p0 = positions[indices[i]];
+            const glm::vec3 &p1 = positions[indices[i + 1]];
+            const glm::vec3 &p2 = positions[indices[i + 2]];
+            const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            const double length = std::sqrt((double)glm::dot(n, n));
+            if (length <= 0.0)
+                continue;
+
+            const double nx = n.x / length, ny = n.y / length, nz = n.z / length;
+            const Quadric q = Quadric::fromPlane(nx, ny, nz, -(nx * p0.x + ny * p0.y + nz * p0.z));
+            for (int k = 0; k < 3; k++)
+                quadrics[indices[i + k]] += q;
+        }
+
+        const double maxCost = (double)maxError * maxError;
+        double largestCost = 0.0;
+
+        std::vector<unsigned> remap(nbrVertices);
+        std::vector<char> touched(nbrVertices);
+        std::vector<unsigned> triangleOffsets(nbrVertices + 1), vertexTriangles;
+        std::vector<Collapse> collapses;
+
+        // Collapse the cheapest edges in passes, rebuilding adjacency between passes
+        while (result.size() > targetNbrIndices)
+        {
+            const unsigned nbrTriangles = (unsigned)result.size() / 3;
+
+            // Triangles around each vertex
+            std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+            for (auto index : result)
+                triangleOffsets[index + 1]++;
+            for (unsigned i = 0; i < nbrVertices; i++)
+                triangleOffsets[i + 1] += triangleOffsets[i];
+            vertexTriangles.resize(result.size());
+            {
+                std::vector<unsigned> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+                for (unsigned i = 0; i < result.size(); i++)
+                    vertexTriangles[fill[result[i]]++] = i / 3;
+            }
+
+            // Candidate collapses, cheapest first
+            collapses.clear();
+            for (unsigned t = 0; t < nbrTriangles; t++)
+                for (int e = 0; e < 3; e++)
+                {
+                    const unsigned a = result[t * 3 + e], b = result[t * 3 + (e + 1) % 3];
+                    for (int k = 0; k < 2; k++)
+                    {
+                        const unsigned from = k ? b : a, to = k ? a : b;
+                        if (locked[from])
+                            continue;
+                        Quadric q = quadrics[from];
+                        q += quadrics[to];
+                        const double cost = q.evaluate(positions[to]);
+                        if (cost <= maxCost)
+                            collapses.push_back({from, to, cost});
+                    }
+                }
+            std::sort(collapses.begin(),
+                      collapses.end(),
+                      [](const Collapse &c0, const Collapse &c1)
+                      { return c0.cost < c1.cost; });
+
+            // Apply collapses that do not interfere with each other
+            const unsigned trianglesToRemove = nbrTriangles - targetNbrIndices / 3;
+            unsigned trianglesRemoved = 0;
+            for (unsigned i = 0; i < nbrVertices; i++)
+                remap[i] = i;
+            std::fill(touched.begin(), touched.end(), 0);
+
+            for (const auto &collapse : collapses)
+            {
+                if (trianglesRemoved >= trianglesToRemove)
+                    break;
+                const unsigned from = collapse.from, to = collapse.to;
+                if (touched[from] || touched[to])
+                    continue;
+
+                // Reject collapses that flip triangles around the removed vertex
+                bool flips = false;
+                unsigned removed = 0;
+                for (unsigned j = triangleOffsets[from]; j < triangleOffsets[from + 1] && !flips; j++)
+                {
+                    const unsigned *tri = &result[vertexTriangles[j] * 3];
+                    if (tri[0] == to || tri[1] == to || tri[2] == to)
+                    {
+                        removed++;
+                        continue;
+                    }
+
+                    glm::vec3 p[3], q[3];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        p[k] = positions[tri[k]];
+                        q[k] = (tri[k] == from ? positions[to] : p[k]);
+                    }
+                    const glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    const glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+                    flips = glm::dot(n0, n1) <= 0.0f;
+                }
+                if (flips)
+                    continue;
+
+                remap[from] = to;
+                quadrics[to] += quadrics[from];
+                largestCost = std::max(largestCost, collapse.cost);
+                trianglesRemoved += removed;
+
+                // Keep the neighborhood fixed for the rest of the pass, so that
+                // the flip test above stays valid
+                for (unsigned j = triangleOffsets[from]; j < triangleOffsets[from + 1]; j++)
+                    for (int k = 0; k < 3; k++)
+                        touched[result[vertexTriangles[j] * 3 + k]] = 1;
+            }
+
+            if (!trianglesRemoved)
+                break;
+
+            // Remap and drop degenerate triangles
+            unsigned nbrKept = 0;
+            for (unsigned t = 0; t < nbrTriangles; t++)
+            {
+                const unsigned a = remap[result[t * 3]];
+                const unsigned b = remap[result[t * 3 + 1]];
+                const unsigned c = remap[result[t * 3 + 2]];
+                if (a == b || b == c || a == c)
+                    continue;
+                result[nbrKept++] = a;
+                result[nbrKept++] = b;
+                result[nbrKept++] = c;
+            }
+            result.resize(nbrKept);
+        }
+
+        if (resultError)
+            *resultError = (float)std::sqrt(largestCost);
+        return result;
+    }
+
+    std::vector<MeshSimplifier::Level> MeshSimplifier::simplifyLevels(const glm::vec3 *positions,
+                                                                      unsigned nbrVertices,
+                                                                      const unsigned *indices,
+                                                                      unsigned nbrIndices,
+                                                                      const std::vector<float> &maxErrors)
+    {
+        std::vector<Level> levels;
+        std::vector<unsigned> previous(indices, indices + nbrIndices);
+        float error = 0.0f;
+        for (float maxError : maxErrors)
+        {
+            float levelError;
+            auto levelIndices = simplify(positions,
+                                         nbrVertices,
+                                         previous.data(),
+                                         (unsigned)previous.size(),
+                                         (unsigned)previous.size() / 6 * 3,
+                                         maxError,
+                                         &levelError);
+            if (levelIndices.size() > previous.size() * 3 / 4)
+                break;
+
+            error += levelError;
+            levels.push_back({levelIndices, error});
+            previous = std::move(levelIndices);
+        }
+        return levels;
+    }
+
+    float MeshSimplifier::measureDeviation(const glm::vec3 *positions,
+                                           const unsigned *originalIndices,
+                                           unsigned nbrOriginalIndices,
+                                           const unsigned *simplifiedIndices,
+                                           unsigned nbrSimplifiedIndices)
+    {
+        if (!nbrOriginalIndices)
+            return 0.0f;
+
+        std::vector<unsigned> vertices(originalIndices, originalIndices + nbrOriginalIndices);
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+        float maxDistance = 0.0f;
+        for (auto v : vertices)
+        {
+            const glm::vec3 &p = positions[v];
+            float minDistance2 = std::numeric_limits<float>::max();
+            for (unsigned i = 0; i + 2 < nbrSimplifiedIndices && minDistance2 > 0.0f; i += 3)
+            {
+                const glm::vec3 closest = closestPointOnTriangle(p,
+                                                                 positions[simplifiedIndices[i]],
+                                                                 positions[simplifiedIndices[i + 1]],
+                                                                 positions[simplifiedIndices[i + 2]]);
+                minDistance2 = std::min(minDistance2, glm::dot(p - closest, p - closest));
+            }
+            maxDistance = std::max(maxDistance, std::sqrt(minDistance2));
+        }
+        return maxDistance;
+    }
+
+} // namespace eeng
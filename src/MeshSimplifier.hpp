@@ -0,0 +1,75 @@
+
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace eeng
+{
+    /// @brief Triangle mesh simplification using quadric error metrics
+    /** Edges are collapsed onto one of their existing vertices (Garland &
+     * Heckbert, Surface Simplification Using Quadric Error Metrics, 1997
+     * - the "subset placement" variant). Vertex data is never modified, so
+     * that a simplified index list can be drawn with the vertex buffers of
+     * the original mesh, e.g. as a LOD level.
+     *
+     * Vertices on open borders and on attribute seams (several vertices
+     * sharing a position) are kept in place, so that simplification does
+     * not open cracks.
+     */
+    class MeshSimplifier
+    {
+    public:
+        /// @brief A simplified triangle list and its error bound
+        struct Level
+        {
+            std::vector<unsigned> indices;
+            float error = 0.0f; //!< Error bound relative to the original triangles, in model units
+        };
+
+        /// @brief Simplify a triangle list
+        /// @param positions Vertex positions
+        /// @param nbrVertices Number of vertices
+        /// @param indices Triangle list
+        /// @param nbrIndices Number of indices
+        /// @param targetNbrIndices Stop when the triangle list has at most this many indices
+        /// @param maxError Largest allowed collapse error, in model units
+        /// @param resultError If not null, set to the largest collapse error
+        /// made, in model units. Bounds the distance of each collapsed vertex
+        /// to the planes of the original triangles around it.
+        /// @return Simplified triangle list, referring to the same vertices
+        static std::vector<unsigned> simplify(const glm::vec3 *positions,
+                                              unsigned nbrVertices,
+                                              const unsigned *indices,
+                                              unsigned nbrIndices,
+                                              unsigned targetNbrIndices,
+                                              float maxError,
+                                              float *resultError = nullptr);
+
+        /// @brief Simplify a triangle list into successively coarser levels, e.g. LODs
+        /// Each level is simplified from the previous one and aims at half
+        /// its triangles, so level errors add up. Stops when simplification
+        /// stalls, i.e. when a level keeps more than 3/4 of the triangles.
+        /// @param maxErrors Largest allowed collapse error of each level, in model units
+        /// @return Levels in order of decreasing detail, at most one per error
+        static std::vector<Level> simplifyLevels(const glm::vec3 *positions,
+                                                 unsigned nbrVertices,
+                                                 const unsigned *indices,
+                                                 unsigned nbrIndices,
+                                                 const std::vector<float> &maxErrors);
+
+        /// @brief Largest distance from a vertex of a mesh to a simplified version of it
+        /// Brute force, intended for verification of simplification results.
+        /// @return Largest distance from a vertex referenced by the original
+        /// triangles to the closest simplified triangle
+        static float measureDeviation(const glm::vec3 *positions,
+                                      const unsigned *originalIndices,
+                                      unsigned nbrOriginalIndices,
+                                      const unsigned *simplifiedIndices,
+                                      unsigned nbrSimplifiedIndices);
+    };
+
+} // namespace eeng
+
+#endif /* MeshSimplifier_hpp */
@@ -0,0 +1,306 @@
+
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include "OcclusionCuller.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EENG_OCCLUSION_SSE
+#include <emmintrin.h>
+#endif
+
+namespace eeng
+{
+    namespace
+    {
+        using Clock = std::chrono::high_resolution_clock;
+
+        float elapsedMs(const Clock::time_point &start)
+        {
+            return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+        }
+
+        /// Vertex is behind the near plane (or the eye)
+        inline bool isBehindNearPlane(const glm::vec4 &clip)
+        {
+            return clip.w <= 1e-6f || clip.z < -clip.w;
+        }
+    }
+
+    OcclusionCuller::OcclusionCuller(int width,
+                                     int height)
+        : width((std::max(width, 4) + 3) & ~3),
+          height(std::max(height, 1))
+    {
+        // Sizes of the depth pyramid, down to a single texel
+        glm::ivec2 size{this->width, this->height};
+        for (;;)
+        {
+            levelSizes.push_back(size);
+            levels.emplace_back(size.x * size.y, 1.0f);
+            if (size.x == 1 && size.y == 1)
+                break;
+            size = {std::max((size.x + 1) / 2, 1), std::max((size.y + 1) / 2, 1)};
+        }
+    }
+
+    void OcclusionCuller::begin(const glm::mat4 &ProjViewMatrix)
+    {
+        this->ProjViewMatrix = ProjViewMatrix;
+        std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+        stats = OcclusionStats{};
+    }
+
+    void OcclusionCuller::rasterize(const glm::vec3 *positions,
+                                    unsigned nbrVertices,
+                                    const unsigned *indices,
+                                    unsigned nbrIndices,
+                                    const glm::mat4 &WorldMatrix)
+    {
+        const auto start = Clock::now();
+
+        // Transform to clip space
+        const glm::mat4 M = ProjViewMatrix * WorldMatrix;
+        clipVertices.resize(nbrVertices);
+        for (unsigned i = 0; i < nbrVertices; i++)
+            clipVertices[i] = M * glm::vec4(positions[i], 1.0f);
+
+        for (unsigned i = 0; i + 2 < nbrIndices; i += 3)
+        {
+            const glm::vec4 &c0 = clipVertices[indices[i]];
+            const glm::vec4 &c1 = clipVertices[indices[i + 1]];
+            const glm::vec4 &c2 = clipVertices[indices[i + 2]];
+
+            // Clipping is not done, since skipping an occluder is always safe
+            if (isBehindNearPlane(c0) || isBehindNearPlane(c1) || isBehindNearPlane(c2))
+                continue;
+
+            // To screen space, with depth in [0,1]
+            auto toScreen = [&](const glm::vec4 &c)
+            {
+                const glm::vec3 ndc = glm::vec3(c) / c.w;
+                return glm::vec4((ndc.x * 0.5f + 0.5f) * width,
+                                 (ndc.y * 0.5f + 0.5f) * height,
+                                 ndc.z * 0.5f + 0.5f,
+                                 1.0f);
+            };
+            rasterizeTriangle(toScreen(c0), toScreen(c1), toScreen(c2));
+        }
+
+        stats.rasterTimeMs += elapsedMs(start);
+    }
+
+    void OcclusionCuller::rasterizeTriangle(const glm::vec4 &v0,
+                                            const glm::vec4 &v1,
+                                            const glm::vec4 &v2)
+    {
+        // Edge functions E_i(x, y) = A_i x + B_i y + C_i, for the edges
+        // opposite to each vertex. Oriented so that the interior is positive.
+        float A[3] = {v1.y - v2.y, v2.y - v0.y, v0.y - v1.y};
+        float B[3] = {v2.x - v1.x, v0.x - v2.x, v1.x - v0.x};
+        float C[3] = {v1.x * v2.y - v2.x * v1.y,
+                      v2.x * v0.y - v0.x * v2.y,
+                      v0.x * v1.y - v1.x * v0.y};
+        float area = C[0] + C[1] + C[2];
+        if (std::fabs(area) < 1e-8f)
+            return;
+        if (area < 0.0f)
+        {
+            // Occluders are rasterized regardless of facing
+            for (int i = 0; i < 3; i++)
+            {
+                A[i] = -A[i];
+                B[i] = -B[i];
+                C[i] = -C[i];
+            }
+            area = -area;
+        }
+
+        // Pixel bounds, with the first column aligned to four pixels
+        const int xmin = std::max(0, (int)std::floor(std::min({v0.x, v1.x, v2.x}))) & ~3;
+        const int xmax = std::min(width - 1, (int)std::ceil(std::max({v0.x, v1.x, v2.x})));
+        const int ymin = std::max(0, (int)std::floor(std::min({v0.y, v1.y, v2.y})));
+        const int ymax = std::min(height - 1, (int)std::ceil(std::max({v0.y, v1.y, v2.y})));
+        if (xmin > xmax || ymin > ymax)
+            return;
+
+        // Depth as a plane in screen space (z/w is linear in x and y)
+        const float invArea = 1.0f / area;
+        const float dzdx = (A[0] * v0.z + A[1] * v1.z + A[2] * v2.z) * invArea;
+        const float dzdy = (B[0] * v0.z + B[1] * v1.z + B[2] * v2.z) * invArea;
+        const float z0 = (C[0] * v0.z + C[1] * v1.z + C[2] * v2.z) * invArea;
+
+        stats.occluderTriangles++;
+        float *depth = levels[0].data();
+
+#ifdef EENG_OCCLUSION_SSE
+        // Four pixels at a time. The buffer width is a multiple of four,
+        // so blocks never straddle rows.
+        const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 A0 = _mm_set1_ps(A[0]), A1 = _mm_set1_ps(A[1]), A2 = _mm_set1_ps(A[2]);
+        const __m128 dzdx4 = _mm_set1_ps(dzdx);
+
+        for (int y = ymin; y <= ymax; y++)
+        {
+            const float py = y + 0.5f;
+            const __m128 rowE0 = _mm_set1_ps(B[0] * py + C[0]);
+            const __m128 rowE1 = _mm_set1_ps(B[1] * py + C[1]);
+            const __m128 rowE2 = _mm_set1_ps(B[2] * py + C[2]);
+            const __m128 rowZ = _mm_set1_ps(dzdy * py + z0);
+            float *row = depth + y * width;
+
+            for (int x = xmin; x <= xmax; x += 4)
+            {
+                const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), pixelOffsets);
+                const __m128 e0 = _mm_add_ps(_mm_mul_ps(A0, px), rowE0);
+                const __m128 e1 = _mm_add_ps(_mm_mul_ps(A1, px), rowE1);
+                const __m128 e2 = _mm_add_ps(_mm_mul_ps(A2, px), rowE2);
+                const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+                                                 _mm_cmpge_ps(e2, zero));
+                if (!_mm_movemask_ps(inside))
+                    continue;
+
+                const __m128 z = _mm_add_ps(_mm_mul_ps(dzdx4, px), rowZ);
+                const __m128 old = _mm_loadu_ps(row + x);
+                const __m128 nearest = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+            }
+        }
+#else
+        for (int y = ymin; y <= ymax; y++)
+        {
+            const float py = y + 0.5f;
+            float *row = depth + y * width;
+            for (int x = xmin; x <= xmax; x++)
+            {
+                const float px = x + 0.5f;
+                if (A[0] * px + B[0] * py + C[0] < 0.0f ||
+                    A[1] * px + B[1] * py + C[1] < 0.0f ||
+                    A[2] * px + B[2] * py + C[2] < 0.0f)
+                    continue;
+                row[x] = std::min(row[x], dzdx * px + dzdy * py + z0);
+            }
+        }
+#endif
+    }
+
+    void OcclusionCuller::end()
+    {
+        const auto start = Clock::now();
+
+        // Each texel holds the farthest depth of the texels it covers in the level below
+        for (size_t l = 1; l < levels.size(); l++)
+        {
+            const auto &src = levels[l - 1];
+            const auto srcSize = levelSizes[l - 1];
+            auto &dst = levels[l];
+            const auto dstSize = levelSizes[l];
+
+            for (int y = 0; y < dstSize.y; y++)
+            {
+                const int y0 = 2 * y, y1 = std::min(2 * y + 1, srcSize.y - 1);
+                for (int x = 0; x < dstSize.x; x++)
+                {
+                    const int x0 = 2 * x, x1 = std::min(2 * x + 1, srcSize.x - 1);
+                    dst[y * dstSize.x + x] = std::max({src[y0 * srcSize.x + x0],
+                                                       src[y0 * srcSize.x + x1],
+                                                       src[y1 * srcSize.x + x0],
+                                                       src[y1 * srcSize.x + x1]});
+                }
+            }
+        }
+
+        stats.rasterTimeMs += elapsedMs(start);
+    }
+
+    bool OcclusionCuller::isVisible(const AABB &aabb,
+                                    const glm::mat4 &WorldMatrix)
+    {
+        const auto start = Clock::now();
+        stats.tested++;
+
+        auto visible = [&]()
+        {
+            stats.testTimeMs += elapsedMs(start);
+            return true;
+        };
+        auto culled = [&](int &counter)
+        {
+            counter++;
+            stats.testTimeMs += elapsedMs(start);
+            return false;
+        };
+
+        // Screen space bounds of the box corners
+        const glm::mat4 M = ProjViewMatrix * WorldMatrix;
+        glm::vec3 smin{std::numeric_limits<float>::max()};
+        glm::vec3 smax{std::numeric_limits<float>::lowest()};
+        for (int i = 0; i < 8; i++)
+        {
+            const glm::vec3 corner{(i & 1) ? aabb.max.x : aabb.min.x,
+                                   (i & 2) ? aabb.max.y : aabb.min.y,
+                                   (i & 4) ? aabb.max.z : aabb.min.z};
+            const glm::vec4 clip = M * glm::vec4(corner, 1.0f);
+
+            // Boxes reaching past the near plane are assumed to be visible
+            if (isBehindNearPlane(clip))
+                return visible();
+
+            const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            const glm::vec3 screen{(ndc.x * 0.5f + 0.5f) * width,
+                                   (ndc.y * 0.5f + 0.5f) * height,
+                                   ndc.z * 0.5f + 0.5f};
+            smin = glm::min(smin, screen);
+            smax = glm::max(smax, screen);
+        }
+
+        // Frustum
+        if (smax.x < 0.0f || smin.x > width || smax.y < 0.0f || smin.y > height || smin.z > 1.0f)
+            return culled(stats.frustumCulled);
+
+        // Choose the level where the bounds cover at most 2x2 texels
+        const int x0 = std::clamp((int)smin.x, 0, width - 1);
+        const int x1 = std::clamp((int)smax.x, 0, width - 1);
+        const int y0 = std::clamp((int)smin.y, 0, height - 1);
+        const int y1 = std::clamp((int)smax.y, 0, height - 1);
+        int level = 0;
+        while (level + 1 < (int)levels.size() &&
+               ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+            level++;
+
+        // Farthest occluder depth within the bounds
+        const auto &depth = levels[level];
+        const int levelWidth = levelSizes[level].x;
+        float maxDepth = 0.0f;
+        for (int y = y0 >> level; y <= (y1 >> level); y++)
+            for (int x = x0 >> level; x <= (x1 >> level); x++)
+                maxDepth = std::max(maxDepth, depth[y * levelWidth + x]);
+
+        if (smin.z > maxDepth)
+            return culled(stats.occluded);
+
+        return visible();
+    }
+
+    const OcclusionStats &OcclusionCuller::getStats() const
+    {
+        return stats;
+    }
+
+    int OcclusionCuller::getWidth() const
+    {
+        return width;
+    }
+
+    int OcclusionCuller::getHeight() const
+    {
+        return height;
+    }
+
+    const std::vector<float> &OcclusionCuller::getDepthBuffer() const
+    {
+        return levels[0];
+    }
+
+} // namespace eeng
@@ -0,0 +1,96 @@
+
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+
+namespace eeng
+{
+    /// @brief Counters of the latest culling pass
+    struct OcclusionStats
+    {
+        unsigned occluderTriangles = 0; ///< Triangles rasterized as occluders
+        int tested = 0;                 ///< Volumes tested
+        int frustumCulled = 0;          ///< Volumes outside the view frustum
+        int occluded = 0;               ///< Volumes behind occluders
+        float rasterTimeMs = 0.0f;      ///< Time to rasterize occluders and build the hierarchy
+        float testTimeMs = 0.0f;        ///< Time spent in visibility tests
+    };
+
+    /// @brief Occlusion culling against a software rasterized, hierarchical depth buffer
+    /** Occluder triangles are rasterized on the CPU into a low resolution
+     * depth buffer. A max-depth pyramid (Hi-Z) is then built from it, against
+     * which bounding boxes are tested conservatively: a box is culled only if
+     * its nearest depth is behind the farthest occluder depth of all texels it
+     * covers. Does not depend on GL.
+     *
+     * Usage: begin(), rasterize() occluders, end(), then isVisible().
+     */
+    class OcclusionCuller
+    {
+        int width, height;
+        glm::mat4 ProjViewMatrix{1.0f};
+
+        // Level 0 is the depth buffer, level i has half the size of level i-1.
+        // Depth is in [0,1] and cleared to 1 (far).
+        std::vector<std::vector<float>> levels;
+        std::vector<glm::ivec2> levelSizes;
+
+        std::vector<glm::vec4> clipVertices; // Scratch for transformed occluder vertices
+        OcclusionStats stats;
+
+    public:
+        /// @brief Create culler
+        /// @param width Depth buffer width, rounded up to a multiple of four
+        /// @param height Depth buffer height
+        OcclusionCuller(int width = 256,
+                        int height = 128);
+
+        /// @brief Clear depth buffer and counters
+        /// @param ProjViewMatrix Camera projection and view
+        void begin(const glm::mat4 &ProjViewMatrix);
+
+        /// @brief Rasterize occluder triangles into the depth buffer
+        /// Triangles that cross the near plane are skipped, which is conservative.
+        /// @param positions Model space vertex positions
+        /// @param nbrVertices Number of positions
+        /// @param indices Triangle vertex indices
+        /// @param nbrIndices Number of indices
+        /// @param WorldMatrix Model to world transform
+        void rasterize(const glm::vec3 *positions,
+                       unsigned nbrVertices,
+                       const unsigned *indices,
+                       unsigned nbrIndices,
+                       const glm::mat4 &WorldMatrix);
+
+        /// @brief Build the depth hierarchy. Call after all occluders are rasterized.
+        void end();
+
+        /// @brief Test a bounding box against the view frustum and occluders
+        /// @param aabb Model space AABB
+        /// @param WorldMatrix Model to world transform
+        /// @return False if the box is certainly not visible
+        bool isVisible(const AABB &aabb,
+                       const glm::mat4 &WorldMatrix);
+
+        const OcclusionStats &getStats() const;
+
+        int getWidth() const;
+
+        int getHeight() const;
+
+        /// @brief Depth buffer, row by row from the bottom of the screen
+        const std::vector<float> &getDepthBuffer() const;
+
+    private:
+        void rasterizeTriangle(const glm::vec4 &v0,
+                               const glm::vec4 &v1,
+                               const glm::vec4 &v2);
+    };
+
+} // namespace eeng
+
+#endif /* OcclusionCuller_hpp */
@@ -0,0 +1,122 @@
+
+#include <cstring>
+#include <stdexcept>
+#include "OffscreenTarget.hpp"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+namespace eeng
+{
+    OffscreenTarget::OffscreenTarget(int width, int height)
+        : width(width),
+          height(height)
+    {
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+            throw std::runtime_error("Offscreen framebuffer is incomplete");
+
+        glGenBuffers(2, pbos);
+        for (GLuint pbo : pbos)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        CheckAndThrowGLErrors();
+    }
+
+    OffscreenTarget::~OffscreenTarget()
+    {
+        glDeleteBuffers(2, pbos);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+    }
+
+    void OffscreenTarget::bind() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+    }
+
+    bool OffscreenTarget::readback(std::vector<uint8_t> &pixels)
+    {
+        // Queue a copy of this frame into the buffer not holding the previous one
+        const GLuint pbo = pbos[(nbrQueued + 1) % 2];
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        const bool hasPrevious = nbrQueued > 0;
+        if (hasPrevious)
+            mapPixels(pbos[nbrQueued % 2], pixels);
+        nbrQueued++;
+        return hasPrevious;
+    }
+
+    bool OffscreenTarget::finish(std::vector<uint8_t> &pixels)
+    {
+        if (!nbrQueued)
+            return false;
+        mapPixels(pbos[nbrQueued % 2], pixels);
+        nbrQueued = 0;
+        return true;
+    }
+
+    void OffscreenTarget::mapPixels(GLuint pbo, std::vector<uint8_t> &pixels) const
+    {
+        const size_t rowSize = (size_t)width * 4;
+        pixels.resize(rowSize * height);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        const auto mapped = (const uint8_t *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)pixels.size(), GL_MAP_READ_BIT);
+        if (!mapped)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            throw std::runtime_error("Failed to map pixel buffer");
+        }
+        // GL rows start at the bottom
+        for (int y = 0; y < height; y++)
+            std::memcpy(&pixels[y * rowSize], mapped + (height - 1 - y) * rowSize, rowSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    int OffscreenTarget::getWidth() const
+    {
+        return width;
+    }
+
+    int OffscreenTarget::getHeight() const
+    {
+        return height;
+    }
+
+    void OffscreenTarget::writePng(const std::string &file,
+                                   const std::vector<uint8_t> &pixels,
+                                   int width,
+                                   int height)
+    {
+        if (!stbi_write_png(file.c_str(), width, height, 4, pixels.data(), width * 4))
+            throw std::runtime_error("Failed to write " + file);
+    }
+
+} // namespace eeng
@@ -0,0 +1,64 @@
+
+#ifndef OffscreenTarget_hpp
+#define OffscreenTarget_hpp
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "glcommon.h"
+
+namespace eeng
+{
+    /// @brief Framebuffer object with color and depth renderbuffers, for rendering without a window
+    /** Frames are read back through two pixel buffer objects. Reading a
+     * frame queues a copy of it and returns the frame before it, whose copy
+     * has had a frame to complete, so that rendering does not wait for the
+     * transfer.
+     */
+    class OffscreenTarget
+    {
+        GLuint fbo = 0;
+        GLuint colorBuffer = 0, depthBuffer = 0;
+        GLuint pbos[2] = {0, 0};
+        int width, height;
+        int nbrQueued = 0; ///< Frames queued for readback, of which the latest is in pbos[nbrQueued % 2]
+
+    public:
+        /// @brief Create target. Requires a current GL context.
+        OffscreenTarget(int width, int height);
+
+        ~OffscreenTarget();
+
+        OffscreenTarget(const OffscreenTarget &) = delete;
+        OffscreenTarget &operator=(const OffscreenTarget &) = delete;
+
+        /// @brief Bind as the draw and read framebuffer, and set the viewport to cover it
+        void bind() const;
+
+        /// @brief Queue readback of the current frame, and get the frame queued before it
+        /// @param pixels RGBA rows, top row first. Resized to fit.
+        /// @return True if there was a previous frame
+        bool readback(std::vector<uint8_t> &pixels);
+
+        /// @brief Get the latest queued frame, waiting for its copy to complete
+        /// @return True if there was a frame
+        bool finish(std::vector<uint8_t> &pixels);
+
+        int getWidth() const;
+
+        int getHeight() const;
+
+        /// @brief Write RGBA pixels as a PNG image
+        static void writePng(const std::string &file,
+                             const std::vector<uint8_t> &pixels,
+                             int width,
+                             int height);
+
+    private:
+        /// @brief Copy a pixel buffer into memory, flipping rows so that the top row comes first
+        void mapPixels(GLuint pbo, std::vector<uint8_t> &pixels) const;
+    };
+
+} // namespace eeng
+
+#endif /* OffscreenTarget_hpp */
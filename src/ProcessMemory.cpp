@@ -0,0 +1,35 @@
+
+#include "ProcessMemory.hpp"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace eeng
+{
+    size_t getPeakResidentBytes()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return 0;
+        return counters.PeakWorkingSetSize;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage))
+            return 0;
+#if defined(__APPLE__)
+        return (size_t)usage.ru_maxrss; // Bytes
+#else
+        return (size_t)usage.ru_maxrss * 1024; // Kilobytes
+#endif
+#endif
+    }
+
+} // namespace eeng
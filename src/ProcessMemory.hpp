@@ -0,0 +1,15 @@
+
+#ifndef ProcessMemory_hpp
+#define ProcessMemory_hpp
+
+#include <cstddef>
+
+namespace eeng
+{
+    /// @brief Peak resident memory (working set) of the process so far, in bytes
+    /// Never decreases, so compare loads in processes of their own. 0 if not available.
+    size_t getPeakResidentBytes();
+
+} // namespace eeng
+
+#endif /* ProcessMemory_hpp */
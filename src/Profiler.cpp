@@ -0,0 +1,458 @@
+
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include "glcommon.h"
+#include "imgui.h"
+#include "StringId.hpp"
+#include "Log.hpp"
+#include "Profiler.hpp"
+
+namespace eeng
+{
+    namespace
+    {
+        std::string jsonString(const char *text)
+        {
+            std::string result = "\"";
+            for (; *text; text++)
+            {
+                if (*text == '"' || *text == '\\')
+                    result += '\\';
+                if ((unsigned char)*text >= 0x20)
+                    result += *text;
+            }
+            return result + "\"";
+        }
+
+        /// Stable color of a zone name
+        ImU32 zoneColor(const char *name)
+        {
+            const uint32_t hash = StringId::hash(name, std::strlen(name));
+            return ImColor::HSV((hash % 360) / 360.0f, 0.45f, 0.85f);
+        }
+
+        constexpr int GpuThread = 1000; // Chrome trace thread id of GPU zones
+    }
+
+    Profiler &Profiler::instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    Profiler::Profiler()
+        : frames(MaxFrames)
+    {
+        frameStartNs = nowNs();
+    }
+
+    uint64_t Profiler::nowNs()
+    {
+        using namespace std::chrono;
+        return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    Profiler::ThreadBuffer &Profiler::threadBuffer()
+    {
+        // Released when the thread exits, so that short-lived threads do not
+        // add a lane each
+        struct Registration
+        {
+            ThreadBuffer *buffer = nullptr;
+            ~Registration()
+            {
+                if (buffer)
+                {
+                    std::lock_guard<std::mutex> lock(buffer->mutex);
+                    buffer->inUse = false;
+                }
+            }
+        };
+        thread_local Registration registration;
+
+        if (!registration.buffer)
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            for (auto &buffer : threads)
+            {
+                std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+                if (!buffer->inUse)
+                {
+                    buffer->inUse = true;
+                    buffer->depth = 0;
+                    registration.buffer = buffer.get();
+                    break;
+                }
+            }
+            if (!registration.buffer)
+            {
+                threads.push_back(std::make_unique<ThreadBuffer>());
+                registration.buffer = threads.back().get();
+                registration.buffer->thread = (int)threads.size() - 1;
+            }
+        }
+        return *registration.buffer;
+    }
+
+    Profiler::ThreadBuffer *Profiler::beginCpuZone()
+    {
+        if (!isEnabled())
+            return nullptr;
+        auto &buffer = threadBuffer();
+        buffer.depth++;
+        return &buffer;
+    }
+
+    void Profiler::endCpuZone(ThreadBuffer *buffer, const char *name, uint64_t startNs)
+    {
+        const uint64_t endNs = nowNs();
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        buffer->depth--;
+        buffer->zones.push_back({name, startNs, endNs, buffer->thread, buffer->depth});
+    }
+
+    void Profiler::beginFrame()
+    {
+        const uint64_t now = nowNs();
+
+        // Collect zones of the frame that ended, unless paused
+        Frame *frame = nullptr;
+        if (!paused)
+        {
+            frame = &frames[nbrRecorded++ % MaxFrames];
+            frame->index = frameIndex;
+            frame->startNs = frameStartNs;
+            frame->endNs = now;
+            frame->cpuZones.clear();
+            frame->gpuZones.clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            for (auto &buffer : threads)
+            {
+                std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+                if (frame)
+                    frame->cpuZones.insert(frame->cpuZones.end(), buffer->zones.begin(), buffer->zones.end());
+                buffer->zones.clear();
+            }
+        }
+
+        frameIndex++;
+        frameStartNs = now;
+    }
+
+    int Profiler::beginGpuZone(const char *name)
+    {
+        if (!isEnabled())
+            return -1;
+
+        // Queries of the first zone of a frame reuse the set of an earlier frame
+        const int slot = frameIndex % GpuLatency;
+        auto &set = gpuSets[slot];
+        if (!set.pending || set.frame != frameIndex)
+        {
+            if (set.pending)
+                readGpuQueries(set);
+            set.zones.clear();
+            set.frame = frameIndex;
+            set.pending = true;
+            GLint64 gpuNow = 0;
+            glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+            set.cpuRefNs = nowNs();
+            set.gpuRefNs = (uint64_t)gpuNow;
+            gpuDepth = 0;
+        }
+
+        const int index = (int)set.zones.size();
+        set.zones.push_back({name, 0, 0, gpuDepth++});
+        if (set.queries.size() < set.zones.size() * 2)
+        {
+            const size_t first = set.queries.size();
+            set.queries.resize(first + 2);
+            glGenQueries(2, &set.queries[first]);
+        }
+        glQueryCounter(set.queries[2 * index], GL_TIMESTAMP);
+        return (slot << 16) | index;
+    }
+
+    void Profiler::endGpuZone(int zone)
+    {
+        if (zone < 0)
+            return;
+        auto &set = gpuSets[zone >> 16];
+        const int index = zone & 0xffff;
+        glQueryCounter(set.queries[2 * index + 1], GL_TIMESTAMP);
+        set.zones[index].endNs = 1; // Ended, time is read later
+        gpuDepth--;
+    }
+
+    void Profiler::readGpuQueries(GpuQuerySet &set)
+    {
+        set.pending = false;
+
+        // Queries complete in order, so if the latest is available, all are
+        GLuint latest = 0;
+        for (size_t i = 0; i < set.zones.size(); i++)
+            if (set.zones[i].endNs)
+                latest = set.queries[2 * i + 1];
+        GLint available = 0;
+        if (latest)
+            glGetQueryObjectiv(latest, GL_QUERY_RESULT_AVAILABLE, &available);
+        Frame *frame = nullptr;
+        for (int age = 0; age <= GpuLatency && !frame; age++)
+        {
+            auto recorded = const_cast<Frame *>(getFrame(age));
+            if (recorded && recorded->index == set.frame)
+                frame = recorded;
+        }
+        if (!available || !frame)
+            return;
+
+        for (size_t i = 0; i < set.zones.size(); i++)
+        {
+            auto zone = set.zones[i];
+            if (!zone.endNs)
+                continue;
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(set.queries[2 * i], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(set.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+            zone.startNs = set.cpuRefNs + (start - set.gpuRefNs);
+            zone.endNs = set.cpuRefNs + (end - set.gpuRefNs);
+            frame->gpuZones.push_back(zone);
+        }
+    }
+
+    void Profiler::setEnabled(bool enabled)
+    {
+        this->enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool Profiler::isEnabled() const
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void Profiler::setPaused(bool paused)
+    {
+        this->paused = paused;
+    }
+
+    bool Profiler::isPaused() const
+    {
+        return paused;
+    }
+
+    int Profiler::getNbrFrames() const
+    {
+        return (int)std::min<uint64_t>(nbrRecorded, MaxFrames);
+    }
+
+    const Profiler::Frame *Profiler::getFrame(int age) const
+    {
+        if (age < 0 || age >= getNbrFrames())
+            return nullptr;
+        return &frames[(nbrRecorded - 1 - age) % MaxFrames];
+    }
+
+    void Profiler::exportChromeTrace(const std::string &file) const
+    {
+        FILE *out = std::fopen(file.c_str(), "w");
+        if (!out)
+            throw std::runtime_error("Failed to open " + file);
+
+        const int nbrFrames = getNbrFrames();
+        const Frame *oldest = getFrame(nbrFrames - 1);
+        const uint64_t originNs = oldest ? oldest->startNs : 0;
+        auto us = [&](uint64_t ns)
+        { return (double)(int64_t)(ns - originNs) * 1e-3; };
+
+        std::fprintf(out, "{\"traceEvents\":[\n");
+        std::fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"eduEngine\"}}");
+        std::fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"GPU\"}}", GpuThread);
+        int nbrThreads = 0;
+        for (int age = nbrFrames - 1; age >= 0; age--)
+        {
+            const Frame &frame = *getFrame(age);
+            std::fprintf(out, ",\n{\"name\":\"Frame %llu\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%i}",
+                         (unsigned long long)frame.index,
+                         us(frame.startNs),
+                         (frame.endNs - frame.startNs) * 1e-3,
+                         GpuThread + 1);
+            for (const auto &zone : frame.cpuZones)
+            {
+                std::fprintf(out, ",\n{\"name\":%s,\"cat\":\"cpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%i}",
+                             jsonString(zone.name).c_str(),
+                             us(zone.startNs),
+                             (zone.endNs - zone.startNs) * 1e-3,
+                             zone.thread);
+                nbrThreads = std::max(nbrThreads, zone.thread + 1);
+            }
+            for (const auto &zone : frame.gpuZones)
+                std::fprintf(out, ",\n{\"name\":%s,\"cat\":\"gpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%i}",
+                             jsonString(zone.name).c_str(),
+                             us(zone.startNs),
+                             (zone.endNs - zone.startNs) * 1e-3,
+                             GpuThread);
+        }
+        std::fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"Frames\"}}", GpuThread + 1);
+        for (int thread = 0; thread < nbrThreads; thread++)
+            std::fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"Thread %i\"}}", thread, thread);
+        std::fprintf(out, "\n]}\n");
+
+        const bool failed = std::ferror(out);
+        std::fclose(out);
+        if (failed)
+            throw std::runtime_error("Failed to write " + file);
+    }
+
+    void Profiler::drawUI(bool *p_open)
+    {
+        if (!ImGui::Begin("Profiler", p_open))
+        {
+            ImGui::End();
+            return;
+        }
+
+        bool enabledFlag = isEnabled();
+        if (ImGui::Checkbox("Enabled", &enabledFlag))
+            setEnabled(enabledFlag);
+        ImGui::SameLine();
+        ImGui::Checkbox("Pause", &paused);
+        ImGui::SameLine();
+        if (ImGui::Button("Export Chrome trace"))
+        {
+            try
+            {
+                exportChromeTrace("profile_trace.json");
+                Log::log("Profile of %i frames written to profile_trace.json", getNbrFrames());
+            }
+            catch (const std::exception &e)
+            {
+                Log::log("Profile export failed: %s", e.what());
+            }
+        }
+
+        const int nbrFrames = getNbrFrames();
+        if (!nbrFrames)
+        {
+            ImGui::Text("No frames recorded");
+            ImGui::End();
+            return;
+        }
+
+        // Frame times, oldest first. Click a frame to select it.
+        float frameMs[MaxFrames];
+        for (int i = 0; i < nbrFrames; i++)
+        {
+            const Frame &frame = *getFrame(nbrFrames - 1 - i);
+            frameMs[i] = (frame.endNs - frame.startNs) * 1e-6f;
+        }
+        ImGui::PlotHistogram("##frametimes", frameMs, nbrFrames, 0, "Frame times (ms)", 0.0f, FLT_MAX, ImVec2(-1.0f, 60.0f));
+        if (ImGui::IsItemHovered() && ImGui::IsMouseClicked(0))
+        {
+            const float x = (ImGui::GetIO().MousePos.x - ImGui::GetItemRectMin().x) / ImGui::GetItemRectSize().x;
+            selectedAge = nbrFrames - 1 - std::clamp((int)(x * nbrFrames), 0, nbrFrames - 1);
+        }
+        selectedAge = std::min(selectedAge, nbrFrames - 1);
+        ImGui::SliderInt("Frame age", &selectedAge, 0, nbrFrames - 1);
+        ImGui::SliderFloat("Zoom", &zoom, 1.0f, 100.0f, "%.1fx", ImGuiSliderFlags_Logarithmic);
+
+        const Frame &frame = *getFrame(selectedAge);
+        ImGui::Text("Frame %llu, %.3f ms, %zu CPU zones, %zu GPU zones",
+                    (unsigned long long)frame.index,
+                    (frame.endNs - frame.startNs) * 1e-6,
+                    frame.cpuZones.size(),
+                    frame.gpuZones.size());
+
+        // Lanes of threads and the GPU, each a header row and a row per depth
+        std::vector<int> threadRows;
+        for (const auto &zone : frame.cpuZones)
+        {
+            if ((int)threadRows.size() <= zone.thread)
+                threadRows.resize(zone.thread + 1, 0);
+            threadRows[zone.thread] = std::max(threadRows[zone.thread], zone.depth + 1);
+        }
+        int gpuRows = 0;
+        uint64_t endNs = frame.endNs;
+        for (const auto &zone : frame.gpuZones)
+        {
+            gpuRows = std::max(gpuRows, zone.depth + 1);
+            endNs = std::max(endNs, zone.endNs);
+        }
+        const float rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+        std::vector<float> threadY;
+        float height = 0.0f;
+        for (int rows : threadRows)
+        {
+            threadY.push_back(height + rowHeight);
+            height += (rows + 1) * rowHeight;
+        }
+        const float gpuY = height + rowHeight;
+        height += gpuRows ? (gpuRows + 1) * rowHeight : 0.0f;
+
+        ImGui::BeginChild("Timeline", ImVec2(0.0f, height + ImGui::GetStyle().ScrollbarSize + 8.0f), true, ImGuiWindowFlags_HorizontalScrollbar);
+        const float width = ImGui::GetContentRegionAvail().x * zoom;
+        const ImVec2 origin = ImGui::GetCursorScreenPos();
+        const double nsToPixels = width / std::max<double>(1.0, double(endNs - frame.startNs));
+        auto drawList = ImGui::GetWindowDrawList();
+        const ImU32 textColor = ImGui::GetColorU32(ImGuiCol_Text);
+
+        auto drawZone = [&](const char *name, uint64_t start, uint64_t end, float y)
+        {
+            const ImVec2 min{origin.x + float((int64_t)(start - frame.startNs) * nsToPixels), origin.y + y};
+            const ImVec2 max{std::max(min.x + 1.0f, origin.x + float((int64_t)(end - frame.startNs) * nsToPixels)), min.y + rowHeight - 1.0f};
+            drawList->AddRectFilled(min, max, zoneColor(name));
+            if (max.x - min.x > 20.0f)
+            {
+                drawList->PushClipRect(min, max, true);
+                drawList->AddText({min.x + 2.0f, min.y + 2.0f}, IM_COL32_BLACK, name);
+                drawList->PopClipRect();
+            }
+            if (ImGui::IsMouseHoveringRect(min, max) && ImGui::IsWindowHovered())
+                ImGui::SetTooltip("%s\n%.3f ms", name, (end - start) * 1e-6);
+        };
+
+        for (size_t thread = 0; thread < threadRows.size(); thread++)
+            drawList->AddText({origin.x + ImGui::GetScrollX(), origin.y + threadY[thread] - rowHeight + 2.0f}, textColor, ("Thread " + std::to_string(thread)).c_str());
+        for (const auto &zone : frame.cpuZones)
+            drawZone(zone.name, zone.startNs, zone.endNs, threadY[zone.thread] + zone.depth * rowHeight);
+        if (gpuRows)
+            drawList->AddText({origin.x + ImGui::GetScrollX(), origin.y + gpuY - rowHeight + 2.0f}, textColor, "GPU");
+        for (const auto &zone : frame.gpuZones)
+            drawZone(zone.name, zone.startNs, zone.endNs, gpuY + zone.depth * rowHeight);
+
+        ImGui::Dummy(ImVec2(width, height));
+        ImGui::EndChild();
+
+        ImGui::End();
+    }
+
+    ProfileZone::ProfileZone(const char *name)
+        : name(name),
+          buffer(Profiler::instance().beginCpuZone())
+    {
+        if (buffer)
+            startNs = Profiler::nowNs();
+    }
+
+    ProfileZone::~ProfileZone()
+    {
+        if (buffer)
+            Profiler::instance().endCpuZone(buffer, name, startNs);
+    }
+
+    GpuProfileZone::GpuProfileZone(const char *name)
+        : zone(Profiler::instance().beginGpuZone(name))
+    {
+    }
+
+    GpuProfileZone::~GpuProfileZone()
+    {
+        Profiler::instance().endGpuZone(zone);
+    }
+
+} // namespace eeng
@@ -0,0 +1,189 @@
+
+#ifndef Profiler_hpp
+#define Profiler_hpp
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/// Profiling zones are compiled in if EENG_PROFILER is defined, see the
+/// EENG_PROFILER option in CMakeLists.txt. Otherwise the macros expand to
+/// nothing, and their arguments are not evaluated.
+#ifdef EENG_PROFILER
+#define EENG_PROFILE_CONCAT_(a, b) a##b
+#define EENG_PROFILE_CONCAT(a, b) EENG_PROFILE_CONCAT_(a, b)
+/// CPU zone until the end of the scope. The name must outlive the profiler, e.g. a literal or StringId::c_str().
+#define EENG_PROFILE_SCOPE(name) eeng::ProfileZone EENG_PROFILE_CONCAT(profileZone, __LINE__)(name)
+/// GPU zone until the end of the scope, on the thread of the GL context
+#define EENG_PROFILE_GPU_SCOPE(name) eeng::GpuProfileZone EENG_PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+/// Start a new frame, on the thread of the GL context
+#define EENG_PROFILE_FRAME() eeng::Profiler::instance().beginFrame()
+#else
+#define EENG_PROFILE_SCOPE(name)
+#define EENG_PROFILE_GPU_SCOPE(name)
+#define EENG_PROFILE_FRAME()
+#endif
+
+namespace eeng
+{
+    /// @brief Hierarchical CPU and GPU profiler keeping the latest frames
+    /** CPU zones are recorded per thread, with the nesting depth of each
+     * thread, and collected into the current frame when the next frame
+     * begins. A zone belongs to the frame during which it ends.
+     *
+     * GPU zones are timestamp query pairs, which, unlike elapsed time
+     * queries, may be nested and may enclose the elapsed time queries of the
+     * renderer. Queries are read a few frames later, once available, so
+     * that the CPU never waits for them. Frames whose queries are not yet
+     * available by then get no GPU zones. GPU times are mapped to the CPU
+     * clock using the GPU time at the start of each frame.
+     */
+    class Profiler
+    {
+    public:
+        /// Frames kept
+        static constexpr int MaxFrames = 256;
+
+        struct CpuZone
+        {
+            const char *name;
+            uint64_t startNs, endNs;
+            int thread; ///< In order of the first zone of each thread
+            int depth;
+        };
+
+        struct GpuZone
+        {
+            const char *name;
+            uint64_t startNs, endNs; ///< On the CPU clock
+            int depth;
+        };
+
+        struct Frame
+        {
+            uint64_t index = 0;
+            uint64_t startNs = 0, endNs = 0;
+            std::vector<CpuZone> cpuZones;
+            std::vector<GpuZone> gpuZones;
+        };
+
+        static Profiler &instance();
+
+        /// @brief Nanoseconds on the profiler clock
+        static uint64_t nowNs();
+
+        /// @brief End the current frame and begin the next
+        /// Call on the thread of the GL context, once per frame.
+        void beginFrame();
+
+        /// @brief Record zones. Zones are always recorded when compiled in, unless disabled.
+        void setEnabled(bool enabled);
+
+        bool isEnabled() const;
+
+        /// @brief Keep the recorded frames, e.g. for inspection, and drop new zones
+        void setPaused(bool paused);
+
+        bool isPaused() const;
+
+        /// @brief Recorded frame
+        /// @param age 0 is the latest complete frame
+        /// @return Frame, or nullptr if not recorded
+        const Frame *getFrame(int age) const;
+
+        /// @brief Number of recorded frames
+        int getNbrFrames() const;
+
+        /// @brief Write recorded frames in the Chrome trace event format
+        /// Open in chrome://tracing or https://ui.perfetto.dev. Throws if the file cannot be written.
+        void exportChromeTrace(const std::string &file) const;
+
+        /// @brief Draw frame times and a timeline of the zones of a frame
+        void drawUI(bool *p_open = nullptr);
+
+        /// Zones of one thread, until collected by beginFrame()
+        struct ThreadBuffer
+        {
+            std::mutex mutex;
+            std::vector<CpuZone> zones;
+            int thread = 0;
+            int depth = 0;
+            bool inUse = true; ///< Buffers of threads that have exited are reused
+        };
+
+        // Used by ProfileZone and GpuProfileZone
+        ThreadBuffer *beginCpuZone();
+        void endCpuZone(ThreadBuffer *buffer, const char *name, uint64_t startNs);
+        int beginGpuZone(const char *name);
+        void endGpuZone(int zone);
+
+    private:
+        Profiler();
+
+        ThreadBuffer &threadBuffer();
+
+        /// Timestamp queries of one frame, read when the set is reused
+        struct GpuQuerySet
+        {
+            std::vector<unsigned> queries; // Two per zone, grown as needed
+            std::vector<GpuZone> zones;    // Names and depths, times once read
+            uint64_t frame = 0;
+            uint64_t cpuRefNs = 0, gpuRefNs = 0;
+            bool pending = false;
+        };
+        static constexpr int GpuLatency = 3;
+        GpuQuerySet gpuSets[GpuLatency];
+        int gpuDepth = 0;
+        void readGpuQueries(GpuQuerySet &set);
+
+        std::mutex threadsMutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+        std::vector<Frame> frames; // Ring buffer of recorded frames
+        uint64_t nbrRecorded = 0;  // Latest recorded frame at (nbrRecorded - 1) % MaxFrames
+        uint64_t frameIndex = 0;   // Current, incomplete frame
+        uint64_t frameStartNs = 0;
+        std::atomic<bool> enabled{true};
+        bool paused = false;
+
+        // UI state
+        int selectedAge = 0;
+        float zoom = 1.0f;
+    };
+
+    /// @brief CPU zone from construction to destruction
+    class ProfileZone
+    {
+        const char *name;
+        Profiler::ThreadBuffer *buffer;
+        uint64_t startNs;
+
+    public:
+        explicit ProfileZone(const char *name);
+
+        ~ProfileZone();
+
+        ProfileZone(const ProfileZone &) = delete;
+        ProfileZone &operator=(const ProfileZone &) = delete;
+    };
+
+    /// @brief GPU zone from construction to destruction, on the thread of the GL context
+    class GpuProfileZone
+    {
+        int zone;
+
+    public:
+        explicit GpuProfileZone(const char *name);
+
+        ~GpuProfileZone();
+
+        GpuProfileZone(const GpuProfileZone &) = delete;
+        GpuProfileZone &operator=(const GpuProfileZone &) = delete;
+    };
+
+} // namespace eeng
+
+#endif /* Profiler_hpp */
@@ -1,12 +1,23 @@
 
 #include "RenderableMesh.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <assimp/version.h>
 
 #include "ShaderLoader.h"
+#include "MeshSimplifier.hpp"
+#include "GLStateCache.hpp"
+#include "ThreadPool.hpp"
+#include "ProcessMemory.hpp"
+#include "Log.hpp"
 #include "parseutil.h"
 
 namespace eeng
@@ -44,45 +55,126 @@ namespace eeng
             glmm[3][3] = aim.d4;
             return glmm;
         }
+
+        using LoadClock = std::chrono::steady_clock;
+
+        /// Attributes of a vertex compared when welding: position, normal,
+        /// tangent frame, texture coordinates, bone indices and weights
+        using WeldKey = std::array<uint32_t, 22>;
+
+        struct WeldKeyHash
+        {
+            size_t operator()(const WeldKey &key) const
+            {
+                // FNV-1a
+                uint64_t hash = 14695981039346656037ull;
+                for (uint32_t word : key)
+                {
+                    hash ^= word;
+                    hash *= 1099511628211ull;
+                }
+                return (size_t)hash;
+            }
+        };
+
+        inline uint32_t floatWord(float value)
+        {
+            uint32_t word;
+            std::memcpy(&word, &value, sizeof(word));
+            return word;
+        }
+
+        inline uint32_t quantizeWord(float value, float scale, float offset)
+        {
+            return (uint32_t)(int32_t)std::lround((value - offset) * scale);
+        }
+
+        const char *getBufferName(int buffer)
+        {
+            static const char *names[] = {"indices", "positions", "normals", "tangents", "binormals", "texture coordinates", "bones"};
+            return names[buffer];
+        }
+
+        /// Vertices per batch of submeshes converted and uploaded when streaming
+        constexpr unsigned StreamingBatchVertices = 1 << 18;
+
+        /// Release the vertices, faces and bone weights of an imported mesh
+        /// Counts are zeroed along with the data, while bones are kept.
+        void releaseMeshData(aiMesh *aimesh)
+        {
+            delete[] aimesh->mVertices;
+            delete[] aimesh->mNormals;
+            delete[] aimesh->mTangents;
+            delete[] aimesh->mBitangents;
+            aimesh->mVertices = aimesh->mNormals = aimesh->mTangents = aimesh->mBitangents = nullptr;
+            for (unsigned i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+            {
+                delete[] aimesh->mTextureCoords[i];
+                aimesh->mTextureCoords[i] = nullptr;
+            }
+            for (unsigned i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++)
+            {
+                delete[] aimesh->mColors[i];
+                aimesh->mColors[i] = nullptr;
+            }
+            delete[] aimesh->mFaces;
+            aimesh->mFaces = nullptr;
+            for (unsigned i = 0; i < aimesh->mNumBones; i++)
+            {
+                delete[] aimesh->mBones[i]->mWeights;
+                aimesh->mBones[i]->mWeights = nullptr;
+                aimesh->mBones[i]->mNumWeights = 0;
+            }
+            aimesh->mNumVertices = 0;
+            aimesh->mNumFaces = 0;
+        }
+
+        inline double elapsedMs(LoadClock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(LoadClock::now() - start).count();
+        }
     }
 
     // Half-ugly way to dump node tree without coupling tree with node type
     namespace
     {
-        /// Dump tree node to stream
-        void dump_tree_to_stream(const VectorTree<SkeletonNode> &tree,
-                                 unsigned i,
-                                 const std::string &indent,
-                                 logstreamer_t &outstream)
+        /// Dump tree node to a log channel
+        void dump_tree_to_log(const VectorTree<SkeletonNode> &tree,
+                              unsigned i,
+                              const std::string &indent,
+                              int channel)
         {
             const auto &node = tree.nodes[i];
-            outstream << indent;
-            outstream << " [node " << i << "]";
+            std::string tags;
             if (node.bone_index != EENG_NULL_INDEX)
-                outstream << "[bone " << node.bone_index << "]";
+                tags += "[bone " + std::to_string(node.bone_index) + "]";
             if (node.nbr_meshes)
-                outstream << "[" << node.nbr_meshes << " meshes]";
-            outstream << " " << node.name
-                      << " (children " << node.m_nbr_children
-                      << ", stride " << node.m_branch_stride
-                      << ", parent ofs " << node.m_parent_ofs << ")";
-            outstream << std::endl;
+                tags += "[" + std::to_string(node.nbr_meshes) + " meshes]";
+            EENG_LOG_TO(channel, Log::Verbose, "%s [node %u]%s %s (children %i, stride %i, parent ofs %i)",
+                        indent,
+                        i,
+                        tags,
+                        node.name.c_str(),
+                        node.m_nbr_children,
+                        node.m_branch_stride,
+                        node.m_parent_ofs);
             int ci = i + 1;
             for (int j = 0; j < node.m_nbr_children; j++)
             {
-                dump_tree_to_stream(tree, ci, indent + "\t", outstream);
+                dump_tree_to_log(tree, ci, indent + "\t", channel);
                 ci += tree.nodes[ci].m_branch_stride;
             }
         }
 
-        /// Dump node tree to stream
-        void dump_tree_to_stream(const VectorTree<SkeletonNode> &tree,
-                                 logstreamer_t &&outstream)
+        /// Dump node tree to a log file
+        void dump_tree_to_log(const VectorTree<SkeletonNode> &tree,
+                              const std::string &file)
         {
+            LogFile log(file, Log::Verbose);
             int i = 0;
             while (i < tree.nodes.size())
             {
-                dump_tree_to_stream(tree, i, "", outstream);
+                dump_tree_to_log(tree, i, "", log.getChannel());
                 i += tree.nodes[i].m_branch_stride;
             }
         }
@@ -156,75 +248,169 @@ namespace eeng
         // by aiScene* once loaded).
         Assimp::Importer aiimporter;
 
-        // Prepare the logs
-        if (!append_animations)
+        // Prepare the log, which is written by the log thread and closed when loaded.
+        // Appended animations are logged to the same file.
+        LogFile logFile(filepath + filename + "_log.txt", Log::Verbose, append_animations);
+        log_channel = logFile.getChannel();
+        struct ChannelReset
         {
-            // log.add_ostream(std::cout, STRICT);
-            log.add_ofstream(filepath + filename + "_log.txt", PRTVERBOSE);
-        }
+            int &channel;
+            ~ChannelReset() { channel = Log::NoChannel; }
+        } channelReset{log_channel};
 
         // Log misc stuff
-        log << priority(PRTSTRICT) << "Assimp version: "
-            << aiGetVersionMajor() << "."
-            << aiGetVersionMinor() << "."
-            << aiGetVersionRevision() << std::endl;
-        log << priority(PRTSTRICT) << "Assimp about to open file:\n"
-            << file << std::endl;
+        EENG_LOG_TO(log_channel, Log::Info, "Assimp version: %u.%u.%u",
+                    aiGetVersionMajor(),
+                    aiGetVersionMinor(),
+                    aiGetVersionRevision());
+        EENG_LOG_TO(log_channel, Log::Info, "Assimp about to open file:\n%s", file);
         // File support
         aiString supported_list;
         aiimporter.GetExtensionList(supported_list);
-        log << priority(PRTVERBOSE) << "Assimp supported formats: \n"
-            << supported_list.C_Str() << std::endl;
+        EENG_LOG_TO(log_channel, Log::Verbose, "Assimp supported formats: \n%s", supported_list.C_Str());
         bool ext_supported = aiimporter.IsExtensionSupported(fileext);
-        log << priority(PRTVERBOSE) << "Format " << fileext << " supported: " << (ext_supported ? "YES" : "NO") << std::endl;
+        EENG_LOG_TO(log_channel, Log::Verbose, "Format %s supported: %s", fileext, ext_supported ? "YES" : "NO");
 
         // Load
+        const auto load_start = LoadClock::now();
         const aiScene *aiscene = aiimporter.ReadFile(file, aiflags);
 
         if (!aiscene)
             throw std::runtime_error(aiimporter.GetErrorString());
-        log << priority(PRTSTRICT) << "Assimp load OK\n";
+        EENG_LOG_TO(log_channel, Log::Info, "Assimp load OK");
 
         // Load animations to a previously loaded model
         if (append_animations)
         {
-            log << priority(PRTSTRICT) << "Appending animations... \n";
+            EENG_LOG_TO(log_channel, Log::Info, "Appending animations... ");
 
             if (!m_meshes.size())
                 throw std::runtime_error("Cannot append animations to an empty model\n");
 
             loadAnimations(aiscene);
+            computeAnimatedAabb();
 
-            log << priority(PRTSTRICT) << "Done appending animations.\n";
+            EENG_LOG_TO(log_channel, Log::Info, "Done appending animations.");
             return;
         }
 
+        m_load_stats = LoadStats{};
+        m_load_stats.import_ms = elapsedMs(load_start);
+
+        // The scene is owned from here, so that imported meshes can be
+        // released as soon as they are converted
+        std::unique_ptr<aiScene> owned_scene(aiimporter.GetOrphanedScene());
+        mSceneAABB = measureScene(aiscene); // Only captures bind pose.
+
+        // Threads are created for this load only, unless given
+        std::shared_ptr<ThreadPool> load_pool;
+        if (m_parallel_loading)
+            load_pool = m_load_pool ? m_load_pool : std::make_shared<ThreadPool>();
+
         glGenVertexArrays(1, &m_VAO);
-        glBindVertexArray(m_VAO);
+        GLStateCache::instance().bindVertexArray(m_VAO);
         glGenBuffers(numelem(m_Buffers), m_Buffers);
-        loadScene(aiscene, filepath);
-        glBindVertexArray(0);
+        loadScene(owned_scene.get(), filepath, load_pool.get());
+        GLStateCache::instance().bindVertexArray(0);
 
         loadNodes(aiscene->mRootNode);
-        dump_tree_to_stream(m_nodetree, logstreamer_t{filepath + filename + "_nodetree.txt", PRTVERBOSE});
+        if (Log::isActive(log_channel, Log::Verbose))
+            dump_tree_to_log(m_nodetree, filepath + filename + "_nodetree.txt");
         // m_nodetree.debug_print({filepath + filename + "_nodetree.txt", PRTVERBOSE});
 
         loadAnimations(aiscene);
+        owned_scene.reset();
 
-        mSceneAABB = measureScene(aiscene); // Only captures bind pose.
+        const auto names = StringId::getStats();
+        EENG_LOG_TO(log_channel, Log::Info, "Names: %zu nodes, %zu bones, %zu textures as %zu-byte ids, %zu interned strings (%zu bytes) in total",
+                    m_nodetree.nodes.size(),
+                    m_bones.size(),
+                    m_textures.size(),
+                    sizeof(StringId),
+                    names.nbrStrings,
+                    names.nbrBytes);
 
         // Traverse the hierarchy.
         // Animated meshes must be traversed before each frame.
         animate(-1, 0.0f);
+        computeAnimatedAabb();
+
+        m_load_stats.total_ms = elapsedMs(load_start);
+        m_load_stats.peak_rss = getPeakResidentBytes();
+        EENG_LOG_TO(log_channel, Log::Info, "Loaded in %.1f ms: import %.1f, convert %.1f (%u threads, %u batches), bounds %.1f, LODs %.1f, BVHs %.1f, materials %.1f, upload %.1f",
+                    m_load_stats.total_ms,
+                    m_load_stats.import_ms,
+                    m_load_stats.convert_ms,
+                    m_load_stats.nbr_threads,
+                    m_load_stats.nbr_batches,
+                    m_load_stats.bounds_ms,
+                    m_load_stats.lod_ms,
+                    m_load_stats.bvh_ms,
+                    m_load_stats.materials_ms,
+                    m_load_stats.upload_ms);
+        EENG_LOG_TO(log_channel, Log::Info, "Peak resident memory %.1f MB", m_load_stats.peak_rss / (1024.0 * 1024.0));
+    }
+
+    void RenderableMesh::setParallelLoading(bool parallel)
+    {
+        m_parallel_loading = parallel;
+    }
+
+    bool RenderableMesh::getParallelLoading() const
+    {
+        return m_parallel_loading;
+    }
+
+    void RenderableMesh::setStreamingImport(bool streaming)
+    {
+        m_streaming_import = streaming;
+    }
+
+    bool RenderableMesh::getStreamingImport() const
+    {
+        return m_streaming_import;
+    }
+
+    void RenderableMesh::setVertexWelding(VertexWelding welding)
+    {
+        m_vertex_welding = welding;
+    }
+
+    VertexWelding RenderableMesh::getVertexWelding() const
+    {
+        return m_vertex_welding;
+    }
+
+    void RenderableMesh::setLodGeneration(bool generate)
+    {
+        m_lod_generation = generate;
     }
 
-    void RenderableMesh::removeTranslationKeys(const std::string &node_name)
+    bool RenderableMesh::getLodGeneration() const
+    {
+        return m_lod_generation;
+    }
+
+    void RenderableMesh::setLoadThreadPool(std::shared_ptr<ThreadPool> threadPool)
+    {
+        m_load_pool = std::move(threadPool);
+    }
+
+    const RenderableMesh::LoadStats &RenderableMesh::getLoadStats() const
+    {
+        return m_load_stats;
+    }
+
+    void RenderableMesh::removeTranslationKeys(StringId node_name)
     {
         removeTranslationKeys(m_nodetree.find_node_index(node_name));
     }
 
     void RenderableMesh::removeTranslationKeys(int node_index)
     {
+        // Keys of the current pose may change
+        m_pose_evaluated = false;
+
         for (auto &anim : m_animations)
         {
             EENG_ASSERT(node_index <= anim.node_animations.size(), "{0} is not a valid node index", node_index);
@@ -232,9 +418,262 @@ namespace eeng
             for (auto &pk : pos_keys)
                 pk = {0, pk.y, 0};
         }
+        computeAnimatedAabb();
+    }
+
+    void RenderableMesh::computeAnimatedAabb()
+    {
+        const PoseKey pose = m_pose;
+        const bool pose_evaluated = m_pose_evaluated;
+        const HierarchyStats hierarchy_stats = m_hierarchy_stats;
+
+        m_animated_aabb = mSceneAABB ? mSceneAABB : m_model_aabb;
+        for (int i = 0; i < (int)m_animations.size(); i++)
+        {
+            // Keys are evenly spaced over a clip, so poses are sampled as
+            // densely as the keys of the node with the most keys
+            size_t nbr_samples = 1;
+            for (const auto &keys : m_animations[i].node_animations)
+                if (keys.is_used)
+                    nbr_samples = std::max({nbr_samples, keys.pos_keys.size(), keys.rot_keys.size(), keys.scale_keys.size()});
+            for (size_t j = 0; j < nbr_samples; j++)
+            {
+                animate(i, nbr_samples > 1 ? (float)j / (nbr_samples - 1) : 0.0f, AnmationTimeFormat::NormalizedTime);
+                if (m_model_aabb)
+                    m_animated_aabb.grow(m_model_aabb);
+            }
+        }
+
+        // Back to the previous pose
+        if (pose_evaluated)
+            animate(pose.anim_index, pose.time, pose.time_format);
+        m_pose_evaluated = pose_evaluated;
+        m_hierarchy_stats = hierarchy_stats;
+    }
+
+    void RenderableMesh::buildRaycastBvhs(const std::vector<glm::vec3> &scene_positions,
+                                          const std::vector<unsigned> &scene_indices,
+                                          const std::vector<SkinData> &scene_skindata)
+    {
+        m_mesh_bvhs.assign(m_meshes.size(), TriangleBvh{});
+        m_bone_bvhs.assign(m_bones.size(), TriangleBvh{});
+
+        // Triangle vertices and ids (triangle numbers in the index buffer) per bone
+        std::vector<std::vector<glm::vec3>> bone_vertices(m_bones.size());
+        std::vector<std::vector<unsigned>> bone_triangles(m_bones.size());
+
+        unsigned nbr_nodes = 0;
+        for (int i = 0; i < m_meshes.size(); i++)
+        {
+            const auto &mesh = m_meshes[i];
+            const unsigned first_triangle = mesh.base_index / 3;
+            const unsigned nbr_triangles = mesh.nbr_indices / 3;
+            if (!mesh.is_skinned)
+            {
+                std::vector<glm::vec3> vertices;
+                std::vector<unsigned> triangles;
+                vertices.reserve(mesh.nbr_indices);
+                triangles.reserve(nbr_triangles);
+                for (unsigned j = 0; j < nbr_triangles; j++)
+                {
+                    for (unsigned k = 0; k < 3; k++)
+                        vertices.push_back(scene_positions[mesh.base_vertex + scene_indices[mesh.base_index + 3 * j + k]]);
+                    triangles.push_back(first_triangle + j);
+                }
+                m_mesh_bvhs[i].build(vertices, triangles);
+                nbr_nodes += m_mesh_bvhs[i].getNbrNodes();
+                continue;
+            }
+
+            // Triangles go to the bone with the largest total weight of their vertices
+            for (unsigned j = 0; j < nbr_triangles; j++)
+            {
+                unsigned vertex_indices[3];
+                for (unsigned k = 0; k < 3; k++)
+                    vertex_indices[k] = mesh.base_vertex + scene_indices[mesh.base_index + 3 * j + k];
+
+                int bone = EENG_NULL_INDEX;
+                float bone_weight = 0.0f;
+                for (unsigned k = 0; k < 3; k++)
+                {
+                    const auto &skindata = scene_skindata[vertex_indices[k]];
+                    for (int b = 0; b < NUM_BONES_PER_VERTEX; b++)
+                    {
+                        if (skindata.bone_weights[b] <= 0.0f)
+                            continue;
+                        float weight = 0.0f;
+                        for (unsigned l = 0; l < 3; l++)
+                        {
+                            const auto &other = scene_skindata[vertex_indices[l]];
+                            for (int c = 0; c < NUM_BONES_PER_VERTEX; c++)
+                                if (other.bone_indices[c] == skindata.bone_indices[b])
+                                    weight += other.bone_weights[c];
+                        }
+                        if (weight > bone_weight)
+                        {
+                            bone_weight = weight;
+                            bone = skindata.bone_indices[b];
+                        }
+                    }
+                }
+                if (bone == EENG_NULL_INDEX)
+                    continue;
+
+                // Bone pose AABBs then bound the triangles moved with the bone
+                for (unsigned k = 0; k < 3; k++)
+                {
+                    bone_vertices[bone].push_back(scene_positions[vertex_indices[k]]);
+                    m_bone_aabbs_bind[bone].grow(scene_positions[vertex_indices[k]]);
+                }
+                bone_triangles[bone].push_back(first_triangle + j);
+            }
+        }
+
+        for (int i = 0; i < m_bones.size(); i++)
+        {
+            m_bone_bvhs[i].build(bone_vertices[i], bone_triangles[i]);
+            nbr_nodes += m_bone_bvhs[i].getNbrNodes();
+        }
+
+        EENG_LOG_TO(log_channel, Log::Info, "Raycast BVH nodes %zu", nbr_nodes);
+    }
+
+    bool RenderableMesh::raycast(const glm::vec3 &origin,
+                                 const glm::vec3 &direction,
+                                 MeshHit &hit) const
+    {
+        const glm::vec3 invDirection = 1.0f / direction;
+        auto intersectBox = [&](const AABB &aabb)
+        {
+            const glm::vec3 t0 = (aabb.min - origin) * invDirection;
+            const glm::vec3 t1 = (aabb.max - origin) * invDirection;
+            const glm::vec3 tmin = glm::min(t0, t1), tmax = glm::max(t0, t1);
+            const float tnear = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+            const float tfar = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, hit.t));
+            return tnear <= tfar ? tnear : -1.0f;
+        };
+
+        // Static meshes and bones whose pose bounds are hit
+        struct Candidate
+        {
+            float t;
+            int mesh, bone;
+        };
+        std::vector<Candidate> candidates;
+        for (int i = 0; i < m_mesh_bvhs.size(); i++)
+        {
+            if (m_mesh_bvhs[i].empty())
+                continue;
+            const float t = intersectBox(m_mesh_aabbs_pose[i]);
+            if (t >= 0.0f)
+                candidates.push_back({t, i, EENG_NULL_INDEX});
+        }
+        for (int i = 0; i < m_bone_bvhs.size(); i++)
+        {
+            if (m_bone_bvhs[i].empty())
+                continue;
+            const float t = intersectBox(m_bone_aabbs_pose[i]);
+            if (t >= 0.0f)
+                candidates.push_back({t, EENG_NULL_INDEX, i});
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+                  { return a.t < b.t; });
+
+        bool is_hit = false;
+        for (const auto &candidate : candidates)
+        {
+            if (candidate.t >= hit.t)
+                break;
+
+            // Move the ray into the space of the triangles. Ray parameters are
+            // the same in both spaces, since the direction is not normalized.
+            const TriangleBvh *bvh;
+            glm::mat4 M{1.0f};
+            if (candidate.bone != EENG_NULL_INDEX)
+            {
+                bvh = &m_bone_bvhs[candidate.bone];
+                M = boneMatrices[candidate.bone];
+            }
+            else
+            {
+                bvh = &m_mesh_bvhs[candidate.mesh];
+                if (m_meshes[candidate.mesh].node_index > EENG_NULL_INDEX)
+                    M = m_nodetree.nodes[m_meshes[candidate.mesh].node_index].global_tfm;
+            }
+            const glm::mat4 invM = glm::inverse(M);
+
+            TriangleHit triangle_hit{hit.t};
+            if (!bvh->raycast(glm::vec3(invM * glm::vec4(origin, 1.0f)),
+                              glm::vec3(invM * glm::vec4(direction, 0.0f)),
+                              triangle_hit))
+                continue;
+
+            hit.t = triangle_hit.t;
+            hit.triangle = triangle_hit.id;
+            hit.u = triangle_hit.u;
+            hit.v = triangle_hit.v;
+            hit.bone = candidate.bone;
+            hit.mesh = candidate.mesh;
+            if (hit.mesh == EENG_NULL_INDEX)
+            {
+                // Submeshes are ordered by their full detail index ranges
+                const auto mesh = std::upper_bound(m_meshes.begin(), m_meshes.end(), 3 * hit.triangle, [](unsigned index, const Submesh &mesh)
+                                                   { return index < mesh.base_index; });
+                hit.mesh = (int)(mesh - m_meshes.begin()) - 1;
+            }
+            is_hit = true;
+        }
+        return is_hit;
+    }
+
+    void RenderableMesh::generateLods(const std::vector<glm::vec3> &scene_positions,
+                                      std::vector<unsigned> &scene_indices)
+    {
+        // Largest errors of the levels, relative to the size of the submesh
+        const float lod_errors[] = {0.005f, 0.01f, 0.02f};
+
+        unsigned nbr_lod_indices = 0;
+        for (auto &mesh : m_meshes)
+        {
+            if (!mesh.nbr_vertices || !mesh.nbr_indices)
+                continue;
+            const glm::vec3 *positions = &scene_positions[mesh.base_vertex];
+
+            AABB aabb;
+            for (unsigned i = 0; i < mesh.nbr_vertices; i++)
+                aabb.grow(positions[i]);
+            const float size = glm::length(aabb.max - aabb.min);
+
+            std::vector<float> max_errors;
+            for (float lod_error : lod_errors)
+                max_errors.push_back(lod_error * size);
+            const auto levels = MeshSimplifier::simplifyLevels(positions,
+                                                               mesh.nbr_vertices,
+                                                               &scene_indices[mesh.base_index],
+                                                               mesh.nbr_indices,
+                                                               max_errors);
+            for (const auto &level : levels)
+            {
+                mesh.lods.push_back({(unsigned)scene_indices.size(), (unsigned)level.indices.size(), level.error});
+                scene_indices.insert(scene_indices.end(), level.indices.begin(), level.indices.end());
+                nbr_lod_indices += (unsigned)level.indices.size();
+            }
+
+            if (Log::isActive(log_channel, Log::Verbose))
+            {
+                std::string triangles = std::to_string(mesh.nbr_indices / 3);
+                for (auto &lod : mesh.lods)
+                    triangles += ", " + std::to_string(lod.nbr_indices / 3);
+                EENG_LOG_TO(log_channel, Log::Verbose, "LOD triangles %s", triangles);
+            }
+        }
+
+        EENG_LOG_TO(log_channel, Log::Info, "LOD triangles in total %u", nbr_lod_indices / 3);
     }
 
-    bool RenderableMesh::loadScene(const aiScene *aiscene, const std::string &filename)
+    bool RenderableMesh::loadScene(aiScene *aiscene,
+                                   const std::string &filename,
+                                   ThreadPool *threadPool)
     {
         unsigned scene_nbr_meshes = aiscene->mNumMeshes;
         unsigned scene_nbr_mtl = aiscene->mNumMaterials;
@@ -242,24 +681,23 @@ namespace eeng
         unsigned scene_nbr_indices = 0;
 
         // Print some debug info
-        log << priority(PRTSTRICT) << "Scene overview" << std::endl;
-        log << "\t" << scene_nbr_meshes << " meshes" << std::endl;
-        log << "\t" << scene_nbr_mtl << " materials" << std::endl;
-        log << "\t" << aiscene->mNumTextures << " embedded textures" << std::endl;
-        log << "\t" << aiscene->mNumAnimations << " animations" << std::endl;
-        log << "\t" << aiscene->mNumLights << " lights" << std::endl;
-        log << "\t" << aiscene->mNumCameras << " cameras" << std::endl;
+        EENG_LOG_TO(log_channel, Log::Info, "Scene overview\n\t%u meshes\n\t%u materials\n\t%u embedded textures\n\t%u animations\n\t%u lights\n\t%u cameras",
+                    scene_nbr_meshes,
+                    scene_nbr_mtl,
+                    aiscene->mNumTextures,
+                    aiscene->mNumAnimations,
+                    aiscene->mNumLights,
+                    aiscene->mNumCameras);
         // Animations
-        log << "Animations:\n";
+        EENG_LOG_TO(log_channel, Log::Info, "Animations:");
         for (int i = 0; i < aiscene->mNumAnimations; i++)
         {
             aiAnimation *anim = aiscene->mAnimations[i];
-            log
-                << "\t" << anim->mName.C_Str()
-                << ", channels " << anim->mNumChannels
-                << ", duration in ticks " << anim->mDuration
-                << ", tps " << anim->mTicksPerSecond
-                << std::endl;
+            EENG_LOG_TO(log_channel, Log::Info, "\t%s, channels %u, duration in ticks %g, tps %g",
+                        anim->mName.C_Str(),
+                        anim->mNumChannels,
+                        anim->mDuration,
+                        anim->mTicksPerSecond);
         }
         // Throw errors for cases which are not yet supported
         if (!aiscene->HasMeshes())
@@ -270,14 +708,6 @@ namespace eeng
         m_meshes.resize(scene_nbr_meshes);
         m_materials.resize(scene_nbr_mtl);
 
-        std::vector<glm::vec3> scene_positions;
-        std::vector<glm::vec3> scene_normals;
-        std::vector<glm::vec3> scene_tangents;
-        std::vector<glm::vec3> scene_binormals;
-        std::vector<glm::vec2> scene_texcoords;
-        std::vector<SkinData> scene_skinweights;
-        std::vector<uint> scene_indices;
-
         // Count vertices and indices of the whole scene
         for (unsigned i = 0; i < m_meshes.size(); i++)
         {
@@ -288,177 +718,490 @@ namespace eeng
 
             m_meshes[i].base_index = scene_nbr_indices;
             m_meshes[i].nbr_indices = mesh_nbr_indices;
-            m_meshes[i].base_vertex = scene_nbr_vertices;
             m_meshes[i].nbr_vertices = mesh_nbr_vertices;
             m_meshes[i].mtl_index = mesh_mtl_index;
             m_meshes[i].is_skinned = (bool)mesh_nbr_bones;
             // m_meshes[i].node_index <- set while loading node tree
+            // m_meshes[i].base_vertex <- set once vertices are welded
 
             scene_nbr_vertices += mesh_nbr_vertices;
             scene_nbr_indices += mesh_nbr_indices;
         }
+        const unsigned scene_nbr_imported_vertices = scene_nbr_vertices;
 
-        // Reserve space in the vectors for the vertex attributes and indices
-        scene_positions.reserve(scene_nbr_vertices);
-        scene_normals.reserve(scene_nbr_vertices);
-        scene_tangents.reserve(scene_nbr_vertices);
-        scene_binormals.reserve(scene_nbr_vertices);
-        scene_texcoords.reserve(scene_nbr_vertices);
-        scene_skinweights.resize(scene_nbr_vertices);
-        scene_indices.reserve(scene_nbr_indices);
-
-        // Initialize the meshes in the scene one by one
+        // Bones are created serially, in the order of the submeshes and of
+        // their bones, so that bone indices do not depend on threading
+        auto phase_start = LoadClock::now();
+        std::vector<std::vector<unsigned>> mesh_bone_indices(m_meshes.size());
+        for (uint i = 0; i < m_meshes.size(); i++)
+            createBones(aiscene->mMeshes[i], mesh_bone_indices[i]);
+
+        // Vertex data used on the CPU once converted: positions and indices
+        // of all models (LODs, bounds, BVHs, occluders), all streams of
+        // skinned models (CPU skinning)
+        const bool skinned = m_bones.size();
+
+        // Optimization: streams that the material of each submesh does not
+        // use are dropped, and duplicate vertices welded, before vertices
+        // are laid out
+        std::vector<MeshStreams> mesh_streams(m_meshes.size());
+        bool any_texcoords = false, any_tangent_frame = false;
         for (uint i = 0; i < m_meshes.size(); i++)
         {
-            const aiMesh *paiMesh = aiscene->mMeshes[i];
-            loadMesh(i,
-                     paiMesh,
-                     scene_positions,
-                     scene_normals,
-                     scene_tangents,
-                     scene_binormals,
-                     scene_texcoords,
-                     scene_skinweights,
-                     scene_indices);
+            const aiMesh *aimesh = aiscene->mMeshes[i];
+            if (aimesh->mMaterialIndex < scene_nbr_mtl)
+                mesh_streams[i] = getMaterialStreams(aiscene->mMaterials[aimesh->mMaterialIndex]);
+            mesh_streams[i].texcoords &= aimesh->HasTextureCoords(0);
+            mesh_streams[i].tangent_frame &= aimesh->HasTangentsAndBitangents();
+            any_texcoords |= mesh_streams[i].texcoords;
+            any_tangent_frame |= mesh_streams[i].tangent_frame;
         }
 
-        log << priority(PRTSTRICT);
-        log << "Scene total vertices " << scene_nbr_vertices << ", triangles " << scene_nbr_indices / 3 << std::endl;
-        log << "Bone mapping contains " << m_bonehash.size() << " bones in total\n";
+        std::vector<MeshWeld> mesh_welds(m_meshes.size());
+        if (m_vertex_welding != VertexWelding::Off)
+        {
+            auto weld_meshes = [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; i++)
+                    weldMesh(aiscene->mMeshes[i], mesh_bone_indices[i], mesh_streams[i], mesh_welds[i]);
+            };
+            if (threadPool)
+                threadPool->parallelFor(0, m_meshes.size(), 1, weld_meshes);
+            else
+                weld_meshes(0, m_meshes.size());
+        }
 
-#if 1
-        // Model & bone AABB's
-        boneMatrices.resize(m_bones.size());
-        m_bone_aabbs_bind.resize(m_bones.size()); // Constructor resets AABB
-        m_bone_aabbs_pose.resize(m_bones.size());
+        scene_nbr_vertices = 0;
+        for (uint i = 0; i < m_meshes.size(); i++)
+        {
+            if (mesh_welds[i].vertices.size())
+                m_meshes[i].nbr_vertices = (unsigned)mesh_welds[i].vertices.size();
+            m_meshes[i].base_vertex = scene_nbr_vertices;
+            scene_nbr_vertices += m_meshes[i].nbr_vertices;
+        }
 
-        m_mesh_aabbs_bind.resize(m_meshes.size());
-        m_mesh_aabbs_pose.resize(m_meshes.size());
+        // Load GL buffers
+#define POSITION_LOCATION 0
+#define TEXCOORD_LOCATION 1
+#define NORMAL_LOCATION 2
+#define TANGENT_LOCATION 3
+#define BINORMAL_LOCATION 4
+#define BONE_INDEX_LOCATION 5
+#define BONE_WEIGHT_LOCATION 6
 
-        for (int i = 0; i < m_meshes.size(); i++)
+        // Vertex buffers with the size of their vertices, and their data in arrays
+        // and whether any submesh uses them. Unused buffers are deleted.
+        struct VertexStream
         {
-            const auto &mesh = m_meshes[i];
-            if (mesh.is_skinned)
+            int buffer;
+            size_t vertex_size;
+            const void *(*data)(const VertexArrays &arrays);
+            bool used;
+        };
+        const VertexStream vertex_streams[] = {
+            {PositionBuffer, sizeof(glm::vec3), [](const VertexArrays &arrays) -> const void * { return arrays.positions.data(); }, true},
+            {TexturecoordBuffer, sizeof(glm::vec2), [](const VertexArrays &arrays) -> const void * { return arrays.texcoords.data(); }, any_texcoords},
+            {NormalBuffer, sizeof(glm::vec3), [](const VertexArrays &arrays) -> const void * { return arrays.normals.data(); }, true},
+            {TangentBuffer, sizeof(glm::vec3), [](const VertexArrays &arrays) -> const void * { return arrays.tangents.data(); }, any_tangent_frame},
+            {BinormalBuffer, sizeof(glm::vec3), [](const VertexArrays &arrays) -> const void * { return arrays.binormals.data(); }, any_tangent_frame},
+            {BoneBuffer, sizeof(SkinData), [](const VertexArrays &arrays) -> const void * { return arrays.skindata.data(); }, skinned}};
+        std::string skipped_streams;
+        for (const auto &stream : vertex_streams)
+        {
+            m_load_stats.imported_vertex_bytes += stream.vertex_size * scene_nbr_imported_vertices;
+            if (stream.used)
+                m_load_stats.vertex_bytes += stream.vertex_size * scene_nbr_vertices;
+            else
+            {
+                glDeleteBuffers(1, &m_Buffers[stream.buffer]);
+                m_Buffers[stream.buffer] = 0;
+                skipped_streams += std::string(skipped_streams.size() ? ", " : "") + getBufferName(stream.buffer);
+            }
+        }
+
+        // Convert a range of submeshes into arrays holding them, concurrently
+        auto load_meshes = [&](uint begin, uint end, VertexArrays &arrays)
+        {
+            auto load_range = [&](size_t range_begin, size_t range_end)
             {
-                // bones
-                for (int j = mesh.base_vertex; j < mesh.base_vertex + mesh.nbr_vertices; j++)
+                for (size_t i = range_begin; i < range_end; i++)
                 {
-                    for (int k = 0; k < NUM_BONES_PER_VERTEX; k++)
+                    loadMesh(m_meshes[i], aiscene->mMeshes[i], mesh_bone_indices[i], mesh_streams[i], mesh_welds[i], arrays);
+                    if (m_streaming_import)
                     {
-                        if (scene_skinweights[j].bone_weights[k] > 0)
-                            m_bone_aabbs_bind[scene_skinweights[j].bone_indices[k]].grow(scene_positions[j]);
+                        releaseMeshData(aiscene->mMeshes[i]);
+                        mesh_welds[i] = MeshWeld{};
                     }
                 }
+            };
+            if (threadPool)
+                threadPool->parallelFor(begin, end, 1, load_range);
+            else
+                load_range(begin, end);
+        };
+
+        VertexArrays scene;
+        unsigned nbr_batches = 1;
+        if (!m_streaming_import)
+        {
+            // All submeshes are converted into arrays for the whole scene
+            scene.reset(0, scene_nbr_vertices, 0, scene_nbr_indices);
+            load_meshes(0, (uint)m_meshes.size(), scene);
+        }
+        else
+        {
+            // Vertex buffers are allocated up front and filled batch by batch.
+            // Only the arrays used on the CPU are kept for the whole scene.
+            scene.positions.resize(scene_nbr_vertices);
+            scene.indices.resize(scene_nbr_indices);
+            if (skinned)
+            {
+                scene.normals.resize(scene_nbr_vertices);
+                scene.tangents.resize(scene_nbr_vertices);
+                scene.binormals.resize(scene_nbr_vertices);
+                scene.skindata.resize(scene_nbr_vertices);
+            }
+            for (const auto &stream : vertex_streams)
+            {
+                if (!stream.used)
+                    continue;
+                glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[stream.buffer]);
+                glBufferData(GL_ARRAY_BUFFER, stream.vertex_size * scene_nbr_vertices, nullptr, GL_STATIC_DRAW);
             }
-            else // if ( m_meshes[i].node_index != EENG_NULL_INDEX )
+
+            VertexArrays batch;
+            nbr_batches = 0;
+            for (uint begin = 0, end = 0; begin < m_meshes.size(); begin = end, nbr_batches++)
             {
-                for (int j = mesh.base_vertex; j < mesh.base_vertex + mesh.nbr_vertices; j++)
-                    m_mesh_aabbs_bind[i].grow(scene_positions[j]);
+                // Whole submeshes, up to the size of a batch unless a single one is larger
+                unsigned nbr_vertices = m_meshes[begin].nbr_vertices;
+                for (end = begin + 1; end < m_meshes.size() && nbr_vertices + m_meshes[end].nbr_vertices <= StreamingBatchVertices; end++)
+                    nbr_vertices += m_meshes[end].nbr_vertices;
+                const auto &last = m_meshes[end - 1];
+                const unsigned first_vertex = m_meshes[begin].base_vertex;
+                const unsigned first_index = m_meshes[begin].base_index;
+                const unsigned nbr_indices = last.base_index + last.nbr_indices - first_index;
+
+                batch.reset(first_vertex, nbr_vertices, first_index, nbr_indices);
+                load_meshes(begin, end, batch);
+
+                for (const auto &stream : vertex_streams)
+                {
+                    if (!stream.used)
+                        continue;
+                    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[stream.buffer]);
+                    glBufferSubData(GL_ARRAY_BUFFER, stream.vertex_size * first_vertex, stream.vertex_size * nbr_vertices, stream.data(batch));
+                }
+
+                std::copy(batch.positions.begin(), batch.positions.end(), scene.positions.begin() + first_vertex);
+                std::copy(batch.indices.begin(), batch.indices.end(), scene.indices.begin() + first_index);
+                if (skinned)
+                {
+                    std::copy(batch.normals.begin(), batch.normals.end(), scene.normals.begin() + first_vertex);
+                    std::copy(batch.tangents.begin(), batch.tangents.end(), scene.tangents.begin() + first_vertex);
+                    std::copy(batch.binormals.begin(), batch.binormals.end(), scene.binormals.begin() + first_vertex);
+                    std::copy(batch.skindata.begin(), batch.skindata.end(), scene.skindata.begin() + first_vertex);
+                }
             }
         }
+        m_load_stats.convert_ms = elapsedMs(phase_start);
+        m_load_stats.nbr_threads = threadPool ? threadPool->getNbrThreads() + 1 : 1;
+        m_load_stats.nbr_batches = nbr_batches;
+        m_load_stats.nbr_meshes = (unsigned)m_meshes.size();
+        m_load_stats.nbr_vertices = scene_nbr_vertices;
+        m_load_stats.nbr_imported_vertices = scene_nbr_imported_vertices;
+        m_load_stats.nbr_triangles = scene_nbr_indices / 3;
+
+        EENG_LOG_TO(log_channel, Log::Info, "Scene total vertices %u, triangles %u", scene_nbr_vertices, scene_nbr_indices / 3);
+        EENG_LOG_TO(log_channel, Log::Info, "Vertices welded %u -> %u, vertex buffers %.2f -> %.2f MB, skipped streams: %s",
+                    scene_nbr_imported_vertices,
+                    scene_nbr_vertices,
+                    m_load_stats.imported_vertex_bytes / (1024.0 * 1024.0),
+                    m_load_stats.vertex_bytes / (1024.0 * 1024.0),
+                    skipped_streams.size() ? skipped_streams : std::string("none"));
+        EENG_LOG_TO(log_channel, Log::Info, "Bone mapping contains %zu bones in total", m_bonehash.size());
+
+        // Simplified index ranges, appended after the full detail indices
+        phase_start = LoadClock::now();
+        if (m_lod_generation)
+            generateLods(scene.positions, scene.indices);
+        m_load_stats.lod_ms = elapsedMs(phase_start);
 
-#endif
+        // Model & bone AABB's
+        phase_start = LoadClock::now();
+        computeBindAabbs(scene.positions, scene.skindata, threadPool);
+        m_load_stats.bounds_ms = elapsedMs(phase_start);
+
+        phase_start = LoadClock::now();
+        buildRaycastBvhs(scene.positions, scene.indices, scene.skindata);
+        m_load_stats.bvh_ms = elapsedMs(phase_start);
+
+        phase_start = LoadClock::now();
         loadMaterials(aiscene, filename);
+        m_load_stats.materials_ms = elapsedMs(phase_start);
+        phase_start = LoadClock::now();
 
-        // Load GL buffers
-#define POSITION_LOCATION 0
-#define TEXCOORD_LOCATION 1
-#define NORMAL_LOCATION 2
-#define TANGENT_LOCATION 3
-#define BINORMAL_LOCATION 4
-#define BONE_INDEX_LOCATION 5
-#define BONE_WEIGHT_LOCATION 6
+        // Populate the vertex buffers, unless streamed, and the index
+        // buffer, which holds LODs too
+        for (const auto &stream : vertex_streams)
+        {
+            if (!stream.used)
+                continue;
+            glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[stream.buffer]);
+            if (!m_streaming_import)
+                glBufferData(GL_ARRAY_BUFFER, stream.vertex_size * scene_nbr_vertices, stream.data(scene), GL_STATIC_DRAW);
 
-        // Generate and populate the buffers with vertex attributes and the indices
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[PositionBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_positions[0]) * scene_positions.size(), &scene_positions[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(POSITION_LOCATION);
-        glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[TexturecoordBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_texcoords[0]) * scene_texcoords.size(), &scene_texcoords[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(TEXCOORD_LOCATION);
-        glVertexAttribPointer(TEXCOORD_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[NormalBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_normals[0]) * scene_normals.size(), &scene_normals[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(NORMAL_LOCATION);
-        glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[TangentBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_tangents[0]) * scene_tangents.size(), &scene_tangents[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(TANGENT_LOCATION);
-        glVertexAttribPointer(TANGENT_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[BinormalBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_binormals[0]) * scene_binormals.size(), &scene_binormals[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(BINORMAL_LOCATION);
-        glVertexAttribPointer(BINORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[BoneBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_skinweights[0]) * scene_skinweights.size(), &scene_skinweights[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(BONE_INDEX_LOCATION);
-        glVertexAttribIPointer(BONE_INDEX_LOCATION, 4, GL_UNSIGNED_INT, sizeof(SkinData), (const GLvoid *)0);
-        glEnableVertexAttribArray(BONE_WEIGHT_LOCATION);
-        glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(SkinData), (const GLvoid *)16);
+            switch (stream.buffer)
+            {
+            case PositionBuffer:
+                glEnableVertexAttribArray(POSITION_LOCATION);
+                glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+                break;
+            case TexturecoordBuffer:
+                glEnableVertexAttribArray(TEXCOORD_LOCATION);
+                glVertexAttribPointer(TEXCOORD_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, 0);
+                break;
+            case NormalBuffer:
+                glEnableVertexAttribArray(NORMAL_LOCATION);
+                glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+                break;
+            case TangentBuffer:
+                glEnableVertexAttribArray(TANGENT_LOCATION);
+                glVertexAttribPointer(TANGENT_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+                break;
+            case BinormalBuffer:
+                glEnableVertexAttribArray(BINORMAL_LOCATION);
+                glVertexAttribPointer(BINORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+                break;
+            case BoneBuffer:
+                glEnableVertexAttribArray(BONE_INDEX_LOCATION);
+                glVertexAttribIPointer(BONE_INDEX_LOCATION, 4, GL_UNSIGNED_INT, sizeof(SkinData), (const GLvoid *)0);
+                glEnableVertexAttribArray(BONE_WEIGHT_LOCATION);
+                glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(SkinData), (const GLvoid *)16);
+                break;
+            }
+        }
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[IndexBuffer]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(scene_indices[0]) * scene_indices.size(), &scene_indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(scene.indices[0]) * scene.indices.size(), &scene.indices[0], GL_STATIC_DRAW);
 
         CheckAndThrowGLErrors();
+        m_load_stats.upload_ms = elapsedMs(phase_start);
+
+        // Keep vertex data used on the CPU
+        m_bind_positions = std::move(scene.positions);
+        m_indices = std::move(scene.indices);
+        if (skinned)
+        {
+            m_bind_normals = std::move(scene.normals);
+            m_bind_tangents = std::move(scene.tangents);
+            m_bind_binormals = std::move(scene.binormals);
+            m_bind_skindata = std::move(scene.skindata);
+        }
+
         return true;
     }
 
-    void RenderableMesh::loadMesh(uint meshindex,
-                                  const aiMesh *aimesh,
-                                  std::vector<glm::vec3> &scene_positions,
-                                  std::vector<glm::vec3> &scene_normals,
-                                  std::vector<glm::vec3> &scene_tangents,
-                                  std::vector<glm::vec3> &scene_binormals,
-                                  std::vector<glm::vec2> &scene_texcoords,
-                                  std::vector<SkinData> &scene_skindata,
-                                  std::vector<unsigned int> &scene_indices)
+    void RenderableMesh::VertexArrays::reset(unsigned first_vertex,
+                                             unsigned nbr_vertices,
+                                             unsigned first_index,
+                                             unsigned nbr_indices)
     {
-        log << priority(PRTVERBOSE);
-        log << "Loading mesh " << aimesh->mName.C_Str() << std::endl;
-        log << "\t" << aimesh->mNumVertices << " vertices" << std::endl;
-        log << "\t" << aimesh->mNumFaces << " faces" << std::endl;
-        log << "\t" << aimesh->mNumBones << " bones" << std::endl;
-        log << "\t" << aimesh->mNumAnimMeshes << " anim-meshes*" << std::endl;
-        // std::cout << "\t" << paiMesh->mNumUVComponents << " UV components" << std::endl;
-        log << "\thas tangents and bitangents: " << (aimesh->HasTangentsAndBitangents() ? "YES" : "NO") << std::endl;
-        log << "\thas vertex colors: " << (aimesh->HasVertexColors(0) ? "YES" : "NO") << std::endl;
+        this->first_vertex = first_vertex;
+        this->first_index = first_index;
+        positions.assign(nbr_vertices, glm::vec3{0.0f});
+        normals.assign(nbr_vertices, glm::vec3{0.0f});
+        tangents.assign(nbr_vertices, glm::vec3{0.0f});
+        binormals.assign(nbr_vertices, glm::vec3{0.0f});
+        texcoords.assign(nbr_vertices, glm::vec2{0.0f});
+        skindata.assign(nbr_vertices, SkinData{});
+        indices.assign(nbr_indices, 0);
+    }
 
-        // Populate the vertex attribute vectors
+    RenderableMesh::MeshStreams RenderableMesh::getMaterialStreams(const aiMaterial *material)
+    {
+        MeshStreams streams;
+        const bool normal_map = material->GetTextureCount(aiTextureType_NORMALS) ||
+                                material->GetTextureCount(aiTextureType_HEIGHT); // OBJ normal maps, see loadMaterials
+        streams.tangent_frame = normal_map;
+        streams.texcoords = normal_map ||
+                            material->GetTextureCount(aiTextureType_DIFFUSE) ||
+                            material->GetTextureCount(aiTextureType_SPECULAR) ||
+                            material->GetTextureCount(aiTextureType_OPACITY);
+        return streams;
+    }
+
+    void RenderableMesh::weldMesh(const aiMesh *aimesh,
+                                  const std::vector<unsigned> &bone_indices,
+                                  const MeshStreams &streams,
+                                  MeshWeld &weld) const
+    {
+        const unsigned nbr_vertices = aimesh->mNumVertices;
+        const bool quantized = m_vertex_welding == VertexWelding::Quantized;
+
+        // Skin data is compared along with the other attributes
+        std::vector<SkinData> skindata(aimesh->mNumBones ? nbr_vertices : 0);
+        for (uint i = 0; i < aimesh->mNumBones; i++)
+            for (uint j = 0; j < aimesh->mBones[i]->mNumWeights; j++)
+                skindata[aimesh->mBones[i]->mWeights[j].mVertexId].addWeight(bone_indices[i], aimesh->mBones[i]->mWeights[j].mWeight);
+
+        // Positions are quantized over the bounds of the submesh
+        AABB bounds;
+        if (quantized)
+            for (uint i = 0; i < nbr_vertices; i++)
+                bounds.grow(aivec_to_glmvec(aimesh->mVertices[i]));
+        const glm::vec3 extent = bounds.max - bounds.min;
+        const glm::vec3 position_scale{extent.x > 0.0f ? 65535.0f / extent.x : 0.0f,
+                                       extent.y > 0.0f ? 65535.0f / extent.y : 0.0f,
+                                       extent.z > 0.0f ? 65535.0f / extent.z : 0.0f};
+
+        std::unordered_map<WeldKey, unsigned, WeldKeyHash> welded;
+        welded.reserve(nbr_vertices);
+        weld.remap.resize(nbr_vertices);
+        weld.vertices.clear();
+        for (uint i = 0; i < nbr_vertices; i++)
+        {
+            WeldKey key{};
+            unsigned k = 0;
+            auto add = [&](float value, float scale, float offset)
+            {
+                key[k++] = quantized ? quantizeWord(value, scale, offset) : floatWord(value);
+            };
+
+            const aiVector3D &position = aimesh->mVertices[i];
+            add(position.x, position_scale.x, bounds.min.x);
+            add(position.y, position_scale.y, bounds.min.y);
+            add(position.z, position_scale.z, bounds.min.z);
+            auto addDirection = [&](const aiVector3D &v)
+            {
+                add(v.x, 1024.0f, 0.0f);
+                add(v.y, 1024.0f, 0.0f);
+                add(v.z, 1024.0f, 0.0f);
+            };
+            if (aimesh->HasNormals())
+                addDirection(aimesh->mNormals[i]);
+            if (streams.tangent_frame)
+            {
+                addDirection(aimesh->mTangents[i]);
+                addDirection(aimesh->mBitangents[i]);
+            }
+            if (streams.texcoords)
+            {
+                add(aimesh->mTextureCoords[0][i].x, 4096.0f, 0.0f);
+                add(aimesh->mTextureCoords[0][i].y, 4096.0f, 0.0f);
+            }
+            if (skindata.size())
+                for (unsigned c = 0; c < NUM_BONES_PER_VERTEX; c++)
+                {
+                    key[k++] = skindata[i].bone_indices[c];
+                    add(skindata[i].bone_weights[c], 1024.0f, 0.0f);
+                }
+
+            auto it = welded.emplace(key, (unsigned)weld.vertices.size()).first;
+            if (it->second == weld.vertices.size())
+                weld.vertices.push_back(i);
+            weld.remap[i] = it->second;
+        }
+    }
+
+    void RenderableMesh::loadMesh(const Submesh &mesh,
+                                  const aiMesh *aimesh,
+                                  const std::vector<unsigned> &bone_indices,
+                                  const MeshStreams &streams,
+                                  const MeshWeld &weld,
+                                  VertexArrays &arrays) const
+    {
+        // Populate the vertex attribute vectors, with the kept vertices if welded
         const aiVector3D v3zero(0.0f, 0.0f, 0.0f);
-        for (uint i = 0; i < aimesh->mNumVertices; i++)
+        const uint first_vertex = mesh.base_vertex - arrays.first_vertex;
+        for (uint i = 0; i < mesh.nbr_vertices; i++)
         {
-            const aiVector3D *pPos = &(aimesh->mVertices[i]);
-            const aiVector3D *pNormal = (aimesh->HasNormals() ? &(aimesh->mNormals[i]) : &v3zero);
-            const aiVector3D *pTangent = (aimesh->HasTangentsAndBitangents() ? &(aimesh->mTangents[i]) : &v3zero);
-            const aiVector3D *pBinormal = (aimesh->HasTangentsAndBitangents() ? &(aimesh->mBitangents[i]) : &v3zero);
-            const aiVector3D *pTexCoord = (aimesh->HasTextureCoords(0) ? &(aimesh->mTextureCoords[0][i]) : &v3zero);
-
-            scene_positions.push_back({pPos->x, pPos->y, pPos->z});
-            scene_normals.push_back({pNormal->x, pNormal->y, pNormal->z});
-            scene_tangents.push_back({pTangent->x, pTangent->y, pTangent->z});
-            scene_binormals.push_back({pBinormal->x, pBinormal->y, pBinormal->z});
-            scene_texcoords.push_back({pTexCoord->x, pTexCoord->y});
+            const uint v = weld.vertices.size() ? weld.vertices[i] : i;
+            const aiVector3D *pPos = &(aimesh->mVertices[v]);
+            const aiVector3D *pNormal = (aimesh->HasNormals() ? &(aimesh->mNormals[v]) : &v3zero);
+            const aiVector3D *pTangent = (streams.tangent_frame ? &(aimesh->mTangents[v]) : &v3zero);
+            const aiVector3D *pBinormal = (streams.tangent_frame ? &(aimesh->mBitangents[v]) : &v3zero);
+            const aiVector3D *pTexCoord = (streams.texcoords ? &(aimesh->mTextureCoords[0][v]) : &v3zero);
+
+            const uint vertex = first_vertex + i;
+            arrays.positions[vertex] = {pPos->x, pPos->y, pPos->z};
+            arrays.normals[vertex] = {pNormal->x, pNormal->y, pNormal->z};
+            arrays.tangents[vertex] = {pTangent->x, pTangent->y, pTangent->z};
+            arrays.binormals[vertex] = {pBinormal->x, pBinormal->y, pBinormal->z};
+            arrays.texcoords[vertex] = {pTexCoord->x, pTexCoord->y};
         }
 
-        loadBones(meshindex, aimesh, scene_skindata);
+        loadBones(mesh, aimesh, bone_indices, weld, arrays);
 
         // Populate the index buffer
+        const uint first_index = mesh.base_index - arrays.first_index;
         for (uint i = 0; i < aimesh->mNumFaces; i++)
         {
             const aiFace &Face = aimesh->mFaces[i];
             assert(Face.mNumIndices == 3);
-            scene_indices.push_back(Face.mIndices[0]);
-            scene_indices.push_back(Face.mIndices[1]);
-            scene_indices.push_back(Face.mIndices[2]);
+            const uint index = first_index + 3 * i;
+            for (uint j = 0; j < 3; j++)
+                arrays.indices[index + j] = weld.remap.size() ? weld.remap[Face.mIndices[j]] : Face.mIndices[j];
         }
     }
 
+    void RenderableMesh::computeBindAabbs(const std::vector<glm::vec3> &scene_positions,
+                                          const std::vector<SkinData> &scene_skindata,
+                                          ThreadPool *threadPool)
+    {
+        boneMatrices.resize(m_bones.size());
+        m_bone_aabbs_bind.resize(m_bones.size()); // Constructor resets AABB
+        m_bone_aabbs_pose.resize(m_bones.size());
+
+        m_mesh_aabbs_bind.resize(m_meshes.size());
+        m_mesh_aabbs_pose.resize(m_meshes.size());
+
+        // Meshes grow their own AABBs, and the AABBs of their bones in a
+        // chunk of their own, merged when the chunk is done. Merging takes
+        // minima and maxima, so the result does not depend on the order.
+        std::mutex merge_mutex;
+        auto measure_meshes = [&](size_t begin, size_t end)
+        {
+            std::vector<AABB> bone_aabbs;
+            for (size_t i = begin; i < end; i++)
+            {
+                const auto &mesh = m_meshes[i];
+                if (mesh.is_skinned)
+                {
+                    if (bone_aabbs.empty())
+                        bone_aabbs.resize(m_bones.size());
+                    for (unsigned j = mesh.base_vertex; j < mesh.base_vertex + mesh.nbr_vertices; j++)
+                    {
+                        for (int k = 0; k < NUM_BONES_PER_VERTEX; k++)
+                        {
+                            if (scene_skindata[j].bone_weights[k] > 0)
+                                bone_aabbs[scene_skindata[j].bone_indices[k]].grow(scene_positions[j]);
+                        }
+                    }
+                }
+                else
+                {
+                    for (unsigned j = mesh.base_vertex; j < mesh.base_vertex + mesh.nbr_vertices; j++)
+                        m_mesh_aabbs_bind[i].grow(scene_positions[j]);
+                }
+            }
+
+            if (bone_aabbs.empty())
+                return;
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            for (size_t i = 0; i < bone_aabbs.size(); i++)
+            {
+                // Bones without vertices in this chunk are left as they are
+                if (bone_aabbs[i].min.x <= bone_aabbs[i].max.x)
+                    m_bone_aabbs_bind[i].grow(bone_aabbs[i]);
+            }
+        };
+        if (threadPool)
+            threadPool->parallelFor(0, m_meshes.size(), 1, measure_meshes);
+        else
+            measure_meshes(0, m_meshes.size());
+    }
+
     AABB RenderableMesh::measureScene(const aiScene *aiscene)
     {
         AABB aabb;
@@ -507,17 +1250,24 @@ namespace eeng
     // Load node hierarchy and link nodes to bones & meshes
     void RenderableMesh::loadNodes(aiNode *ainode_root)
     {
-        // Load node hierarchy recursively from root
-        loadNode(ainode_root);
+        // Collect the node hierarchy in pre-order and build the tree in one pass
+        std::vector<SkeletonNode> nodes;
+        std::vector<size_t> parent_indices;
+        std::vector<aiNode *> ainodes;
+        loadNode(ainode_root, EENG_NULL_INDEX, nodes, parent_indices, ainodes);
+        if (!m_nodetree.build(std::move(nodes), parent_indices))
+            throw std::runtime_error("Node tree construction failed, hierarchy corrupt");
 
         // Link node->bone (0 or 1) and node->meshes (0+)
         // Link bones<->nodes (1<->1)
         for (int i = 0; i < m_nodetree.nodes.size(); i++)
         {
-            // Link node<->meshes (re-retrieve the original assimp node by name)
+            // Link node<->meshes
             // Note: the node transform is ignored during rendering if the mesh
             // is skinned, since it is part of the inverse-transpose matrix.
-            aiNode *ainode = ainode_root->FindNode(m_nodetree.nodes[i].name.c_str());
+            // Note: the tree keeps the pre-order of the input, so tree nodes
+            // and collected assimp nodes share indices.
+            aiNode *ainode = ainodes[i];
             for (int j = 0; j < ainode->mNumMeshes; j++)
             {
                 m_meshes[ainode->mMeshes[j]].node_index = i;
@@ -539,45 +1289,56 @@ namespace eeng
             m_nodehash[m_nodetree.nodes[i].name] = i;
     }
 
-    void RenderableMesh::loadNode(aiNode *ainode)
+    void RenderableMesh::loadNode(aiNode *ainode,
+                                  size_t parent_index,
+                                  std::vector<SkeletonNode> &nodes,
+                                  std::vector<size_t> &parent_indices,
+                                  std::vector<aiNode *> &ainodes)
     {
-        // Node data
-        std::string node_name;   //
-        std::string parent_name; //
-        glm::mat4 transform;     // Local transform = transform relative parent
         // Fetch node data from assimp
-        node_name = std::string(ainode->mName.C_Str());
-        const aiNode *parent_node = ainode->mParent;
-        parent_name = parent_node ? std::string(parent_node->mName.C_Str()) : "";
-        transform = aimat_to_glmmat(ainode->mTransformation);
+        StringId node_name(ainode->mName.C_Str());
+        glm::mat4 transform = aimat_to_glmmat(ainode->mTransformation); // Local transform = transform relative parent
 
-        // Create & insert node
-        SkeletonNode stnode(node_name, transform);
-        if (!m_nodetree.insert(stnode, parent_name))
-            throw std::runtime_error("Node tree insertion failed, hierarchy corrupt");
+        // Add node
+        const size_t node_index = nodes.size();
+        nodes.emplace_back(node_name, transform);
+        parent_indices.push_back(parent_index);
+        ainodes.push_back(ainode);
 
         for (int i = 0; i < ainode->mNumChildren; i++)
         {
-            loadNode(ainode->mChildren[i]);
+            loadNode(ainode->mChildren[i], node_index, nodes, parent_indices, ainodes);
         }
     }
 
-    void RenderableMesh::loadBones(uint mesh_index,
-                                   const aiMesh *aimesh,
-                                   std::vector<SkinData> &scene_skindata)
+    void RenderableMesh::createBones(const aiMesh *aimesh,
+                                     std::vector<unsigned> &bone_indices)
     {
-        log << priority(PRTVERBOSE) << aimesh->mNumBones << " bones (nbr weights):\n";
+        EENG_LOG_TO(log_channel, Log::Verbose, "Loading mesh %s\n\t%u vertices\n\t%u faces\n\t%u bones\n\t%u anim-meshes*",
+                    aimesh->mName.C_Str(),
+                    aimesh->mNumVertices,
+                    aimesh->mNumFaces,
+                    aimesh->mNumBones,
+                    aimesh->mNumAnimMeshes);
+        // std::cout << "\t" << paiMesh->mNumUVComponents << " UV components" << std::endl;
+        EENG_LOG_TO(log_channel, Log::Verbose, "\thas tangents and bitangents: %s\n\thas vertex colors: %s",
+                    aimesh->HasTangentsAndBitangents() ? "YES" : "NO",
+                    aimesh->HasVertexColors(0) ? "YES" : "NO");
+        EENG_LOG_TO(log_channel, Log::Verbose, "%u bones (nbr weights):", aimesh->mNumBones);
 
+        bone_indices.resize(aimesh->mNumBones);
         for (uint i = 0; i < aimesh->mNumBones; i++)
         {
             uint bone_index = 0;
 
-            std::string bone_name(aimesh->mBones[i]->mName.C_Str());
+            const char *bone_name_str = aimesh->mBones[i]->mName.C_Str();
+            StringId bone_name(bone_name_str);
 
-            log << "\t" << bone_name << " (" << aimesh->mBones[i]->mNumWeights << ")\n";
+            EENG_LOG_TO(log_channel, Log::Verbose, "\t%s (%u)", bone_name_str, aimesh->mBones[i]->mNumWeights);
 
             // Checks if bone is not yet created
-            if (m_bonehash.find(bone_name) == m_bonehash.end())
+            auto boneit = m_bonehash.find(bone_name);
+            if (boneit == m_bonehash.end())
             {
                 // Generate an index for a new bone
                 bone_index = (unsigned)m_bones.size();
@@ -590,15 +1351,34 @@ namespace eeng
             }
             else
             {
-                bone_index = m_bonehash[bone_name];
+                bone_index = boneit->second;
             }
+            bone_indices[i] = bone_index;
+        }
+    }
 
+    void RenderableMesh::loadBones(const Submesh &mesh,
+                                   const aiMesh *aimesh,
+                                   const std::vector<unsigned> &bone_indices,
+                                   const MeshWeld &weld,
+                                   VertexArrays &arrays) const
+    {
+        const uint first_vertex = mesh.base_vertex - arrays.first_vertex;
+        for (uint i = 0; i < aimesh->mNumBones; i++)
+        {
             // For all weights associated with this bone
             for (uint j = 0; j < aimesh->mBones[i]->mNumWeights; j++)
             {
-                uint vertex_id = m_meshes[mesh_index].base_vertex + aimesh->mBones[i]->mWeights[j].mVertexId;
+                // Welded vertices take the weights of the vertex kept
+                uint vertex_id = aimesh->mBones[i]->mWeights[j].mVertexId;
+                if (weld.remap.size())
+                {
+                    if (weld.vertices[weld.remap[vertex_id]] != vertex_id)
+                        continue;
+                    vertex_id = weld.remap[vertex_id];
+                }
                 float bone_weight = aimesh->mBones[i]->mWeights[j].mWeight;
-                scene_skindata[vertex_id].addWeight(bone_index, bone_weight);
+                arrays.skindata[first_vertex + vertex_id].addWeight(bone_indices[i], bone_weight);
             }
         }
     }
@@ -648,7 +1428,7 @@ namespace eeng
         if (sscanf(textureRelPath.c_str(), "*%d", &embedded_texture_index) == 1)
         {
             textureIndex = m_embedded_textures_ofs + embedded_texture_index;
-            log << priority(PRTSTRICT) << "\tUsing indexed embedded texture: " << embedded_texture_index << std::endl;
+            EENG_LOG_TO(log_channel, Log::Info, "\tUsing indexed embedded texture: %i", embedded_texture_index);
         }
         // Texture is a separate file
         else
@@ -662,26 +1442,30 @@ namespace eeng
             std::string textureAbsPath = modelDir + textureFilename;
 #endif
 
-            log << priority(PRTVERBOSE) << "\traw path: " << textureRelPath << std::endl;
-            log << priority(PRTVERBOSE) << "\tlocal file: " << textureAbsPath << std::endl;
+            EENG_LOG_TO(log_channel, Log::Verbose, "\traw path: %s\n\tlocal file: %s", textureRelPath, textureAbsPath);
 
             // Look for non-embedded textures (filepath + filename)
-            auto tex_it = m_texturehash.find(textureRelPath);
+            StringId textureRelPathId(textureRelPath);
+            auto tex_it = m_texturehash.find(textureRelPathId);
 
             if (tex_it == m_texturehash.end())
             {
                 // Look for embedded texture (just filename)
-                tex_it = m_texturehash.find(textureFilename);
+                tex_it = m_texturehash.find(StringId(textureFilename));
             }
             if (tex_it == m_texturehash.end())
             {
                 // New texture found: create & hash it
                 Texture2D texture;
                 texture.load_from_file(textureFilename, textureAbsPath);
-                log << priority(PRTSTRICT) << "Loaded texture " << texture << std::endl;
+                EENG_LOG_TO(log_channel, Log::Info, "Loaded texture %s, %ux%u, chan %u",
+                            texture.m_name,
+                            texture.m_width,
+                            texture.m_height,
+                            texture.m_channels);
                 textureIndex = (unsigned)m_textures.size();
                 m_textures.push_back(texture);
-                m_texturehash[textureRelPath] = textureIndex;
+                m_texturehash[textureRelPathId] = textureIndex;
             }
             else
                 textureIndex = tex_it->second;
@@ -717,16 +1501,15 @@ namespace eeng
     {
         std::string local_filepath = get_parentdir(file);
 
-        log << priority(PRTSTRICT) << "Loading materials...\n";
-        log << "\tNum materials " << aiscene->mNumMaterials << std::endl;
-        log << "\tParent dir: " << local_filepath << std::endl;
+        EENG_LOG_TO(log_channel, Log::Info, "Loading materials...\n\tNum materials %u\n\tParent dir: %s",
+                    aiscene->mNumMaterials,
+                    local_filepath);
 
         // Load embedded textures to texture array, using plain indices as
         // hash strings. If any regular texture is named e.g. '1', without an
         // extension (which it really shouldn't), there will be a conflict in the
         // name hash.
-        log << "Embedded textures: " << aiscene->mNumTextures << std::endl;
-        log << priority(PRTVERBOSE);
+        EENG_LOG_TO(log_channel, Log::Info, "Embedded textures: %u", aiscene->mNumTextures);
 
         m_embedded_textures_ofs = (unsigned)m_textures.size();
         for (int i = 0; i < aiscene->mNumTextures; i++)
@@ -744,7 +1527,11 @@ namespace eeng
                                    aitexture->mWidth,
                                    aitexture->mHeight,
                                    4);
-                log << priority(PRTSTRICT) << "Loaded uncompressed embedded texture " << texture << std::endl;
+                EENG_LOG_TO(log_channel, Log::Info, "Loaded uncompressed embedded texture %s, %ux%u, chan %u",
+                            texture.m_name,
+                            texture.m_width,
+                            texture.m_height,
+                            texture.m_channels);
             }
             else
             {
@@ -752,13 +1539,17 @@ namespace eeng
                 texture.load_from_memory(filename,
                                          (unsigned char *)aitexture->pcData,
                                          sizeof(aiTexel) * (aitexture->mWidth));
-                log << priority(PRTSTRICT) << "Loaded compressed embedded texture " << texture << std::endl;
+                EENG_LOG_TO(log_channel, Log::Info, "Loaded compressed embedded texture %s, %ux%u, chan %u",
+                            texture.m_name,
+                            texture.m_width,
+                            texture.m_height,
+                            texture.m_channels);
             }
 
             m_texturehash[filename] = (unsigned)m_textures.size();
             m_textures.push_back(texture);
         }
-        log << priority(PRTSTRICT) << "Loaded " << aiscene->mNumTextures << " embedded textures\n";
+        EENG_LOG_TO(log_channel, Log::Info, "Loaded %u embedded textures", aiscene->mNumTextures);
 
         // Initialize the materials
         for (uint i = 0; i < aiscene->mNumMaterials; i++)
@@ -768,29 +1559,29 @@ namespace eeng
 
             aiString mtlname;
             pMaterial->Get(AI_MATKEY_NAME, mtlname);
-            log << priority(PRTVERBOSE);
-            log << "Loading material '" << mtlname.C_Str() << "', index " << i << "..." << std::endl;
-            log << "Available textures:" << std::endl;
-            log << "\tNone " << pMaterial->GetTextureCount(aiTextureType_NONE) << std::endl;
-            log << "\tdiffuse " << pMaterial->GetTextureCount(aiTextureType_DIFFUSE) << std::endl;
-            log << "\tSpecular " << pMaterial->GetTextureCount(aiTextureType_SPECULAR) << std::endl;
-            log << "\tAmbient " << pMaterial->GetTextureCount(aiTextureType_AMBIENT) << std::endl;
-            log << "\tEmissive " << pMaterial->GetTextureCount(aiTextureType_EMISSIVE) << std::endl;
-            log << "\tHeight " << pMaterial->GetTextureCount(aiTextureType_HEIGHT) << std::endl;
-            log << "\tNormals " << pMaterial->GetTextureCount(aiTextureType_NORMALS) << std::endl;
-            log << "\tShininess " << pMaterial->GetTextureCount(aiTextureType_SHININESS) << std::endl;
-            log << "\tOpacity " << pMaterial->GetTextureCount(aiTextureType_OPACITY) << std::endl;
-            log << "\tDisplacement " << pMaterial->GetTextureCount(aiTextureType_DISPLACEMENT) << std::endl;
-            log << "\tLightmap " << pMaterial->GetTextureCount(aiTextureType_LIGHTMAP) << std::endl;
-            log << "\tReflection " << pMaterial->GetTextureCount(aiTextureType_REFLECTION) << std::endl;
+            EENG_LOG_TO(log_channel, Log::Verbose, "Loading material '%s', index %u...", mtlname.C_Str(), i);
+            EENG_LOG_TO(log_channel, Log::Verbose, "Available textures:\n\tNone %u\n\tdiffuse %u\n\tSpecular %u\n\tAmbient %u\n\tEmissive %u\n\tHeight %u\n\tNormals %u\n\tShininess %u\n\tOpacity %u\n\tDisplacement %u\n\tLightmap %u\n\tReflection %u",
+                        pMaterial->GetTextureCount(aiTextureType_NONE),
+                        pMaterial->GetTextureCount(aiTextureType_DIFFUSE),
+                        pMaterial->GetTextureCount(aiTextureType_SPECULAR),
+                        pMaterial->GetTextureCount(aiTextureType_AMBIENT),
+                        pMaterial->GetTextureCount(aiTextureType_EMISSIVE),
+                        pMaterial->GetTextureCount(aiTextureType_HEIGHT),
+                        pMaterial->GetTextureCount(aiTextureType_NORMALS),
+                        pMaterial->GetTextureCount(aiTextureType_SHININESS),
+                        pMaterial->GetTextureCount(aiTextureType_OPACITY),
+                        pMaterial->GetTextureCount(aiTextureType_DISPLACEMENT),
+                        pMaterial->GetTextureCount(aiTextureType_LIGHTMAP),
+                        pMaterial->GetTextureCount(aiTextureType_REFLECTION));
             // Added in https://github.com/assimp/assimp/pull/2640
-            log << "\tBase color " << pMaterial->GetTextureCount(aiTextureType_BASE_COLOR) << std::endl;
-            log << "\tNormal camera " << pMaterial->GetTextureCount(aiTextureType_NORMAL_CAMERA) << std::endl;
-            log << "\tEmission color " << pMaterial->GetTextureCount(aiTextureType_EMISSION_COLOR) << std::endl;
-            log << "\tMetalness " << pMaterial->GetTextureCount(aiTextureType_METALNESS) << std::endl;
-            log << "\tDiffuse roughness " << pMaterial->GetTextureCount(aiTextureType_DIFFUSE_ROUGHNESS) << std::endl;
-            log << "\tAO " << pMaterial->GetTextureCount(aiTextureType_AMBIENT_OCCLUSION) << std::endl;
-            log << "\tUnknown " << pMaterial->GetTextureCount(aiTextureType_UNKNOWN) << std::endl;
+            EENG_LOG_TO(log_channel, Log::Verbose, "\tBase color %u\n\tNormal camera %u\n\tEmission color %u\n\tMetalness %u\n\tDiffuse roughness %u\n\tAO %u\n\tUnknown %u",
+                        pMaterial->GetTextureCount(aiTextureType_BASE_COLOR),
+                        pMaterial->GetTextureCount(aiTextureType_NORMAL_CAMERA),
+                        pMaterial->GetTextureCount(aiTextureType_EMISSION_COLOR),
+                        pMaterial->GetTextureCount(aiTextureType_METALNESS),
+                        pMaterial->GetTextureCount(aiTextureType_DIFFUSE_ROUGHNESS),
+                        pMaterial->GetTextureCount(aiTextureType_AMBIENT_OCCLUSION),
+                        pMaterial->GetTextureCount(aiTextureType_UNKNOWN));
 
             // Fetch common color attributes
             aiColor3D aic;
@@ -803,7 +1594,7 @@ namespace eeng
             pMaterial->Get(AI_MATKEY_SHININESS, mtl.shininess);
 
             // Fetch common textures
-            log << "Loading textures..." << std::endl;
+            EENG_LOG_TO(log_channel, Log::Verbose, "Loading textures...");
             using TextureType = PhongMaterial::TextureTypeIndex;
             mtl.textureIndices[TextureType::Diffuse] = loadTexture(pMaterial, aiTextureType_DIFFUSE, local_filepath);
             mtl.textureIndices[TextureType::Normal] = loadTexture(pMaterial, aiTextureType_NORMALS, local_filepath);
@@ -814,23 +1605,22 @@ namespace eeng
             if (mtl.textureIndices[TextureType::Normal] == NO_TEXTURE)
                 mtl.textureIndices[TextureType::Normal] = loadTexture(pMaterial, aiTextureType_HEIGHT, local_filepath);
 
-            log << "Done loading textures" << std::endl;
+            EENG_LOG_TO(log_channel, Log::Verbose, "Done loading textures");
 
             m_materials[i] = mtl;
         }
-        log << "Done loading materials" << std::endl;
+        EENG_LOG_TO(log_channel, Log::Verbose, "Done loading materials");
 
-        log << priority(PRTSTRICT) << "Num materials " << m_materials.size() << std::endl;
+        EENG_LOG_TO(log_channel, Log::Info, "Num materials %zu", m_materials.size());
 
-        log << priority(PRTSTRICT) << "Num textures " << m_textures.size() << std::endl;
-        log << priority(PRTVERBOSE);
+        EENG_LOG_TO(log_channel, Log::Info, "Num textures %zu", m_textures.size());
         for (auto &t : m_textures)
-            log << "\t" << t.m_name << std::endl;
+            EENG_LOG_TO(log_channel, Log::Verbose, "\t%s", t.m_name);
     }
 
     void RenderableMesh::loadAnimations(const aiScene *scene)
     {
-        log << priority(PRTSTRICT) << "Loading animations..." << std::endl;
+        EENG_LOG_TO(log_channel, Log::Info, "Loading animations...");
 
         for (int i = 0; i < scene->mNumAnimations; i++)
         {
@@ -842,26 +1632,24 @@ namespace eeng
             anim.tps = aianim->mTicksPerSecond;
             anim.node_animations.resize(m_nodetree.nodes.size());
 
-            log << priority(PRTSTRICT)
-                << "Loading animation '" << anim.name
-                << "', dur in ticks " << anim.duration_ticks
-                << ", tps " << anim.tps
-                << ", nbr channels " << aianim->mNumChannels
-                << std::endl;
+            EENG_LOG_TO(log_channel, Log::Info, "Loading animation '%s', dur in ticks %g, tps %g, nbr channels %u",
+                        anim.name,
+                        anim.duration_ticks,
+                        anim.tps,
+                        aianim->mNumChannels);
 
             for (int j = 0; j < aianim->mNumChannels; j++)
             {
                 aiNodeAnim *ainode_anim = aianim->mChannels[j];
                 NodeKeyframes node_anim;
                 node_anim.is_used = true;
-                auto name = std::string(ainode_anim->mNodeName.C_Str());
+                const char *name = ainode_anim->mNodeName.C_Str();
 
-                log << priority(PRTVERBOSE)
-                    << "\tLoading channel " << name
-                    << ", nbr pos keys  " << ainode_anim->mNumPositionKeys
-                    << ", nbr scale keys  " << ainode_anim->mNumScalingKeys
-                    << ", nbr rot keys  " << ainode_anim->mNumRotationKeys
-                    << std::endl;
+                EENG_LOG_TO(log_channel, Log::Verbose, "\tLoading channel %s, nbr pos keys  %u, nbr scale keys  %u, nbr rot keys  %u",
+                            name,
+                            ainode_anim->mNumPositionKeys,
+                            ainode_anim->mNumScalingKeys,
+                            ainode_anim->mNumRotationKeys);
 
                 for (int k = 0; k < ainode_anim->mNumPositionKeys; k++)
                 {
@@ -879,7 +1667,7 @@ namespace eeng
                     node_anim.rot_keys.push_back(rot_key);
                 }
 
-                auto index = m_nodetree.find_node_index(name);
+                auto index = m_nodetree.find_node_index(StringId(name));
                 if (index != EENG_NULL_INDEX)
                     anim.node_animations[index] = node_anim;
             }
@@ -887,7 +1675,7 @@ namespace eeng
             m_animations.push_back(anim);
         }
 
-        log << priority(PRTSTRICT) << "Animations in total " << m_animations.size() << std::endl;
+        EENG_LOG_TO(log_channel, Log::Info, "Animations in total %zu", m_animations.size());
     }
 
     glm::mat4 RenderableMesh::blendTransformAtTime(const AnimationClip *anim,
@@ -961,36 +1749,72 @@ namespace eeng
             anim = &m_animations[anim_index];
         }
 
-        for (auto &node : m_nodetree.nodes)
-            node.global_tfm = glm::mat4{1.0f};
+        // Remember what pose this is, so that derived data (e.g. skinned
+        // vertices) can tell whether it is up to date. All invalid clip indices
+        // map to the same bind pose.
+        const PoseKey pose = anim ? PoseKey{anim_index, time, animTimeFormat} : PoseKey{};
+
+        // Nothing moves if the pose is unchanged, e.g. for static models
+        if (m_pose_evaluated && pose == m_pose && m_incremental_updates)
+        {
+            m_hierarchy_stats.nodes_updated = 0;
+            m_hierarchy_stats.skipped++;
+            return;
+        }
+        m_pose = pose;
+        m_pose_evaluated = true;
 
-        int node_index = 0;
-        while (node_index < m_nodetree.nodes.size())
+        // Set pose transforms and mark nodes whose pose transforms change
+        for (int node_index = 0; node_index < m_nodetree.nodes.size(); node_index++)
         {
-            glm::mat4 node_tfm = m_nodetree.nodes[node_index].local_tfm;
-            glm::mat4 global_tfm;
+            auto &node = m_nodetree.nodes[node_index];
 
             // If an animation key is available, use it to replace the node tfm
-            if (anim)
+            const bool is_animated = anim && anim->node_animations[node_index].is_used;
+            if (is_animated)
             {
-                const auto &node_anim = anim->node_animations[node_index];
-                if (node_anim.is_used)
-                    // node_tfm = blendTransformAtTime(anim, node_anim, time);
-                    node_tfm = std::invoke(blendFunc, this, anim, node_anim, time);
+                // node_tfm = blendTransformAtTime(anim, node_anim, time);
+                const glm::mat4 node_tfm = std::invoke(blendFunc, this, anim, anim->node_animations[node_index], time);
+                if (node_tfm != node.pose_tfm)
+                {
+                    node.pose_tfm = node_tfm;
+                    node.dirty = true;
+                }
             }
-
-            // Apply parent transform
-            const auto parent_ofs = m_nodetree.nodes[node_index].m_parent_ofs;
-            if (parent_ofs)
+            else if (node.is_animated)
             {
-                const auto &parent_tfm = m_nodetree.nodes[node_index - parent_ofs].global_tfm;
-                node_tfm = parent_tfm * node_tfm;
+                // Back to bind pose
+                node.pose_tfm = node.local_tfm;
+                node.dirty = true;
             }
-            m_nodetree.nodes[node_index].global_tfm = node_tfm;
+            node.is_animated = is_animated;
 
-            node_index++;
+            if (!m_incremental_updates)
+                node.dirty = true;
         }
 
+        // Update dirty nodes and their descendants. Since nodes are in
+        // pre-order, parents are updated before their children.
+        const auto nodes_updated = m_nodetree.traverse_dirty_branches(
+            [](const SkeletonNode &node)
+            { return node.dirty; },
+            [&](size_t node_index)
+            {
+                auto &node = m_nodetree.nodes[node_index];
+                node.global_tfm = node.pose_tfm;
+                if (node.m_parent_ofs)
+                    node.global_tfm = m_nodetree.nodes[node_index - node.m_parent_ofs].global_tfm * node.global_tfm;
+                node.dirty = false;
+            });
+
+        m_hierarchy_stats.nodes_updated = (unsigned)nodes_updated;
+        m_hierarchy_stats.evaluations++;
+        m_hierarchy_stats.total_updated += nodes_updated;
+
+        // Bones and bounds only change with the nodes
+        if (!nodes_updated)
+            return;
+
         m_model_aabb.reset();
         for (int i = 0; i < m_bones.size(); i++)
         {
@@ -1031,6 +1855,26 @@ namespace eeng
         return (unsigned)m_animations.size();
     }
 
+    void RenderableMesh::setIncrementalUpdates(bool incremental)
+    {
+        m_incremental_updates = incremental;
+    }
+
+    bool RenderableMesh::getIncrementalUpdates() const
+    {
+        return m_incremental_updates;
+    }
+
+    const RenderableMesh::HierarchyStats &RenderableMesh::getHierarchyStats() const
+    {
+        return m_hierarchy_stats;
+    }
+
+    void RenderableMesh::resetHierarchyStats()
+    {
+        m_hierarchy_stats = HierarchyStats{};
+    }
+
     std::string RenderableMesh::getAnimationName(unsigned i) const
     {
         return (i < getNbrAnimations() ? m_animations[i].name : "");
@@ -1048,6 +1892,7 @@ namespace eeng
 
         if (m_VAO != 0)
         {
+            GLStateCache::instance().forgetVertexArray(m_VAO);
             glDeleteVertexArrays(1, &m_VAO);
             m_VAO = 0;
         }
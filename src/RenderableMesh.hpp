@@ -12,6 +12,7 @@
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <memory>
 
 #include "glcommon.h"
 
@@ -22,13 +23,16 @@
 #include <glm/glm.hpp>
 
 #include "AABB.h"
+#include "TriangleBvh.hpp"
 #include "Texture.hpp"
 #include "VectorTree.h"
-#include "logstreamer.h"
+#include "StringId.hpp"
+#include "Log.hpp"
 
 namespace eeng
 {
-    using namespace logstreamer;
+    class ThreadPool;
+
     using uint = uint32_t;
 
     const int NUM_BONES_PER_VERTEX = 4;
@@ -41,17 +45,21 @@ namespace eeng
     struct SkeletonNode : public TreeNode
     {
         glm::mat4 local_tfm;
+        glm::mat4 pose_tfm;         ///< Local transform of the current pose
         glm::mat4 global_tfm{1.0f};
+        bool is_animated = false;   ///< Pose transform is taken from an animation
+        bool dirty = true;          ///< Pose transform changed since global_tfm was evaluated
 
         int bone_index = EENG_NULL_INDEX;
         int nbr_meshes = 0;
 
-        std::string name = "";
+        StringId name;
 
         SkeletonNode() = default;
-        SkeletonNode(const std::string &name, const glm::mat4 &local_tfm)
+        SkeletonNode(StringId name, const glm::mat4 &local_tfm)
             : name(name),
-              local_tfm(local_tfm) {}
+              local_tfm(local_tfm),
+              pose_tfm(local_tfm) {}
     };
 
     /// A material with typical Phong illumination properties
@@ -80,6 +88,14 @@ namespace eeng
         xi_load_animations = 0x2
     };
 
+    /// @brief Welding of duplicate vertices of submeshes while loading
+    enum class VertexWelding
+    {
+        Off,
+        Exact,    ///< Vertices whose compared attributes are bitwise equal
+        Quantized ///< Vertices whose compared attributes are equal once quantized
+    };
+
     /// @brief Interpretation of time when mapping to keyframes
     /// Real-time means that (t = 0) maps to the first keyframe, 
     /// and (t = clip duration) maps to the last keyframe.
@@ -96,6 +112,17 @@ namespace eeng
     {
         friend class ForwardRenderer;
 
+    public:
+        /// Bone indices and weights for a vertex
+        struct SkinData
+        {
+            unsigned bone_indices[NUM_BONES_PER_VERTEX]{0};
+            float bone_weights[NUM_BONES_PER_VERTEX]{0};
+
+            int nbr_added = 0; // For checking
+            void addWeight(unsigned bone_index, float bone_weight);
+        };
+
     private:
         enum
         {
@@ -109,6 +136,14 @@ namespace eeng
             BufferCount
         };
 
+        /// Index range of a simplified version of a submesh, using the same vertices
+        struct LodRange
+        {
+            unsigned base_index = 0;
+            unsigned nbr_indices = 0;
+            float error = 0.0f; //!< Simplification error bound, in model units
+        };
+
         /// A mesh with a single material and a given set of geometry
         struct Submesh
         {
@@ -121,6 +156,8 @@ namespace eeng
             int mtl_index = -1;
             int node_index = -1;
             bool is_skinned = false;
+
+            std::vector<LodRange> lods; //!< Coarser levels of detail, in order of decreasing detail
         };
 
         /// Per-bone data
@@ -130,16 +167,6 @@ namespace eeng
             int node_index = -1;             //!< Node associated with this bone
         };
 
-        /// Bone indices and weights for a vertex
-        struct SkinData
-        {
-            unsigned bone_indices[NUM_BONES_PER_VERTEX]{0};
-            float bone_weights[NUM_BONES_PER_VERTEX]{0};
-
-            int nbr_added = 0; // For checking
-            void addWeight(unsigned bone_index, float bone_weight);
-        };
-
         /// Keyframe sequence for a node and an animation.
         struct NodeKeyframes // NodeKeyframes ???
         {
@@ -171,23 +198,121 @@ namespace eeng
         std::vector<PhongMaterial> m_materials;
         std::vector<Texture2D> m_textures;
 
+        // Vertex data retained for CPU-side use. Positions and indices are kept
+        // for all models (occluders), the other streams for skinned models (CPU skinning).
+        std::vector<glm::vec3> m_bind_positions;
+        std::vector<unsigned> m_indices;
+        std::vector<glm::vec3> m_bind_normals;
+        std::vector<glm::vec3> m_bind_tangents;
+        std::vector<glm::vec3> m_bind_binormals;
+        std::vector<SkinData> m_bind_skindata;
+
         // Bounding volumes
         std::vector<AABB> m_bone_aabbs_bind; // Per-bone bind AABB
         std::vector<AABB> m_bone_aabbs_pose; // Per-node pose AABB's – intermediary, used for visualization
         std::vector<AABB> m_mesh_aabbs_bind; // Per-mesh bind AABB
         std::vector<AABB> m_mesh_aabbs_pose; // Per-mesh pose AABB's – intermediary, used for visualization
         AABB m_model_aabb;                   // AABB for the entire model
+        AABB m_animated_aabb;                // AABB for the model in bind pose and at all keyframes, e.g. for culling animated instances
+
+        // Triangle BVHs for ray queries
+        std::vector<TriangleBvh> m_mesh_bvhs; // Per-mesh, node space. Empty for skinned meshes.
+        std::vector<TriangleBvh> m_bone_bvhs; // Per-bone, bind space. Triangles of skinned meshes, by dominant bone.
 
     public:
         unsigned m_embedded_textures_ofs = 0;
 
-        using index_hash_t = std::unordered_map<std::string, unsigned>;
+        using index_hash_t = std::unordered_map<StringId, unsigned>;
         index_hash_t m_texturehash; // full file path, or just filename for embedded textures
         index_hash_t m_bonehash;
         index_hash_t m_nodehash;
 
+        /// @brief Animation parameters of the current pose, as set by the latest call to animate()
+        struct PoseKey
+        {
+            int anim_index = EENG_NULL_INDEX;
+            float time = 0.0f;
+            AnmationTimeFormat time_format = AnmationTimeFormat::RealTime;
+
+            bool operator==(const PoseKey &other) const
+            {
+                return anim_index == other.anim_index &&
+                       time == other.time &&
+                       time_format == other.time_format;
+            }
+            bool operator!=(const PoseKey &other) const { return !(*this == other); }
+        };
+        PoseKey m_pose;
+        bool m_pose_evaluated = false;
+
+        /// @brief Counters for node transform updates made by animate()
+        struct HierarchyStats
+        {
+            unsigned nodes_updated = 0;          ///< Nodes updated by the latest call
+            unsigned evaluations = 0;            ///< Calls that evaluated the hierarchy
+            unsigned skipped = 0;                ///< Calls skipped because the pose was unchanged
+            unsigned long long total_updated = 0; ///< Nodes updated by all calls
+        };
+        HierarchyStats m_hierarchy_stats;
+        bool m_incremental_updates = true;
+
+        /// @brief Wall-clock times of the phases of the latest call to load()
+        struct LoadStats
+        {
+            double import_ms = 0.0;    ///< Assimp import and post-processing
+            double convert_ms = 0.0;   ///< Vertices, indices and bone weights of all submeshes
+            double bounds_ms = 0.0;    ///< Bind AABBs of meshes and bones
+            double lod_ms = 0.0;       ///< Simplified index ranges
+            double bvh_ms = 0.0;       ///< Triangle BVHs for ray queries
+            double materials_ms = 0.0; ///< Materials and textures
+            double upload_ms = 0.0;    ///< GL buffers
+            double total_ms = 0.0;
+            unsigned nbr_meshes = 0;
+            unsigned nbr_vertices = 0;          ///< After welding
+            unsigned nbr_imported_vertices = 0; ///< Before welding
+            unsigned nbr_triangles = 0;
+            size_t vertex_bytes = 0;          ///< Vertex buffers uploaded
+            size_t imported_vertex_bytes = 0; ///< Vertex buffers of all streams, for the imported vertices
+            unsigned nbr_threads = 1; ///< Threads that converted submeshes
+            unsigned nbr_batches = 1; ///< Batches of submeshes uploaded, more than one when streaming
+            size_t peak_rss = 0;      ///< Peak resident memory of the process after loading, in bytes
+        };
+        LoadStats m_load_stats;
+        std::shared_ptr<ThreadPool> m_load_pool;
+        bool m_parallel_loading = true;
+        bool m_streaming_import = false;
+        VertexWelding m_vertex_welding = VertexWelding::Exact;
+        bool m_lod_generation = false;
+
+        /// @brief Vertex attributes and indices of the whole scene, or of a batch of consecutive submeshes
+        struct VertexArrays
+        {
+            unsigned first_vertex = 0; ///< Scene vertex of the first element
+            unsigned first_index = 0;  ///< Scene index of the first element
+            std::vector<glm::vec3> positions, normals, tangents, binormals;
+            std::vector<glm::vec2> texcoords;
+            std::vector<SkinData> skindata;
+            std::vector<unsigned> indices;
+
+            /// @brief Size all arrays for a range of the scene, with all elements reset
+            void reset(unsigned first_vertex,
+                       unsigned nbr_vertices,
+                       unsigned first_index,
+                       unsigned nbr_indices);
+        };
+
         // Log & debug stuff
-        logstreamer_t log;
+        int log_channel = Log::NoChannel; ///< File channel while loading
+
+        /// @brief Closest hit of a ray against the mesh
+        struct MeshHit
+        {
+            float t;                        ///< Ray parameter. Largest accepted value on input to raycast().
+            int mesh = EENG_NULL_INDEX;     ///< Submesh
+            unsigned triangle = 0;          ///< Triangle, whose indices start at m_indices[3 * triangle]
+            float u = 0.0f, v = 0.0f;       ///< Barycentric coordinates of the second and third vertex
+            int bone = EENG_NULL_INDEX;     ///< Bone whose triangles were hit, for skinned meshes
+        };
 
     public:
         AABB mSceneAABB;
@@ -202,9 +327,50 @@ namespace eeng
                   unsigned xiflags,
                   unsigned aiflags = 0);
 
+        /// @brief Convert submeshes and compute bind AABBs concurrently while loading
+        /// On by default. Results are the same either way, bone indices included.
+        void setParallelLoading(bool parallel);
+
+        bool getParallelLoading() const;
+
+        /// @brief Upload submeshes in batches as they are converted, and release imported data early
+        /** Off by default. Caps the memory used while loading large models,
+         * since vertex attributes only used by the GPU are never held for the
+         * whole model, and imported meshes are released once converted.
+         */
+        void setStreamingImport(bool streaming);
+
+        bool getStreamingImport() const;
+
+        /// @brief Weld duplicate vertices of submeshes while loading
+        /** Exact by default. Streams that the material of a submesh does not
+         * use, texture coordinates without textures and tangent frames
+         * without a normal map, are zeroed and left out of the comparison.
+         * Quantized welding compares positions on a 16-bit grid over the
+         * bounds of the submesh, directions and bone weights in steps of
+         * 1/1024 and texture coordinates in steps of 1/4096. The first of the
+         * welded vertices is kept.
+         */
+        void setVertexWelding(VertexWelding welding);
+
+        VertexWelding getVertexWelding() const;
+
+        /// @brief Generate simplified index ranges of submeshes while loading
+        /// Off by default, since simplifying adds to the load time. Meshes
+        /// loaded without LODs are always drawn at full detail.
+        void setLodGeneration(bool generate);
+
+        bool getLodGeneration() const;
+
+        /// @brief Threads used by parallel loading
+        /// If none are given, threads are created for the duration of each load.
+        void setLoadThreadPool(std::shared_ptr<ThreadPool> threadPool);
+
+        const LoadStats &getLoadStats() const;
+
         /// @brief
         /// @param node_name
-        void removeTranslationKeys(const std::string &node_name);
+        void removeTranslationKeys(StringId node_name);
 
         /// @brief
         /// @param node_index
@@ -218,6 +384,32 @@ namespace eeng
                      float time,
                      AnmationTimeFormat animTimeFormat = AnmationTimeFormat::RealTime);
 
+        /// @brief Update only animated nodes and their descendants, or the entire hierarchy
+        /// Incremental updates are on by default. Full updates are intended for comparison.
+        void setIncrementalUpdates(bool incremental);
+
+        bool getIncrementalUpdates() const;
+
+        const HierarchyStats &getHierarchyStats() const;
+
+        /// @brief Reset node update counters
+        void resetHierarchyStats();
+
+        /// @brief Closest hit of a ray against the triangles of the current pose
+        /** Static meshes are tested in the space of their nodes. Skinned
+         * meshes are tested per bone, against the triangles that depend the
+         * most on the bone, moved rigidly with it. Bones whose pose AABBs are
+         * hit are visited nearest first. Hits on skinned meshes are therefore
+         * approximate close to joints, where vertices blend several bones.
+         * @param origin Ray origin, model space
+         * @param direction Ray direction, model space, need not be normalized
+         * @param hit Largest ray parameter on input, the hit on output if there is one
+         * @return True if a triangle was hit
+         */
+        bool raycast(const glm::vec3 &origin,
+                     const glm::vec3 &direction,
+                     MeshHit &hit) const;
+
         /// @brief
         /// @return
         unsigned getNbrAnimations() const;
@@ -228,27 +420,83 @@ namespace eeng
         std::string getAnimationName(unsigned i) const;
 
     private:
-        bool loadScene(const aiScene *pScene,
-                       const std::string &file);
-        void loadMesh(uint MeshIndex,
-                      const aiMesh *paiMesh,
-                      std::vector<glm::vec3> &Positions,
-                      std::vector<glm::vec3> &Normals,
-                      std::vector<glm::vec3> &Tangents,
-                      std::vector<glm::vec3> &Binormals,
-                      std::vector<glm::vec2> &TexCoords,
-                      std::vector<SkinData> &Bones,
-                      std::vector<unsigned int> &Indices);
-
-        void compute_bind_aabbs(); // not implemented. where?
+        /// @param threadPool Threads that convert submeshes, or null to convert them serially
+        bool loadScene(aiScene *pScene,
+                       const std::string &file,
+                       ThreadPool *threadPool);
+
+        /// @brief Vertex streams used by the material of a submesh
+        struct MeshStreams
+        {
+            bool texcoords = true;
+            bool tangent_frame = true;
+        };
+
+        /// @brief Streams used by a material: tangent frames by normal maps and
+        /// texture coordinates by any texture
+        static MeshStreams getMaterialStreams(const aiMaterial *material);
+
+        /// @brief Welded vertices of a submesh
+        /// Empty if not welded, in which case all imported vertices are kept.
+        struct MeshWeld
+        {
+            std::vector<unsigned> remap;    ///< Welded vertex of each imported vertex
+            std::vector<unsigned> vertices; ///< Imported vertex kept for each welded vertex
+        };
+
+        /// @brief Find the duplicate vertices of a submesh, see setVertexWelding()
+        void weldMesh(const aiMesh *aimesh,
+                      const std::vector<unsigned> &bone_indices,
+                      const MeshStreams &streams,
+                      MeshWeld &weld) const;
+
+        /// @brief Convert a submesh into its range of pre-sized arrays
+        /// Submeshes write disjoint ranges, so that they can be converted concurrently.
+        void loadMesh(const Submesh &mesh,
+                      const aiMesh *aimesh,
+                      const std::vector<unsigned> &bone_indices,
+                      const MeshStreams &streams,
+                      const MeshWeld &weld,
+                      VertexArrays &arrays) const;
+
+        void generateLods(const std::vector<glm::vec3> &scene_positions,
+                          std::vector<unsigned> &scene_indices);
+
+        /// @brief Build triangle BVHs for ray queries from the full detail triangles
+        /// Also grows bone bind AABBs to include the triangles of each bone.
+        void buildRaycastBvhs(const std::vector<glm::vec3> &scene_positions,
+                              const std::vector<unsigned> &scene_indices,
+                              const std::vector<SkinData> &scene_skindata);
+
         void compute_pose_aabbs(); // not implemented. where?
 
         void loadNodes(aiNode *node);
-        void loadNode(aiNode *node);
-
-        void loadBones(uint mesh_index,
+        void loadNode(aiNode *node,
+                      size_t parent_index,
+                      std::vector<SkeletonNode> &nodes,
+                      std::vector<size_t> &parent_indices,
+                      std::vector<aiNode *> &ainodes);
+
+        /// @brief Create the bones of a submesh that are not yet created
+        /// Called for one submesh at a time in order, so that bone indices are deterministic.
+        /// @param bone_indices Index of each bone of the submesh, on output
+        void createBones(const aiMesh *aimesh,
+                         std::vector<unsigned> &bone_indices);
+
+        void loadBones(const Submesh &mesh,
                        const aiMesh *aimesh,
-                       std::vector<SkinData> &scene_skindata);
+                       const std::vector<unsigned> &bone_indices,
+                       const MeshWeld &weld,
+                       VertexArrays &arrays) const;
+
+        /// @brief Union of the model AABBs of the bind pose and of poses at the keyframes of all clips
+        /// The mesh is posed to compute it, and then returned to its pose.
+        void computeAnimatedAabb();
+
+        /// @brief Bind AABBs of static meshes and of bones
+        void computeBindAabbs(const std::vector<glm::vec3> &scene_positions,
+                              const std::vector<SkinData> &scene_skindata,
+                              ThreadPool *threadPool);
 
         void loadMaterials(const aiScene *aiscene,
                            const std::string &file);
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "ForwardRenderer.hpp"
+#include "SystemScheduler.hpp"
 
 namespace eeng {
     class SceneBase
@@ -20,6 +21,75 @@ namespace eeng {
             int screenHeight,
             ForwardRendererPtr renderer) = 0;
 
+        /// @brief Add the systems of a simulation step to a scheduler
+        /// By default update() runs on the main thread. Scenes override this
+        /// and scheduleFrame() to split the frame into systems that declare
+        /// the resources they read and write.
+        virtual void scheduleStep(
+            SystemScheduler& scheduler,
+            float time_s,
+            float deltaTime_s)
+        {
+            const auto scene = resources<SceneBase>();
+            scheduler.addSystem("update", [=]() { update(time_s, deltaTime_s); }, scene, scene, true);
+        }
+
+        /// @brief Add the systems of a rendered frame to a scheduler
+        /// @param time_s Time of the rendered frame
+        /// @param alpha Interpolation between the two latest simulation steps,
+        /// where 1 renders the latest step. Ignored by default.
+        virtual void scheduleFrame(
+            SystemScheduler& scheduler,
+            float time_s,
+            float alpha,
+            int screenWidth,
+            int screenHeight,
+            ForwardRendererPtr renderer)
+        {
+            const auto scene = resources<SceneBase>();
+            scheduler.addSystem("render", [=]() { render(time_s, screenWidth, screenHeight, renderer); }, scene, scene, true);
+        }
+
+        /// @brief Whether the scene supports scheduleCapture() and renderSnapshot()
+        virtual bool supportsPipelining() const { return false; }
+
+        /// @brief Add the systems that capture a frame into a snapshot, see FramePipeline
+        /// These run after the systems of the steps before the frame, on the
+        /// simulation thread, and must not use GL.
+        /// @param slot Snapshot slot, 0 or 1
+        virtual void scheduleCapture(
+            SystemScheduler& scheduler,
+            float time_s,
+            float alpha,
+            int screenWidth,
+            int screenHeight,
+            int slot)
+        {
+        }
+
+        /// @brief Render a snapshot captured by scheduleCapture(), on the thread of the GL context
+        /// The simulation may capture the other slot meanwhile.
+        virtual void renderSnapshot(
+            int slot,
+            int screenWidth,
+            int screenHeight,
+            ForwardRendererPtr renderer)
+        {
+        }
+
+        /// @brief Add the systems of a simulation step and a frame that renders it
+        void schedule(
+            SystemScheduler& scheduler,
+            float time_s,
+            float deltaTime_s,
+            int screenWidth,
+            int screenHeight,
+            ForwardRendererPtr renderer)
+        {
+            scheduleStep(scheduler, time_s, deltaTime_s);
+            scheduleFrame(scheduler, time_s, 1.0f, screenWidth, screenHeight, renderer);
+        }
+
         virtual void destroy() = 0;
     };
 }
@@ -0,0 +1,69 @@
+
+#ifndef SceneComponents_hpp
+#define SceneComponents_hpp
+
+#include <memory>
+#include <entt/entt.hpp>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "RenderableMesh.hpp"
+#include "ForwardRenderer.hpp"
+
+namespace eeng
+{
+    /// @brief Placement of an entity, relative to its parent if it has one
+    struct Transform
+    {
+        glm::vec3 position{0.0f};
+        float angle = 0.0f;                   ///< Degrees
+        glm::vec3 axis{0.0f, 1.0f, 0.0f};     ///< Rotation axis
+        glm::vec3 scale{1.0f};
+
+        entt::entity parent = entt::null;     ///< Set with setParent()
+        unsigned depth = 0;                   ///< Number of ancestors, set with setParent()
+
+        glm::mat4 worldMatrix{1.0f};          ///< Written by updateTransforms()
+
+        /// Placement at the previous simulation step, set by storePreviousState()
+        glm::vec3 previousPosition{0.0f};
+        float previousAngle = 0.0f;
+        glm::vec3 previousScale{1.0f};
+        bool hasPrevious = false;
+    };
+
+    /// @brief Mesh drawn at the transform of an entity
+    struct MeshRef
+    {
+        std::shared_ptr<RenderableMesh> mesh;
+        bool isOccluder = false;              ///< Also rasterized as an occluder
+        LodState lod;
+    };
+
+    /// @brief Animation clip playback of a mesh instance
+    struct Animator
+    {
+        int clipIndex = EENG_NULL_INDEX;      ///< Clip, or bind pose if not a valid clip
+        float speed = 1.0f;
+        float time = 0.0f;                    ///< Clip time in seconds, advanced by updateAnimators()
+        float poseTime = 0.0f;                ///< Clip time of the rendered pose, see interpolateAnimators()
+
+        /// Clip time at the previous simulation step, set by storePreviousState()
+        float previousTime = 0.0f;
+        bool hasPrevious = false;
+
+        /// Skinned vertices of this instance, created by the skinning system when used
+        std::shared_ptr<SkinnedVertexCache> skinCache;
+    };
+
+    /// @brief Bounding box of an entity
+    struct Bounds
+    {
+        AABB local;                           ///< Model space, e.g. the bind pose AABB of the mesh, or its animated AABB if animated
+        AABB world;                           ///< Written by updateBounds()
+        int proxy = EENG_NULL_INDEX;          ///< In the scene BVH, see addToBvh()
+    };
+
+} // namespace eeng
+
+#endif /* SceneComponents_hpp */
@@ -0,0 +1,402 @@
+
+#include "glmcommon.h"
+#include "SceneSystems.hpp"
+
+namespace eeng
+{
+    namespace
+    {
+        /// Entities with meshes. Owns MeshRef and Bounds, so that the bounds
+        /// and render systems iterate them in tightly packed arrays. Transform
+        /// is not owned, since it is sorted by updateTransforms().
+        auto meshGroup(entt::registry &registry)
+        {
+            return registry.group<MeshRef, Bounds>(entt::get<Transform>);
+        }
+
+        /// Box is entirely outside one of the planes of a frustum
+        bool isOutsideFrustum(const AABB &aabb,
+                              const glm::mat4 &ProjViewMatrix)
+        {
+            int outside[6] = {0};
+            for (int i = 0; i < 8; i++)
+            {
+                const glm::vec4 clip = ProjViewMatrix * glm::vec4((i & 1) ? aabb.max.x : aabb.min.x,
+                                                                  (i & 2) ? aabb.max.y : aabb.min.y,
+                                                                  (i & 4) ? aabb.max.z : aabb.min.z,
+                                                                  1.0f);
+                outside[0] += clip.x < -clip.w;
+                outside[1] += clip.x > clip.w;
+                outside[2] += clip.y < -clip.w;
+                outside[3] += clip.y > clip.w;
+                outside[4] += clip.z < -clip.w;
+                outside[5] += clip.z > clip.w;
+            }
+            for (int i = 0; i < 6; i++)
+                if (outside[i] == 8)
+                    return true;
+            return false;
+        }
+    }
+
+    void prepareSystems(entt::registry &registry)
+    {
+        registry.storage<Transform>();
+        registry.storage<MeshRef>();
+        registry.storage<Animator>();
+        registry.storage<Bounds>();
+        meshGroup(registry);
+    }
+
+    void setParent(entt::registry &registry,
+                   entt::entity entity,
+                   entt::entity parent)
+    {
+        auto &tfm = registry.get<Transform>(entity);
+        tfm.parent = parent;
+        tfm.depth = (parent == entt::null) ? 0 : registry.get<Transform>(parent).depth + 1;
+    }
+
+    void storePreviousState(entt::registry &registry)
+    {
+        for (auto [entity, tfm] : registry.view<Transform>().each())
+        {
+            tfm.previousPosition = tfm.position;
+            tfm.previousAngle = tfm.angle;
+            tfm.previousScale = tfm.scale;
+            tfm.hasPrevious = true;
+        }
+        for (auto [entity, animator] : registry.view<Animator>().each())
+        {
+            animator.previousTime = animator.time;
+            animator.hasPrevious = true;
+        }
+    }
+
+    void updateTransforms(entt::registry &registry,
+                          float alpha)
+    {
+        auto view = registry.view<Transform>();
+
+        // Parents before children
+        unsigned depth = 0;
+        for (auto [entity, tfm] : view.each())
+        {
+            if (tfm.depth < depth)
+            {
+                registry.sort<Transform>([](const Transform &lhs, const Transform &rhs)
+                                         { return lhs.depth < rhs.depth; });
+                break;
+            }
+            depth = tfm.depth;
+        }
+
+        for (auto [entity, tfm] : view.each())
+        {
+            // Angles are interpolated as they are, so they should not wrap between steps
+            const bool interpolate = alpha < 1.0f && tfm.hasPrevious;
+            const glm::mat4 LocalMatrix = interpolate
+                                              ? TRS(glm::mix(tfm.previousPosition, tfm.position, alpha),
+                                                    glm::mix(tfm.previousAngle, tfm.angle, alpha),
+                                                    tfm.axis,
+                                                    glm::mix(tfm.previousScale, tfm.scale, alpha))
+                                              : TRS(tfm.position, tfm.angle, tfm.axis, tfm.scale);
+            if (tfm.parent == entt::null)
+                tfm.worldMatrix = LocalMatrix;
+            else
+                tfm.worldMatrix = view.get<Transform>(tfm.parent).worldMatrix * LocalMatrix;
+        }
+    }
+
+    void updateAnimators(entt::registry &registry,
+                         float deltaTime_s)
+    {
+        for (auto [entity, animator] : registry.view<Animator>().each())
+        {
+            animator.time += deltaTime_s * animator.speed;
+            animator.poseTime = animator.time;
+        }
+    }
+
+    void interpolateAnimators(entt::registry &registry,
+                              float alpha)
+    {
+        for (auto [entity, animator] : registry.view<Animator>().each())
+            animator.poseTime = animator.hasPrevious
+                                    ? glm::mix(animator.previousTime, animator.time, alpha)
+                                    : animator.time;
+    }
+
+    void updateBounds(entt::registry &registry)
+    {
+        for (auto [entity, meshRef, bounds, tfm] : meshGroup(registry).each())
+        {
+            if (!bounds.local)
+            {
+                bounds.world = bounds.local;
+                continue;
+            }
+            const auto &M = tfm.worldMatrix;
+            bounds.world = bounds.local.post_transform(glm::vec3(M[3]), glm::mat3(M));
+        }
+    }
+
+    void addToBvh(entt::registry &registry,
+                  entt::entity entity,
+                  DynamicBvh &bvh)
+    {
+        // Entities without proper bounds are never culled, so they are left out
+        auto &bounds = registry.get<Bounds>(entity);
+        if (bounds.local)
+            bounds.proxy = bvh.insert(bounds.world, entt::to_integral(entity));
+    }
+
+    void removeFromBvh(entt::registry &registry,
+                       entt::entity entity,
+                       DynamicBvh &bvh)
+    {
+        auto &bounds = registry.get<Bounds>(entity);
+        if (bounds.proxy == EENG_NULL_INDEX)
+            return;
+        bvh.remove(bounds.proxy);
+        bounds.proxy = EENG_NULL_INDEX;
+    }
+
+    void updateBvh(entt::registry &registry,
+                   DynamicBvh &bvh)
+    {
+        for (auto [entity, meshRef, bounds, tfm] : meshGroup(registry).each())
+            if (bounds.proxy != EENG_NULL_INDEX)
+                bvh.move(bounds.proxy, bounds.world);
+        bvh.update();
+    }
+
+    entt::entity pickEntity(entt::registry &registry,
+                            const DynamicBvh &bvh,
+                            const glm::vec3 &origin,
+                            const glm::vec3 &direction,
+                            RenderableMesh::MeshHit &hit)
+    {
+        float t = hit.t;
+        const int proxy = bvh.raycast(origin, direction, t, [&](int proxy, float tmax)
+                                      {
+            const auto entity = entt::entity{bvh.getUserData(proxy)};
+            const auto &meshRef = registry.get<MeshRef>(entity);
+            if (auto animator = registry.try_get<Animator>(entity))
+                meshRef.mesh->animate(animator->clipIndex, animator->poseTime);
+
+            // Ray parameters are the same in model space, since the direction
+            // is not normalized
+            const glm::mat4 invM = glm::inverse(registry.get<Transform>(entity).worldMatrix);
+            RenderableMesh::MeshHit meshHit{tmax};
+            if (!meshRef.mesh->raycast(glm::vec3(invM * glm::vec4(origin, 1.0f)),
+                                       glm::vec3(invM * glm::vec4(direction, 0.0f)),
+                                       meshHit))
+                return tmax;
+            // Hits are only accepted when closer, so the latest one is the closest
+            hit = meshHit;
+            return meshHit.t; });
+
+        return proxy == EENG_NULL_INDEX ? entt::null : entt::entity{bvh.getUserData(proxy)};
+    }
+
+    void skinEntities(entt::registry &registry,
+                      ForwardRenderer &renderer,
+                      const glm::mat4 &ProjViewMatrix)
+    {
+        for (auto [entity, animator, meshRef, bounds] : registry.view<Animator, MeshRef, Bounds>().each())
+        {
+            // Instances outside the view are only needed as occluders. Their
+            // caches are invalidated, so that they are posed if drawn anyway.
+            if (!meshRef.isOccluder && bounds.world && isOutsideFrustum(bounds.world, ProjViewMatrix))
+            {
+                if (animator.skinCache)
+                    animator.skinCache->invalidate();
+                continue;
+            }
+
+            if (!animator.skinCache)
+                animator.skinCache = std::make_shared<SkinnedVertexCache>();
+            meshRef.mesh->animate(animator.clipIndex, animator.poseTime);
+            renderer.skinMesh(meshRef.mesh, *animator.skinCache);
+        }
+    }
+
+    RenderSystemStats renderEntities(entt::registry &registry,
+                                     ForwardRenderer &renderer,
+                                     const glm::mat4 &ProjViewMatrix,
+                                     bool useSkinCaches,
+                                     const DynamicBvh *bvh)
+    {
+        RenderSystemStats stats;
+        int nbrRendered = 0;
+
+        // Meshes are shared, so each instance is posed right before it is
+        // queued, unless it is drawn from a skin cache in its pose
+        auto pose = [&](entt::entity entity, MeshRef &meshRef) -> const SkinnedVertexCache *
+        {
+            auto animator = registry.try_get<Animator>(entity);
+            if (!animator)
+                return nullptr;
+            if (useSkinCaches && animator->skinCache && animator->skinCache->isValidFor(*meshRef.mesh))
+                return animator->skinCache.get();
+            meshRef.mesh->animate(animator->clipIndex, animator->poseTime);
+            return nullptr;
+        };
+
+        auto render = [&](entt::entity entity, MeshRef &meshRef, const Transform &tfm)
+        {
+            nbrRendered++;
+            renderer.renderMesh(meshRef.mesh, tfm.worldMatrix, pose(entity, meshRef), &meshRef.lod);
+        };
+
+        auto addOccluder = [&](entt::entity entity, MeshRef &meshRef, const Transform &tfm)
+        {
+            const auto skinCache = pose(entity, meshRef);
+            renderer.addOccluder(meshRef.mesh, tfm.worldMatrix, skinCache ? skinCache->getNodeMatrices().data() : nullptr);
+        };
+
+        if (bvh)
+        {
+            for (auto [entity, meshRef, bounds, tfm] : meshGroup(registry).each())
+            {
+                stats.entities++;
+                if (meshRef.isOccluder)
+                    addOccluder(entity, meshRef, tfm);
+                // Entities without proxies are tested one by one
+                if (bounds.proxy == EENG_NULL_INDEX &&
+                    !(bounds.world && isOutsideFrustum(bounds.world, ProjViewMatrix)))
+                    render(entity, meshRef, tfm);
+            }
+
+            std::vector<int> visible;
+            bvh->queryFrustum(ProjViewMatrix, visible);
+            for (int proxy : visible)
+            {
+                const auto entity = entt::entity{bvh->getUserData(proxy)};
+                render(entity, registry.get<MeshRef>(entity), registry.get<Transform>(entity));
+            }
+        }
+        else
+        {
+            for (auto [entity, meshRef, bounds, tfm] : meshGroup(registry).each())
+            {
+                stats.entities++;
+                if (meshRef.isOccluder)
+                    addOccluder(entity, meshRef, tfm);
+                if (!(bounds.world && isOutsideFrustum(bounds.world, ProjViewMatrix)))
+                    render(entity, meshRef, tfm);
+            }
+        }
+
+        stats.culled = stats.entities - nbrRendered;
+        return stats;
+    }
+
+    void RenderSnapshot::clear()
+    {
+        instances.clear();
+        matrices.clear();
+        stats = RenderSystemStats{};
+    }
+
+    void captureEntities(entt::registry &registry,
+                         const glm::mat4 &ProjViewMatrix,
+                         const DynamicBvh *bvh,
+                         RenderSnapshot &snapshot)
+    {
+        // Levels of detail selected when the snapshot was last rendered
+        for (const auto &instance : snapshot.instances)
+            if (instance.isVisible && registry.valid(instance.entity))
+                if (auto meshRef = registry.try_get<MeshRef>(instance.entity); meshRef && meshRef->mesh == instance.mesh)
+                    meshRef->lod = instance.lod;
+
+        snapshot.clear();
+        int nbrVisible = 0;
+
+        auto capture = [&](entt::entity entity, MeshRef &meshRef, const Transform &tfm, bool isOccluder, bool isVisible)
+        {
+            if (!isOccluder && !isVisible)
+                return;
+            nbrVisible += isVisible;
+
+            // Meshes are shared, so each instance is posed right before it is captured
+            auto &mesh = *meshRef.mesh;
+            if (auto animator = registry.try_get<Animator>(entity))
+                mesh.animate(animator->clipIndex, animator->poseTime);
+
+            RenderSnapshot::Instance instance;
+            instance.entity = entity;
+            instance.mesh = meshRef.mesh;
+            instance.worldMatrix = tfm.worldMatrix;
+            instance.poseAABB = mesh.m_model_aabb ? mesh.m_model_aabb : mesh.mSceneAABB;
+            instance.nodeMatrices = (unsigned)snapshot.matrices.size();
+            instance.boneMatrices = -1;
+            instance.lod = meshRef.lod;
+            instance.isOccluder = isOccluder;
+            instance.isVisible = isVisible;
+
+            for (const auto &submesh : mesh.m_meshes)
+                snapshot.matrices.push_back(submesh.node_index != EENG_NULL_INDEX
+                                                ? mesh.m_nodetree.nodes[submesh.node_index].global_tfm
+                                                : glm::mat4{1.0f});
+            if (mesh.boneMatrices.size())
+            {
+                instance.boneMatrices = (int)snapshot.matrices.size();
+                snapshot.matrices.insert(snapshot.matrices.end(), mesh.boneMatrices.begin(), mesh.boneMatrices.end());
+            }
+            snapshot.instances.push_back(std::move(instance));
+        };
+
+        // Same instances as renderEntities()
+        if (bvh)
+        {
+            for (auto [entity, meshRef, bounds, tfm] : meshGroup(registry).each())
+            {
+                snapshot.stats.entities++;
+                // Entities without proxies are tested one by one
+                const bool isVisible = bounds.proxy == EENG_NULL_INDEX &&
+                                       !(bounds.world && isOutsideFrustum(bounds.world, ProjViewMatrix));
+                capture(entity, meshRef, tfm, meshRef.isOccluder, isVisible);
+            }
+
+            std::vector<int> visible;
+            bvh->queryFrustum(ProjViewMatrix, visible);
+            for (int proxy : visible)
+            {
+                const auto entity = entt::entity{bvh->getUserData(proxy)};
+                capture(entity, registry.get<MeshRef>(entity), registry.get<Transform>(entity), false, true);
+            }
+        }
+        else
+        {
+            for (auto [entity, meshRef, bounds, tfm] : meshGroup(registry).each())
+            {
+                snapshot.stats.entities++;
+                const bool isVisible = !(bounds.world && isOutsideFrustum(bounds.world, ProjViewMatrix));
+                capture(entity, meshRef, tfm, meshRef.isOccluder, isVisible);
+            }
+        }
+
+        snapshot.stats.culled = snapshot.stats.entities - nbrVisible;
+    }
+
+    void renderSnapshot(RenderSnapshot &snapshot,
+                        ForwardRenderer &renderer)
+    {
+        for (auto &instance : snapshot.instances)
+        {
+            const glm::mat4 *nodeMatrices = snapshot.matrices.data() + instance.nodeMatrices;
+            if (instance.isOccluder)
+                renderer.addOccluder(instance.mesh, instance.worldMatrix, nodeMatrices);
+            if (instance.isVisible)
+                renderer.renderMesh(instance.mesh,
+                                    instance.worldMatrix,
+                                    nodeMatrices,
+                                    instance.boneMatrices >= 0 ? snapshot.matrices.data() + instance.boneMatrices : nullptr,
+                                    instance.poseAABB,
+                                    &instance.lod);
+        }
+    }
+
+} // namespace eeng
@@ -0,0 +1,171 @@
+
+#ifndef SceneSystems_hpp
+#define SceneSystems_hpp
+
+#include <vector>
+#include <memory>
+#include <entt/entt.hpp>
+#include <glm/glm.hpp>
+
+#include "SceneComponents.hpp"
+#include "DynamicBvh.hpp"
+
+namespace eeng
+{
+    /// @brief Counters of the latest call to renderEntities()
+    struct RenderSystemStats
+    {
+        int entities = 0; ///< Entities with a mesh
+        int culled = 0;   ///< Entities outside the view frustum
+    };
+
+    /// @brief Draw list of a frame, captured for rendering on another thread
+    /** Holds the visible instances and occluders with everything that
+     * depends on the pose of their meshes, so that meshes can be animated
+     * for the next frame while this one is rendered.
+     */
+    struct RenderSnapshot
+    {
+        struct Instance
+        {
+            entt::entity entity;
+            std::shared_ptr<RenderableMesh> mesh;
+            glm::mat4 worldMatrix;
+            AABB poseAABB;              ///< Model space
+            unsigned nodeMatrices;      ///< First of the node transforms of the submeshes in matrices
+            int boneMatrices;           ///< First bone matrix in matrices, or -1 without bones
+            LodState lod;               ///< Of the entity, updated when rendered and written back by the next capture
+            bool isOccluder;
+            bool isVisible;             ///< Occluders may be culled as draws
+        };
+        std::vector<Instance> instances;
+        std::vector<glm::mat4> matrices;
+
+        // Camera and light
+        glm::mat4 ProjMatrix{1.0f}, ViewMatrix{1.0f};
+        glm::vec3 eyePos{0.0f}, lightPos{0.0f}, lightColor{1.0f};
+
+        RenderSystemStats stats;
+
+        /// @brief Remove all instances, keeping allocations
+        void clear();
+    };
+
+    /// @brief Create the storages and groups used by the systems
+    /// Call once before running systems concurrently, since creating them
+    /// modifies the registry.
+    void prepareSystems(entt::registry &registry);
+
+    /// @brief Attach an entity to a parent, or detach it if parent is entt::null
+    /// Both entities must have a Transform. Entities are expected to be attached
+    /// before children are attached to them, since the depths of existing
+    /// children are not updated.
+    void setParent(entt::registry &registry,
+                   entt::entity entity,
+                   entt::entity parent);
+
+    /// @brief Keep the state of transforms and animators before a simulation step
+    /// Rendered frames can then be interpolated between the two latest
+    /// steps, see updateTransforms() and interpolateAnimators().
+    void storePreviousState(entt::registry &registry);
+
+    /// @brief Compute world matrices from transforms
+    /** Transforms are kept sorted by depth, so that parents are visited
+     * before their children in a single pass over the transform storage.
+     * The storage is sorted again only when a transform is found out of order.
+     * @param alpha Interpolation between the previous and current placement
+     * of transforms that have one, where 1 is the current placement
+     */
+    void updateTransforms(entt::registry &registry,
+                          float alpha = 1.0f);
+
+    /// @brief Advance the clocks of all animators
+    /// Poses are set to the new clip times.
+    void updateAnimators(entt::registry &registry,
+                         float deltaTime_s);
+
+    /// @brief Set the pose times of animators between their previous and current clip times
+    /// @param alpha Interpolation, where 1 is the current clip time
+    void interpolateAnimators(entt::registry &registry,
+                              float alpha);
+
+    /// @brief Transform local bounds to world space
+    void updateBounds(entt::registry &registry);
+
+    /// @brief Add an entity with Bounds to a BVH
+    /// The user data of the proxy is the entity. Entities with empty local
+    /// bounds are not added.
+    void addToBvh(entt::registry &registry,
+                  entt::entity entity,
+                  DynamicBvh &bvh);
+
+    /// @brief Remove an entity from the BVH it was added to
+    void removeFromBvh(entt::registry &registry,
+                       entt::entity entity,
+                       DynamicBvh &bvh);
+
+    /// @brief Move BVH proxies to the world bounds of their entities, and refit or rebuild
+    void updateBvh(entt::registry &registry,
+                   DynamicBvh &bvh);
+
+    /// @brief Closest entity hit by a ray, tested against the triangles of its mesh
+    /// Entities are found with a BVH raycast, and animated entities are posed
+    /// as they are tested. Meshes are therefore left in the pose of the latest
+    /// entity tested. Entities without BVH proxies are not tested.
+    /// @param direction Ray direction, need not be normalized
+    /// @param hit Largest ray parameter on input, the hit on output if there is one.
+    /// Apart from the ray parameter, it is in the model space of the hit entity.
+    /// @return Hit entity, or entt::null
+    entt::entity pickEntity(entt::registry &registry,
+                            const DynamicBvh &bvh,
+                            const glm::vec3 &origin,
+                            const glm::vec3 &direction,
+                            RenderableMesh::MeshHit &hit);
+
+    /// @brief Pose and skin animated entities into their own vertex caches
+    /// Call between ForwardRenderer::beginSkinningPass() and endSkinningPass().
+    /// Entities outside the view frustum are skipped unless they are occluders,
+    /// so their bounds should contain all of their poses.
+    /// @param ProjViewMatrix Camera projection and view, for frustum culling
+    void skinEntities(entt::registry &registry,
+                      ForwardRenderer &renderer,
+                      const glm::mat4 &ProjViewMatrix);
+
+    /// @brief Queue all visible entities with meshes for rendering
+    /// Call between ForwardRenderer::beginPass() and endPass().
+    /// @param ProjViewMatrix Camera projection and view, for frustum culling
+    /// @param useSkinCaches Draw animated entities from the vertex caches
+    /// written by skinEntities(), rather than posing them here. Entities
+    /// without a valid cache, e.g. with meshes without bones, are posed.
+    /// @param bvh If given, visible entities are found with a frustum query
+    /// against it, rather than by testing every entity
+    RenderSystemStats renderEntities(entt::registry &registry,
+                                     ForwardRenderer &renderer,
+                                     const glm::mat4 &ProjViewMatrix,
+                                     bool useSkinCaches,
+                                     const DynamicBvh *bvh = nullptr);
+
+    /// @brief Capture the entities that renderEntities() would queue, posed, into a snapshot
+    /** Meshes are animated to capture their poses. Camera and light are
+     * left as they are. Levels of detail are copied, and the levels the
+     * snapshot was last rendered with are first written back to entities
+     * that still exist, so that entities may be created and destroyed while
+     * a snapshot is rendered.
+     * @param ProjViewMatrix Camera projection and view, for frustum culling
+     * @param bvh If given, visible entities are found with a frustum query
+     */
+    void captureEntities(entt::registry &registry,
+                         const glm::mat4 &ProjViewMatrix,
+                         const DynamicBvh *bvh,
+                         RenderSnapshot &snapshot);
+
+    /// @brief Queue the instances of a snapshot for rendering
+    /// Call between ForwardRenderer::beginPass() and endPass(). Meshes are
+    /// not read for their poses, so they may be animated concurrently.
+    /// Levels of detail are updated in the snapshot, not in the registry.
+    void renderSnapshot(RenderSnapshot &snapshot,
+                        ForwardRenderer &renderer);
+
+} // namespace eeng
+
+#endif /* SceneSystems_hpp */
@@ -0,0 +1,276 @@
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+#include "ShaderLoader.h"
+#include "ShaderCache.hpp"
+#include "Log.hpp"
+
+namespace eeng
+{
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        /// Header of a stored binary, followed by the binary itself
+        struct BinaryHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t key;
+            uint32_t format; // Binary format of the driver
+            uint32_t length;
+        };
+
+        const uint32_t BinaryMagic = 0x43534545; // "EESC"
+        const uint32_t BinaryVersion = 1;
+
+        /// FNV-1a, continued from a previous hash
+        uint64_t hashBytes(uint64_t hash, const void *data, size_t length)
+        {
+            const uint8_t *bytes = (const uint8_t *)data;
+            for (size_t i = 0; i < length; i++)
+            {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        /// Hash a string and a terminator, so that consecutive strings cannot run into each other
+        uint64_t hashString(uint64_t hash, const char *str)
+        {
+            return hashBytes(hash, str, std::strlen(str) + 1);
+        }
+
+        /// Insert defines after the #version line, which must come first
+        std::string insertDefines(const std::string &source, const std::string &defines)
+        {
+            if (defines.empty())
+                return source;
+            const size_t version = source.find("#version");
+            if (version == std::string::npos)
+                return defines + source;
+            const size_t lineEnd = source.find('\n', version);
+            if (lineEnd == std::string::npos)
+                return source + "\n" + defines;
+            return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+        }
+
+        std::string getGLString(GLenum name)
+        {
+            const GLubyte *str = glGetString(name);
+            return str ? (const char *)str : "";
+        }
+    }
+
+    ShaderCache::ShaderCache(const std::string &directory)
+        : directory(directory)
+    {
+    }
+
+    GLuint ShaderCache::createProgram(const std::string &vertSource,
+                                      const std::string &fragSource,
+                                      const std::string &defines)
+    {
+        const std::string vert = insertDefines(vertSource, defines);
+        const std::string frag = insertDefines(fragSource, defines);
+        const bool cached = enabled && isSupported();
+        const uint64_t key = cached ? makeKey(vert, frag, defines, nullptr, 0) : 0;
+        return create(cached, key, [&](bool retrievable)
+                      { return createShaderProgram(vert.c_str(), frag.c_str(), retrievable); });
+    }
+
+    GLuint ShaderCache::createTransformFeedbackProgram(const std::string &vertSource,
+                                                       const char *const *varyings,
+                                                       int nbrVaryings,
+                                                       const std::string &defines)
+    {
+        const std::string vert = insertDefines(vertSource, defines);
+        const bool cached = enabled && isSupported();
+        const uint64_t key = cached ? makeKey(vert, "", defines, varyings, nbrVaryings) : 0;
+        return create(cached, key, [&](bool retrievable)
+                      { return ::createTransformFeedbackProgram(vert.c_str(), varyings, nbrVaryings, retrievable); });
+    }
+
+    void ShaderCache::setEnabled(bool enabled)
+    {
+        this->enabled = enabled;
+    }
+
+    bool ShaderCache::getEnabled() const
+    {
+        return enabled;
+    }
+
+    void ShaderCache::clear()
+    {
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+            if (entry.path().extension() == ".bin")
+                std::filesystem::remove(entry.path(), error);
+    }
+
+    const std::string &ShaderCache::getDirectory() const
+    {
+        return directory;
+    }
+
+    const ShaderCacheStats &ShaderCache::getStats() const
+    {
+        return stats;
+    }
+
+    void ShaderCache::clearStats()
+    {
+        stats = ShaderCacheStats{};
+    }
+
+    bool ShaderCache::isSupported()
+    {
+        if (!driverQueried)
+        {
+            GLint nbrFormats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nbrFormats);
+            driverSupported = nbrFormats > 0;
+            driverString = getGLString(GL_VENDOR) + ", " + getGLString(GL_RENDERER) + ", " + getGLString(GL_VERSION);
+            driverQueried = true;
+            if (!driverSupported)
+                EENG_LOG(Log::Warning, "Shader cache disabled, no program binary formats (%s)", driverString.c_str());
+        }
+        return driverSupported;
+    }
+
+    uint64_t ShaderCache::makeKey(const std::string &vertSource,
+                                  const std::string &fragSource,
+                                  const std::string &defines,
+                                  const char *const *varyings,
+                                  int nbrVaryings) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        hash = hashString(hash, driverString.c_str());
+        hash = hashString(hash, defines.c_str());
+        hash = hashString(hash, vertSource.c_str());
+        hash = hashString(hash, fragSource.c_str());
+        for (int i = 0; i < nbrVaryings; i++)
+            hash = hashString(hash, varyings[i]);
+        return hash;
+    }
+
+    std::string ShaderCache::getPath(uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return (std::filesystem::path(directory) / name).string();
+    }
+
+    GLuint ShaderCache::create(bool cached, uint64_t key, const std::function<GLuint(bool)> &compile)
+    {
+        const auto start = Clock::now();
+        GLuint program = cached ? load(key) : 0;
+        if (!cached)
+            stats.misses++;
+        if (!program)
+        {
+            program = compile(cached);
+            if (cached)
+                store(key, program);
+        }
+
+        stats.ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        return program;
+    }
+
+    GLuint ShaderCache::load(uint64_t key)
+    {
+        std::ifstream file(getPath(key), std::ios::binary);
+        if (!file.is_open())
+        {
+            stats.misses++;
+            return 0;
+        }
+
+        BinaryHeader header;
+        std::vector<char> binary;
+        if (file.read((char *)&header, sizeof(header)) &&
+            header.magic == BinaryMagic &&
+            header.version == BinaryVersion &&
+            header.key == key)
+        {
+            binary.resize(header.length);
+            file.read(binary.data(), header.length);
+        }
+        if (binary.empty() || !file)
+        {
+            EENG_LOG(Log::Warning, "Shader cache: invalid file %s, compiling", getPath(key).c_str());
+            stats.rejected++;
+            return 0;
+        }
+
+        // Errors of glProgramBinary are reported by the link status, except
+        // for unknown formats which also raise GL_INVALID_ENUM
+        CheckAndThrowGLErrors();
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+        GLint linkStatus = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+        glGetError();
+        if (linkStatus != GL_TRUE)
+        {
+            EENG_LOG(Log::Warning, "Shader cache: binary %s rejected by the driver, compiling", getPath(key).c_str());
+            glDeleteProgram(program);
+            stats.rejected++;
+            return 0;
+        }
+
+        stats.hits++;
+        return program;
+    }
+
+    void ShaderCache::store(uint64_t key, GLuint program)
+    {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+        {
+            EENG_LOG(Log::Warning, "Shader cache: driver returned no binary");
+            return;
+        }
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+        CheckAndThrowGLErrors();
+
+        // Written to a temporary file first, so that an interrupted write
+        // never leaves a truncated binary behind
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        const std::string path = getPath(key);
+        const std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            const BinaryHeader header{BinaryMagic, BinaryVersion, key, format, (uint32_t)length};
+            file.write((const char *)&header, sizeof(header));
+            file.write(binary.data(), length);
+            if (!file)
+            {
+                EENG_LOG(Log::Warning, "Shader cache: cannot write %s", tempPath.c_str());
+                return;
+            }
+        }
+        std::filesystem::rename(tempPath, path, error);
+        if (error)
+        {
+            EENG_LOG(Log::Warning, "Shader cache: cannot write %s: %s", path.c_str(), error.message().c_str());
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+        stats.stored++;
+    }
+
+} // namespace eeng
@@ -0,0 +1,110 @@
+
+#ifndef ShaderCache_hpp
+#define ShaderCache_hpp
+
+#include <string>
+#include <cstdint>
+#include <functional>
+#include "glcommon.h"
+
+namespace eeng
+{
+    /// @brief Counters of the programs created through a ShaderCache
+    struct ShaderCacheStats
+    {
+        int hits = 0;       ///< Programs created from a stored binary
+        int misses = 0;     ///< Programs compiled, with no binary stored or with the cache disabled
+        int rejected = 0;   ///< Stored binaries the driver did not accept, then compiled
+        int stored = 0;     ///< Binaries written after compiling
+        double ms = 0.0;    ///< Time spent creating programs
+    };
+
+    /// @brief Persistent cache of linked shader programs
+    /** Compiled programs are stored on disk as program binaries
+     * (glGetProgramBinary), one file per program, and loaded with
+     * glProgramBinary when created again. Files are keyed by a 64-bit FNV-1a
+     * hash of the sources, the defines, and the vendor, renderer and version
+     * strings of the driver, so that editing a shader or updating the driver
+     * never loads a stale binary.
+     *
+     * Drivers may reject a binary anyway, e.g. after an update that kept the
+     * version string. The program is then compiled from source and its
+     * binary stored again. Drivers without binary formats are not cached.
+     * Needs a current GL context.
+     */
+    class ShaderCache
+    {
+        std::string directory;
+        bool enabled = true;
+        bool driverQueried = false;
+        bool driverSupported = false;
+        std::string driverString;
+        ShaderCacheStats stats;
+
+    public:
+        /// @param directory Where binaries are stored. Created when the first binary is stored.
+        explicit ShaderCache(const std::string &directory);
+
+        /// @brief Create a program from a vertex and a fragment shader
+        /// Throws if compiling or linking fails.
+        /// @param defines Lines inserted after the #version line of both
+        /// shaders, e.g. "#define USE_FOG 1\n", for variants of the same sources
+        GLuint createProgram(const std::string &vertSource,
+                             const std::string &fragSource,
+                             const std::string &defines = "");
+
+        /// @brief Create a vertex-only program capturing the given outputs, see createTransformFeedbackProgram
+        GLuint createTransformFeedbackProgram(const std::string &vertSource,
+                                              const char *const *varyings,
+                                              int nbrVaryings,
+                                              const std::string &defines = "");
+
+        /// @brief Bypass the cache, so that all programs are compiled
+        void setEnabled(bool enabled);
+
+        bool getEnabled() const;
+
+        /// @brief Delete all stored binaries
+        void clear();
+
+        const std::string &getDirectory() const;
+
+        const ShaderCacheStats &getStats() const;
+
+        void clearStats();
+
+        ShaderCache(const ShaderCache &) = delete;
+        ShaderCache &operator=(const ShaderCache &) = delete;
+
+    private:
+        /// @brief Query the driver string and whether there are binary formats
+        bool isSupported();
+
+        /// @brief Hash of a program's sources, defines and the driver string
+        /// The driver is queried by isSupported() first.
+        uint64_t makeKey(const std::string &vertSource,
+                         const std::string &fragSource,
+                         const std::string &defines,
+                         const char *const *varyings,
+                         int nbrVaryings) const;
+
+        std::string getPath(uint64_t key) const;
+
+        /// @brief Load the program of a key, or compile it and store its binary
+        /// @param cached Use the cache, or only compile
+        /// @param compile Compiles and links the program, retrievable if its argument is true
+        GLuint create(bool cached,
+                      uint64_t key,
+                      const std::function<GLuint(bool)> &compile);
+
+        /// @brief Load a stored binary into a new program
+        /// @return The program, or 0 if there is no binary or it was rejected
+        GLuint load(uint64_t key);
+
+        /// @brief Store the binary of a linked program. Failures are logged, not thrown.
+        void store(uint64_t key, GLuint program);
+    };
+
+} // namespace eeng
+
+#endif /* ShaderCache_hpp */
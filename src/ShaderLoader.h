@@ -45,8 +45,10 @@ static void printShaderLog(GLuint obj,
 	}
 }
 
+/// Compile and link a program. A retrievable program can be stored with glGetProgramBinary.
 static GLuint createShaderProgram(const char *vertexShaderSource,
-								  const char *fragmentShaderSource)
+								  const char *fragmentShaderSource,
+								  bool retrievable = false)
 {
 	// Make sure GL-errors has not already been thrown elsewhere
 	CheckAndThrowGLErrors();
@@ -71,6 +73,8 @@ static GLuint createShaderProgram(const char *vertexShaderSource,
 	glAttachShader(program, fragmentShader);
 	printShaderLog(program, fragmentShader);
 
+	if (retrievable)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(program);
 	if (glGetError() != GL_NO_ERROR)
 	{
@@ -105,4 +109,43 @@ static GLuint createShaderProgram(const char *vertexShaderSource,
 	return program;
 }
 
+/// Create a vertex-only program that captures the given outputs with transform feedback.
+/// Outputs are written to separate buffers, in the order given.
+static GLuint createTransformFeedbackProgram(const char *vertexShaderSource,
+											 const char *const *varyings,
+											 int nbrVaryings,
+											 bool retrievable = false)
+{
+	// Make sure GL-errors has not already been thrown elsewhere
+	CheckAndThrowGLErrors();
+
+	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertexShader, 1, &vertexShaderSource, 0);
+
+	std::cout << "Compiling transform feedback vertex shader..." << std::endl;
+	glCompileShader(vertexShader);
+
+	GLuint program = glCreateProgram();
+
+	glAttachShader(program, vertexShader);
+	printShaderLog(program, vertexShader);
+
+	// Varyings must be declared before linking
+	glTransformFeedbackVaryings(program, nbrVaryings, varyings, GL_SEPARATE_ATTRIBS);
+
+	if (retrievable)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+	GLint linkStatus = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+	if (glGetError() != GL_NO_ERROR || linkStatus != GL_TRUE)
+	{
+		std::cerr << "errors:\n";
+		printShaderLog(program, vertexShader);
+		throw std::runtime_error("shader linking failed");
+	}
+
+	return program;
+}
+
 #endif
@@ -0,0 +1,75 @@
+
+#include <mutex>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include "StringId.hpp"
+
+namespace eeng
+{
+    namespace
+    {
+        struct StringTable
+        {
+            std::mutex mutex;
+            std::unordered_map<uint32_t, std::string> strings;
+            size_t nbrBytes = 0;
+        };
+
+        StringTable &getTable()
+        {
+            static StringTable table;
+            return table;
+        }
+
+        const std::string emptyString;
+    }
+
+    StringId::StringId(const char *str)
+    {
+        if (str)
+            intern(str, std::strlen(str));
+    }
+
+    StringId::StringId(const std::string &str)
+    {
+        intern(str.data(), str.size());
+    }
+
+    void StringId::intern(const char *str, size_t length)
+    {
+        id = hash(str, length);
+        if (!id)
+            return;
+
+        auto &table = getTable();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        auto [it, inserted] = table.strings.try_emplace(id, str, length);
+        if (inserted)
+            table.nbrBytes += length + 1;
+#ifndef NDEBUG
+        else if (it->second.compare(0, std::string::npos, str, length))
+            throw std::runtime_error("StringId collision between '" + it->second + "' and '" + std::string(str, length) + "'");
+#endif
+    }
+
+    const std::string &StringId::str() const
+    {
+        if (!id)
+            return emptyString;
+
+        auto &table = getTable();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        auto it = table.strings.find(id);
+        // Elements of unordered_map are not moved by later insertions
+        return it == table.strings.end() ? emptyString : it->second;
+    }
+
+    StringId::Stats StringId::getStats()
+    {
+        auto &table = getTable();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        return {table.strings.size(), table.nbrBytes};
+    }
+
+} // namespace eeng
@@ -0,0 +1,94 @@
+
+#ifndef StringId_hpp
+#define StringId_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <ostream>
+#include <functional>
+
+namespace eeng
+{
+    /// @brief Interned string, represented by a 32-bit hash of its characters
+    /** Strings are hashed with FNV-1a and stored once in a global table, so
+     * that ids can be compared, hashed and copied as integers and converted
+     * back to strings for display. The table is thread-safe.
+     *
+     * Debug builds check that no two different strings are given the same
+     * id and throw std::runtime_error if they are. Release builds skip the
+     * check.
+     */
+    class StringId
+    {
+        uint32_t id = 0; // 0 is the empty string
+
+    public:
+        StringId() = default;
+
+        /// @brief Intern a string
+        StringId(const char *str);
+
+        /// @brief Intern a string
+        StringId(const std::string &str);
+
+        /// @brief Id of a string, without interning it
+        static constexpr uint32_t hash(const char *str, size_t length)
+        {
+            uint32_t h = 2166136261u;
+            for (size_t i = 0; i < length; i++)
+            {
+                h ^= (uint8_t)str[i];
+                h *= 16777619u;
+            }
+            return length ? (h ? h : 1u) : 0u;
+        }
+
+        /// @brief Numeric id
+        uint32_t value() const { return id; }
+
+        /// @brief Interned string of this id, or an empty string if the id is not interned
+        const std::string &str() const;
+
+        const char *c_str() const { return str().c_str(); }
+
+        bool empty() const { return !id; }
+
+        bool operator==(const StringId &other) const { return id == other.id; }
+        bool operator!=(const StringId &other) const { return id != other.id; }
+        bool operator<(const StringId &other) const { return id < other.id; }
+
+        /// @brief Interning table statistics
+        struct Stats
+        {
+            size_t nbrStrings = 0; ///< Interned strings
+            size_t nbrBytes = 0;   ///< Characters stored, including terminators
+        };
+
+        static Stats getStats();
+
+    private:
+        void intern(const char *str, size_t length);
+    };
+
+    inline std::ostream &operator<<(std::ostream &os, const StringId &id)
+    {
+        return os << id.str();
+    }
+
+} // namespace eeng
+
+namespace std
+{
+    template <>
+    struct hash<eeng::StringId>
+    {
+        size_t operator()(const eeng::StringId &id) const noexcept
+        {
+            // Already a hash
+            return id.value();
+        }
+    };
+}
+
+#endif /* StringId_hpp */
@@ -0,0 +1,210 @@
+
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include "ThreadPool.hpp"
+#include "StringId.hpp"
+#include "Profiler.hpp"
+#include "SystemScheduler.hpp"
+
+namespace eeng
+{
+    namespace
+    {
+        using Clock = std::chrono::high_resolution_clock;
+
+        bool intersect(const ResourceSet &a, const ResourceSet &b)
+        {
+            for (const auto &resource : a)
+                if (std::find(b.begin(), b.end(), resource) != b.end())
+                    return true;
+            return false;
+        }
+    }
+
+    SystemScheduler::SystemScheduler(unsigned nbrThreads)
+        : threadPool(std::make_unique<ThreadPool>(nbrThreads))
+    {
+    }
+
+    SystemScheduler::~SystemScheduler() = default;
+
+    void SystemScheduler::addSystem(const std::string &name,
+                                    std::function<void()> func,
+                                    const ResourceSet &reads,
+                                    const ResourceSet &writes,
+                                    bool mainThread)
+    {
+        // System names are interned, since zones outlive the systems. Systems
+        // are added each frame, so names are only interned when first seen.
+        auto it = profileNames.find(name);
+        if (it == profileNames.end())
+            it = profileNames.emplace(name, StringId(name).c_str()).first;
+        systems.push_back({name, it->second, std::move(func), reads, writes, mainThread});
+    }
+
+    bool SystemScheduler::conflicts(const System &i,
+                                    const System &j) const
+    {
+        return intersect(i.writes, j.reads) ||
+               intersect(i.writes, j.writes) ||
+               intersect(i.reads, j.writes);
+    }
+
+    void SystemScheduler::run()
+    {
+        const auto start = Clock::now();
+        const size_t nbrSystems = systems.size();
+        trace.assign(nbrSystems, SystemTrace{});
+
+        auto execute = [&](size_t i, int thread)
+        {
+            trace[i].name = systems[i].name;
+            trace[i].thread = thread;
+            const auto systemStart = Clock::now();
+            {
+                EENG_PROFILE_SCOPE(systems[i].profileName);
+                systems[i].func();
+            }
+            const auto systemEnd = Clock::now();
+            trace[i].startMs = std::chrono::duration<float, std::milli>(systemStart - start).count();
+            trace[i].durationMs = std::chrono::duration<float, std::milli>(systemEnd - systemStart).count();
+        };
+
+        if (deterministic)
+        {
+            try
+            {
+                for (size_t i = 0; i < nbrSystems; i++)
+                    execute(i, 0);
+            }
+            catch (...)
+            {
+                systems.clear();
+                throw;
+            }
+            systems.clear();
+            return;
+        }
+
+        // Dependency graph: each system waits for the earlier systems it conflicts with
+        std::vector<std::vector<size_t>> successors(nbrSystems);
+        std::vector<int> nbrPending(nbrSystems, 0);
+        for (size_t j = 0; j < nbrSystems; j++)
+            for (size_t i = 0; i < j; i++)
+                if (conflicts(systems[i], systems[j]))
+                {
+                    successors[i].push_back(j);
+                    nbrPending[j]++;
+                }
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::vector<size_t> mainThreadReady;
+        std::vector<std::thread::id> threads{std::this_thread::get_id()};
+        std::exception_ptr exception;
+        size_t nbrCompleted = 0;
+
+        std::function<void(size_t)> dispatch;
+        auto runSystem = [&](size_t i)
+        {
+            int thread;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = std::find(threads.begin(), threads.end(), std::this_thread::get_id());
+                if (it == threads.end())
+                    it = threads.insert(threads.end(), std::this_thread::get_id());
+                thread = (int)(it - threads.begin());
+            }
+
+            try
+            {
+                execute(i, thread);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!exception)
+                    exception = std::current_exception();
+            }
+
+            // Release successors
+            std::vector<size_t> ready;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t j : successors[i])
+                    if (!--nbrPending[j])
+                        ready.push_back(j);
+            }
+            for (size_t j : ready)
+                dispatch(j);
+
+            // Last access to shared state, since run() may return after this
+            std::lock_guard<std::mutex> lock(mutex);
+            nbrCompleted++;
+            condition.notify_all();
+        };
+        dispatch = [&](size_t i)
+        {
+            if (systems[i].mainThread)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                mainThreadReady.push_back(i);
+                condition.notify_all();
+            }
+            else
+                threadPool->enqueue([&runSystem, i]()
+                                    { runSystem(i); });
+        };
+
+        for (size_t i = 0; i < nbrSystems; i++)
+            if (!nbrPending[i])
+                dispatch(i);
+
+        // Run main thread systems as they become ready, until all systems are done
+        std::unique_lock<std::mutex> lock(mutex);
+        while (nbrCompleted < nbrSystems)
+        {
+            condition.wait(lock, [&]()
+                           { return nbrCompleted == nbrSystems || !mainThreadReady.empty(); });
+            if (mainThreadReady.empty())
+                continue;
+
+            // Earliest added first
+            auto it = std::min_element(mainThreadReady.begin(), mainThreadReady.end());
+            const size_t i = *it;
+            mainThreadReady.erase(it);
+            lock.unlock();
+            runSystem(i);
+            lock.lock();
+        }
+        lock.unlock();
+
+        systems.clear();
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+
+    const std::vector<SystemTrace> &SystemScheduler::getTrace() const
+    {
+        return trace;
+    }
+
+    void SystemScheduler::setDeterministic(bool deterministic)
+    {
+        this->deterministic = deterministic;
+    }
+
+    bool SystemScheduler::getDeterministic() const
+    {
+        return deterministic;
+    }
+
+    unsigned SystemScheduler::getNbrThreads() const
+    {
+        return threadPool->getNbrThreads();
+    }
+
+} // namespace eeng
@@ -0,0 +1,108 @@
+
+#ifndef SystemScheduler_hpp
+#define SystemScheduler_hpp
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <typeindex>
+#include <unordered_map>
+
+namespace eeng
+{
+    class ThreadPool;
+
+    /// @brief Set of resource types, e.g. components, accessed by a system
+    using ResourceSet = std::vector<std::type_index>;
+
+    /// @brief Resource types accessed by a system
+    template <class... T>
+    ResourceSet resources()
+    {
+        return {std::type_index(typeid(T))...};
+    }
+
+    /// @brief Timing of a system during the latest frame
+    struct SystemTrace
+    {
+        std::string name;
+        int thread = 0;        ///< 0 is the thread that called run()
+        float startMs = 0.0f;  ///< Relative to the start of run()
+        float durationMs = 0.0f;
+    };
+
+    /// @brief Runs systems concurrently, as allowed by the resources they read and write
+    /** Systems are added each frame, in the order they would run serially.
+     * When run, each system waits for all earlier systems it conflicts with:
+     * those that write a resource it reads or writes, and those that read a
+     * resource it writes. Results are therefore the same as for serial
+     * execution, as long as systems only touch the resources they declare.
+     *
+     * Systems that must run on the calling thread, e.g. those using GL, are
+     * added with mainThread set. In deterministic mode all systems run on
+     * the calling thread in the order they were added.
+     *
+     * Systems that iterate entt registries concurrently must not cause
+     * storages or groups to be created, so these should exist beforehand.
+     */
+    class SystemScheduler
+    {
+        struct System
+        {
+            std::string name;
+            const char *profileName; ///< Interned name, for profiler zones
+            std::function<void()> func;
+            ResourceSet reads, writes;
+            bool mainThread = false;
+        };
+
+        std::vector<System> systems;
+        std::unordered_map<std::string, const char *> profileNames; ///< Names interned so far
+        std::vector<SystemTrace> trace;
+        std::unique_ptr<ThreadPool> threadPool;
+        bool deterministic = false;
+
+    public:
+        /// @brief Create scheduler
+        /// @param nbrThreads Number of worker threads, see ThreadPool
+        explicit SystemScheduler(unsigned nbrThreads = 0);
+
+        ~SystemScheduler();
+
+        /// @brief Add a system to the current frame
+        /// @param name Name shown in traces
+        /// @param func System
+        /// @param reads Resources the system reads, e.g. resources<Transform, MeshRef>()
+        /// @param writes Resources the system writes
+        /// @param mainThread Run on the thread that calls run()
+        void addSystem(const std::string &name,
+                       std::function<void()> func,
+                       const ResourceSet &reads,
+                       const ResourceSet &writes,
+                       bool mainThread = false);
+
+        /// @brief Run all added systems and wait for them to finish
+        /// Systems are removed once run. Exceptions thrown by systems are
+        /// rethrown after all other systems have finished.
+        void run();
+
+        /// @brief Systems of the latest run, in the order they were added
+        const std::vector<SystemTrace> &getTrace() const;
+
+        /// @brief Run systems serially in the order they were added
+        void setDeterministic(bool deterministic);
+
+        bool getDeterministic() const;
+
+        unsigned getNbrThreads() const;
+
+    private:
+        /// @brief System j must wait for system i
+        bool conflicts(const System &i,
+                       const System &j) const;
+    };
+
+} // namespace eeng
+
+#endif /* SystemScheduler_hpp */
@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include "Texture.hpp"
+#include "GLStateCache.hpp"
 
 #define STBI_NO_HDR
 #define STB_IMAGE_IMPLEMENTATION
@@ -123,7 +124,7 @@ void Texture2D::load_to_VRAM(const std::string &name,
     m_name = name;
 
     glGenTextures(1, &m_handle);
-    glBindTexture(GL_TEXTURE_2D, m_handle);
+    eeng::GLStateCache::instance().bindTexture(GL_TEXTURE_2D, m_handle);
 
     // Minification & magnification filters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, m_filter_mode.min_filter);
@@ -147,7 +148,7 @@ void Texture2D::load_to_VRAM(const std::string &name,
 
     glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, GL_UNSIGNED_BYTE, image);
     glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    eeng::GLStateCache::instance().bindTexture(GL_TEXTURE_2D, 0);
     CheckAndThrowGLErrors();
 }
 
@@ -158,19 +159,19 @@ GLuint Texture2D::getHandle()
 
 void Texture2D::bind(GLenum p_texture_slot) const
 {
-    glActiveTexture(p_texture_slot);
-    glBindTexture(GL_TEXTURE_2D, m_handle);
+    eeng::GLStateCache::instance().bindTexture(p_texture_slot, GL_TEXTURE_2D, m_handle);
 }
 
 void Texture2D::unbind() const
 {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    eeng::GLStateCache::instance().bindTexture(GL_TEXTURE_2D, 0);
 }
 
 void Texture2D::free()
 {
     if (m_handle)
     {
+        eeng::GLStateCache::instance().forgetTexture(m_handle);
         glDeleteTextures(1, &m_handle);
         m_handle = 0;
     }
@@ -179,7 +180,7 @@ void Texture2D::free()
 void gl_cubemap_t::load_from_files(const std::string filepaths[])
 {
     glGenTextures(1, &m_handle);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, m_handle);
+    eeng::GLStateCache::instance().bindTexture(GL_TEXTURE_CUBE_MAP, m_handle);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -194,9 +195,9 @@ void gl_cubemap_t::load_from_files(const std::string filepaths[])
     for (int i = 0; i < 6; i++)
         load_from_file(filepaths[i], GL_TEXTURE_CUBE_MAP_POSITIVE_X + i);
 
-    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    eeng::GLStateCache::instance().enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
     glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    eeng::GLStateCache::instance().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
     CheckAndThrowGLErrors();
 }
 
@@ -270,11 +271,10 @@ void gl_cubemap_t::load_to_VRAM(const unsigned char *image,
 
 void gl_cubemap_t::bind(GLenum p_texture_slot)
 {
-    glActiveTexture(p_texture_slot);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, m_handle);
+    eeng::GLStateCache::instance().bindTexture(p_texture_slot, GL_TEXTURE_CUBE_MAP, m_handle);
 }
 
 void gl_cubemap_t::unbind()
 {
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    eeng::GLStateCache::instance().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
 }
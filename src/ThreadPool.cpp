@@ -0,0 +1,68 @@
+
+#include "ThreadPool.hpp"
+
+namespace eeng
+{
+    ThreadPool::ThreadPool(unsigned nbrThreads)
+    {
+        if (!nbrThreads)
+        {
+            const unsigned hardwareThreads = std::thread::hardware_concurrency();
+            nbrThreads = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+        }
+
+        workers.reserve(nbrThreads);
+        for (unsigned i = 0; i < nbrThreads; i++)
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    unsigned ThreadPool::getNbrThreads() const
+    {
+        return (unsigned)workers.size();
+    }
+
+    bool ThreadPool::runPendingTask()
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty())
+                return false;
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+        return true;
+    }
+
+    void ThreadPool::workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]()
+                               { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+} // namespace eeng
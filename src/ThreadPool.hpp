@@ -0,0 +1,145 @@
+
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <vector>
+#include <algorithm>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <memory>
+
+namespace eeng
+{
+    /// @brief A fixed set of worker threads executing queued tasks
+    /** The thread that waits for work to finish (e.g. in parallelFor) helps
+     * out by running queued tasks, so that nested parallel calls from within
+     * a task cannot deadlock.
+     */
+    class ThreadPool
+    {
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stopping = false;
+
+    public:
+        /// @brief Create pool
+        /// @param nbrThreads Number of worker threads. If zero, one less than
+        /// the number of hardware threads is used (the caller being the last one).
+        explicit ThreadPool(unsigned nbrThreads = 0);
+
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        /// @brief Number of worker threads
+        unsigned getNbrThreads() const;
+
+        /// @brief Queue a task
+        /// @param func Callable to execute
+        /// @return Future holding the result of the task
+        template <class F>
+        auto enqueue(F &&func) -> std::future<decltype(func())>
+        {
+            using R = decltype(func());
+            auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(func));
+            auto future = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.emplace([task]()
+                              { (*task)(); });
+            }
+            condition.notify_one();
+            return future;
+        }
+
+        /// @brief Run a function over a range split into chunks, and wait for it to finish
+        /// @param begin First index
+        /// @param end One past the last index
+        /// @param grainSize Smallest number of indices per chunk
+        /// @param func Callable with signature void(size_t chunkBegin, size_t chunkEnd)
+        template <class F>
+        void parallelFor(size_t begin, size_t end, size_t grainSize, F &&func)
+        {
+            if (end <= begin)
+                return;
+
+            const size_t count = end - begin;
+            const size_t maxChunks = workers.size() + 1;
+            const size_t nbrChunks = std::max<size_t>(1, std::min(maxChunks, count / std::max<size_t>(1, grainSize)));
+            const size_t chunkSize = (count + nbrChunks - 1) / nbrChunks;
+
+            if (nbrChunks == 1)
+            {
+                func(begin, end);
+                return;
+            }
+
+            std::atomic<size_t> remaining{nbrChunks - 1};
+            std::exception_ptr exception;
+            std::mutex exceptionMutex;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = 1; i < nbrChunks; i++)
+                {
+                    const size_t chunkBegin = begin + i * chunkSize;
+                    const size_t chunkEnd = std::min(end, chunkBegin + chunkSize);
+                    tasks.emplace([&, chunkBegin, chunkEnd]()
+                                  {
+                        try
+                        {
+                            if (chunkBegin < chunkEnd)
+                                func(chunkBegin, chunkEnd);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(exceptionMutex);
+                            exception = std::current_exception();
+                        }
+                        remaining--; });
+                }
+            }
+            condition.notify_all();
+
+            // First chunk runs on the calling thread. Queued chunks refer to
+            // locals of this function, so always wait for them before leaving.
+            try
+            {
+                func(begin, std::min(end, begin + chunkSize));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(exceptionMutex);
+                exception = std::current_exception();
+            }
+
+            // Help out until all chunks are done
+            while (remaining.load())
+            {
+                if (!runPendingTask())
+                    std::this_thread::yield();
+            }
+
+            if (exception)
+                std::rethrow_exception(exception);
+        }
+
+    private:
+        /// @brief Run one queued task on the calling thread, if there is one
+        /// @return True if a task was run
+        bool runPendingTask();
+
+        void workerLoop();
+    };
+
+} // namespace eeng
+
+#endif /* ThreadPool_hpp */
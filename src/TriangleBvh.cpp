@@ -0,0 +1,381 @@
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "TriangleBvh.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EENG_TRIANGLE_SSE
+#include <emmintrin.h>
+#endif
+
+namespace eeng
+{
+    namespace
+    {
+        // Deeper nodes become leaves of several packs, which bounds the traversal stack
+        const int MaxDepth = 60;
+        const int StackSize = MaxDepth + 2;
+
+        const int NbrBins = 12;
+        const int PackSize = 4;
+
+        /// Grow a box to include another. Unlike AABB::grow, empty boxes are left out.
+        void unite(AABB &aabb, const AABB &other)
+        {
+            aabb.min = glm::min(aabb.min, other.min);
+            aabb.max = glm::max(aabb.max, other.max);
+        }
+
+        float surfaceArea(const AABB &aabb)
+        {
+            const glm::vec3 d = glm::max(aabb.max - aabb.min, glm::vec3(0.0f));
+            return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+
+        /// Ray parameter where a ray enters a box, or infinity if it misses it before tmax
+        float intersectBox(const glm::vec3 &min,
+                           const glm::vec3 &max,
+                           const glm::vec3 &origin,
+                           const glm::vec3 &invDirection,
+                           float tmax)
+        {
+            const glm::vec3 t0 = (min - origin) * invDirection;
+            const glm::vec3 t1 = (max - origin) * invDirection;
+            const glm::vec3 tmin = glm::min(t0, t1), tmaxs = glm::max(t0, t1);
+            const float tnear = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+            const float tfar = std::min(std::min(tmaxs.x, tmaxs.y), std::min(tmaxs.z, tmax));
+            return tnear <= tfar ? tnear : std::numeric_limits<float>::infinity();
+        }
+    }
+
+    void TriangleBvh::build(const std::vector<glm::vec3> &vertices,
+                            const std::vector<unsigned> &ids)
+    {
+        if (vertices.size() != 3 * ids.size())
+            throw std::runtime_error("Triangle BVH expects three vertices per triangle id");
+
+        nodes.clear();
+        packs.clear();
+        nbrTriangles = (unsigned)ids.size();
+        if (!nbrTriangles)
+            return;
+
+        std::vector<BuildItem> items(nbrTriangles);
+        for (int i = 0; i < (int)nbrTriangles; i++)
+        {
+            auto &item = items[i];
+            item.aabb.min = glm::min(vertices[3 * i], glm::min(vertices[3 * i + 1], vertices[3 * i + 2]));
+            item.aabb.max = glm::max(vertices[3 * i], glm::max(vertices[3 * i + 1], vertices[3 * i + 2]));
+            item.centroid = (item.aabb.min + item.aabb.max) * 0.5f;
+            item.triangle = i;
+        }
+
+        nodes.reserve(2 * (nbrTriangles / PackSize) + 1);
+        packs.reserve(nbrTriangles / PackSize + 1);
+        nodes.emplace_back();
+        buildNode(0, items, 0, (int)nbrTriangles, 1, vertices, ids);
+    }
+
+    void TriangleBvh::buildNode(int node,
+                                std::vector<BuildItem> &items,
+                                int first,
+                                int count,
+                                int depth,
+                                const std::vector<glm::vec3> &vertices,
+                                const std::vector<unsigned> &ids)
+    {
+        AABB bounds, centroidBounds;
+        for (int i = first; i < first + count; i++)
+        {
+            unite(bounds, items[i].aabb);
+            centroidBounds.min = glm::min(centroidBounds.min, items[i].centroid);
+            centroidBounds.max = glm::max(centroidBounds.max, items[i].centroid);
+        }
+        nodes[node].min = bounds.min;
+        nodes[node].max = bounds.max;
+
+        // Binned SAH over all three axes
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1, bestBin = 0;
+        if (count > PackSize && depth < MaxDepth)
+        {
+            const int nbrBins = std::min(NbrBins, count);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+                if (extent <= 0.0f)
+                    continue;
+                const float scale = nbrBins / extent;
+
+                AABB binBounds[NbrBins];
+                int binCounts[NbrBins] = {0};
+                for (int i = first; i < first + count; i++)
+                {
+                    const int bin = std::min(nbrBins - 1, (int)((items[i].centroid[axis] - centroidBounds.min[axis]) * scale));
+                    unite(binBounds[bin], items[i].aabb);
+                    binCounts[bin]++;
+                }
+
+                float rightAreas[NbrBins];
+                int rightCounts[NbrBins];
+                AABB right;
+                int rightCount = 0;
+                for (int b = nbrBins - 1; b > 0; b--)
+                {
+                    unite(right, binBounds[b]);
+                    rightCount += binCounts[b];
+                    rightAreas[b] = surfaceArea(right);
+                    rightCounts[b] = rightCount;
+                }
+                AABB left;
+                int leftCount = 0;
+                for (int b = 0; b < nbrBins - 1; b++)
+                {
+                    unite(left, binBounds[b]);
+                    leftCount += binCounts[b];
+                    if (!leftCount || !rightCounts[b + 1])
+                        continue;
+                    const float cost = surfaceArea(left) * leftCount + rightAreas[b + 1] * rightCounts[b + 1];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = b;
+                    }
+                }
+            }
+        }
+
+        int leftCount = count / 2;
+        if (bestAxis >= 0)
+        {
+            const int nbrBins = std::min(NbrBins, count);
+            const float scale = nbrBins / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+            const float offset = centroidBounds.min[bestAxis];
+            const auto middle = std::partition(items.begin() + first,
+                                               items.begin() + first + count,
+                                               [&](const BuildItem &item)
+                                               { return std::min(nbrBins - 1, (int)((item.centroid[bestAxis] - offset) * scale)) <= bestBin; });
+            leftCount = (int)(middle - (items.begin() + first));
+        }
+
+        // Leaf: pack the triangles four at a time
+        if (count <= PackSize || depth >= MaxDepth)
+        {
+            nodes[node].first = (int)packs.size();
+            nodes[node].count = (count + PackSize - 1) / PackSize;
+            for (int i = 0; i < count; i += PackSize)
+            {
+                TrianglePack pack{};
+                for (int lane = 0; lane < PackSize && i + lane < count; lane++)
+                {
+                    const int triangle = items[first + i + lane].triangle;
+                    const glm::vec3 &v0 = vertices[3 * triangle];
+                    const glm::vec3 e1 = vertices[3 * triangle + 1] - v0;
+                    const glm::vec3 e2 = vertices[3 * triangle + 2] - v0;
+                    pack.v0x[lane] = v0.x, pack.v0y[lane] = v0.y, pack.v0z[lane] = v0.z;
+                    pack.e1x[lane] = e1.x, pack.e1y[lane] = e1.y, pack.e1z[lane] = e1.z;
+                    pack.e2x[lane] = e2.x, pack.e2y[lane] = e2.y, pack.e2z[lane] = e2.z;
+                    pack.id[lane] = ids[triangle];
+                }
+                packs.push_back(pack);
+            }
+            return;
+        }
+
+        const int left = (int)nodes.size();
+        nodes[node].first = left;
+        nodes[node].count = 0;
+        nodes.emplace_back();
+        nodes.emplace_back();
+        buildNode(left, items, first, leftCount, depth + 1, vertices, ids);
+        buildNode(left + 1, items, first + leftCount, count - leftCount, depth + 1, vertices, ids);
+    }
+
+    bool TriangleBvh::intersectPack(const TrianglePack &p,
+                                    const glm::vec3 &o,
+                                    const glm::vec3 &d,
+                                    TriangleHit &hit) const
+    {
+        // Both paths use the same operations in the same order, so that they
+        // give the same hits
+        float t[4], u[4], v[4];
+        int mask = 0;
+#ifdef EENG_TRIANGLE_SSE
+        if (simd)
+        {
+            const __m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+            const __m128 e1x = _mm_loadu_ps(p.e1x), e1y = _mm_loadu_ps(p.e1y), e1z = _mm_loadu_ps(p.e1z);
+            const __m128 e2x = _mm_loadu_ps(p.e2x), e2y = _mm_loadu_ps(p.e2y), e2z = _mm_loadu_ps(p.e2z);
+
+            // P = d x e2, det = e1 . P
+            const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+            // S = o - v0, u = (S . P) / det
+            const __m128 sx = _mm_sub_ps(_mm_set1_ps(o.x), _mm_loadu_ps(p.v0x));
+            const __m128 sy = _mm_sub_ps(_mm_set1_ps(o.y), _mm_loadu_ps(p.v0y));
+            const __m128 sz = _mm_sub_ps(_mm_set1_ps(o.z), _mm_loadu_ps(p.v0z));
+            const __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+            // Q = S x e1, v = (d . Q) / det, t = (e2 . Q) / det
+            const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+            const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+            const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+            const __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+            const __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+            // NaNs of degenerate triangles fail all comparisons
+            const __m128 zero = _mm_setzero_ps();
+            __m128 valid = _mm_cmpneq_ps(det, zero);
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(uu, zero));
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(vv, zero));
+            valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.0f)));
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(tt, zero));
+            valid = _mm_and_ps(valid, _mm_cmplt_ps(tt, _mm_set1_ps(hit.t)));
+            mask = _mm_movemask_ps(valid);
+            if (!mask)
+                return false;
+            _mm_storeu_ps(t, tt);
+            _mm_storeu_ps(u, uu);
+            _mm_storeu_ps(v, vv);
+        }
+        else
+#endif
+        {
+            for (int i = 0; i < PackSize; i++)
+            {
+                const float px = d.y * p.e2z[i] - d.z * p.e2y[i];
+                const float py = d.z * p.e2x[i] - d.x * p.e2z[i];
+                const float pz = d.x * p.e2y[i] - d.y * p.e2x[i];
+                const float det = p.e1x[i] * px + p.e1y[i] * py + p.e1z[i] * pz;
+                const float invDet = 1.0f / det;
+
+                const float sx = o.x - p.v0x[i], sy = o.y - p.v0y[i], sz = o.z - p.v0z[i];
+                u[i] = (sx * px + sy * py + sz * pz) * invDet;
+
+                const float qx = sy * p.e1z[i] - sz * p.e1y[i];
+                const float qy = sz * p.e1x[i] - sx * p.e1z[i];
+                const float qz = sx * p.e1y[i] - sy * p.e1x[i];
+                v[i] = (d.x * qx + d.y * qy + d.z * qz) * invDet;
+                t[i] = (p.e2x[i] * qx + p.e2y[i] * qy + p.e2z[i] * qz) * invDet;
+
+                if (det != 0.0f && u[i] >= 0.0f && v[i] >= 0.0f && u[i] + v[i] <= 1.0f && t[i] >= 0.0f && t[i] < hit.t)
+                    mask |= 1 << i;
+            }
+            if (!mask)
+                return false;
+        }
+
+        for (int i = 0; i < PackSize; i++)
+        {
+            if ((mask & (1 << i)) && t[i] < hit.t)
+            {
+                hit.t = t[i];
+                hit.u = u[i];
+                hit.v = v[i];
+                hit.id = p.id[i];
+            }
+        }
+        return true;
+    }
+
+    bool TriangleBvh::raycast(const glm::vec3 &origin,
+                              const glm::vec3 &direction,
+                              TriangleHit &hit) const
+    {
+        if (nodes.empty())
+            return false;
+
+        const glm::vec3 invDirection = 1.0f / direction;
+        if (intersectBox(nodes[0].min, nodes[0].max, origin, invDirection, hit.t) == std::numeric_limits<float>::infinity())
+            return false;
+
+        // Nearer children are visited first, and entries farther than the
+        // closest hit are skipped when popped
+        struct Entry
+        {
+            int node;
+            float t;
+        };
+        Entry stack[StackSize];
+        int stackSize = 0;
+        stack[stackSize++] = {0, 0.0f};
+        bool isHit = false;
+        while (stackSize)
+        {
+            const Entry entry = stack[--stackSize];
+            if (entry.t >= hit.t)
+                continue;
+
+            const Node &node = nodes[entry.node];
+            if (node.count)
+            {
+                for (int i = node.first; i < node.first + node.count; i++)
+                    isHit |= intersectPack(packs[i], origin, direction, hit);
+                continue;
+            }
+
+            const Node &left = nodes[node.first], &right = nodes[node.first + 1];
+            float tLeft = intersectBox(left.min, left.max, origin, invDirection, hit.t);
+            float tRight = intersectBox(right.min, right.max, origin, invDirection, hit.t);
+            int nearChild = node.first, farChild = node.first + 1;
+            if (tRight < tLeft)
+            {
+                std::swap(tLeft, tRight);
+                std::swap(nearChild, farChild);
+            }
+            if (tRight != std::numeric_limits<float>::infinity())
+                stack[stackSize++] = {farChild, tRight};
+            if (tLeft != std::numeric_limits<float>::infinity())
+                stack[stackSize++] = {nearChild, tLeft};
+        }
+        return isHit;
+    }
+
+    AABB TriangleBvh::getBounds() const
+    {
+        AABB aabb;
+        if (nodes.size())
+        {
+            aabb.min = nodes[0].min;
+            aabb.max = nodes[0].max;
+        }
+        return aabb;
+    }
+
+    bool TriangleBvh::empty() const
+    {
+        return nodes.empty();
+    }
+
+    unsigned TriangleBvh::getNbrTriangles() const
+    {
+        return nbrTriangles;
+    }
+
+    unsigned TriangleBvh::getNbrNodes() const
+    {
+        return (unsigned)nodes.size();
+    }
+
+    void TriangleBvh::setSimd(bool enabled)
+    {
+        simd = enabled;
+    }
+
+    bool TriangleBvh::isSimdSupported()
+    {
+#ifdef EENG_TRIANGLE_SSE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+} // namespace eeng
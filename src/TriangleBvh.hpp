@@ -0,0 +1,109 @@
+
+#ifndef TriangleBvh_hpp
+#define TriangleBvh_hpp
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+
+namespace eeng
+{
+    /// @brief Closest hit of a ray against triangles
+    struct TriangleHit
+    {
+        float t;          ///< Ray parameter. Largest accepted value on input to raycast().
+        float u = 0.0f;   ///< Barycentric coordinate of the second vertex
+        float v = 0.0f;   ///< Barycentric coordinate of the third vertex
+        unsigned id = 0;  ///< Id of the triangle, as given to build()
+    };
+
+    /// @brief Bounding volume hierarchy over a static set of triangles, for ray queries
+    /** Built with a binned surface area heuristic (SAH) down to leaves of at
+     * most four triangles. Leaf triangles are stored as one vertex and two
+     * edges per component, so that all four are intersected at once with SSE
+     * (Möller-Trumbore). Triangles are two-sided.
+     *
+     * Queries are const and may run concurrently with each other.
+     */
+    class TriangleBvh
+    {
+        /// Leaf with up to four triangles. Unused slots are degenerate and never hit.
+        struct TrianglePack
+        {
+            float v0x[4], v0y[4], v0z[4];
+            float e1x[4], e1y[4], e1z[4];
+            float e2x[4], e2y[4], e2z[4];
+            unsigned id[4];
+        };
+
+        struct Node
+        {
+            glm::vec3 min;
+            int first;  ///< Left child, the right one follows it. First pack of a leaf.
+            glm::vec3 max;
+            int count;  ///< Packs of a leaf, or 0 for an inner node
+        };
+
+        std::vector<Node> nodes;
+        std::vector<TrianglePack> packs;
+        unsigned nbrTriangles = 0;
+        bool simd = true;
+
+    public:
+        /// @brief Build from a triangle list
+        /// @param vertices Three vertices per triangle
+        /// @param ids Id of each triangle, reported by hits
+        void build(const std::vector<glm::vec3> &vertices,
+                   const std::vector<unsigned> &ids);
+
+        /// @brief Closest hit along a ray
+        /// @param direction Ray direction, need not be normalized
+        /// @param hit Largest ray parameter on input, the hit on output if there is one
+        /// @return True if a triangle was hit
+        bool raycast(const glm::vec3 &origin,
+                     const glm::vec3 &direction,
+                     TriangleHit &hit) const;
+
+        /// @brief Bounds of all triangles
+        AABB getBounds() const;
+
+        bool empty() const;
+
+        unsigned getNbrTriangles() const;
+
+        unsigned getNbrNodes() const;
+
+        /// @brief Use SSE triangle tests, if compiled in. On by default.
+        void setSimd(bool enabled);
+
+        /// @brief Check if SSE triangle tests are compiled in
+        static bool isSimdSupported();
+
+    private:
+        struct BuildItem
+        {
+            AABB aabb;
+            glm::vec3 centroid;
+            int triangle;
+        };
+
+        /// @brief Build a node for a range of items
+        void buildNode(int node,
+                       std::vector<BuildItem> &items,
+                       int first,
+                       int count,
+                       int depth,
+                       const std::vector<glm::vec3> &vertices,
+                       const std::vector<unsigned> &ids);
+
+        /// @brief Closest hit in a leaf pack
+        bool intersectPack(const TrianglePack &pack,
+                           const glm::vec3 &origin,
+                           const glm::vec3 &direction,
+                           TriangleHit &hit) const;
+    };
+
+} // namespace eeng
+
+#endif /* TriangleBvh_hpp */
@@ -11,6 +11,10 @@
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <type_traits>
 #include "config.h"
 
 namespace eeng
@@ -23,14 +27,24 @@ namespace eeng
     };
 
     /// @brief Contiguous tree representation optimized for depth-first traversal
-    /// @tparam NodeType Node type, should inherit from TreeNode
+    /// @tparam NodeType Node type, should inherit from TreeNode and have a
+    /// hashable `name`, e.g. a std::string or StringId
     /** Nodes are organized in pre-order, which means that the first child of a
      * node is located directly after the node. Each node has information about
      * number children, stride of its branch, and offset from its parent.
+     *
+     * Node names are indexed in a hash map, kept up to date by insert() and
+     * build(). Nodes should not be added to or removed from `nodes` directly.
      */
     template <class NodeType>
     class VectorTree
     {
+    public:
+        using name_t = std::decay_t<decltype(NodeType::name)>;
+
+    private:
+        std::unordered_map<name_t, size_t> name_index; // First node with a given name
+
     public:
         std::vector<NodeType> nodes;
 
@@ -38,27 +52,120 @@ namespace eeng
 
         /// @brief Find index of a node by name
         /// @param node_name Node name to search for
-        /// @return Index Node index
-        size_t find_node_index(const std::string &node_name)
+        /// @return Index Node index, or EENG_NULL_INDEX if not found.
+        /// If several nodes have the same name, the first one is returned.
+        size_t find_node_index(const name_t &node_name) const
         {
-            auto it = std::find_if(nodes.begin(),
-                                   nodes.end(),
-                                   [&node_name](const NodeType &node)
-                                   { return !node.name.compare(node_name); });
-            if (it == nodes.end())
+            auto it = name_index.find(node_name);
+            if (it == name_index.end())
                 return EENG_NULL_INDEX;
-            return std::distance(nodes.begin(), it);
+            return it->second;
+        }
+
+        /// @brief Build the tree from nodes linked to their parents, in a single pass
+        /// @param input_nodes Nodes in any order
+        /// @param parent_indices Index of the parent of each node in input_nodes,
+        /// or EENG_NULL_INDEX for roots
+        /// @return True if successful, false if the parent links are invalid or
+        /// contain cycles, in which case the tree is left empty
+        /** Children are placed in the order they appear in the input. Input that
+         * is already in pre-order, e.g. from a depth-first traversal, therefore
+         * keeps its order.
+         */
+        bool build(std::vector<NodeType> input_nodes,
+                   const std::vector<size_t> &parent_indices)
+        {
+            const size_t nbr_nodes = input_nodes.size();
+            nodes.clear();
+            name_index.clear();
+            if (parent_indices.size() != nbr_nodes)
+                return false;
+
+            // Children of each node (and the roots) in input order,
+            // as offsets into a shared child list
+            std::vector<size_t> child_offsets(nbr_nodes + 2, 0);
+            for (size_t i = 0; i < nbr_nodes; i++)
+            {
+                const size_t parent = parent_indices[i];
+                if (parent != (size_t)EENG_NULL_INDEX && parent >= nbr_nodes)
+                    return false;
+                child_offsets[(parent == (size_t)EENG_NULL_INDEX ? nbr_nodes : parent) + 1]++;
+            }
+            for (size_t i = 0; i <= nbr_nodes; i++)
+                child_offsets[i + 1] += child_offsets[i];
+            std::vector<size_t> children(nbr_nodes);
+            {
+                std::vector<size_t> fill(child_offsets.begin(), child_offsets.end() - 1);
+                for (size_t i = 0; i < nbr_nodes; i++)
+                {
+                    const size_t parent = parent_indices[i];
+                    children[fill[parent == (size_t)EENG_NULL_INDEX ? nbr_nodes : parent]++] = i;
+                }
+            }
+
+            // Depth-first traversal from the roots, emitting nodes in pre-order
+            struct Visit
+            {
+                size_t input_index;
+                size_t parent_tree_index;
+            };
+            std::vector<Visit> stack;
+            auto push_children = [&](size_t list, size_t parent_tree_index)
+            {
+                // Reversed, so that the first child is visited first
+                for (size_t c = child_offsets[list + 1]; c > child_offsets[list]; c--)
+                    stack.push_back({children[c - 1], parent_tree_index});
+            };
+            push_children(nbr_nodes, EENG_NULL_INDEX);
+
+            nodes.reserve(nbr_nodes);
+            while (stack.size())
+            {
+                const Visit visit = stack.back();
+                stack.pop_back();
+
+                const size_t tree_index = nodes.size();
+                NodeType &node = input_nodes[visit.input_index];
+                node.m_nbr_children = (unsigned)(child_offsets[visit.input_index + 1] - child_offsets[visit.input_index]);
+                node.m_branch_stride = 1;
+                node.m_parent_ofs = (visit.parent_tree_index == (size_t)EENG_NULL_INDEX) ? 0 : (unsigned)(tree_index - visit.parent_tree_index);
+                nodes.push_back(std::move(node));
+
+                push_children(visit.input_index, tree_index);
+            }
+
+            // Nodes on cycles are never reached from a root
+            if (nodes.size() != nbr_nodes)
+            {
+                nodes.clear();
+                return false;
+            }
+
+            // Branch strides, accumulated from the leaves up
+            for (size_t i = nbr_nodes; i-- > 0;)
+            {
+                if (nodes[i].m_parent_ofs)
+                    nodes[i - nodes[i].m_parent_ofs].m_branch_stride += nodes[i].m_branch_stride;
+            }
+
+            name_index.reserve(nbr_nodes);
+            for (size_t i = 0; i < nbr_nodes; i++)
+                name_index.emplace(nodes[i].name, i);
+
+            return true;
         }
 
         /// @brief Insert a node
         /// @param node Node to insert
         /// @param parent Name of parent node. If empty, node is inserted as a root
         /// @return True if insertion was successfull, false otherwise
-        bool insert(NodeType node, const std::string &parent_name)
+        bool insert(NodeType node, const name_t &parent_name)
         {
             // No parent given - insert as root
-            if (!parent_name.size())
+            if (parent_name == name_t{})
             {
+                shift_name_index(0);
+                index_name(node.name, 0);
                 nodes.insert(nodes.begin(), node);
                 return true;
             }
@@ -100,10 +207,56 @@ namespace eeng
             // Insert new node after its parent
             node.m_parent_ofs = 1;
             pit->m_nbr_children++;
+            shift_name_index(parent_index + 1);
+            index_name(node.name, parent_index + 1);
             nodes.insert(pit + 1, node);
 
             return true;
         }
+
+        /// @brief Visit the branches rooted at dirty nodes, in pre-order
+        /// @param is_dirty Predicate taking a node
+        /// @param func Function taking a node index, called for each node in
+        /// a dirty branch, after its parent
+        /// @return Number of nodes visited
+        /** Each node is visited at most once, also if it has dirty ancestors.
+         * Nodes outside dirty branches are skipped using their branch strides.
+         */
+        template <class IsDirty, class Func>
+        size_t traverse_dirty_branches(IsDirty &&is_dirty, Func &&func)
+        {
+            size_t node_index = 0, nbr_visited = 0;
+            while (node_index < nodes.size())
+            {
+                if (!is_dirty(nodes[node_index]))
+                {
+                    node_index++;
+                    continue;
+                }
+                const size_t branch_end = node_index + nodes[node_index].m_branch_stride;
+                nbr_visited += branch_end - node_index;
+                for (; node_index < branch_end; node_index++)
+                    func(node_index);
+            }
+            return nbr_visited;
+        }
+
+    private:
+        /// @brief Make room in the name index for a node inserted at a given index
+        void shift_name_index(size_t index)
+        {
+            for (auto &entry : name_index)
+                if (entry.second >= index)
+                    entry.second++;
+        }
+
+        /// @brief Add a node name to the name index, keeping the first node for duplicate names
+        void index_name(const name_t &name, size_t index)
+        {
+            auto [it, inserted] = name_index.emplace(name, index);
+            if (!inserted && index < it->second)
+                it->second = index;
+        }
     };
 }
 #endif /* VectorTree */